@@ -28,6 +28,13 @@ typedef enum {
     HYPERLINK_AUTO
 } HyperlinkMode;
 
+typedef enum {
+    FORMAT_TEXT,
+    FORMAT_JSON,
+    FORMAT_NDJSON,
+    FORMAT_COLUMNAR
+} OutputFormat;
+
 typedef struct {
     const char **paths;
     size_t path_count;
@@ -77,6 +84,34 @@ typedef struct {
     int hide_control;
     int show_controls;
     int literal_names;
+    OutputFormat format;
+    const char *cache_dir;
+    int cache_revalidate;
+    const char *build_index;
+    const char *index_file;
+    long index_max_age;
+    const char *save_snapshot;
+    const char *diff_file;
+    int watch;
+    int dir_size;
+    int one_file_system;
+    int summary;
+    const char *where;
+    const char **ignore_files;
+    size_t ignore_file_count;
+    int max_depth;
+    unsigned long max_entries;
+    int stats;
+    const char *trace_file;
+    const char *serve_socket;
+    const char *client_socket;
+    const char *files_from;
+    int null_sep;
+    int group_files;
+    const char *color_cache;
+    int sort_threads;
+    size_t memory_limit;
+    size_t inode_order;
 } Args;
 
 void parse_args(int argc, char *argv[], Args *args);
@@ -0,0 +1,26 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stddef.h>
+#include <sys/stat.h>
+
+/*
+ * Operands read with --files-from=FILE, one per line or NUL-terminated with
+ * --null, handed out in batches so that a long list streams through one
+ * process, and stat calls for a batch spread over a few threads.
+ */
+typedef struct BatchReader BatchReader;
+
+/* FILE "-" is standard input.  NULL, with a message, when it cannot be
+ * opened. */
+BatchReader *batch_open(const char *file, int null_sep);
+/* Up to MAX paths into *PATHS, valid until the next call; 0 at the end. */
+size_t batch_next(BatchReader *r, char ***paths, size_t max);
+/* -1 when reading failed part way. */
+int batch_close(BatchReader *r);
+
+/* stat (FOLLOW) or lstat each of PATHS; ERRS[i] is 0 or the errno value.
+ * Served from the index when one is open. */
+void batch_stat(char *const *paths, size_t count, int follow, struct stat *sts, int *errs);
+
+#endif // BATCH_H
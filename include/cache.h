@@ -0,0 +1,68 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include "entry.h"
+
+/*
+ * Persistent per-directory metadata cache (--cache=DIR).
+ *
+ * Each listed directory is stored as one snapshot file holding every entry
+ * name and its stat data.  A snapshot is only used while the directory's
+ * (dev, ino, mtime, ctime) still match the values it was written with, so
+ * adding, removing or renaming entries invalidates it.  Changes that do not
+ * touch the directory itself (a file growing in place) are only noticed
+ * with revalidation enabled.
+ */
+
+typedef struct {
+    uint64_t ino;
+    uint64_t dev;
+    uint64_t rdev;
+    uint64_t nlink;
+    int64_t size;
+    int64_t blocks;
+    int64_t atime_s;
+    int64_t mtime_s;
+    int64_t ctime_s;
+    uint32_t atime_ns;
+    uint32_t mtime_ns;
+    uint32_t ctime_ns;
+    uint32_t mode;
+    uint32_t uid;
+    uint32_t gid;
+    uint32_t blksize;
+    uint32_t name_off;
+} CacheRecord;
+
+typedef struct {
+    void *map;
+    size_t map_len;
+    size_t count;
+    const CacheRecord *recs;
+    const char *names;
+} CacheSnapshot;
+
+void cache_init(const char *dir, int revalidate);
+/* Make DIR the snapshot directory when cache_init is given none, as in the
+ * children of --serve.  Each snapshot written there is then announced on
+ * NOTIFY_FD as a "dev ino path" line so the daemon can watch the directory
+ * and invalidate the snapshot when anything in it changes. */
+void cache_attach(const char *dir, int notify_fd);
+int cache_enabled(void);
+int cache_revalidating(void);
+
+/* Map the snapshot for the directory described by DST.  Returns 1 on a hit. */
+int cache_load(const struct stat *dst, int follow_links, CacheSnapshot *snap);
+void cache_release(CacheSnapshot *snap);
+const char *cache_name(const CacheSnapshot *snap, size_t i);
+void cache_stat(const CacheSnapshot *snap, size_t i, struct stat *st);
+
+/* Write the unfiltered ENTRIES of a freshly scanned directory PATH. */
+void cache_store(const struct stat *dst, int follow_links, const char *path, const Entry *entries,
+                 size_t count);
+void cache_invalidate(const struct stat *dst, int follow_links);
+
+#endif // CACHE_H
@@ -1,10 +1,46 @@
 #ifndef COLOR_H
 #define COLOR_H
 
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * Color slots for file types as named in LS_COLORS.  Extension rules
+ * ("*.ext=...") are numbered after COLOR_TYPE_COUNT, so every entry can
+ * be resolved once into a single small index.
+ */
+typedef enum {
+    COLOR_TYPE_NONE,
+    COLOR_TYPE_NORMAL,
+    COLOR_TYPE_FILE,
+    COLOR_TYPE_DIR,
+    COLOR_TYPE_LINK,
+    COLOR_TYPE_FIFO,
+    COLOR_TYPE_SOCK,
+    COLOR_TYPE_BLK,
+    COLOR_TYPE_CHR,
+    COLOR_TYPE_ORPHAN,
+    COLOR_TYPE_MISSING,
+    COLOR_TYPE_SETUID,
+    COLOR_TYPE_SETGID,
+    COLOR_TYPE_EXEC,
+    COLOR_TYPE_STICKY_OTHER_WRITABLE,
+    COLOR_TYPE_OTHER_WRITABLE,
+    COLOR_TYPE_STICKY,
+    COLOR_TYPE_COUNT
+} ColorType;
+
 const char *color_reset(void);
-const char *color_dir(void);
-const char *color_link(void);
-const char *color_exec(void);
-void color_init(void);
+/* Build the tables from LS_COLORS, or map the ones saved in CACHE_DIR
+ * for the same value; CACHE_DIR may be NULL. */
+void color_init(const char *cache_dir);
+
+/* Returns nonzero when LS_COLORS assigned a sequence to TYPE. */
+int color_has(ColorType type);
+/* Resolve NAME with MODE to a color index; BROKEN marks dangling links. */
+int color_resolve(const char *name, mode_t mode, int broken);
+const char *color_code(int idx);
+size_t color_code_len(int idx);
+size_t color_reset_len(void);
 
 #endif // COLOR_H
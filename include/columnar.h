@@ -0,0 +1,100 @@
+#ifndef COLUMNAR_H
+#define COLUMNAR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+/*
+ * Columnar binary export (--format=columnar).
+ *
+ * Layout, all integers in host byte order (check `endian`):
+ *
+ *   ColumnarHeader
+ *   mode        uint32_t[rows]
+ *   size        int64_t[rows]
+ *   mtime_ns    int64_t[rows]
+ *   ino         uint64_t[rows]
+ *   nlink       uint64_t[rows]
+ *   uid         uint32_t[rows]
+ *   gid         uint32_t[rows]
+ *   parent      uint32_t[rows]   index into the directory table, or
+ *                                COLUMNAR_NO_DIR for command line operands
+ *   name_off    uint64_t[rows + 1]
+ *   names       NUL-terminated names, row i at names + name_off[i]
+ *   dir_off     uint64_t[dirs + 1]
+ *   dir_names   NUL-terminated directory paths
+ *
+ * Every block starts at the offset recorded in the header and is 8-byte
+ * aligned, so a mapped file can be read column by column in place.
+ */
+
+#define COLUMNAR_MAGIC "VLSCOLS"
+#define COLUMNAR_VERSION 1
+#define COLUMNAR_ENDIAN 0x01020304u
+#define COLUMNAR_NO_DIR UINT32_MAX
+
+enum {
+    COL_MODE,
+    COL_SIZE,
+    COL_MTIME_NS,
+    COL_INO,
+    COL_NLINK,
+    COL_UID,
+    COL_GID,
+    COL_PARENT,
+    COL_NAME_OFF,
+    COL_NAMES,
+    COL_DIR_OFF,
+    COL_DIR_NAMES,
+    COL_COUNT
+};
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t endian;
+    uint64_t rows;
+    uint64_t dirs;
+    uint64_t file_size;
+    uint64_t off[COL_COUNT];
+} ColumnarHeader;
+
+/* Writer: rows are collected for the whole run and written at exit; each
+ * column keeps at most a chunk in memory and spools the rest to a
+ * temporary file. */
+uint32_t columnar_add_dir(const char *path);
+void columnar_add_row(uint32_t dir, const char *name, const struct stat *st);
+int columnar_finish(FILE *out);
+
+/* Reader over a read-only mapping of a columnar file. */
+typedef struct {
+    void *map;
+    size_t map_len;
+    uint64_t rows;
+    uint64_t dirs;
+    const uint32_t *mode;
+    const int64_t *size;
+    const int64_t *mtime_ns;
+    const uint64_t *ino;
+    const uint64_t *nlink;
+    const uint32_t *uid;
+    const uint32_t *gid;
+    const uint32_t *parent;
+    const uint64_t *name_off;
+    const char *names;
+    uint64_t names_len;
+    const uint64_t *dir_off;
+    const char *dir_names;
+    uint64_t dir_names_len;
+} ColumnarFile;
+
+int columnar_open(const char *path, ColumnarFile *cf);
+void columnar_close(ColumnarFile *cf);
+/* The name of ROW and the path of directory DIR; NULL when out of range,
+ * or when the file's offsets or NUL terminators are damaged. */
+const char *columnar_name(const ColumnarFile *cf, uint64_t row);
+const char *columnar_dir(const ColumnarFile *cf, uint32_t dir);
+
+#endif // COLUMNAR_H
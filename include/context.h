@@ -0,0 +1,17 @@
+#ifndef CONTEXT_H
+#define CONTEXT_H
+
+#include <stddef.h>
+
+/*
+ * Security context lookup for -Z.  Contexts are read from the
+ * security.selinux extended attribute relative to the directory being
+ * listed and interned in a per-run table, so entries only carry a small id.
+ * Id 0 is the placeholder "-" used when no context is available.
+ */
+void context_set_dir(int dfd, const char *dir);
+int context_lookup(const char *name);
+const char *context_str(int id);
+size_t context_width(int id);
+
+#endif // CONTEXT_H
@@ -0,0 +1,35 @@
+#ifndef DIFF_H
+#define DIFF_H
+
+#include <sys/stat.h>
+#include "args.h"
+#include "index.h"
+
+/*
+ * Compare the tree under ROOT with the snapshot FILE written by
+ * --save-snapshot and print one line or record per added ("+"), removed
+ * ("-") or modified ("M") entry that the name filters of ARGS show.  An
+ * entry counts as modified when its size, modification time, mode, owner or
+ * group changed; a different inode under the same name is reported as a
+ * removal followed by an addition.
+ */
+int diff_tree(const char *file, const char *root, const Args *args);
+
+/* Change records as --diff prints them, used by --watch as well when
+ * output is not a terminal.  In text a change is a line of the long or
+ * short listing format with its marker in front, and for a modification
+ * the changed fields after it. */
+typedef struct DiffPrinter DiffPrinter;
+
+/* NULL, with a message, when out of memory. */
+DiffPrinter *diff_printer_new(const Args *args, OutputFormat format);
+/* The change to NAME in the displayed directory DIR.  DFD is as for
+ * linkcache_target.  Text lines are held while the changes stay in DIR, so
+ * that their columns line up. */
+void diff_printer_add(DiffPrinter *p, IndexChange change, int dfd, const char *dir, const char *name,
+                      const struct stat *old, const struct stat *cur);
+/* Print the lines held so far. */
+void diff_printer_flush(DiffPrinter *p);
+void diff_printer_free(DiffPrinter *p);
+
+#endif // DIFF_H
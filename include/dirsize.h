@@ -0,0 +1,32 @@
+#ifndef DIRSIZE_H
+#define DIRSIZE_H
+
+#include <stddef.h>
+#include "entry.h"
+
+/*
+ * Subtree totals for directories (--dir-size).
+ *
+ * A directory's size is replaced with the sum over everything below it,
+ * counting each hard-linked inode once through a (dev, ino) set.  Totals
+ * are memoized per directory for the rest of the run, so listing a parent
+ * and then one of its children (as -R does) walks each subtree only once.
+ * The subdirectories of one listing are summed by a small pool of threads;
+ * when siblings share a hard link, which of them is charged for it can
+ * depend on which finishes first, but their parent's total cannot.
+ */
+typedef enum {
+    DIRSIZE_NONE,
+    DIRSIZE_APPARENT,   /* sum of st_size */
+    DIRSIZE_BLOCKS      /* sum of allocated bytes, like du */
+} DirSizeMode;
+
+void dirsize_init(DirSizeMode mode, int one_file_system);
+int dirsize_enabled(void);
+/* Replace st_size and st_blocks of the directories among ENTRIES, which
+ * were read from PATH, with their subtree totals. */
+void dirsize_apply(const char *path, Entry *entries, size_t count);
+/* The same for the directory PATH itself, described by ST. */
+void dirsize_path(const char *path, struct stat *st);
+
+#endif // DIRSIZE_H
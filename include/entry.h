@@ -0,0 +1,14 @@
+#ifndef ENTRY_H
+#define ENTRY_H
+
+#include <sys/stat.h>
+
+/* One listed directory entry with its metadata and resolved render state. */
+typedef struct {
+    char *name;
+    struct stat st;
+    int color;
+    int context;
+} Entry;
+
+#endif // ENTRY_H
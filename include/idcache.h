@@ -0,0 +1,17 @@
+#ifndef IDCACHE_H
+#define IDCACHE_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * Per-run cache of user and group names.  Each id is resolved through NSS
+ * at most once; NULL is returned (and remembered) for ids without a name.
+ */
+const char *idcache_user(uid_t uid);
+const char *idcache_group(gid_t gid);
+/* Fill both tables from the first LIMIT entries of the user and group
+ * databases, so processes forked afterwards start with them resolved. */
+void idcache_preload(size_t limit);
+
+#endif // IDCACHE_H
@@ -0,0 +1,28 @@
+#ifndef IGNORE_H
+#define IGNORE_H
+
+#include <stddef.h>
+
+/*
+ * Hierarchical ignore files (--ignore-file-name).
+ *
+ * Each directory's ignore files are read when it is listed and their rules
+ * are pushed onto a stack above its parent's, so siblings share everything
+ * their ancestors compiled and a directory's rules are freed when its
+ * listing ends.  Rules follow .gitignore: the last match wins, deeper
+ * files override shallower ones, "!" re-includes, a trailing "/" only
+ * matches directories, a "/" anywhere else anchors the pattern to the
+ * file's directory and "**" spans directories.  Excluded directories are
+ * dropped from their parent's listing and so are never opened.
+ */
+void ignore_init(const char **names, size_t count);
+int ignore_active(void);
+/* Stack the rules of directory PATH, open as DFD (-1 to open by path);
+ * each successful push is paired with an ignore_pop. */
+int ignore_push(const char *path, int dfd);
+void ignore_pop(void);
+/* Nonzero when entry NAME of the directory PATH on top of the stack is
+ * excluded; IS_DIR tells whether it is a directory. */
+int ignore_excluded(const char *path, const char *name, int is_dir);
+
+#endif // IGNORE_H
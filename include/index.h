@@ -0,0 +1,52 @@
+#ifndef INDEX_H
+#define INDEX_H
+
+#include <sys/stat.h>
+
+/*
+ * Whole-tree index files (--build-index / --index).
+ *
+ * Records are ordered by (directory, name), with '/' sorting before every
+ * other byte in directory paths so that each directory's entries and each
+ * subtree are contiguous.  Keys are prefix-compressed against the previous
+ * record and every INDEX_RESTART-th record starts a block with a full key;
+ * lookups binary-search the block starts and then scan forward.  Paths in
+ * the index are relative to the root the index was built from.  Records
+ * of symbolic links carry the link's target after the stat data.
+ */
+
+#define INDEX_RESTART 16
+
+/* Called for every entry of a listed directory. */
+typedef int (*IndexVisit)(void *ctx, const char *name, const struct stat *st);
+
+int index_build(const char *file, const char *root);
+int index_open(const char *file, long max_age);
+int index_active(void);
+/* List the directory PATH; returns -1 when it is not a directory in the index. */
+int index_list(const char *path, IndexVisit visit, void *ctx);
+int index_stat(const char *path, struct stat *st);
+/* The recorded target of the link PATH, valid while the index is open;
+ * NULL with errno set when PATH is not a link in the index or its target
+ * could not be read at build time. */
+const char *index_readlink(const char *path);
+
+/*
+ * Snapshot diffs (--save-snapshot / --diff).  A snapshot is an index file;
+ * the live tree under ROOT is walked in index key order and merge-joined
+ * against it, so memory use does not grow with the size of the tree.
+ * OLD is NULL for added entries and CUR for removed ones; DFD is the open
+ * parent directory of live entries and -1 otherwise.
+ */
+typedef enum {
+    INDEX_ADDED,
+    INDEX_REMOVED,
+    INDEX_MODIFIED
+} IndexChange;
+
+typedef void (*IndexDiffVisit)(void *ctx, IndexChange change, int dfd, const char *dir,
+                               const char *name, const struct stat *old, const struct stat *cur);
+
+int index_diff(const char *file, const char *root, IndexDiffVisit visit, void *ctx);
+
+#endif // INDEX_H
@@ -0,0 +1,35 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include "args.h"
+
+/*
+ * JSON and NDJSON emitters.  Records are formatted directly into an
+ * internal output buffer which is handed to stdout in large chunks, so no
+ * memory is allocated per record.  With FORMAT_JSON every json_begin/
+ * json_end pair produces one array; with FORMAT_NDJSON each entry is a
+ * line of its own.  DIR may be NULL for command line operands.
+ */
+void json_begin(OutputFormat format);
+void json_entry(OutputFormat format, int dfd, const char *dir, const char *name,
+                const struct stat *st, int numeric_ids);
+/* A json_entry record with a "change" member and, when NFIELDS is
+ * nonzero, a "changed" array naming the fields that differ. */
+void json_change(OutputFormat format, int dfd, const char *dir, const char *name,
+                 const struct stat *st, int numeric_ids, const char *change,
+                 const char *const *fields, size_t nfields);
+void json_end(OutputFormat format);
+void json_flush(void);
+
+/* Building blocks for other JSON documents written through the same buffer. */
+void json_raw(const char *s);
+void json_string(const char *s);
+void json_u64(uint64_t v);
+/* json_string's escaping, written straight to OUT rather than the buffer. */
+void json_fstring(FILE *out, const char *s);
+
+#endif // JSON_H
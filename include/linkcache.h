@@ -0,0 +1,31 @@
+#ifndef LINKCACHE_H
+#define LINKCACHE_H
+
+#include <sys/stat.h>
+
+/*
+ * Symlink targets for long listings and link coloring.  Targets are read
+ * into one reusable buffer, and each target is stat'ed at most once per
+ * listing: directories of links often point at the same few files.
+ */
+
+/* In place of a directory descriptor, an entry that no longer exists and
+ * is in no index (a --watch removal): callers read nothing about it. */
+#define LINK_GONE (-2)
+
+/* The target of link NAME in DFD, valid until the next call; NULL, with
+ * errno set, when it cannot be read.  DFD is -1 for entries served from
+ * an index, whose recorded target is returned; DIR names their directory
+ * and is NULL when NAME is itself a path.  With AT_FDCWD and a DIR, NAME
+ * is looked up in DIR. */
+const char *linkcache_target(int dfd, const char *dir, const char *name);
+/* What the link NAME in DIR, pointing at TARGET, resolves to: 0 with the
+ * status in *ST, or -1 when it dangles.  DIR is NULL when NAME is itself
+ * a path.  Results are kept under the target path resolved against the
+ * link's directory. */
+int linkcache_stat(const char *dir, const char *name, const char *target, struct stat *st);
+/* Forget the stat results: at the start of a listing, and before a
+ * long-running --watch or --serve looks at targets that may have changed. */
+void linkcache_clear(void);
+
+#endif // LINKCACHE_H
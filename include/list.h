@@ -1,8 +1,74 @@
 #ifndef LIST_H
 #define LIST_H
 
+#include <stdio.h>
 #include "args.h"
+#include "entry.h"
+#include "vlsdir.h"
 
-void list_directory(const char *path, ColorMode color_mode, HyperlinkMode hyperlink_mode, int show_hidden, int almost_all, int long_format, int show_inode, int sort_time, int sort_atime, int sort_ctime, int sort_size, int sort_extension, int sort_version, const char *sort_word, int unsorted, int reverse, int dirs_first, int recursive, IndicatorStyle indicator_style, int human_readable, int human_si, int numeric_ids, int hide_owner, int hide_group, int show_context, int follow_links, int list_dirs_only, int ignore_backups, const char **ignore_patterns, size_t ignore_count, const char **hide_patterns, size_t hide_count, int columns, int across_columns, int one_per_line, int comma_separated, int output_width, int tabsize, int show_blocks, QuotingStyle quoting_style, const char *time_word, const char *time_style, unsigned block_size, int hide_control, int show_controls, int literal_names);
+/*
+ * The listing renderer: directories come from a libvls walk, with the
+ * options derived from the command line, and are printed as text, JSON or
+ * columnar records.
+ */
+typedef struct {
+    const Args *args;
+    VlsOptions walk;
+    /* Entries listed so far, charged to --max-entries across operands. */
+    unsigned long listed;
+    /* Set once --max-entries cut the listing short. */
+    int truncated;
+    /* When set, also handed each directory's entries as the walk loads
+     * them (--watch takes its initial state from them). */
+    VlsPrepare prepare;
+    void *prepare_arg;
+} Listing;
+
+void list_init(Listing *ls, const Args *args);
+/* List the directory PATH, and with -R the tree below it. */
+void list_directory(Listing *ls, const char *path);
+/* List ENTRIES (malloc'ed, names included), which are taken over, as one
+ * group without a "total" line: operands named by their paths, sorted and
+ * aligned like a directory. */
+void list_entries(Listing *ls, Entry *entries, size_t count);
+/* List PATH, of which ST is the status, as a name rather than a directory:
+ * -d, or a file operand followed with -H. */
+void list_single(Listing *ls, const char *path, const struct stat *st);
+/* Print the "PATH:" line that names an operand above its listing. */
+void list_header(const Listing *ls, const char *path);
+
+/* An entry named by its path, for output that is not a directory listing
+ * (--diff and --watch changes). */
+typedef struct {
+    Entry ent;
+    int dfd;                   /* AT_FDCWD, -1 when known only from an index, or LINK_GONE */
+    const char *mark;          /* printed before the line */
+    const char *note;          /* printed after it, or NULL */
+} ListLine;
+
+/* Print LINES one per line in the long or short format ARGS selects,
+ * aligned with each other, with each MARK as a leading column. */
+void list_lines(const Args *args, ListLine *lines, size_t count);
+
+/* The column widths of a text listing and its "total", measured over its
+ * entries.  The --watch screen keeps each directory's as its entries
+ * change instead of measuring them all for every redraw. */
+typedef struct {
+    size_t link_w, owner_w, group_w, size_w, block_w, context_w, max_len;
+    unsigned long total_blocks;
+} ListWidths;
+
+/* Set the render state (color and context) of ENTRIES of the directory
+ * PATH, as a listing of it would. */
+void list_resolve(const Args *args, const char *path, Entry *entries, size_t count);
+/* Widen W to fit ENT, and count its blocks in the total. */
+void list_measure(const Args *args, ListWidths *w, const Entry *ent);
+/* Take ENT's blocks out of the total; the widths stay as they are. */
+void list_unmeasure(const Args *args, ListWidths *w, const Entry *ent);
+/* Render ENTRIES, the directory PATH in display order, as its text listing
+ * into OUT, laid out with W: its "PATH:" header when HEADER is set, the
+ * "total" line and the first MAX_ROWS rows of entries. */
+int list_render(FILE *out, const Args *args, const char *path, Entry *const *entries, size_t count,
+                const ListWidths *w, int header, size_t max_rows);
 
 #endif // LIST_H
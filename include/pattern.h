@@ -0,0 +1,30 @@
+#ifndef PATTERN_H
+#define PATTERN_H
+
+#include <stddef.h>
+
+/*
+ * Compiled --ignore and --hide pattern sets.
+ *
+ * Every pattern is sorted into the cheapest class that matches exactly
+ * like fnmatch(pattern, name, 0): whole literals, "*literal" suffixes and
+ * "literal*" prefixes go into hash sets probed once per distinct length,
+ * and the remaining globs are bucketed by a literal first or last byte so
+ * a name is only tried against globs it could match.  Names that are not
+ * ASCII in a multibyte locale are handed to fnmatch directly.
+ */
+typedef struct PatternSet PatternSet;
+
+/* A set of its own for the COUNT patterns in PATTERNS, which must outlive
+ * it; NULL when out of memory. */
+PatternSet *pattern_set_new(const char **patterns, size_t count);
+void pattern_set_free(PatternSet *set);
+/* Compile the COUNT patterns in PATTERNS for pattern_lookup; done once
+ * after parsing. */
+int pattern_compile(const char **patterns, size_t count);
+/* The set compiled for PATTERNS, or NULL when there is none. */
+const PatternSet *pattern_lookup(const char **patterns, size_t count);
+/* Nonzero when NAME matches any pattern of SET. */
+int pattern_match(const PatternSet *set, const char *name);
+
+#endif // PATTERN_H
@@ -1,8 +1,9 @@
 #ifndef QUOTE_H
 #define QUOTE_H
 
+#include <stdio.h>
 #include "args.h"
 
-void print_quoted(const char *s, QuotingStyle style, int hide_control, int show_controls, int literal_names);
+void print_quoted(FILE *out, const char *s, QuotingStyle style, int hide_control, int show_controls, int literal_names);
 
 #endif // QUOTE_H
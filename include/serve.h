@@ -0,0 +1,29 @@
+#ifndef SERVE_H
+#define SERVE_H
+
+/*
+ * Listing daemon (--serve=SOCKET) and its client (--client=SOCKET).
+ *
+ * The daemon loads the user and group databases, parses LS_COLORS and
+ * keeps per-directory snapshots in a cache directory once, then forks a
+ * worker for every request, so each listing starts from that warm state.
+ * On Linux every cached directory is watched with inotify and its snapshot
+ * dropped as soon as anything in it changes.
+ *
+ * A client passes its standard descriptors, its working directory, its
+ * environment and its arguments over the socket.  The worker lists onto
+ * the client's own descriptors, so the output is exactly what a local vls
+ * would write, and the client exits with the worker's status.  Only
+ * processes of the daemon's own user are served.
+ */
+
+/* Runs one request's listing in a worker; returns its exit status. */
+typedef int (*ServeHandler)(int argc, char *argv[]);
+
+/* Serve until SIGINT or SIGTERM.  Snapshots go to CACHE_DIR, or to a
+ * private directory removed on exit when it is NULL. */
+int serve_run(const char *socket_path, const char *cache_dir, ServeHandler handler);
+/* Send ARGV without its --client option; returns the remote exit status. */
+int serve_client(const char *socket_path, int argc, char *argv[]);
+
+#endif // SERVE_H
@@ -0,0 +1,31 @@
+#ifndef SORT_H
+#define SORT_H
+
+#include <stddef.h>
+#include "vls.h"
+#include "entry.h"
+
+/*
+ * Entry orderings shared by the renderer and libvls.  Comparators take
+ * two Entry pointers, as qsort passes them.
+ */
+typedef int (*EntryCmp)(const void *, const void *);
+
+/* The ordering selected by --sort=WORD, or else by the sort flags. */
+VlsSort sort_key(const char *sort_word, int sort_time, int sort_atime, int sort_ctime,
+                 int sort_size, int sort_extension, int sort_version);
+EntryCmp sort_cmp(VlsSort key);
+/* The order entries are shown in: KEY with --group-directories-first and
+ * -r folded in, reversal included, so that one sort (or one forward merge)
+ * yields it.  Under VLS_SORT_NONE only directories and files are told
+ * apart. */
+EntryCmp sort_order(VlsSort key, int dirs_first, int reverse);
+
+/* Sort ENTRIES with CMP: qsort for small directories, a merge sort spread
+ * over threads for large ones, with the same result either way. */
+void sort_entries(Entry *entries, size_t count, EntryCmp cmp);
+/* Threads for large sorts: 0 (the default) for one per CPU, 1 for qsort
+ * only. */
+void sort_set_threads(int threads);
+
+#endif // SORT_H
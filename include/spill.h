@@ -0,0 +1,46 @@
+#ifndef SPILL_H
+#define SPILL_H
+
+#include <stddef.h>
+#include "entry.h"
+#include "sort.h"
+
+/*
+ * Runs of entries kept in an unlinked temporary file, for directories
+ * whose entry table would outgrow --memory-limit.  A record holds the
+ * name, the stat fields the renderer and the orderings read, and the
+ * resolved color and context, so a run reads back as the entries it was
+ * written from.
+ */
+typedef struct SpillSet SpillSet;
+typedef struct SpillReader SpillReader;
+typedef struct SpillMerge SpillMerge;
+
+/* A set in $TMPDIR, or /tmp, whose merges use about MEMORY bytes of read
+ * buffers; NULL, with a message, when the file cannot be created. */
+SpillSet *spill_open(size_t memory);
+/* Append ENT to the current run; -1 with a message on a write error. */
+int spill_add(SpillSet *s, const Entry *ent);
+/* Close the current run; an empty run is not recorded. */
+int spill_end_run(SpillSet *s);
+size_t spill_run_count(const SpillSet *s);
+void spill_close(SpillSet *s);
+
+/* Read run RUN back from its start. */
+SpillReader *spill_reader(SpillSet *s, size_t run);
+/* 1 with the next entry in *ENT, its name valid until the next call; 0 at
+ * the end of the run and -1, with a message, on a read error. */
+int spill_read(SpillReader *r, Entry *ent);
+void spill_reader_close(SpillReader *r);
+
+/* Merge all runs, each already in CMP order, to be read with
+ * spill_merge_next.  Entries CMP finds equal come from the earlier run
+ * first, or from the later one with LATER_FIRST.  When there are more runs
+ * than the read buffers allow, groups of them are merged into longer runs
+ * first.  NULL, with a message, on an I/O error. */
+SpillMerge *spill_merge(SpillSet *s, EntryCmp cmp, int later_first);
+/* The next merged entry, as spill_read returns them. */
+int spill_merge_next(SpillMerge *m, Entry *ent);
+void spill_merge_close(SpillMerge *m);
+
+#endif // SPILL_H
@@ -0,0 +1,61 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stddef.h>
+#include <time.h>
+
+/*
+ * --stats instrumentation.  Phases are timed by laps: a mark is taken when
+ * a directory listing starts and each lap charges the wall and CPU time
+ * since the previous one to a phase.  Time spent in write(2) on standard
+ * output is charged to the write phase and taken out of whichever phase
+ * the write happened in.  The report goes to standard error at exit.
+ * With --trace the same laps and directories are also recorded as spans.
+ *
+ * Every hook is behind a test of stats_on, so a run with neither option
+ * pays one predictable branch per hook and nothing else.
+ */
+typedef enum {
+    STATS_OPEN,
+    STATS_SCAN,
+    STATS_STAT,
+    STATS_SORT,
+    STATS_MEASURE,
+    STATS_RENDER,
+    STATS_WRITE,
+    STATS_PHASES
+} StatsPhase;
+
+typedef enum {
+    STATS_OPENDIR,
+    STATS_READDIR,
+    STATS_STAT_CALL,
+    STATS_GETPWUID,
+    STATS_GETGRGID,
+    STATS_GETFILECON,
+    STATS_CALLS
+} StatsCall;
+
+typedef struct {
+    struct timespec wall, cpu;
+    double write_wall, write_cpu;
+} StatsMark;
+
+extern int stats_on;
+
+/* Enable the hooks.  With REPORT, also route standard output through a
+ * counting stream and register the report to run at exit. */
+void stats_init(int report);
+void stats_mark(StatsMark *mark);
+/* Charge the time since MARK to PHASE and move MARK to now. */
+void stats_lap(StatsPhase phase, StatsMark *mark);
+void stats_call(StatsCall call, int failed);
+/* Record that listing PATH (COUNT entries) took the time since MARK. */
+void stats_dir(const char *path, size_t count, const StatsMark *mark);
+
+#define STATS_MARK(m) do { if (stats_on) stats_mark(&(m)); } while (0)
+#define STATS_LAP(phase, m) do { if (stats_on) stats_lap((phase), &(m)); } while (0)
+#define STATS_CALL(call, failed) do { if (stats_on) stats_call((call), (failed)); } while (0)
+#define STATS_DIR(path, count, m) do { if (stats_on) stats_dir((path), (count), &(m)); } while (0)
+
+#endif // STATS_H
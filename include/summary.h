@@ -0,0 +1,44 @@
+#ifndef SUMMARY_H
+#define SUMMARY_H
+
+#include <stddef.h>
+#include <sys/stat.h>
+#include "args.h"
+
+/*
+ * Aggregate statistics (--summary).
+ *
+ * A Summary accumulates counts by file type and extension, apparent and
+ * allocated bytes, a log2 size histogram, modification-age buckets and
+ * bytes per owner.  Accumulators are independent and summary_merge folds
+ * one into another, so each thread of a parallel walk can fill its own.
+ * In SUMMARY_FULL mode list_directory feeds every collected entry into the
+ * run's accumulator instead of printing it.  SUMMARY_TYPES only counts
+ * types, which summary_walk does from d_type without stat'ing entries.
+ */
+typedef enum {
+    SUMMARY_NONE,
+    SUMMARY_FULL,
+    SUMMARY_TYPES
+} SummaryMode;
+
+typedef struct Summary Summary;
+
+void summary_init(SummaryMode mode);
+SummaryMode summary_mode(void);
+
+Summary *summary_new(void);
+void summary_free(Summary *s);
+void summary_add(Summary *s, const char *name, const struct stat *st);
+void summary_merge(Summary *dst, const Summary *src);
+/* The accumulator list_directory adds to. */
+Summary *summary_run(void);
+
+/* Count types under PATHS with a parallel d_type walk into summary_run(). */
+int summary_walk(const char **paths, size_t path_count, int recursive, int show_hidden,
+                 int almost_all, int ignore_backups, const char **ignore_patterns,
+                 size_t ignore_count, const char **hide_patterns, size_t hide_count);
+
+void summary_print(OutputFormat format, int numeric_ids);
+
+#endif // SUMMARY_H
@@ -0,0 +1,34 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+/*
+ * --trace=FILE: a Chrome trace-event timeline of the run, viewable in
+ * Perfetto or chrome://tracing.  Each thread records into a ring buffer of
+ * its own without locking; when a ring is full its oldest events are
+ * overwritten.  Nothing is formatted or written until exit, when every
+ * thread's events are serialized as one track per thread.
+ *
+ * Events carry the directory and optional entry they concern as a "path"
+ * argument.
+ */
+extern int trace_on;
+
+/* Create FILE and start recording; -1 (after a message) if it cannot be
+ * created. */
+int trace_open(const char *file);
+uint64_t trace_now(void);
+/* Label the calling thread's track. */
+void trace_thread_name(const char *name);
+/* A span named NAME from START to now; ENTRY may be NULL, and a NULL
+ * NAME names the span after its path. */
+void trace_span(const char *name, const char *dir, const char *entry, uint64_t start);
+/* A point event such as a failed call; ERR is an errno value or 0. */
+void trace_instant(const char *name, const char *dir, const char *entry, int err);
+
+#define TRACE_NOW(t) do { if (trace_on) (t) = trace_now(); } while (0)
+#define TRACE_SPAN(name, dir, entry, t) do { if (trace_on) trace_span((name), (dir), (entry), (t)); } while (0)
+#define TRACE_INSTANT(name, dir, entry, err) do { if (trace_on) trace_instant((name), (dir), (entry), (err)); } while (0)
+
+#endif // TRACE_H
@@ -1,6 +1,39 @@
 #ifndef UTIL_H
 #define UTIL_H
 
+#if defined(__APPLE__)
+# define ST_ATIM st_atimespec
+# define ST_MTIM st_mtimespec
+# define ST_CTIM st_ctimespec
+#else
+# define ST_ATIM st_atim
+# define ST_MTIM st_mtim
+# define ST_CTIM st_ctim
+#endif
+
+#include <sys/types.h>
+
 char *join_path(const char *dir, const char *name);
+/* An unlinked temporary file in $TMPDIR, or /tmp, open for reading and
+ * writing, so nothing is left behind however vls exits; -1 with errno
+ * set when it cannot be created. */
+int temp_file(const char *prefix);
+/* Fill PERMS with the ten-character "drwxr-xr-x" form of MODE. */
+void mode_string(mode_t mode, char perms[11]);
+
+/* isatty(STDOUT_FILENO), asked once; forget the answer with
+ * stdout_tty_reset after descriptor 1 is replaced. */
+int stdout_isatty(void);
+void stdout_tty_reset(void);
+
+/*
+ * setlocale(LC_ALL, "") deferred until something needs it.  locale_init
+ * loads the locale at once only when a category other than LC_CTYPE and
+ * LC_TIME differs from C; otherwise locale_need(LC_CTYPE) before the first
+ * non-ASCII byte is decoded or classified and locale_need(LC_TIME) before
+ * the first strftime load it, and a listing that needs neither never does.
+ */
+void locale_init(void);
+void locale_need(int category);
 
 #endif // UTIL_H
@@ -0,0 +1,80 @@
+#ifndef VLS_H
+#define VLS_H
+
+#include <stddef.h>
+#include <sys/stat.h>
+
+/*
+ * libvls: directory traversal without rendering.
+ *
+ * A walk is opened on one path with a VlsOptions (the traversal half of
+ * the command line options) and pulled one entry at a time.  Each
+ * directory's entries are filtered, stat'ed and sorted before any of them
+ * is returned; with recursion its subdirectories follow in the same order,
+ * exactly as vls -R visits them: vls itself lists directories through
+ * this walk.  It also uses whichever process-wide services vls sets up
+ * from its command line (an index, the stat cache, ignore files, --where,
+ * directory sizes, --stats and --trace), and the compiled -I/--hide
+ * patterns and the lazily loaded locale are shared as well.  Walks are
+ * therefore not reentrant: only one may be open in a process at a time,
+ * and it must be driven from one thread.
+ */
+typedef enum {
+    VLS_SORT_NAME,
+    VLS_SORT_SIZE,
+    VLS_SORT_TIME,
+    VLS_SORT_ATIME,
+    VLS_SORT_CTIME,
+    VLS_SORT_EXTENSION,
+    VLS_SORT_VERSION,
+    VLS_SORT_NONE
+} VlsSort;
+
+typedef struct {
+    int show_hidden;           /* -a */
+    int almost_all;            /* -A */
+    int ignore_backups;        /* -B */
+    const char **ignore_patterns;
+    size_t ignore_count;
+    const char **hide_patterns;
+    size_t hide_count;
+    VlsSort sort;
+    int reverse;
+    int dirs_first;
+    int follow_links;          /* -L, with cycle detection */
+    int recursive;
+    int max_depth;             /* levels below the operand, -1 for no limit */
+    int one_file_system;
+    unsigned long max_entries; /* stop after this many entries, 0 for no limit */
+    /* Past this many bytes of entries a directory is sorted in runs on
+     * disk and merged as it is read; 0 keeps every directory in memory. */
+    size_t memory_limit;
+    /* stat directories of at least this many entries in inode order, 0
+     * for never. */
+    size_t inode_order;
+} VlsOptions;
+
+typedef struct {
+    const char *path;          /* DIR/NAME */
+    const char *dir;
+    const char *name;
+    struct stat st;
+    int depth;                 /* 1 for the operand's own entries */
+    int error;                 /* nonzero: PATH could not be read; ST is unset */
+} VlsEntry;
+
+typedef struct VlsWalk VlsWalk;
+
+/* Defaults matching a bare vls: names only, sorted, no recursion. */
+void vls_options_init(VlsOptions *opts);
+/* NULL with errno set when the walk cannot be allocated.  OPTS and the
+ * pattern arrays it points to must outlive the walk. */
+VlsWalk *vls_walk_open(const char *path, const VlsOptions *opts);
+/* The next entry, valid until the following call, or NULL at the end.
+ * Directories that cannot be opened and entries that cannot be stat'ed are
+ * returned as records with ERROR set to the errno value; a directory
+ * skipped as a -L cycle is reported with ELOOP. */
+const VlsEntry *vls_walk_next(VlsWalk *walk);
+void vls_walk_close(VlsWalk *walk);
+
+#endif // VLS_H
@@ -0,0 +1,76 @@
+#ifndef VLSDIR_H
+#define VLSDIR_H
+
+#include <stddef.h>
+#include "vls.h"
+#include "entry.h"
+#include "stats.h"
+
+/*
+ * Directory-at-a-time access to a libvls walk, for vls's own renderers.
+ *
+ * vls_walk_next hands out single entries; a listing also needs each
+ * directory whole, to measure its columns and print its total.  Both are
+ * served by the same loader, which reads a directory from an index, the
+ * stat cache or readdir, applies the name filters, ignore files, --where,
+ * directory sizes and --max-entries, and orders the entries.  Those
+ * integrations are process-wide services that vls sets up from its
+ * options; a walk uses whichever of them are active.
+ */
+
+typedef struct {
+    char *name;
+    int err;
+} VlsFailure;
+
+typedef struct {
+    const char *path;          /* NULL for an operand group */
+    int dfd;                   /* -1 when served from an index */
+    int depth;                 /* of the entries, 1 for the operand's own */
+    /* Nonzero when PATH could not be listed: an errno value, ELOOP for a
+     * directory skipped as a -L cycle. */
+    int error;
+    /* Entries that could not be stat'ed, reported with their errno. */
+    const VlsFailure *failed;
+    size_t failed_count;
+    /* The entries in display order.  A spilled directory (see
+     * VlsOptions.memory_limit) has none here; its TOTAL entries are read
+     * with vls_dir_read instead. */
+    Entry *entries;
+    size_t count;
+    int spilled;
+    size_t total;
+    /* Taken when the directory was opened and lapped through loading. */
+    StatsMark start, mark;
+} VlsDir;
+
+/* Handed every entry a directory yields, before any is returned: once
+ * with all of them, or for a spilled directory a batch at a time before
+ * each batch is written out.  It may set the render state (color and
+ * context) of the entries, which spilled runs keep. */
+typedef void (*VlsPrepare)(void *arg, const VlsDir *dir, Entry *entries, size_t count);
+
+/* A walk over ENTRIES (malloc'ed, names included), which it takes over:
+ * operands named by their paths, listed as one directory-like group
+ * without recursion.  NULL, with ENTRIES freed, when out of memory. */
+VlsWalk *vls_walk_open_group(Entry *entries, size_t count, const VlsOptions *opts);
+void vls_walk_set_prepare(VlsWalk *walk, VlsPrepare prepare, void *arg);
+
+/* The next directory, valid until the following call, or NULL at the end.
+ * Its subdirectories are entered only after it has been returned. */
+const VlsDir *vls_walk_next_dir(VlsWalk *walk);
+/* The next entry of the spilled current directory: 1 with it in *ENT, its
+ * name valid until the next call, 0 at the end and -1 on an error. */
+int vls_dir_read(VlsWalk *walk, Entry *ent);
+
+/* How many entries the walk has yielded, and whether --max-entries
+ * (VlsOptions.max_entries) cut it short. */
+unsigned long vls_walk_listed(const VlsWalk *walk);
+int vls_walk_truncated(const VlsWalk *walk);
+
+/* Nonzero when NAME is hidden by -a/-A, -B, --ignore or --hide. */
+int skip_name(const char *name, int show_hidden, int almost_all, int ignore_backups,
+              const char **ignore_patterns, size_t ignore_count,
+              const char **hide_patterns, size_t hide_count);
+
+#endif // VLSDIR_H
@@ -0,0 +1,29 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <stddef.h>
+#include "args.h"
+#include "vlsdir.h"
+
+/*
+ * Live watch mode (--watch, Linux only).
+ *
+ * watch_init subscribes to the listed directories with inotify before
+ * they are read, so no change between the initial listing and the event
+ * loop is lost.  The listing hands watch_seed each directory's entries as
+ * it reads them (subscribing to subdirectories with -R before the walk
+ * enters them), so nothing is read twice; watch_run reads only what the
+ * listing did not.  Each directory's entries are kept by name and in the
+ * listing's order; events re-stat only the names they mention.  On a
+ * terminal watch_run owns the screen, drawn as the listing would draw it,
+ * and rewrites only the lines that changed; otherwise it prints one change
+ * record per added, removed or modified entry in the --diff format.
+ */
+int watch_init(const Args *args);
+/* Nonzero when watch_run will draw a screen rather than print records. */
+int watch_interactive(void);
+/* A VlsPrepare for the initial listing. */
+void watch_seed(void *arg, const VlsDir *dir, Entry *entries, size_t count);
+int watch_run(void);
+
+#endif // WATCH_H
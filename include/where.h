@@ -0,0 +1,31 @@
+#ifndef WHERE_H
+#define WHERE_H
+
+#include <sys/stat.h>
+
+/*
+ * Filter expressions (--where).
+ *
+ * The expression is compiled once into a short postfix program whose
+ * leaves test one attribute (type, size, times, owner, group, permission
+ * bits or a name glob) and whose && and || skip their right operand when
+ * the left one decides the result.  Evaluation is three-valued so the same
+ * program can run before stat with only the name and d_type: leaves that
+ * need stat data are unknown there, and an entry is only stat'ed when the
+ * expression could still accept it.
+ */
+typedef enum {
+    WHERE_FALSE,
+    WHERE_TRUE,
+    WHERE_UNKNOWN
+} WhereResult;
+
+/* Compile EXPR; prints a diagnostic and returns -1 when it is invalid. */
+int where_compile(const char *expr);
+int where_active(void);
+/* Evaluate with NAME and a dirent D_TYPE only (DT_UNKNOWN if not known). */
+WhereResult where_prestat(const char *name, unsigned char d_type);
+/* Nonzero when the entry NAME described by ST matches. */
+int where_match(const char *name, const struct stat *st);
+
+#endif // WHERE_H
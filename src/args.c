@@ -5,7 +5,14 @@
 #include <string.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
 #include "version.h"
+#include "dirsize.h"
+#include "summary.h"
+#include "pattern.h"
+#include "util.h"
 
 void parse_args(int argc, char *argv[], Args *args) {
     args->color_mode = COLOR_AUTO;
@@ -40,7 +47,7 @@ void parse_args(int argc, char *argv[], Args *args) {
     args->ignore_count = 0;
     args->hide_patterns = NULL;
     args->hide_count = 0;
-    args->columns = isatty(STDOUT_FILENO);
+    args->columns = stdout_isatty();
     args->across_columns = 0;
     args->one_per_line = 0;
     args->comma_separated = 0;
@@ -49,6 +56,34 @@ void parse_args(int argc, char *argv[], Args *args) {
     args->hide_control = 0;
     args->show_controls = 0;
     args->literal_names = 0;
+    args->format = FORMAT_TEXT;
+    args->cache_dir = NULL;
+    args->cache_revalidate = 0;
+    args->build_index = NULL;
+    args->index_file = NULL;
+    args->index_max_age = 86400;
+    args->save_snapshot = NULL;
+    args->diff_file = NULL;
+    args->watch = 0;
+    args->dir_size = 0;
+    args->one_file_system = 0;
+    args->summary = 0;
+    args->where = NULL;
+    args->ignore_files = NULL;
+    args->ignore_file_count = 0;
+    args->max_depth = -1;
+    args->max_entries = 0;
+    args->stats = 0;
+    args->trace_file = NULL;
+    args->serve_socket = NULL;
+    args->client_socket = NULL;
+    args->files_from = NULL;
+    args->null_sep = 0;
+    args->group_files = 0;
+    args->color_cache = NULL;
+    args->sort_threads = 0;
+    args->memory_limit = 0;
+    args->inode_order = 10000;
     args->time_word = NULL;
     args->time_style = "%b %e %H:%M";
     args->block_size = 0;
@@ -80,13 +115,40 @@ void parse_args(int argc, char *argv[], Args *args) {
         {"show-control-chars", no_argument, 0, 13},
         {"hyperlink", required_argument, 0, 14},
         {"si", no_argument, 0, 15},
+        {"format", required_argument, 0, 16},
+        {"cache", required_argument, 0, 17},
+        {"cache-revalidate", no_argument, 0, 18},
+        {"build-index", required_argument, 0, 19},
+        {"index", required_argument, 0, 20},
+        {"index-max-age", required_argument, 0, 21},
+        {"save-snapshot", required_argument, 0, 22},
+        {"diff", required_argument, 0, 23},
+        {"watch", no_argument, 0, 24},
+        {"dir-size", optional_argument, 0, 25},
+        {"one-file-system", no_argument, 0, 26},
+        {"summary", optional_argument, 0, 27},
+        {"where", required_argument, 0, 28},
+        {"ignore-file-name", required_argument, 0, 29},
+        {"max-depth", required_argument, 0, 30},
+        {"max-entries", required_argument, 0, 31},
+        {"stats", no_argument, 0, 32},
+        {"trace", required_argument, 0, 33},
+        {"serve", required_argument, 0, 34},
+        {"client", required_argument, 0, 35},
+        {"files-from", required_argument, 0, 36},
+        {"null", no_argument, 0, 37},
+        {"group-files", no_argument, 0, 38},
+        {"color-cache", required_argument, 0, 39},
+        {"sort-threads", required_argument, 0, 40},
+        {"memory-limit", required_argument, 0, 41},
+        {"inode-order", required_argument, 0, 42},
         {"help", no_argument, 0, 1},
         {"version", no_argument, 0, 'V'},
         {0, 0, 0, 0}
     };
 
     int opt;
-    while ((opt = getopt_long(argc, argv, "AialtrucUfhXvRFpI:BhHLZdgonCx1msbQVNkqw:T:", long_options, NULL)) != -1) {
+    while ((opt = getopt_long(argc, argv, "AialtrucSUfhXvRFpI:BhHLZdgonCx1msbQVNkqw:T:", long_options, NULL)) != -1) {
         switch (opt) {
         case 'A':
             args->almost_all = 1;
@@ -289,6 +351,176 @@ void parse_args(int argc, char *argv[], Args *args) {
         case 15:
             args->human_si = 1;
             break;
+        case 16:
+            if (strcmp(optarg, "json") == 0)
+                args->format = FORMAT_JSON;
+            else if (strcmp(optarg, "ndjson") == 0)
+                args->format = FORMAT_NDJSON;
+            else if (strcmp(optarg, "columnar") == 0)
+                args->format = FORMAT_COLUMNAR;
+            else if (strcmp(optarg, "long") == 0 || strcmp(optarg, "verbose") == 0)
+                args->long_format = 1;
+            else if (strcmp(optarg, "single-column") == 0)
+                args->one_per_line = 1;
+            else if (strcmp(optarg, "commas") == 0)
+                args->comma_separated = 1;
+            else if (strcmp(optarg, "across") == 0 || strcmp(optarg, "horizontal") == 0) {
+                args->columns = 1;
+                args->across_columns = 1;
+            } else if (strcmp(optarg, "vertical") == 0) {
+                args->columns = 1;
+                args->across_columns = 0;
+            } else {
+                fprintf(stderr, "Invalid format: %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 17:
+            args->cache_dir = optarg;
+            break;
+        case 18:
+            args->cache_revalidate = 1;
+            break;
+        case 19:
+            args->build_index = optarg;
+            break;
+        case 20:
+            args->index_file = optarg;
+            break;
+        case 21: {
+            char *end;
+            errno = 0;
+            long v = strtol(optarg, &end, 10);
+            if (errno || *end || v < 0) {
+                fprintf(stderr, "Invalid index age: %s\n", optarg);
+                exit(1);
+            }
+            args->index_max_age = v;
+            break;
+        }
+        case 22:
+            args->save_snapshot = optarg;
+            break;
+        case 23:
+            args->diff_file = optarg;
+            break;
+        case 24:
+            args->watch = 1;
+            break;
+        case 25:
+            if (!optarg || strcmp(optarg, "blocks") == 0)
+                args->dir_size = DIRSIZE_BLOCKS;
+            else if (strcmp(optarg, "apparent") == 0)
+                args->dir_size = DIRSIZE_APPARENT;
+            else {
+                fprintf(stderr, "Invalid argument for --dir-size: %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 26:
+            args->one_file_system = 1;
+            break;
+        case 27:
+            if (!optarg || strcmp(optarg, "full") == 0)
+                args->summary = SUMMARY_FULL;
+            else if (strcmp(optarg, "types") == 0)
+                args->summary = SUMMARY_TYPES;
+            else {
+                fprintf(stderr, "Invalid argument for --summary: %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 28:
+            args->where = optarg;
+            break;
+        case 29:
+            args->ignore_files = realloc(args->ignore_files,
+                                         (args->ignore_file_count + 1) * sizeof(char *));
+            if (!args->ignore_files) {
+                perror("realloc");
+                exit(1);
+            }
+            args->ignore_files[args->ignore_file_count++] = optarg;
+            break;
+        case 30:
+        case 31: {
+            char *end;
+            errno = 0;
+            long v = strtol(optarg, &end, 10);
+            if (errno || *end || end == optarg || v < (opt == 30 ? 0 : 1) || v > INT_MAX) {
+                fprintf(stderr, "Invalid argument for --%s: %s\n", opt == 30 ? "max-depth" : "max-entries", optarg);
+                exit(1);
+            }
+            if (opt == 30)
+                args->max_depth = (int)v;
+            else
+                args->max_entries = (unsigned long)v;
+            break;
+        }
+        case 32:
+            args->stats = 1;
+            break;
+        case 33:
+            args->trace_file = optarg;
+            break;
+        case 34:
+            args->serve_socket = optarg;
+            break;
+        case 35:
+            args->client_socket = optarg;
+            break;
+        case 36:
+            args->files_from = optarg;
+            break;
+        case 37:
+            args->null_sep = 1;
+            break;
+        case 38:
+            args->group_files = 1;
+            break;
+        case 39:
+            args->color_cache = optarg;
+            break;
+        case 40: {
+            char *end;
+            errno = 0;
+            long v = strtol(optarg, &end, 10);
+            if (errno || *end || end == optarg || v < 0 || v > INT_MAX) {
+                fprintf(stderr, "Invalid argument for --sort-threads: %s\n", optarg);
+                exit(1);
+            }
+            args->sort_threads = (int)v;
+            break;
+        }
+        case 41: {
+            char *end;
+            errno = 0;
+            unsigned long long v = strtoull(optarg, &end, 10);
+            unsigned shift = 0;
+            switch (*end) {
+            case 'K': shift = 10; end++; break;
+            case 'M': shift = 20; end++; break;
+            case 'G': shift = 30; end++; break;
+            case 'T': shift = 40; end++; break;
+            }
+            if (errno || *end || end == optarg || optarg[0] == '-' || v == 0 || v > (SIZE_MAX >> shift)) {
+                fprintf(stderr, "Invalid argument for --memory-limit: %s\n", optarg);
+                exit(1);
+            }
+            args->memory_limit = (size_t)(v << shift);
+            break;
+        }
+        case 42: {
+            char *end;
+            errno = 0;
+            unsigned long long v = strtoull(optarg, &end, 10);
+            if (errno || *end || end == optarg || optarg[0] == '-' || v > SIZE_MAX) {
+                fprintf(stderr, "Invalid argument for --inode-order: %s\n", optarg);
+                exit(1);
+            }
+            args->inode_order = (size_t)v;
+            break;
+        }
         case 8:
             args->hide_patterns = realloc(args->hide_patterns,
                                           (args->hide_count + 1) * sizeof(char *));
@@ -335,7 +567,7 @@ void parse_args(int argc, char *argv[], Args *args) {
             }
             break;
         case 1:
-            printf("Usage: %s [-a] [-A] [-l] [-i] [-t] [-u] [-c] [-S] [-X] [-v] [-f] [-U] [-r] [-R] [-d] [-p] [-I PAT] [-B] [-L] [-H] [-Z] [-F] [-C] [-x] [-m] [-1] [-h] [--si] [-n] [-g] [-o] [-s] [-k] [-b] [-Q] [-N] [-q] [-w COLS] [-T COLS] [-V] [--color=WHEN] [--hyperlink=WHEN] [--block-size=SIZE] [--group-directories-first] [--time-style=FMT] [--full-time] [--time=WORD] [--file-type] [--indicator-style=STYLE] [--almost-all] [--ignore=PAT] [--hide=PAT] [--sort=WORD] [--quoting-style=STYLE] [--quote-name] [--literal] [--hide-control-chars] [--show-control-chars] [--help] [--version] [path]\n", argv[0]);
+            printf("Usage: %s [-a] [-A] [-l] [-i] [-t] [-u] [-c] [-S] [-X] [-v] [-f] [-U] [-r] [-R] [-d] [-p] [-I PAT] [-B] [-L] [-H] [-Z] [-F] [-C] [-x] [-m] [-1] [-h] [--si] [-n] [-g] [-o] [-s] [-k] [-b] [-Q] [-N] [-q] [-w COLS] [-T COLS] [-V] [--color=WHEN] [--hyperlink=WHEN] [--block-size=SIZE] [--group-directories-first] [--time-style=FMT] [--full-time] [--time=WORD] [--file-type] [--indicator-style=STYLE] [--almost-all] [--ignore=PAT] [--hide=PAT] [--sort=WORD] [--quoting-style=STYLE] [--quote-name] [--literal] [--hide-control-chars] [--show-control-chars] [--format=WORD] [--cache=DIR] [--cache-revalidate] [--build-index=FILE] [--index=FILE] [--index-max-age=SECS] [--save-snapshot=FILE] [--diff=FILE] [--watch] [--dir-size[=WORD]] [--one-file-system] [--summary[=WORD]] [--where=EXPR] [--ignore-file-name=NAME] [--max-depth=N] [--max-entries=N] [--stats] [--trace=FILE] [--serve=SOCKET] [--client=SOCKET] [--files-from=FILE] [--null] [--group-files] [--color-cache=DIR] [--sort-threads=N] [--memory-limit=SIZE] [--inode-order=N] [--help] [--version] [path]\n", argv[0]);
             printf("Default is to display information about symbolic links. Use -L to follow them or -H for command line arguments only. Context display with -Z is supported only on systems with SELinux.\n");
             exit(0);
             break;
@@ -344,7 +576,7 @@ void parse_args(int argc, char *argv[], Args *args) {
             exit(0);
             break;
         default:
-            fprintf(stderr, "Usage: %s [-a] [-A] [-l] [-i] [-t] [-u] [-c] [-S] [-X] [-v] [-f] [-U] [-r] [-R] [-d] [-p] [-I PAT] [-B] [-L] [-H] [-Z] [-F] [-C] [-x] [-m] [-1] [-h] [--si] [-n] [-g] [-o] [-s] [-k] [-b] [-Q] [-N] [-q] [-w COLS] [-T COLS] [-V] [--color=WHEN] [--hyperlink=WHEN] [--block-size=SIZE] [--group-directories-first] [--time-style=FMT] [--full-time] [--time=WORD] [--file-type] [--indicator-style=STYLE] [--almost-all] [--ignore=PAT] [--hide=PAT] [--sort=WORD] [--quoting-style=STYLE] [--quote-name] [--literal] [--hide-control-chars] [--show-control-chars] [--help] [--version] [path]\n", argv[0]);
+            fprintf(stderr, "Usage: %s [-a] [-A] [-l] [-i] [-t] [-u] [-c] [-S] [-X] [-v] [-f] [-U] [-r] [-R] [-d] [-p] [-I PAT] [-B] [-L] [-H] [-Z] [-F] [-C] [-x] [-m] [-1] [-h] [--si] [-n] [-g] [-o] [-s] [-k] [-b] [-Q] [-N] [-q] [-w COLS] [-T COLS] [-V] [--color=WHEN] [--hyperlink=WHEN] [--block-size=SIZE] [--group-directories-first] [--time-style=FMT] [--full-time] [--time=WORD] [--file-type] [--indicator-style=STYLE] [--almost-all] [--ignore=PAT] [--hide=PAT] [--sort=WORD] [--quoting-style=STYLE] [--quote-name] [--literal] [--hide-control-chars] [--show-control-chars] [--format=WORD] [--cache=DIR] [--cache-revalidate] [--build-index=FILE] [--index=FILE] [--index-max-age=SECS] [--save-snapshot=FILE] [--diff=FILE] [--watch] [--dir-size[=WORD]] [--one-file-system] [--summary[=WORD]] [--where=EXPR] [--ignore-file-name=NAME] [--max-depth=N] [--max-entries=N] [--stats] [--trace=FILE] [--serve=SOCKET] [--client=SOCKET] [--files-from=FILE] [--null] [--group-files] [--color-cache=DIR] [--sort-threads=N] [--memory-limit=SIZE] [--inode-order=N] [--help] [--version] [path]\n", argv[0]);
             exit(1);
         }
     }
@@ -359,13 +591,25 @@ void parse_args(int argc, char *argv[], Args *args) {
         args->block_size = getenv("POSIXLY_CORRECT") ? 512 : 1024;
     }
 
+    if (pattern_compile(args->ignore_patterns, args->ignore_count) == -1 ||
+        pattern_compile(args->hide_patterns, args->hide_count) == -1)
+        exit(1);
+
+    /* Only the column and comma layouts are fitted to the terminal. */
+    int fitted = args->format == FORMAT_TEXT && !args->long_format &&
+                 (args->comma_separated || (args->columns && !args->one_per_line));
     if (args->output_width <= 0) {
         struct winsize ws;
         args->output_width = 80;
-        if (isatty(STDOUT_FILENO) && ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0)
+        if (fitted && stdout_isatty() && ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0)
             args->output_width = ws.ws_col;
     }
 
+    if (args->files_from && optind < argc) {
+        fprintf(stderr, "--files-from cannot be combined with path operands\n");
+        exit(1);
+    }
+
     if (optind < argc) {
         args->path_count = (size_t)(argc - optind);
         args->paths = malloc(args->path_count * sizeof(const char *));
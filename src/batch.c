@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "batch.h"
+#include "index.h"
+#include "stats.h"
+#include "trace.h"
+
+/* stat is bound by latency rather than CPU on cold or remote file systems,
+ * so a batch gets a thread per BATCH_PER_THREAD paths up to the maximum
+ * whatever the CPU count. */
+#define BATCH_MAX_THREADS 8
+#define BATCH_PER_THREAD 128
+#define BATCH_CHUNK 32
+
+struct BatchReader {
+    FILE *f;
+    const char *name;
+    int delim;
+    int failed;
+    unsigned long line;
+    char **paths;
+    size_t count;
+};
+
+typedef struct {
+    char *const *paths;
+    size_t count;
+    int follow;
+    struct stat *sts;
+    int *errs;
+    size_t next;
+    pthread_t owner;
+    pthread_mutex_t lock;
+} Job;
+
+BatchReader *batch_open(const char *file, int null_sep) {
+    BatchReader *r = calloc(1, sizeof(BatchReader));
+    if (!r) {
+        perror("calloc");
+        return NULL;
+    }
+    r->name = file;
+    r->delim = null_sep ? '\0' : '\n';
+    r->f = strcmp(file, "-") == 0 ? stdin : fopen(file, "r");
+    if (!r->f) {
+        fprintf(stderr, "files-from: %s: %s\n", file, strerror(errno));
+        free(r);
+        return NULL;
+    }
+    return r;
+}
+
+static void release(BatchReader *r) {
+    for (size_t i = 0; i < r->count; i++)
+        free(r->paths[i]);
+    r->count = 0;
+}
+
+size_t batch_next(BatchReader *r, char ***paths, size_t max) {
+    release(r);
+    if (!r->paths && !(r->paths = malloc(max * sizeof(char *)))) {
+        perror("malloc");
+        r->failed = 1;
+        return 0;
+    }
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    while (r->count < max && (len = getdelim(&line, &cap, r->delim, r->f)) != -1) {
+        r->line++;
+        if (len > 0 && line[len - 1] == r->delim)
+            line[--len] = '\0';
+        if (len == 0) {
+            fprintf(stderr, "files-from: %s:%lu: empty file name\n", r->name, r->line);
+            continue;
+        }
+        /* Ownership passes to the batch; getdelim allocates a fresh line. */
+        r->paths[r->count++] = line;
+        line = NULL;
+        cap = 0;
+    }
+    free(line);
+    if (ferror(r->f)) {
+        fprintf(stderr, "files-from: %s: %s\n", r->name, strerror(errno));
+        r->failed = 1;
+    }
+    *paths = r->paths;
+    return r->count;
+}
+
+int batch_close(BatchReader *r) {
+    if (!r)
+        return 0;
+    release(r);
+    free(r->paths);
+    if (r->f != stdin)
+        fclose(r->f);
+    int failed = r->failed;
+    free(r);
+    return failed ? -1 : 0;
+}
+
+static void *worker(void *arg) {
+    Job *job = arg;
+    if (trace_on && !pthread_equal(pthread_self(), job->owner))
+        trace_thread_name("stat worker");
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        size_t from = job->next;
+        job->next += BATCH_CHUNK;
+        pthread_mutex_unlock(&job->lock);
+        if (from >= job->count)
+            break;
+        size_t to = from + BATCH_CHUNK < job->count ? from + BATCH_CHUNK : job->count;
+        uint64_t start = 0;
+        TRACE_NOW(start);
+        for (size_t i = from; i < to; i++) {
+            int rc = job->follow ? stat(job->paths[i], &job->sts[i]) : lstat(job->paths[i], &job->sts[i]);
+            job->errs[i] = rc == -1 ? errno : 0;
+        }
+        TRACE_SPAN("stat batch", job->paths[from], NULL, start);
+    }
+    return NULL;
+}
+
+void batch_stat(char *const *paths, size_t count, int follow, struct stat *sts, int *errs) {
+    if (index_active()) {
+        for (size_t i = 0; i < count; i++)
+            errs[i] = index_stat(paths[i], &sts[i]) == -1 ? errno : 0;
+        return;
+    }
+    Job job = {paths, count, follow, sts, errs, 0, pthread_self(), PTHREAD_MUTEX_INITIALIZER};
+    size_t threads = count / BATCH_PER_THREAD;
+    if (threads > BATCH_MAX_THREADS)
+        threads = BATCH_MAX_THREADS;
+    pthread_t tids[BATCH_MAX_THREADS];
+    size_t started = 0;
+    for (size_t i = 1; i < threads; i++)
+        if (pthread_create(&tids[started], NULL, worker, &job) == 0)
+            started++;
+    worker(&job);
+    for (size_t i = 0; i < started; i++)
+        pthread_join(tids[i], NULL);
+    /* The call counters are not shared between threads. */
+    for (size_t i = 0; i < count; i++)
+        STATS_CALL(STATS_STAT_CALL, errs[i] != 0);
+}
@@ -0,0 +1,736 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "sort.h"
+#if defined(__linux__)
+# include <sys/ptrace.h>
+# define HAVE_PTRACE 1
+#else
+# define HAVE_PTRACE 0
+#endif
+
+/*
+ * Scale benchmark for `make bench`.
+ *
+ * With -g the synthetic trees are generated under DIR: every name, size
+ * and timestamp is derived from a fixed seed so two runs build identical
+ * trees.  The matrix then runs each mode on each tree RUNS times and keeps
+ * the run with the median wall time; a further traced run counts syscalls
+ * on Linux.  Results are written as TSV and can be compared with a
+ * previous results file.
+ *
+ * With -S COUNT only process startup is measured: vls is run COUNT times
+ * per configuration on an empty directory, and the minimum and median
+ * exec-to-exit times are reported, since for tiny directories that is
+ * nearly all a listing costs.
+ *
+ * With -P SIZES the sort stage is measured in-process on synthetic entries
+ * (a comma-separated list of entry counts): each ordering is sorted once
+ * on one thread and once on -j threads, and the two results are checked
+ * to be identical.  Sizes and times repeat often, so ties are common.
+ *
+ * With -K COUNT, DIR is expected to be a scratch file system (`make
+ * bench-cold` mounts a loopback ext4 image there).  A directory of COUNT
+ * files is created once, then `vls -l` is timed RUNS times with its stat
+ * calls in readdir order and in inode order, the caches being dropped
+ * before every run; this needs root.
+ */
+
+#define BENCH_VERSION 1
+#define MAX_RUNS 99
+
+typedef struct {
+    const char *name;
+    long entries;      /* at scale 1 */
+} Tree;
+
+static const Tree trees[] = {
+    {"flat", 1000000},     /* one directory */
+    {"deep", 20000},       /* 100 chains of 100 levels, two files each */
+    {"wide", 100000},      /* 1000 directories of 100 files */
+    {"utf8", 20000},       /* long multibyte names */
+    {"symlinks", 20000}    /* links to files, some dangling */
+};
+
+static const char *modes[] = {"-1", "-C", "-l", "-lR", "-S", "-t", "--color=always", "-Q"};
+
+/* Startup configurations; "@" stands for a color cache directory. */
+static const struct {
+    const char *label;
+    const char *args[2];
+} startup_modes[] = {
+    {"-1", {"-1", NULL}},
+    {"-l", {"-l", NULL}},
+    {"--color=always", {"--color=always", NULL}},
+    {"--color-cache", {"--color=always", "@"}},
+};
+
+/* A typical LS_COLORS, so that color startup pays for a real parse. */
+static const char startup_colors[] =
+    "rs=0:di=01;34:ln=01;36:mh=00:pi=40;33:so=01;35:do=01;35:bd=40;33;01:cd=40;33;01:"
+    "or=40;31;01:mi=00:su=37;41:sg=30;43:ca=00:tw=30;42:ow=34;42:st=37;44:ex=01;32:"
+    "*.tar=01;31:*.tgz=01;31:*.arc=01;31:*.arj=01;31:*.taz=01;31:*.lha=01;31:*.lz4=01;31:"
+    "*.lzh=01;31:*.lzma=01;31:*.tlz=01;31:*.txz=01;31:*.tzo=01;31:*.t7z=01;31:*.zip=01;31:"
+    "*.z=01;31:*.dz=01;31:*.gz=01;31:*.lrz=01;31:*.lz=01;31:*.lzo=01;31:*.xz=01;31:"
+    "*.zst=01;31:*.tzst=01;31:*.bz2=01;31:*.bz=01;31:*.tbz=01;31:*.tbz2=01;31:*.tz=01;31:"
+    "*.deb=01;31:*.rpm=01;31:*.jar=01;31:*.war=01;31:*.ear=01;31:*.sar=01;31:*.rar=01;31:"
+    "*.alz=01;31:*.ace=01;31:*.zoo=01;31:*.cpio=01;31:*.7z=01;31:*.rz=01;31:*.cab=01;31:"
+    "*.wim=01;31:*.swm=01;31:*.dwm=01;31:*.esd=01;31:*.avif=01;35:*.jpg=01;35:*.jpeg=01;35:"
+    "*.mjpg=01;35:*.mjpeg=01;35:*.gif=01;35:*.bmp=01;35:*.pbm=01;35:*.pgm=01;35:*.ppm=01;35:"
+    "*.tga=01;35:*.xbm=01;35:*.xpm=01;35:*.tif=01;35:*.tiff=01;35:*.png=01;35:*.svg=01;35:"
+    "*.svgz=01;35:*.mng=01;35:*.pcx=01;35:*.mov=01;35:*.mpg=01;35:*.mpeg=01;35:*.m2v=01;35:"
+    "*.mkv=01;35:*.webm=01;35:*.webp=01;35:*.ogm=01;35:*.mp4=01;35:*.m4v=01;35:*.mp4v=01;35:"
+    "*.vob=01;35:*.qt=01;35:*.nuv=01;35:*.wmv=01;35:*.asf=01;35:*.rm=01;35:*.rmvb=01;35:"
+    "*.flc=01;35:*.avi=01;35:*.fli=01;35:*.flv=01;35:*.gl=01;35:*.dl=01;35:*.xcf=01;35:"
+    "*.xwd=01;35:*.yuv=01;35:*.cgm=01;35:*.emf=01;35:*.ogv=01;35:*.ogx=01;35:*.aac=00;36:"
+    "*.au=00;36:*.flac=00;36:*.m4a=00;36:*.mid=00;36:*.midi=00;36:*.mka=00;36:*.mp3=00;36:"
+    "*.mpc=00;36:*.ogg=00;36:*.ra=00;36:*.wav=00;36:*.oga=00;36:*.opus=00;36:*.spx=00;36:"
+    "*.xspf=00;36:*~=00;90:*#=00;90:*.bak=00;90:*.old=00;90:*.orig=00;90:*.part=00;90:"
+    "*.rej=00;90:*.swp=00;90:*.tmp=00;90:*.dpkg-dist=00;90:*.dpkg-old=00;90:*.ucf-dist=00;90:"
+    "*.ucf-new=00;90:*.ucf-old=00;90:*.rpmnew=00;90:*.rpmorig=00;90:*.rpmsave=00;90:";
+
+#define NTREES (sizeof(trees) / sizeof(trees[0]))
+#define NMODES (sizeof(modes) / sizeof(modes[0]))
+
+typedef struct {
+    char tool[16];
+    char tree[16];
+    char mode[24];
+    double wall_ms, user_ms, sys_ms;
+    long maxrss_kb;
+    long syscalls;
+} Result;
+
+static uint64_t rng = 0x2545f4914f6cdd1dULL;
+
+static uint64_t next_rand(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng;
+}
+
+static void die(const char *what, const char *path) {
+    fprintf(stderr, "vls-bench: %s: %s: %s\n", what, path, strerror(errno));
+    exit(1);
+}
+
+static void make_dir(const char *path) {
+    if (mkdir(path, 0755) == -1 && errno != EEXIST)
+        die("mkdir", path);
+}
+
+/* An empty file of pseudo-random (sparse) size and modification time. */
+static void make_file(const char *path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1)
+        die("open", path);
+    uint64_t r = next_rand();
+    if (ftruncate(fd, (off_t)(r % (1 << 20))) == -1)
+        die("ftruncate", path);
+    struct timespec ts[2];
+    ts[0].tv_sec = ts[1].tv_sec = 1500000000 + (time_t)(r >> 40) % 200000000;
+    ts[0].tv_nsec = ts[1].tv_nsec = 0;
+    if (futimens(fd, ts) == -1)
+        die("futimens", path);
+    close(fd);
+}
+
+static long scaled(const Tree *t, double scale) {
+    long n = (long)(t->entries * scale);
+    return n < 10 ? 10 : n;
+}
+
+static void generate(const char *root, double scale) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/.stamp", root);
+    FILE *f = fopen(path, "r");
+    if (f) {
+        double have = 0;
+        int version = 0;
+        int ok = fscanf(f, "%d %lf", &version, &have) == 2 && version == BENCH_VERSION && have == scale;
+        fclose(f);
+        if (ok)
+            return;
+    }
+    make_dir(root);
+    for (size_t t = 0; t < NTREES; t++) {
+        long n = scaled(&trees[t], scale);
+        char dir[2048];
+        snprintf(dir, sizeof(dir), "%s/%s", root, trees[t].name);
+        fprintf(stderr, "vls-bench: generating %s (%ld entries)\n", dir, n);
+        make_dir(dir);
+        if (strcmp(trees[t].name, "flat") == 0) {
+            for (long i = 0; i < n; i++) {
+                /* 7919 is coprime to 10^7, so the names are distinct but
+                 * not created in sorted order. */
+                snprintf(path, sizeof(path), "%s/f%07ld.%s", dir, (i * 7919) % 10000000,
+                         (i % 3) ? "dat" : "txt");
+                make_file(path);
+            }
+        } else if (strcmp(trees[t].name, "deep") == 0) {
+            long chains = n / 200 > 0 ? n / 200 : 1;
+            for (long c = 0; c < chains; c++) {
+                int len = snprintf(path, sizeof(path), "%s/c%03ld", dir, c);
+                for (int level = 0; level < 100 && len < (int)sizeof(path) - 64; level++) {
+                    make_dir(path);
+                    for (int k = 0; k < 2; k++) {
+                        char file[sizeof(path) + 16];
+                        snprintf(file, sizeof(file), "%s/file%d", path, k);
+                        make_file(file);
+                    }
+                    len += snprintf(path + len, sizeof(path) - (size_t)len, "/d%02d", level);
+                }
+            }
+        } else if (strcmp(trees[t].name, "wide") == 0) {
+            long dirs = n / 100 > 0 ? n / 100 : 1;
+            for (long d = 0; d < dirs; d++) {
+                snprintf(path, sizeof(path), "%s/dir%04ld", dir, d);
+                make_dir(path);
+                for (int k = 0; k < 100; k++) {
+                    char file[sizeof(path) + 16];
+                    snprintf(file, sizeof(file), "%s/e%03d", path, k);
+                    make_file(file);
+                }
+            }
+        } else if (strcmp(trees[t].name, "utf8") == 0) {
+            static const char *parts[] = {"caf\xc3\xa9", "\xe3\x81\x93\xe3\x82\x93", "\xd0\xb4\xd0\xb0\xd0\xbd",
+                                          "\xce\xb4\xce\xad\xce\xbd", "na\xc3\xafve", "\xf0\x9f\x93\x81"};
+            for (long i = 0; i < n; i++) {
+                int len = snprintf(path, sizeof(path), "%s/%06ld-", dir, i);
+                for (int k = 0; k < 24; k++)
+                    len += snprintf(path + len, sizeof(path) - (size_t)len, "%s", parts[next_rand() % 6]);
+                make_file(path);
+            }
+        } else {
+            for (long i = 0; i < n; i++) {
+                char target[64];
+                snprintf(target, sizeof(target), "%s%06ld", (i % 10) ? "t" : "missing", i);
+                if (i % 10) {
+                    snprintf(path, sizeof(path), "%s/%s", dir, target);
+                    make_file(path);
+                }
+                snprintf(path, sizeof(path), "%s/l%06ld", dir, i);
+                if (symlink(target, path) == -1 && errno != EEXIST)
+                    die("symlink", path);
+            }
+        }
+    }
+    snprintf(path, sizeof(path), "%s/.stamp", root);
+    f = fopen(path, "w");
+    if (!f)
+        die("fopen", path);
+    fprintf(f, "%d %g\n", BENCH_VERSION, scale);
+    fclose(f);
+}
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static pid_t spawn_argv(const char *tool, char *const argv[], int trace) {
+    pid_t pid = fork();
+    if (pid == -1)
+        die("fork", tool);
+    if (pid == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        if (null == -1 || dup2(null, STDOUT_FILENO) == -1)
+            _exit(127);
+        setenv("LC_ALL", "C.UTF-8", 1);
+#if HAVE_PTRACE
+        if (trace) {
+            if (ptrace(PTRACE_TRACEME, 0, NULL, NULL) == -1)
+                _exit(127);
+            raise(SIGSTOP);
+        }
+#else
+        (void)trace;
+#endif
+        execvp(tool, argv);
+        _exit(127);
+    }
+    return pid;
+}
+
+/* Run once and fill the timing fields of R; returns the exit status. */
+static int time_argv(const char *tool, char *const argv[], Result *r) {
+    double start = now_ms();
+    pid_t pid = spawn_argv(tool, argv, 0);
+    int status;
+    struct rusage ru;
+    if (wait4(pid, &status, 0, &ru) == -1)
+        die("wait4", tool);
+    r->wall_ms = now_ms() - start;
+    r->user_ms = ru.ru_utime.tv_sec * 1e3 + ru.ru_utime.tv_usec / 1e3;
+    r->sys_ms = ru.ru_stime.tv_sec * 1e3 + ru.ru_stime.tv_usec / 1e3;
+#if defined(__APPLE__)
+    r->maxrss_kb = ru.ru_maxrss / 1024;
+#else
+    r->maxrss_kb = ru.ru_maxrss;
+#endif
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128;
+}
+
+static int time_run(const char *tool, const char *mode, const char *dir, Result *r) {
+    char *const argv[] = {(char *)tool, (char *)mode, (char *)dir, NULL};
+    return time_argv(tool, argv, r);
+}
+
+/* Count syscalls with ptrace: every call stops on entry and on exit. */
+static long count_syscalls_argv(const char *tool, char *const argv[]) {
+#if HAVE_PTRACE
+    pid_t pid = spawn_argv(tool, argv, 1);
+    int status;
+    if (waitpid(pid, &status, 0) == -1 || !WIFSTOPPED(status)) {
+        kill(pid, SIGKILL);
+        waitpid(pid, &status, 0);
+        return -1;
+    }
+    ptrace(PTRACE_SETOPTIONS, pid, NULL, (void *)(long)(PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE));
+    long stops = 0;
+    ptrace(PTRACE_SYSCALL, pid, NULL, NULL);
+    for (;;) {
+        pid_t cur = waitpid(-1, &status, __WALL);
+        if (cur == -1)
+            break;
+        if (WIFEXITED(status) || WIFSIGNALED(status)) {
+            if (cur == pid)
+                break;
+            continue;
+        }
+        int sig = 0;
+        if (WSTOPSIG(status) == (SIGTRAP | 0x80))
+            stops++;
+        else if (WSTOPSIG(status) != SIGTRAP && WSTOPSIG(status) != SIGSTOP)
+            sig = WSTOPSIG(status);
+        ptrace(PTRACE_SYSCALL, cur, NULL, (void *)(long)sig);
+    }
+    return (stops + 1) / 2;
+#else
+    (void)tool;
+    (void)argv;
+    return -1;
+#endif
+}
+
+static long count_syscalls(const char *tool, const char *mode, const char *dir) {
+    char *const argv[] = {(char *)tool, (char *)mode, (char *)dir, NULL};
+    return count_syscalls_argv(tool, argv);
+}
+
+static int by_wall(const void *a, const void *b) {
+    const Result *ra = a, *rb = b;
+    return (ra->wall_ms > rb->wall_ms) - (ra->wall_ms < rb->wall_ms);
+}
+
+static int by_ms(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* Time COUNT runs of each startup configuration on an empty directory
+ * under ROOT; returns the median of each as a result row. */
+/* ---- sort benchmark ---- */
+
+static const struct {
+    const char *name;
+    VlsSort key;
+} sort_orders[] = {
+    {"name", VLS_SORT_NAME},
+    {"size", VLS_SORT_SIZE},
+    {"time", VLS_SORT_TIME},
+    {"extension", VLS_SORT_EXTENSION},
+    {"version", VLS_SORT_VERSION},
+};
+
+static uint64_t mix(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+/* Refill ENTRIES in the same unsorted order every time. */
+static void fill_entries(Entry *entries, char **names, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        uint64_t h = mix(i);
+        memset(&entries[i], 0, sizeof(Entry));
+        entries[i].name = names[i];
+        entries[i].st.st_mode = S_IFREG | 0644;
+        entries[i].st.st_size = (off_t)(h % 4096);
+        entries[i].st.st_mtime = (time_t)(1600000000 + (h >> 16) % 86400);
+    }
+}
+
+static double cpu_ms(void) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec * 1e3 + ru.ru_utime.tv_usec / 1e3 + ru.ru_stime.tv_sec * 1e3 +
+           ru.ru_stime.tv_usec / 1e3;
+}
+
+static double time_sort(Entry *entries, size_t count, EntryCmp cmp, int threads, double *cpu) {
+    sort_set_threads(threads);
+    double c0 = cpu_ms(), start = now_ms();
+    sort_entries(entries, count, cmp);
+    double wall = now_ms() - start;
+    *cpu = cpu_ms() - c0;
+    return wall;
+}
+
+static size_t sort_bench(const char *sizes, int threads, Result **out) {
+    static const char *const exts[] = {"c", "h", "o", "txt", "tar.gz", "png", "md", ""};
+    size_t norders = sizeof(sort_orders) / sizeof(sort_orders[0]);
+    Result *res = NULL;
+    size_t nres = 0;
+    printf("%-10s %-10s %12s %12s %8s %s\n", "entries", "order", "1 thread ms", "threads ms", "speedup", "result");
+    for (const char *p = sizes; *p;) {
+        char *end;
+        size_t count = (size_t)strtoull(p, &end, 10);
+        if (end == p || count == 0) {
+            fprintf(stderr, "vls-bench: bad size list: %s\n", sizes);
+            exit(1);
+        }
+        p = *end == ',' ? end + 1 : end;
+        char **names = malloc(count * sizeof(char *));
+        Entry *entries = malloc(count * sizeof(Entry));
+        char **serial = malloc(count * sizeof(char *));
+        if (!names || !entries || !serial)
+            die("malloc", "sort benchmark");
+        for (size_t i = 0; i < count; i++) {
+            uint64_t h = mix(i ^ 0x5bd1e995ULL);
+            const char *ext = exts[h % (sizeof(exts) / sizeof(exts[0]))];
+            if (asprintf(&names[i], "file-%llu%s%s", (unsigned long long)(h >> 20), *ext ? "." : "", ext) < 0)
+                die("asprintf", "sort benchmark");
+        }
+        for (size_t o = 0; o < norders; o++) {
+            EntryCmp cmp = sort_cmp(sort_orders[o].key);
+            double cpu1, cpun;
+            fill_entries(entries, names, count);
+            double one = time_sort(entries, count, cmp, 1, &cpu1);
+            for (size_t i = 0; i < count; i++)
+                serial[i] = entries[i].name;
+            fill_entries(entries, names, count);
+            double many = time_sort(entries, count, cmp, threads, &cpun);
+            int same = 1;
+            for (size_t i = 0; i < count && same; i++)
+                same = entries[i].name == serial[i];
+            printf("%-10zu %-10s %12.1f %12.1f %7.2fx %s\n", count, sort_orders[o].name, one, many,
+                   many > 0 ? one / many : 0, same ? "identical" : "DIFFERENT");
+            fflush(stdout);
+            if (!same) {
+                fprintf(stderr, "vls-bench: %s sort of %zu entries differs between thread counts\n",
+                        sort_orders[o].name, count);
+                exit(1);
+            }
+            char tree[32];
+            snprintf(tree, sizeof(tree), "sort%zu", count);
+            Result *tmp = realloc(res, (nres + 2) * sizeof(Result));
+            if (!tmp)
+                die("realloc", "sort benchmark");
+            res = tmp;
+            for (int k = 0; k < 2; k++) {
+                Result *r = &res[nres++];
+                memset(r, 0, sizeof(*r));
+                snprintf(r->tool, sizeof(r->tool), "vls");
+                snprintf(r->tree, sizeof(r->tree), "%.15s", tree);
+                snprintf(r->mode, sizeof(r->mode), "%s/%s", sort_orders[o].name, k ? "threads" : "serial");
+                r->wall_ms = k ? many : one;
+                r->user_ms = k ? cpun : cpu1;
+                r->syscalls = -1;
+            }
+        }
+        for (size_t i = 0; i < count; i++)
+            free(names[i]);
+        free(names);
+        free(entries);
+        free(serial);
+    }
+    *out = res;
+    return nres;
+}
+
+static size_t startup(const char *vls, const char *root, int count, Result **out) {
+    char dir[4096], cache[4096], cache_arg[4200];
+    snprintf(dir, sizeof(dir), "%s/empty", root);
+    snprintf(cache, sizeof(cache), "%s/colors", root);
+    snprintf(cache_arg, sizeof(cache_arg), "--color-cache=%s", cache);
+    make_dir(root);
+    make_dir(dir);
+    setenv("LS_COLORS", startup_colors, 1);
+    size_t n = sizeof(startup_modes) / sizeof(startup_modes[0]);
+    Result *res = calloc(n, sizeof(Result));
+    double *ms = malloc((size_t)count * sizeof(double));
+    if (!res || !ms)
+        die("malloc", root);
+    printf("%-15s %10s %10s %10s %10s\n", "startup", "min_ms", "median_ms", "user_ms", "sys_ms");
+    for (size_t m = 0; m < n; m++) {
+        char *argv[5];
+        int argc = 0;
+        argv[argc++] = (char *)vls;
+        for (int a = 0; a < 2 && startup_modes[m].args[a]; a++)
+            argv[argc++] = strcmp(startup_modes[m].args[a], "@") == 0 ? cache_arg
+                                                                     : (char *)startup_modes[m].args[a];
+        argv[argc++] = dir;
+        argv[argc] = NULL;
+        /* One unmeasured run warms the page cache and writes the color
+         * cache file. */
+        double user = 0, sys = 0;
+        long rss = 0;
+        for (int i = -1; i < count; i++) {
+            double start = now_ms();
+            pid_t pid = spawn_argv(vls, argv, 0);
+            int status;
+            struct rusage ru;
+            if (wait4(pid, &status, 0, &ru) == -1)
+                die("wait4", vls);
+            double wall = now_ms() - start;
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+                fprintf(stderr, "vls-bench: %s %s exited with an error\n", vls, startup_modes[m].label);
+            if (i < 0)
+                continue;
+            ms[i] = wall;
+            user += ru.ru_utime.tv_sec * 1e3 + ru.ru_utime.tv_usec / 1e3;
+            sys += ru.ru_stime.tv_sec * 1e3 + ru.ru_stime.tv_usec / 1e3;
+            rss = ru.ru_maxrss;
+        }
+        qsort(ms, (size_t)count, sizeof(double), by_ms);
+        Result *r = &res[m];
+        snprintf(r->tool, sizeof(r->tool), "vls");
+        snprintf(r->tree, sizeof(r->tree), "empty");
+        snprintf(r->mode, sizeof(r->mode), "%s", startup_modes[m].label);
+        r->wall_ms = ms[count / 2];
+        r->user_ms = user / count;
+        r->sys_ms = sys / count;
+#if defined(__APPLE__)
+        r->maxrss_kb = rss / 1024;
+#else
+        r->maxrss_kb = rss;
+#endif
+        r->syscalls = count_syscalls_argv(vls, argv);
+        printf("%-15s %10.3f %10.3f %10.3f %10.3f\n", r->mode, ms[0], r->wall_ms, r->user_ms, r->sys_ms);
+        fflush(stdout);
+    }
+    free(ms);
+    *out = res;
+    return n;
+}
+
+/* Empty the page, dentry and inode caches; needs root. */
+static void drop_caches(void) {
+    sync();
+    int fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+    if (fd == -1 || write(fd, "3\n", 2) != 2)
+        die("drop_caches", "/proc/sys/vm/drop_caches");
+    close(fd);
+}
+
+static size_t cold(const char *vls, const char *root, long count, int runs, Result **out) {
+    static const struct {
+        const char *label;
+        const char *arg;
+    } cold_modes[] = {{"readdir-order", "--inode-order=0"}, {"inode-order", "--inode-order=1"}};
+    char dir[4096], path[4200];
+    snprintf(dir, sizeof(dir), "%s/cold", root);
+    snprintf(path, sizeof(path), "%s/.stamp", dir);
+    long have = 0;
+    FILE *f = fopen(path, "r");
+    if (f) {
+        if (fscanf(f, "%ld", &have) != 1)
+            have = 0;
+        fclose(f);
+    }
+    if (have != count) {
+        fprintf(stderr, "vls-bench: generating %s (%ld entries)\n", dir, count);
+        make_dir(dir);
+        for (long i = 0; i < count; i++) {
+            snprintf(path, sizeof(path), "%s/f%07ld.dat", dir, (i * 7919) % 10000000);
+            make_file(path);
+        }
+        snprintf(path, sizeof(path), "%s/.stamp", dir);
+        if (!(f = fopen(path, "w")))
+            die("fopen", path);
+        fprintf(f, "%ld\n", count);
+        fclose(f);
+    }
+    size_t n = sizeof(cold_modes) / sizeof(cold_modes[0]);
+    Result *res = calloc(n, sizeof(Result));
+    if (!res)
+        die("calloc", root);
+    printf("%-15s %10s %10s %10s\n", "cold -l", "wall_ms", "user_ms", "sys_ms");
+    for (size_t m = 0; m < n; m++) {
+        char *argv[] = {(char *)vls, "-l", (char *)cold_modes[m].arg, dir, NULL};
+        Result samples[MAX_RUNS];
+        for (int i = 0; i < runs; i++) {
+            drop_caches();
+            if (time_argv(vls, argv, &samples[i]) != 0)
+                fprintf(stderr, "vls-bench: %s %s exited with an error\n", vls, cold_modes[m].label);
+        }
+        qsort(samples, (size_t)runs, sizeof(Result), by_wall);
+        Result *r = &res[m];
+        *r = samples[runs / 2];
+        snprintf(r->tool, sizeof(r->tool), "vls");
+        snprintf(r->tree, sizeof(r->tree), "cold%ld", count);
+        snprintf(r->mode, sizeof(r->mode), "%s", cold_modes[m].label);
+        r->syscalls = -1;
+        printf("%-15s %10.1f %10.1f %10.1f\n", r->mode, r->wall_ms, r->user_ms, r->sys_ms);
+        fflush(stdout);
+    }
+    *out = res;
+    return n;
+}
+
+static size_t load_results(const char *file, Result **out) {
+    FILE *f = fopen(file, "r");
+    if (!f)
+        die("fopen", file);
+    char line[512];
+    size_t count = 0, cap = 0;
+    Result *res = NULL;
+    while (fgets(line, sizeof(line), f)) {
+        Result r;
+        memset(&r, 0, sizeof(r));
+        if (line[0] == '#' || sscanf(line, "%15s\t%15s\t%23s\t%lf\t%lf\t%lf\t%ld\t%ld", r.tool, r.tree, r.mode,
+                                     &r.wall_ms, &r.user_ms, &r.sys_ms, &r.maxrss_kb, &r.syscalls) != 8)
+            continue;
+        if (count == cap) {
+            cap = cap ? cap * 2 : 64;
+            Result *tmp = realloc(res, cap * sizeof(Result));
+            if (!tmp)
+                die("realloc", file);
+            res = tmp;
+        }
+        res[count++] = r;
+    }
+    fclose(f);
+    *out = res;
+    return count;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-g] [-s SCALE] [-n RUNS] [-S COUNT] [-P SIZES [-j THREADS]] [-K COUNT] [-v VLS] [-l LS] [-o FILE] [-b BASELINE] [-t PCT] "
+            "DIR\n",
+            prog);
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    int gen = 0, runs = 3, startup_runs = 0, sort_threads = 0;
+    long cold_count = 0;
+    const char *sort_sizes = NULL;
+    double scale = 1.0, threshold = 10.0;
+    const char *vls = "./build/vls", *ls = NULL, *out = "build/bench.tsv", *baseline = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "gs:n:S:P:j:K:v:l:o:b:t:")) != -1) {
+        switch (opt) {
+        case 'g': gen = 1; break;
+        case 's': scale = strtod(optarg, NULL); break;
+        case 'n': runs = atoi(optarg); break;
+        case 'S': startup_runs = atoi(optarg); break;
+        case 'P': sort_sizes = optarg; break;
+        case 'j': sort_threads = atoi(optarg); break;
+        case 'K': cold_count = atol(optarg); break;
+        case 'v': vls = optarg; break;
+        case 'l': ls = optarg; break;
+        case 'o': out = optarg; break;
+        case 'b': baseline = optarg; break;
+        case 't': threshold = strtod(optarg, NULL); break;
+        default: usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1 || scale <= 0 || runs < 1 || runs > MAX_RUNS || startup_runs < 0 ||
+        sort_threads < 0 || cold_count < 0)
+        usage(argv[0]);
+    const char *root = argv[optind];
+    int matrix = !startup_runs && !sort_sizes && !cold_count;
+    if (gen && matrix)
+        generate(root, scale);
+
+    FILE *f = fopen(out, "w");
+    if (!f)
+        die("fopen", out);
+    fprintf(f, "# tool\ttree\tmode\twall_ms\tuser_ms\tsys_ms\tmaxrss_kb\tsyscalls\n");
+    const char *tools[2] = {vls, ls};
+    const char *labels[2] = {"vls", "ls"};
+    Result *results = NULL;
+    size_t count = 0;
+    if (!matrix) {
+        if (cold_count)
+            count = cold(vls, root, cold_count, runs, &results);
+        else
+            count = sort_sizes ? sort_bench(sort_sizes, sort_threads, &results)
+                               : startup(vls, root, startup_runs, &results);
+        for (size_t i = 0; i < count; i++) {
+            const Result *r = &results[i];
+            fprintf(f, "%s\t%s\t%s\t%.3f\t%.3f\t%.3f\t%ld\t%ld\n", r->tool, r->tree, r->mode, r->wall_ms,
+                    r->user_ms, r->sys_ms, r->maxrss_kb, r->syscalls);
+        }
+    } else {
+        printf("%-5s %-9s %-15s %10s %10s %10s %9s %9s\n", "tool", "tree", "mode", "wall_ms", "user_ms", "sys_ms",
+               "rss_kb", "syscalls");
+    }
+    for (size_t tool = 0; matrix && tool < 2 && tools[tool]; tool++) {
+        for (size_t t = 0; t < NTREES; t++) {
+            char dir[4096];
+            snprintf(dir, sizeof(dir), "%s/%s", root, trees[t].name);
+            for (size_t m = 0; m < NMODES; m++) {
+                Result samples[MAX_RUNS];
+                for (int i = 0; i < runs; i++)
+                    if (time_run(tools[tool], modes[m], dir, &samples[i]) != 0)
+                        fprintf(stderr, "vls-bench: %s %s %s exited with an error\n", tools[tool], modes[m], dir);
+                qsort(samples, (size_t)runs, sizeof(Result), by_wall);
+                Result r = samples[runs / 2];
+                snprintf(r.tool, sizeof(r.tool), "%s", labels[tool]);
+                snprintf(r.tree, sizeof(r.tree), "%s", trees[t].name);
+                snprintf(r.mode, sizeof(r.mode), "%s", modes[m]);
+                r.syscalls = count_syscalls(tools[tool], modes[m], dir);
+                fprintf(f, "%s\t%s\t%s\t%.2f\t%.2f\t%.2f\t%ld\t%ld\n", r.tool, r.tree, r.mode, r.wall_ms,
+                        r.user_ms, r.sys_ms, r.maxrss_kb, r.syscalls);
+                printf("%-5s %-9s %-15s %10.2f %10.2f %10.2f %9ld %9ld\n", r.tool, r.tree, r.mode, r.wall_ms,
+                       r.user_ms, r.sys_ms, r.maxrss_kb, r.syscalls);
+                fflush(stdout);
+                Result *tmp = realloc(results, (count + 1) * sizeof(Result));
+                if (!tmp)
+                    die("realloc", out);
+                results = tmp;
+                results[count++] = r;
+            }
+        }
+    }
+    fclose(f);
+    printf("results written to %s\n", out);
+
+    int regressed = 0;
+    if (baseline) {
+        Result *base;
+        size_t nbase = load_results(baseline, &base);
+        printf("\ncompared with %s (threshold %.0f%%):\n", baseline, threshold);
+        for (size_t i = 0; i < count; i++)
+            for (size_t j = 0; j < nbase; j++) {
+                const Result *a = &results[i], *b = &base[j];
+                if (strcmp(a->tool, b->tool) || strcmp(a->tree, b->tree) || strcmp(a->mode, b->mode))
+                    continue;
+                double change = b->wall_ms > 0 ? (a->wall_ms / b->wall_ms - 1) * 100 : 0;
+                int slow = change > threshold;
+                regressed |= slow;
+                printf("%-5s %-9s %-15s %10.2f -> %10.2f ms %+7.1f%%%s\n", a->tool, a->tree, a->mode,
+                       b->wall_ms, a->wall_ms, change, slow ? "  REGRESSION" : "");
+            }
+        free(base);
+    }
+    free(results);
+    return regressed ? 2 : 0;
+}
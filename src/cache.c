@@ -0,0 +1,246 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "cache.h"
+#include "util.h"
+
+#define CACHE_MAGIC "VLSCACHE"
+#define CACHE_VERSION 1
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t follow_links;
+    uint64_t dev;
+    uint64_t ino;
+    int64_t mtime_s;
+    int64_t ctime_s;
+    uint32_t mtime_ns;
+    uint32_t ctime_ns;
+    uint64_t count;
+    uint64_t names_len;
+} CacheHeader;
+
+static const char *cache_dir = NULL;
+static int revalidate = 0;
+static const char *attached_dir = NULL;
+static int notify_fd = -1;
+
+void cache_attach(const char *dir, int fd) {
+    attached_dir = dir;
+    notify_fd = fd;
+}
+
+void cache_init(const char *dir, int reval) {
+    if (!dir)
+        dir = attached_dir;
+    cache_dir = dir;
+    revalidate = reval;
+    if (dir && mkdir(dir, 0700) == -1 && errno != EEXIST) {
+        fprintf(stderr, "cache: %s: %s\n", dir, strerror(errno));
+        cache_dir = NULL;
+    }
+}
+
+int cache_enabled(void) {
+    return cache_dir != NULL;
+}
+
+int cache_revalidating(void) {
+    return revalidate;
+}
+
+static char *snapshot_path(const struct stat *dst, int follow_links) {
+    char *path = NULL;
+    if (asprintf(&path, "%s/%llx-%llx-%c.vlc", cache_dir, (unsigned long long)dst->st_dev,
+                 (unsigned long long)dst->st_ino, follow_links ? 'L' : 'P') < 0)
+        return NULL;
+    return path;
+}
+
+static int header_matches(const CacheHeader *h, const struct stat *dst, int follow_links) {
+    return memcmp(h->magic, CACHE_MAGIC, 8) == 0 && h->version == CACHE_VERSION &&
+           h->follow_links == (uint32_t)follow_links &&
+           h->dev == (uint64_t)dst->st_dev && h->ino == (uint64_t)dst->st_ino &&
+           h->mtime_s == (int64_t)dst->ST_MTIM.tv_sec && h->mtime_ns == (uint32_t)dst->ST_MTIM.tv_nsec &&
+           h->ctime_s == (int64_t)dst->ST_CTIM.tv_sec && h->ctime_ns == (uint32_t)dst->ST_CTIM.tv_nsec;
+}
+
+int cache_load(const struct stat *dst, int follow_links, CacheSnapshot *snap) {
+    memset(snap, 0, sizeof(*snap));
+    char *path = snapshot_path(dst, follow_links);
+    if (!path)
+        return 0;
+    int fd = open(path, O_RDONLY);
+    free(path);
+    if (fd == -1)
+        return 0;
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(CacheHeader)) {
+        close(fd);
+        return 0;
+    }
+    size_t len = (size_t)st.st_size;
+    void *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return 0;
+    const CacheHeader *h = map;
+    if (!header_matches(h, dst, follow_links) ||
+        h->count > (len - sizeof(CacheHeader)) / sizeof(CacheRecord) ||
+        h->names_len != len - sizeof(CacheHeader) - h->count * sizeof(CacheRecord) ||
+        (h->names_len && ((const char *)map)[len - 1] != '\0')) {
+        munmap(map, len);
+        return 0;
+    }
+    snap->map = map;
+    snap->map_len = len;
+    snap->count = (size_t)h->count;
+    snap->recs = (const CacheRecord *)((const char *)map + sizeof(CacheHeader));
+    snap->names = (const char *)(snap->recs + snap->count);
+    for (size_t i = 0; i < snap->count; i++) {
+        if (snap->recs[i].name_off >= h->names_len) {
+            cache_release(snap);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void cache_release(CacheSnapshot *snap) {
+    if (snap->map)
+        munmap(snap->map, snap->map_len);
+    memset(snap, 0, sizeof(*snap));
+}
+
+const char *cache_name(const CacheSnapshot *snap, size_t i) {
+    return snap->names + snap->recs[i].name_off;
+}
+
+void cache_stat(const CacheSnapshot *snap, size_t i, struct stat *st) {
+    const CacheRecord *r = &snap->recs[i];
+    memset(st, 0, sizeof(*st));
+    st->st_ino = (ino_t)r->ino;
+    st->st_dev = (dev_t)r->dev;
+    st->st_rdev = (dev_t)r->rdev;
+    st->st_nlink = (nlink_t)r->nlink;
+    st->st_size = (off_t)r->size;
+    st->st_blocks = (blkcnt_t)r->blocks;
+    st->st_blksize = (blksize_t)r->blksize;
+    st->st_mode = (mode_t)r->mode;
+    st->st_uid = (uid_t)r->uid;
+    st->st_gid = (gid_t)r->gid;
+    st->ST_ATIM.tv_sec = (time_t)r->atime_s;
+    st->ST_ATIM.tv_nsec = (long)r->atime_ns;
+    st->ST_MTIM.tv_sec = (time_t)r->mtime_s;
+    st->ST_MTIM.tv_nsec = (long)r->mtime_ns;
+    st->ST_CTIM.tv_sec = (time_t)r->ctime_s;
+    st->ST_CTIM.tv_nsec = (long)r->ctime_ns;
+}
+
+/* One write of at most PIPE_BUF bytes, so lines from concurrent writers
+ * never interleave; longer paths simply go unwatched. */
+static void announce(const struct stat *dst, const char *path) {
+    char *abs = realpath(path, NULL);
+    if (!abs)
+        return;
+    char line[PIPE_BUF];
+    int len = snprintf(line, sizeof(line), "%llx %llx %s\n", (unsigned long long)dst->st_dev,
+                       (unsigned long long)dst->st_ino, abs);
+    /* Should the daemon be gone, the snapshot is still checked by mtime. */
+    if (len > 0 && (size_t)len < sizeof(line)) {
+        ssize_t n = write(notify_fd, line, (size_t)len);
+        (void)n;
+    }
+    free(abs);
+}
+
+void cache_store(const struct stat *dst, int follow_links, const char *path, const Entry *entries,
+                 size_t count) {
+    /* A directory changed within the last tick could change again without
+     * moving its timestamps, so such snapshots are not trusted. */
+    time_t now = time(NULL);
+    if (dst->ST_MTIM.tv_sec >= now - 1 || dst->ST_CTIM.tv_sec >= now - 1)
+        return;
+
+    size_t names_len = 0;
+    for (size_t i = 0; i < count; i++)
+        names_len += strlen(entries[i].name) + 1;
+    if (names_len > UINT32_MAX)
+        return;
+    char *snap = snapshot_path(dst, follow_links);
+    char *tmp = NULL;
+    if (!snap || asprintf(&tmp, "%s.%ld", snap, (long)getpid()) < 0) {
+        free(snap);
+        return;
+    }
+    FILE *f = fopen(tmp, "wb");
+    if (!f) {
+        free(snap);
+        free(tmp);
+        return;
+    }
+    CacheHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, CACHE_MAGIC, 8);
+    h.version = CACHE_VERSION;
+    h.follow_links = (uint32_t)follow_links;
+    h.dev = (uint64_t)dst->st_dev;
+    h.ino = (uint64_t)dst->st_ino;
+    h.mtime_s = (int64_t)dst->ST_MTIM.tv_sec;
+    h.mtime_ns = (uint32_t)dst->ST_MTIM.tv_nsec;
+    h.ctime_s = (int64_t)dst->ST_CTIM.tv_sec;
+    h.ctime_ns = (uint32_t)dst->ST_CTIM.tv_nsec;
+    h.count = count;
+    h.names_len = names_len;
+    int ok = fwrite(&h, sizeof(h), 1, f) == 1;
+    uint32_t off = 0;
+    for (size_t i = 0; ok && i < count; i++) {
+        const struct stat *st = &entries[i].st;
+        CacheRecord r;
+        memset(&r, 0, sizeof(r));
+        r.ino = (uint64_t)st->st_ino;
+        r.dev = (uint64_t)st->st_dev;
+        r.rdev = (uint64_t)st->st_rdev;
+        r.nlink = (uint64_t)st->st_nlink;
+        r.size = (int64_t)st->st_size;
+        r.blocks = (int64_t)st->st_blocks;
+        r.atime_s = (int64_t)st->ST_ATIM.tv_sec;
+        r.mtime_s = (int64_t)st->ST_MTIM.tv_sec;
+        r.ctime_s = (int64_t)st->ST_CTIM.tv_sec;
+        r.atime_ns = (uint32_t)st->ST_ATIM.tv_nsec;
+        r.mtime_ns = (uint32_t)st->ST_MTIM.tv_nsec;
+        r.ctime_ns = (uint32_t)st->ST_CTIM.tv_nsec;
+        r.mode = (uint32_t)st->st_mode;
+        r.uid = (uint32_t)st->st_uid;
+        r.gid = (uint32_t)st->st_gid;
+        r.blksize = (uint32_t)st->st_blksize;
+        r.name_off = off;
+        off += (uint32_t)strlen(entries[i].name) + 1;
+        ok = fwrite(&r, sizeof(r), 1, f) == 1;
+    }
+    for (size_t i = 0; ok && i < count; i++)
+        ok = fwrite(entries[i].name, strlen(entries[i].name) + 1, 1, f) == 1;
+    if (fclose(f) == EOF)
+        ok = 0;
+    if (!ok || rename(tmp, snap) == -1)
+        unlink(tmp);
+    else if (notify_fd != -1 && cache_dir == attached_dir)
+        announce(dst, path);
+    free(tmp);
+    free(snap);
+}
+
+void cache_invalidate(const struct stat *dst, int follow_links) {
+    char *path = snapshot_path(dst, follow_links);
+    if (path) {
+        unlink(path);
+        free(path);
+    }
+}
@@ -0,0 +1,32 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include "columnar.h"
+
+/* Print the rows of a --format=columnar file, one tab-separated line each. */
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s FILE\n", argv[0]);
+        return 1;
+    }
+    ColumnarFile cf;
+    if (columnar_open(argv[1], &cf) == -1) {
+        fprintf(stderr, "%s: %s\n", argv[1], strerror(errno));
+        return 1;
+    }
+    for (uint64_t i = 0; i < cf.rows; i++) {
+        const char *dir = columnar_dir(&cf, cf.parent[i]);
+        const char *name = columnar_name(&cf, i);
+        if (!name || (!dir && cf.parent[i] != COLUMNAR_NO_DIR)) {
+            fprintf(stderr, "%s: row %" PRIu64 ": damaged name offsets\n", argv[1], i);
+            columnar_close(&cf);
+            return 1;
+        }
+        printf("%s\t%s\t%06" PRIo32 "\t%" PRId64 "\t%" PRId64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu32 "\t%" PRIu32 "\n",
+               dir ? dir : "-", name, cf.mode[i], cf.size[i], cf.mtime_ns[i],
+               cf.ino[i], cf.nlink[i], cf.uid[i], cf.gid[i]);
+    }
+    columnar_close(&cf);
+    return 0;
+}
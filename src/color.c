@@ -2,39 +2,554 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-static char reset_str[32] = "\x1b[0m";
-static char dir_str[32]   = "\x1b[1;34m";
-static char link_str[32]  = "\x1b[1;36m";
-static char exec_str[32]  = "\x1b[1;32m";
+/*
+ * Parsed LS_COLORS database.  All escape sequences and extension keys live
+ * in one string pool and are referenced by offset; extension rules are kept
+ * in an open-addressed hash table keyed by the lowercased suffix so that
+ * resolving a name costs a few probes regardless of how many rules exist.
+ *
+ * Because the tables hold only offsets they can be written out as they
+ * are: with --color-cache=DIR the first run for an LS_COLORS value saves
+ * them under a hash of the value, and later runs map that file instead of
+ * parsing the variable again.
+ */
 
-static void set_color(char *buf, size_t sz, const char *code) {
-    snprintf(buf, sz, "\x1b[%sm", code);
+typedef struct {
+    uint32_t off;
+    uint32_t len;
+} PoolStr;
+
+typedef struct {
+    uint32_t hash;
+    uint32_t key;
+    uint32_t key_len;
+    uint32_t color;
+} ExtSlot;
+
+typedef struct {
+    const char *key;
+    size_t key_len;
+    const char *val;
+    size_t val_len;
+} ExtRule;
+
+static const char *const type_keys[COLOR_TYPE_COUNT] = {
+    [COLOR_TYPE_NORMAL] = "no",
+    [COLOR_TYPE_FILE] = "fi",
+    [COLOR_TYPE_DIR] = "di",
+    [COLOR_TYPE_LINK] = "ln",
+    [COLOR_TYPE_FIFO] = "pi",
+    [COLOR_TYPE_SOCK] = "so",
+    [COLOR_TYPE_BLK] = "bd",
+    [COLOR_TYPE_CHR] = "cd",
+    [COLOR_TYPE_ORPHAN] = "or",
+    [COLOR_TYPE_MISSING] = "mi",
+    [COLOR_TYPE_SETUID] = "su",
+    [COLOR_TYPE_SETGID] = "sg",
+    [COLOR_TYPE_EXEC] = "ex",
+    [COLOR_TYPE_STICKY_OTHER_WRITABLE] = "tw",
+    [COLOR_TYPE_OTHER_WRITABLE] = "ow",
+    [COLOR_TYPE_STICKY] = "st",
+};
+
+static char *pool = NULL;
+static size_t pool_len = 0, pool_cap = 0;
+static PoolStr *codes = NULL;
+static size_t code_count = 0;
+static PoolStr reset_code;
+static ExtSlot *ext_slots = NULL;
+static uint32_t ext_mask = 0;
+/* Distinct lengths of suffix rules that do not start with '.', room for
+ * one per rule. */
+static uint32_t *nodot_lens = NULL;
+static size_t nodot_count = 0;
+/* The LS_COLORS value the tables were built from. */
+static char *parsed_env = NULL;
+static int parsed = 0;
+/* Set when pool, codes, ext_slots and nodot_lens point into a mapped
+ * cache file. */
+static void *mapped = NULL;
+static size_t mapped_len = 0;
+
+#define CACHE_MAGIC 0x564c5343u /* "VLSC" */
+#define CACHE_VERSION 2
+
+/* Followed by codes, ext_slots, nodot_lens, the LS_COLORS value and the
+ * pool. */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t env_len;
+    uint32_t pool_len;
+    uint32_t code_count;
+    uint32_t ext_size;
+    uint32_t nodot_count;
+    PoolStr reset_code;
+} CacheHeader;
+
+static unsigned char lower(unsigned char c) {
+    return (c >= 'A' && c <= 'Z') ? (unsigned char)(c - 'A' + 'a') : c;
 }
 
-void color_init(void) {
-    const char *env = getenv("LS_COLORS");
-    if (!env)
-        return;
-    char *tmp = strdup(env);
+static uint32_t hash_lower(const char *s, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= lower((unsigned char)s[i]);
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static int pool_reserve(size_t extra) {
+    if (pool_len + extra <= pool_cap)
+        return 0;
+    size_t cap = pool_cap ? pool_cap : 256;
+    while (cap < pool_len + extra)
+        cap *= 2;
+    char *tmp = realloc(pool, cap);
     if (!tmp)
+        return -1;
+    pool = tmp;
+    pool_cap = cap;
+    return 0;
+}
+
+/* Append the concatenation of up to three pieces plus a NUL terminator. */
+static int pool_add(PoolStr *out, const char *a, size_t alen, const char *b, size_t blen,
+                    const char *c, size_t clen) {
+    if (pool_reserve(alen + blen + clen + 1) == -1)
+        return -1;
+    out->off = (uint32_t)pool_len;
+    out->len = (uint32_t)(alen + blen + clen);
+    memcpy(pool + pool_len, a, alen);
+    memcpy(pool + pool_len + alen, b, blen);
+    memcpy(pool + pool_len + alen + blen, c, clen);
+    pool_len += alen + blen + clen;
+    pool[pool_len++] = '\0';
+    return 0;
+}
+
+static int build_ext_table(const ExtRule *rules, size_t nrules, const char *lc, size_t lc_len,
+                           const char *rc, size_t rc_len) {
+    uint32_t size = 16;
+    while (size < nrules * 2)
+        size *= 2;
+    ext_slots = calloc(size, sizeof(ExtSlot));
+    nodot_lens = malloc(nrules * sizeof(uint32_t));
+    if (!ext_slots || !nodot_lens)
+        return -1;
+    ext_mask = size - 1;
+    for (size_t i = 0; i < nrules; i++) {
+        const ExtRule *r = &rules[i];
+        uint32_t h = hash_lower(r->key, r->key_len);
+        uint32_t pos = h & ext_mask;
+        ExtSlot *slot = NULL;
+        while (ext_slots[pos].key_len) {
+            ExtSlot *s = &ext_slots[pos];
+            if (s->hash == h && s->key_len == r->key_len &&
+                strncmp(pool + s->key, r->key, r->key_len) == 0) {
+                slot = s;
+                break;
+            }
+            pos = (pos + 1) & ext_mask;
+        }
+        PoolStr seq;
+        if (pool_add(&seq, lc, lc_len, r->val, r->val_len, rc, rc_len) == -1)
+            return -1;
+        if (slot) {
+            /* Later rules override earlier ones, as in GNU ls. */
+            codes[slot->color] = seq;
+            continue;
+        }
+        slot = &ext_slots[pos];
+        PoolStr key;
+        if (pool_add(&key, r->key, r->key_len, "", 0, "", 0) == -1)
+            return -1;
+        for (size_t k = 0; k < r->key_len; k++)
+            pool[key.off + k] = (char)lower((unsigned char)pool[key.off + k]);
+        slot->hash = h;
+        slot->key = key.off;
+        slot->key_len = (uint32_t)r->key_len;
+        slot->color = (uint32_t)code_count;
+        codes[code_count++] = seq;
+        if (r->key[0] != '.') {
+            size_t j = 0;
+            while (j < nodot_count && nodot_lens[j] != r->key_len)
+                j++;
+            if (j == nodot_count)
+                nodot_lens[nodot_count++] = (uint32_t)r->key_len;
+        }
+    }
+    return 0;
+}
+
+static int lookup_suffix(const char *s, size_t len) {
+    if (!ext_slots)
+        return -1;
+    uint32_t h = hash_lower(s, len);
+    uint32_t pos = h & ext_mask;
+    while (ext_slots[pos].key_len) {
+        const ExtSlot *slot = &ext_slots[pos];
+        if (slot->hash == h && slot->key_len == len) {
+            const char *key = pool + slot->key;
+            size_t i = 0;
+            while (i < len && lower((unsigned char)s[i]) == (unsigned char)key[i])
+                i++;
+            if (i == len)
+                return (int)slot->color;
+        }
+        pos = (pos + 1) & ext_mask;
+    }
+    return -1;
+}
+
+static void release(void) {
+    if (mapped) {
+        munmap(mapped, mapped_len);
+        mapped = NULL;
+    } else {
+        free(pool);
+        free(codes);
+        free(ext_slots);
+        free(nodot_lens);
+    }
+    pool = NULL;
+    pool_len = pool_cap = 0;
+    codes = NULL;
+    code_count = 0;
+    ext_slots = NULL;
+    ext_mask = 0;
+    nodot_lens = NULL;
+    nodot_count = 0;
+}
+
+static char *cache_file(const char *dir, const char *env) {
+    uint64_t h = 14695981039346656037u;
+    for (const char *p = env; *p; p++) {
+        h ^= (unsigned char)*p;
+        h *= 1099511628211u;
+    }
+    char *path = NULL;
+    if (asprintf(&path, "%s/colors-%016llx", dir, (unsigned long long)h) < 0)
+        return NULL;
+    return path;
+}
+
+/* A pool string in bounds and NUL-terminated, as color_code hands it out. */
+static int pool_str_ok(PoolStr s, const char *pool_base, size_t len) {
+    return s.off < len && s.len < len - s.off && pool_base[s.off + s.len] == '\0';
+}
+
+/* Every offset and color index in mapped tables points inside them, and
+ * the suffix table keeps a free slot so that probes end. */
+static int cache_tables_ok(const CacheHeader *h, const PoolStr *c, const ExtSlot *slots,
+                           const char *pool_base) {
+    if (!pool_str_ok(h->reset_code, pool_base, h->pool_len))
+        return 0;
+    for (uint32_t i = 0; i < h->code_count; i++)
+        if (!pool_str_ok(c[i], pool_base, h->pool_len))
+            return 0;
+    uint32_t used = 0;
+    for (uint32_t i = 0; i < h->ext_size; i++) {
+        const ExtSlot *s = &slots[i];
+        if (!s->key_len)
+            continue;
+        if (s->key >= h->pool_len || s->key_len > h->pool_len - s->key || s->color >= h->code_count)
+            return 0;
+        used++;
+    }
+    return h->ext_size == 0 || used < h->ext_size;
+}
+
+/* Map the tables saved for ENV; 0 when they were found intact. */
+static int cache_load(const char *file, const char *env) {
+    int fd = open(file, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return -1;
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(CacheHeader))
+        map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -1;
+    size_t len = (size_t)st.st_size;
+    const CacheHeader *h = map;
+    size_t env_len = strlen(env);
+    size_t codes_sz = (size_t)h->code_count * sizeof(PoolStr);
+    size_t slots_sz = (size_t)h->ext_size * sizeof(ExtSlot);
+    size_t nodot_sz = (size_t)h->nodot_count * sizeof(uint32_t);
+    const char *p = (const char *)(h + 1);
+    const char *env_at = p + codes_sz + slots_sz + nodot_sz;
+    if (h->magic != CACHE_MAGIC || h->version != CACHE_VERSION || h->env_len != env_len ||
+        h->code_count < COLOR_TYPE_COUNT || (h->ext_size & (h->ext_size - 1)) != 0 ||
+        h->nodot_count > h->ext_size ||
+        len != sizeof(CacheHeader) + codes_sz + slots_sz + nodot_sz + env_len + h->pool_len ||
+        memcmp(env_at, env, env_len) != 0 ||
+        !cache_tables_ok(h, (const PoolStr *)p, (const ExtSlot *)(p + codes_sz), env_at + env_len)) {
+        munmap(map, len);
+        return -1;
+    }
+    mapped = map;
+    mapped_len = len;
+    codes = (PoolStr *)p;
+    code_count = h->code_count;
+    ext_slots = h->ext_size ? (ExtSlot *)(p + codes_sz) : NULL;
+    ext_mask = h->ext_size ? h->ext_size - 1 : 0;
+    nodot_lens = h->nodot_count ? (uint32_t *)(p + codes_sz + slots_sz) : NULL;
+    nodot_count = h->nodot_count;
+    pool = (char *)(env_at + env_len);
+    pool_len = pool_cap = h->pool_len;
+    reset_code = h->reset_code;
+    return 0;
+}
+
+/* Written to a temporary name and renamed, so a reader never maps a
+ * partial file; failures only cost the next run a parse. */
+static void cache_save(const char *dir, const char *file, const char *env) {
+    if (mkdir(dir, 0700) == -1 && errno != EEXIST)
+        return;
+    char *tmp = NULL;
+    if (asprintf(&tmp, "%s/.colors-XXXXXX", dir) < 0)
         return;
-    char *tok = strtok(tmp, ":");
-    while (tok) {
-        if (strncmp(tok, "di=", 3) == 0)
-            set_color(dir_str, sizeof(dir_str), tok + 3);
-        else if (strncmp(tok, "ln=", 3) == 0)
-            set_color(link_str, sizeof(link_str), tok + 3);
-        else if (strncmp(tok, "ex=", 3) == 0)
-            set_color(exec_str, sizeof(exec_str), tok + 3);
-        else if (strncmp(tok, "rs=", 3) == 0)
-            set_color(reset_str, sizeof(reset_str), tok + 3);
-        tok = strtok(NULL, ":");
+    int fd = mkstemp(tmp);
+    if (fd == -1) {
+        free(tmp);
+        return;
+    }
+    CacheHeader h;
+    memset(&h, 0, sizeof(h));
+    h.magic = CACHE_MAGIC;
+    h.version = CACHE_VERSION;
+    h.env_len = (uint32_t)strlen(env);
+    h.pool_len = (uint32_t)pool_len;
+    h.code_count = (uint32_t)code_count;
+    h.ext_size = ext_slots ? ext_mask + 1 : 0;
+    h.nodot_count = (uint32_t)nodot_count;
+    h.reset_code = reset_code;
+    FILE *f = fdopen(fd, "wb");
+    int ok = f != NULL;
+    if (ok) {
+        fwrite(&h, sizeof(h), 1, f);
+        fwrite(codes, sizeof(PoolStr), code_count, f);
+        if (ext_slots)
+            fwrite(ext_slots, sizeof(ExtSlot), h.ext_size, f);
+        if (nodot_count)
+            fwrite(nodot_lens, sizeof(uint32_t), nodot_count, f);
+        fwrite(env, 1, h.env_len, f);
+        fwrite(pool, 1, pool_len, f);
+        ok = fclose(f) == 0;
+    } else {
+        close(fd);
     }
+    if (!ok || rename(tmp, file) == -1)
+        unlink(tmp);
     free(tmp);
 }
 
-const char *color_reset(void) { return reset_str; }
-const char *color_dir(void)   { return dir_str; }
-const char *color_link(void)  { return link_str; }
-const char *color_exec(void)  { return exec_str; }
+void color_init(const char *cache_dir) {
+    static const char *const defaults[COLOR_TYPE_COUNT] = {
+        [COLOR_TYPE_DIR] = "1;34",
+        [COLOR_TYPE_LINK] = "1;36",
+        [COLOR_TYPE_EXEC] = "1;32",
+    };
+    const char *type_val[COLOR_TYPE_COUNT];
+    size_t type_len[COLOR_TYPE_COUNT];
+    for (int t = 0; t < COLOR_TYPE_COUNT; t++) {
+        type_val[t] = defaults[t] ? defaults[t] : "";
+        type_len[t] = strlen(type_val[t]);
+    }
+    const char *lc = "\x1b[", *rc = "m", *rs = "0", *ec = NULL;
+    size_t lc_len = 2, rc_len = 1, rs_len = 1, ec_len = 0;
+
+    const char *env = getenv("LS_COLORS");
+    /* A --serve worker inherits the daemon's tables and keeps them unless
+     * the client's LS_COLORS differs. */
+    if (parsed && (env ? parsed_env && strcmp(env, parsed_env) == 0 : !parsed_env))
+        return;
+    release();
+    free(parsed_env);
+    parsed_env = env ? strdup(env) : NULL;
+    parsed = 1;
+    char *file = cache_dir ? cache_file(cache_dir, env ? env : "") : NULL;
+    if (file && cache_load(file, env ? env : "") == 0) {
+        free(file);
+        return;
+    }
+    ExtRule *rules = NULL;
+    size_t nrules = 0, rules_cap = 0;
+    const char *p = env ? env : "";
+    while (*p) {
+        const char *end = strchr(p, ':');
+        if (!end)
+            end = p + strlen(p);
+        const char *eq = memchr(p, '=', (size_t)(end - p));
+        if (eq && eq > p) {
+            size_t key_len = (size_t)(eq - p);
+            const char *val = eq + 1;
+            size_t val_len = (size_t)(end - val);
+            if (p[0] == '*') {
+                if (nrules == rules_cap) {
+                    size_t cap = rules_cap ? rules_cap * 2 : 64;
+                    ExtRule *tmp = realloc(rules, cap * sizeof(ExtRule));
+                    if (!tmp) {
+                        perror("realloc");
+                        /* Never save a partial table. */
+                        free(file);
+                        file = NULL;
+                        break;
+                    }
+                    rules = tmp;
+                    rules_cap = cap;
+                }
+                if (key_len > 1)
+                    rules[nrules++] = (ExtRule){p + 1, key_len - 1, val, val_len};
+            } else if (key_len == 2) {
+                if (strncmp(p, "lc", 2) == 0) {
+                    lc = val; lc_len = val_len;
+                } else if (strncmp(p, "rc", 2) == 0) {
+                    rc = val; rc_len = val_len;
+                } else if (strncmp(p, "rs", 2) == 0) {
+                    rs = val; rs_len = val_len;
+                } else if (strncmp(p, "ec", 2) == 0) {
+                    ec = val; ec_len = val_len;
+                } else {
+                    for (int t = 1; t < COLOR_TYPE_COUNT; t++) {
+                        if (strncmp(p, type_keys[t], 2) == 0) {
+                            type_val[t] = val;
+                            type_len[t] = val_len;
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+        p = *end ? end + 1 : end;
+    }
+
+    codes = malloc((COLOR_TYPE_COUNT + nrules) * sizeof(PoolStr));
+    if (!codes) {
+        perror("malloc");
+        free(rules);
+        free(file);
+        return;
+    }
+    code_count = COLOR_TYPE_COUNT;
+    int err = 0;
+    for (int t = 0; t < COLOR_TYPE_COUNT && !err; t++) {
+        if (type_len[t])
+            err = pool_add(&codes[t], lc, lc_len, type_val[t], type_len[t], rc, rc_len);
+        else
+            err = pool_add(&codes[t], "", 0, "", 0, "", 0);
+    }
+    if (!err) {
+        if (ec)
+            err = pool_add(&reset_code, ec, ec_len, "", 0, "", 0);
+        else
+            err = pool_add(&reset_code, lc, lc_len, rs, rs_len, rc, rc_len);
+    }
+    if (!err && nrules)
+        err = build_ext_table(rules, nrules, lc, lc_len, rc, rc_len);
+    if (err) {
+        perror("malloc");
+        free(pool);
+        free(codes);
+        free(ext_slots);
+        free(nodot_lens);
+        pool = NULL;
+        codes = NULL;
+        ext_slots = NULL;
+        nodot_lens = NULL;
+        nodot_count = 0;
+        code_count = 0;
+    }
+    free(rules);
+    if (file && codes)
+        cache_save(cache_dir, file, env ? env : "");
+    free(file);
+}
+
+int color_has(ColorType type) {
+    return codes && codes[type].len > 0;
+}
+
+int color_resolve(const char *name, mode_t mode, int broken) {
+    if (S_ISDIR(mode)) {
+        if ((mode & S_ISVTX) && (mode & S_IWOTH) && color_has(COLOR_TYPE_STICKY_OTHER_WRITABLE))
+            return COLOR_TYPE_STICKY_OTHER_WRITABLE;
+        if ((mode & S_IWOTH) && color_has(COLOR_TYPE_OTHER_WRITABLE))
+            return COLOR_TYPE_OTHER_WRITABLE;
+        if ((mode & S_ISVTX) && color_has(COLOR_TYPE_STICKY))
+            return COLOR_TYPE_STICKY;
+        return COLOR_TYPE_DIR;
+    }
+    if (S_ISLNK(mode))
+        return (broken && color_has(COLOR_TYPE_ORPHAN)) ? COLOR_TYPE_ORPHAN : COLOR_TYPE_LINK;
+    if (S_ISFIFO(mode))
+        return COLOR_TYPE_FIFO;
+    if (S_ISSOCK(mode))
+        return COLOR_TYPE_SOCK;
+    if (S_ISBLK(mode))
+        return COLOR_TYPE_BLK;
+    if (S_ISCHR(mode))
+        return COLOR_TYPE_CHR;
+    if ((mode & S_ISUID) && color_has(COLOR_TYPE_SETUID))
+        return COLOR_TYPE_SETUID;
+    if ((mode & S_ISGID) && color_has(COLOR_TYPE_SETGID))
+        return COLOR_TYPE_SETGID;
+    if (mode & S_IXUSR)
+        return COLOR_TYPE_EXEC;
+
+    if (ext_slots) {
+        /* Longest matching suffix wins: try every '.' from the left first,
+         * then the few distinct lengths used by rules such as "*~". */
+        size_t len = strlen(name);
+        int best = -1;
+        size_t best_len = 0;
+        for (const char *dot = strchr(name, '.'); dot; dot = strchr(dot + 1, '.')) {
+            size_t tail = len - (size_t)(dot - name);
+            best = lookup_suffix(dot, tail);
+            if (best >= 0) {
+                best_len = tail;
+                break;
+            }
+        }
+        for (size_t i = 0; i < nodot_count; i++) {
+            size_t tail = nodot_lens[i];
+            if (tail > len || tail <= best_len)
+                continue;
+            int idx = lookup_suffix(name + len - tail, tail);
+            if (idx >= 0) {
+                best = idx;
+                best_len = tail;
+            }
+        }
+        if (best >= 0)
+            return best;
+    }
+    if (color_has(COLOR_TYPE_FILE))
+        return COLOR_TYPE_FILE;
+    return color_has(COLOR_TYPE_NORMAL) ? COLOR_TYPE_NORMAL : COLOR_TYPE_NONE;
+}
+
+const char *color_code(int idx) {
+    if (!codes || idx < 0 || (size_t)idx >= code_count)
+        return "";
+    return pool + codes[idx].off;
+}
+
+size_t color_code_len(int idx) {
+    if (!codes || idx < 0 || (size_t)idx >= code_count)
+        return 0;
+    return codes[idx].len;
+}
+
+const char *color_reset(void) { return codes ? pool + reset_code.off : "\x1b[0m"; }
+size_t color_reset_len(void)  { return codes ? reset_code.len : 4; }
@@ -0,0 +1,272 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "columnar.h"
+#include "util.h"
+
+/* Each column is buffered up to this size; beyond it, full buffers go to
+ * the column's spool file, so memory stays flat however many rows a run
+ * exports. */
+#define COLUMNAR_CHUNK (1 << 20)
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+    /* Bytes already moved to SPOOL, an unlinked temporary file. */
+    int spool;
+    uint64_t spooled;
+} Block;
+
+static Block cols[COL_COUNT];
+static uint64_t row_count = 0;
+static uint64_t dir_count = 0;
+
+static void fail_exit(const char *what) {
+    fprintf(stderr, "columnar: %s: %s\n", what, strerror(errno));
+    exit(1);
+}
+
+static int write_all(int fd, const char *buf, size_t len) {
+    while (len) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static void block_spool(Block *b) {
+    if (b->spooled == 0 && (b->spool = temp_file("vls-columnar")) == -1)
+        fail_exit("temporary file");
+    if (write_all(b->spool, b->data, b->len) == -1)
+        fail_exit("write");
+    b->spooled += b->len;
+    b->len = 0;
+}
+
+/* Offset of the next byte appended to B within its column. */
+static uint64_t block_size(const Block *b) {
+    return b->spooled + b->len;
+}
+
+static void *block_append(Block *b, const void *src, size_t len) {
+    if (b->len && b->len + len > COLUMNAR_CHUNK)
+        block_spool(b);
+    if (b->len + len > b->cap) {
+        size_t cap = b->cap ? b->cap : 4096;
+        while (cap < b->len + len)
+            cap *= 2;
+        char *tmp = realloc(b->data, cap);
+        if (!tmp) {
+            perror("realloc");
+            exit(1);
+        }
+        b->data = tmp;
+        b->cap = cap;
+    }
+    void *dst = b->data + b->len;
+    memcpy(dst, src, len);
+    b->len += len;
+    return dst;
+}
+
+static void append_u64(int col, uint64_t v) { block_append(&cols[col], &v, sizeof(v)); }
+static void append_i64(int col, int64_t v)  { block_append(&cols[col], &v, sizeof(v)); }
+static void append_u32(int col, uint32_t v) { block_append(&cols[col], &v, sizeof(v)); }
+
+uint32_t columnar_add_dir(const char *path) {
+    if (dir_count == 0)
+        append_u64(COL_DIR_OFF, 0);
+    block_append(&cols[COL_DIR_NAMES], path, strlen(path) + 1);
+    append_u64(COL_DIR_OFF, block_size(&cols[COL_DIR_NAMES]));
+    return (uint32_t)dir_count++;
+}
+
+void columnar_add_row(uint32_t dir, const char *name, const struct stat *st) {
+    if (row_count == 0)
+        append_u64(COL_NAME_OFF, 0);
+    append_u32(COL_MODE, (uint32_t)st->st_mode);
+    append_i64(COL_SIZE, (int64_t)st->st_size);
+    append_i64(COL_MTIME_NS, (int64_t)st->ST_MTIM.tv_sec * 1000000000 + st->ST_MTIM.tv_nsec);
+    append_u64(COL_INO, (uint64_t)st->st_ino);
+    append_u64(COL_NLINK, (uint64_t)st->st_nlink);
+    append_u32(COL_UID, (uint32_t)st->st_uid);
+    append_u32(COL_GID, (uint32_t)st->st_gid);
+    append_u32(COL_PARENT, dir);
+    block_append(&cols[COL_NAMES], name, strlen(name) + 1);
+    append_u64(COL_NAME_OFF, block_size(&cols[COL_NAMES]));
+    row_count++;
+}
+
+static uint64_t align8(uint64_t v) {
+    return (v + 7) & ~(uint64_t)7;
+}
+
+/* Write B's spooled part, then what is still buffered, to OUT. */
+static int block_copy(Block *b, FILE *out) {
+    char buf[1 << 16];
+    for (uint64_t at = 0; at < b->spooled;) {
+        size_t want = b->spooled - at < sizeof(buf) ? (size_t)(b->spooled - at) : sizeof(buf);
+        ssize_t n = pread(b->spool, buf, want, (off_t)at);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            if (n == 0)
+                errno = EIO;
+            return -1;
+        }
+        if (fwrite(buf, 1, (size_t)n, out) != (size_t)n)
+            return -1;
+        at += (uint64_t)n;
+    }
+    if (b->len && fwrite(b->data, 1, b->len, out) != b->len)
+        return -1;
+    return 0;
+}
+
+int columnar_finish(FILE *out) {
+    static const char zeros[8];
+    if (row_count == 0)
+        append_u64(COL_NAME_OFF, 0);
+    if (dir_count == 0)
+        append_u64(COL_DIR_OFF, 0);
+
+    ColumnarHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, COLUMNAR_MAGIC, sizeof(COLUMNAR_MAGIC));
+    hdr.version = COLUMNAR_VERSION;
+    hdr.endian = COLUMNAR_ENDIAN;
+    hdr.rows = row_count;
+    hdr.dirs = dir_count;
+    uint64_t off = align8(sizeof(hdr));
+    for (int c = 0; c < COL_COUNT; c++) {
+        hdr.off[c] = off;
+        off = align8(off + block_size(&cols[c]));
+    }
+    hdr.file_size = off;
+
+    uint64_t pos = 0;
+    if (fwrite(&hdr, sizeof(hdr), 1, out) != 1)
+        goto fail;
+    pos = sizeof(hdr);
+    for (int c = 0; c < COL_COUNT; c++) {
+        if (fwrite(zeros, 1, hdr.off[c] - pos, out) != hdr.off[c] - pos)
+            goto fail;
+        if (block_copy(&cols[c], out) == -1)
+            goto fail;
+        pos = hdr.off[c] + block_size(&cols[c]);
+    }
+    if (fwrite(zeros, 1, hdr.file_size - pos, out) != hdr.file_size - pos)
+        goto fail;
+    if (fflush(out) == EOF)
+        goto fail;
+    for (int c = 0; c < COL_COUNT; c++) {
+        free(cols[c].data);
+        if (cols[c].spooled)
+            close(cols[c].spool);
+    }
+    memset(cols, 0, sizeof(cols));
+    row_count = dir_count = 0;
+    return 0;
+fail:
+    perror("write");
+    return -1;
+}
+
+int columnar_open(const char *path, ColumnarFile *cf) {
+    memset(cf, 0, sizeof(*cf));
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return -1;
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return -1;
+    }
+    size_t len = (size_t)st.st_size;
+    if (len < sizeof(ColumnarHeader)) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+    void *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -1;
+    const ColumnarHeader *hdr = map;
+    int ok = memcmp(hdr->magic, COLUMNAR_MAGIC, sizeof(COLUMNAR_MAGIC)) == 0 &&
+             hdr->version == COLUMNAR_VERSION && hdr->endian == COLUMNAR_ENDIAN &&
+             hdr->file_size <= len;
+    static const size_t widths[COL_COUNT] = {
+        [COL_MODE] = 4, [COL_SIZE] = 8, [COL_MTIME_NS] = 8, [COL_INO] = 8,
+        [COL_NLINK] = 8, [COL_UID] = 4, [COL_GID] = 4, [COL_PARENT] = 4,
+    };
+    for (int c = 0; ok && c < COL_COUNT; c++) {
+        uint64_t need = widths[c] * hdr->rows;
+        if (c == COL_NAME_OFF)
+            need = 8 * (hdr->rows + 1);
+        else if (c == COL_DIR_OFF)
+            need = 8 * (hdr->dirs + 1);
+        /* Blocks follow one another, so each ends where the next starts. */
+        uint64_t end = c + 1 < COL_COUNT ? hdr->off[c + 1] : hdr->file_size;
+        ok = hdr->off[c] % 8 == 0 && hdr->off[c] <= end && end <= hdr->file_size &&
+             need <= end - hdr->off[c];
+    }
+    if (!ok) {
+        munmap(map, len);
+        errno = EINVAL;
+        return -1;
+    }
+    const char *base = map;
+    cf->map = map;
+    cf->map_len = len;
+    cf->rows = hdr->rows;
+    cf->dirs = hdr->dirs;
+    cf->mode = (const uint32_t *)(base + hdr->off[COL_MODE]);
+    cf->size = (const int64_t *)(base + hdr->off[COL_SIZE]);
+    cf->mtime_ns = (const int64_t *)(base + hdr->off[COL_MTIME_NS]);
+    cf->ino = (const uint64_t *)(base + hdr->off[COL_INO]);
+    cf->nlink = (const uint64_t *)(base + hdr->off[COL_NLINK]);
+    cf->uid = (const uint32_t *)(base + hdr->off[COL_UID]);
+    cf->gid = (const uint32_t *)(base + hdr->off[COL_GID]);
+    cf->parent = (const uint32_t *)(base + hdr->off[COL_PARENT]);
+    cf->name_off = (const uint64_t *)(base + hdr->off[COL_NAME_OFF]);
+    cf->names = base + hdr->off[COL_NAMES];
+    cf->names_len = hdr->off[COL_DIR_OFF] - hdr->off[COL_NAMES];
+    cf->dir_off = (const uint64_t *)(base + hdr->off[COL_DIR_OFF]);
+    cf->dir_names = base + hdr->off[COL_DIR_NAMES];
+    cf->dir_names_len = hdr->file_size - hdr->off[COL_DIR_NAMES];
+    return 0;
+}
+
+void columnar_close(ColumnarFile *cf) {
+    if (cf->map)
+        munmap(cf->map, cf->map_len);
+    memset(cf, 0, sizeof(*cf));
+}
+
+/* String I of a names block: it must end in a NUL just before where
+ * string I + 1 starts, inside the block. */
+static const char *string_at(const char *block, uint64_t len, const uint64_t *off, uint64_t i) {
+    uint64_t start = off[i], end = off[i + 1];
+    if (start >= end || end > len || block[end - 1] != '\0')
+        return NULL;
+    return block + start;
+}
+
+const char *columnar_name(const ColumnarFile *cf, uint64_t row) {
+    return row < cf->rows ? string_at(cf->names, cf->names_len, cf->name_off, row) : NULL;
+}
+
+const char *columnar_dir(const ColumnarFile *cf, uint32_t dir) {
+    return dir < cf->dirs ? string_at(cf->dir_names, cf->dir_names_len, cf->dir_off, dir) : NULL;
+}
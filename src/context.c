@@ -0,0 +1,209 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifndef HAVE_SELINUX
+# define HAVE_SELINUX 0
+#endif
+
+#if defined(__linux__)
+# include <sys/xattr.h>
+# define HAVE_XATTR 1
+#else
+# define HAVE_XATTR 0
+#endif
+
+#if !HAVE_XATTR && HAVE_SELINUX
+# ifdef __has_include
+#  if __has_include(<selinux/selinux.h>)
+#   include <selinux/selinux.h>
+#  else
+#   undef HAVE_SELINUX
+#   define HAVE_SELINUX 0
+#  endif
+# else
+#  include <selinux/selinux.h>
+# endif
+#endif
+#include "context.h"
+#include "stats.h"
+
+typedef struct {
+    char *str;
+    size_t len;
+    uint32_t hash;
+} Context;
+
+static Context *contexts = NULL;
+static size_t context_count = 0, context_cap = 0;
+static int *slots = NULL;
+static size_t slot_mask = 0;
+
+/* Reusable "<dir>/<name>" buffer; only the name part changes per entry. */
+static char *pathbuf = NULL;
+static size_t path_cap = 0, prefix_len = 0;
+static char *valbuf = NULL;
+static size_t val_cap = 0;
+
+static uint32_t hash_bytes(const char *s, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static int reserve(char **buf, size_t *cap, size_t need) {
+    if (need <= *cap)
+        return 0;
+    size_t n = *cap ? *cap : 256;
+    while (n < need)
+        n *= 2;
+    char *tmp = realloc(*buf, n);
+    if (!tmp)
+        return -1;
+    *buf = tmp;
+    *cap = n;
+    return 0;
+}
+
+static int grow_slots(void) {
+    size_t size = slot_mask ? (slot_mask + 1) * 2 : 64;
+    int *tmp = malloc(size * sizeof(int));
+    if (!tmp)
+        return -1;
+    for (size_t i = 0; i < size; i++)
+        tmp[i] = -1;
+    for (size_t id = 1; id < context_count; id++) {
+        size_t pos = contexts[id].hash & (size - 1);
+        while (tmp[pos] != -1)
+            pos = (pos + 1) & (size - 1);
+        tmp[pos] = (int)id;
+    }
+    free(slots);
+    slots = tmp;
+    slot_mask = size - 1;
+    return 0;
+}
+
+static int add_context(const char *s, size_t len, uint32_t h) {
+    if (context_count == context_cap) {
+        size_t cap = context_cap ? context_cap * 2 : 16;
+        Context *tmp = realloc(contexts, cap * sizeof(Context));
+        if (!tmp)
+            return -1;
+        contexts = tmp;
+        context_cap = cap;
+    }
+    char *copy = malloc(len + 1);
+    if (!copy)
+        return -1;
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    contexts[context_count] = (Context){copy, len, h};
+    return (int)context_count++;
+}
+
+static int intern(const char *s, size_t len) {
+    if (context_count == 0 && add_context("-", 1, 0) == -1)
+        return 0;
+    if ((context_count + 1) * 2 > slot_mask + 1 && grow_slots() == -1)
+        return 0;
+    uint32_t h = hash_bytes(s, len);
+    size_t pos = h & slot_mask;
+    while (slots[pos] != -1) {
+        const Context *c = &contexts[slots[pos]];
+        if (c->hash == h && c->len == len && memcmp(c->str, s, len) == 0)
+            return slots[pos];
+        pos = (pos + 1) & slot_mask;
+    }
+    int id = add_context(s, len, h);
+    if (id == -1) {
+        perror("malloc");
+        return 0;
+    }
+    slots[pos] = id;
+    return id;
+}
+
+void context_set_dir(int dfd, const char *dir) {
+    prefix_len = 0;
+    char fdpath[32];
+    const char *prefix = dir;
+#if HAVE_XATTR
+    /* Resolve names through the open directory rather than its path. */
+    static int have_proc = -1;
+    if (have_proc == -1)
+        have_proc = access("/proc/self/fd", X_OK) == 0;
+    if (dfd >= 0 && have_proc) {
+        snprintf(fdpath, sizeof(fdpath), "/proc/self/fd/%d", dfd);
+        prefix = fdpath;
+    }
+#else
+    (void)dfd;
+    (void)fdpath;
+#endif
+    if (!prefix)
+        return;
+    size_t len = strlen(prefix);
+    if (reserve(&pathbuf, &path_cap, len + 2) == -1) {
+        perror("malloc");
+        return;
+    }
+    memcpy(pathbuf, prefix, len);
+    pathbuf[len++] = '/';
+    prefix_len = len;
+}
+
+int context_lookup(const char *name) {
+    size_t name_len = strlen(name);
+    if (reserve(&pathbuf, &path_cap, prefix_len + name_len + 1) == -1)
+        return 0;
+    memcpy(pathbuf + prefix_len, name, name_len + 1);
+#if HAVE_XATTR
+    if (reserve(&valbuf, &val_cap, 256) == -1)
+        return 0;
+    for (;;) {
+        ssize_t n = lgetxattr(pathbuf, "security.selinux", valbuf, val_cap);
+        STATS_CALL(STATS_GETFILECON, n < 0 && errno != ENODATA && errno != ENOTSUP);
+        if (n >= 0) {
+            size_t len = (size_t)n;
+            while (len > 0 && valbuf[len - 1] == '\0')
+                len--;
+            return len ? intern(valbuf, len) : 0;
+        }
+        if (errno != ERANGE)
+            return 0;
+        n = lgetxattr(pathbuf, "security.selinux", NULL, 0);
+        if (n < 0 || reserve(&valbuf, &val_cap, (size_t)n + 1) == -1)
+            return 0;
+    }
+#elif HAVE_SELINUX
+    char *ctx = NULL;
+    int rc = lgetfilecon(pathbuf, &ctx);
+    STATS_CALL(STATS_GETFILECON, rc < 0 && errno != ENODATA && errno != ENOTSUP);
+    if (rc < 0)
+        return 0;
+    int id = intern(ctx, strlen(ctx));
+    freecon(ctx);
+    return id;
+#else
+    return 0;
+#endif
+}
+
+const char *context_str(int id) {
+    if (id <= 0 || (size_t)id >= context_count)
+        return "-";
+    return contexts[id].str;
+}
+
+size_t context_width(int id) {
+    if (id <= 0 || (size_t)id >= context_count)
+        return 1;
+    return contexts[id].len;
+}
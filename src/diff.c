@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include "diff.h"
+#include "index.h"
+#include "json.h"
+#include "linkcache.h"
+#include "list.h"
+#include "vlsdir.h"
+#include "util.h"
+
+struct DiffPrinter {
+    const Args *args;
+    OutputFormat format;
+    /* Text: the changes held for the displayed directory DIR, printed
+     * together so that their columns line up. */
+    char *dir;
+    ListLine *lines;
+    size_t count, cap;
+};
+
+DiffPrinter *diff_printer_new(const Args *args, OutputFormat format) {
+    DiffPrinter *p = calloc(1, sizeof(DiffPrinter));
+    if (!p) {
+        perror("calloc");
+        return NULL;
+    }
+    p->args = args;
+    p->format = format;
+    return p;
+}
+
+void diff_printer_flush(DiffPrinter *p) {
+    list_lines(p->args, p->lines, p->count);
+    for (size_t i = 0; i < p->count; i++) {
+        free(p->lines[i].ent.name);
+        free((char *)p->lines[i].note);
+    }
+    p->count = 0;
+    free(p->dir);
+    p->dir = NULL;
+}
+
+void diff_printer_free(DiffPrinter *p) {
+    if (!p)
+        return;
+    diff_printer_flush(p);
+    free(p->lines);
+    free(p);
+}
+
+/* " (size, mtime)": which fields of a modified entry changed. */
+static char *change_note(const char *const *fields, size_t nfields) {
+    if (!nfields)
+        return NULL;
+    size_t len = 4;
+    for (size_t i = 0; i < nfields; i++)
+        len += strlen(fields[i]) + 2;
+    char *note = malloc(len);
+    if (!note)
+        return NULL;
+    strcpy(note, " (");
+    for (size_t i = 0; i < nfields; i++) {
+        if (i)
+            strcat(note, ", ");
+        strcat(note, fields[i]);
+    }
+    strcat(note, ")");
+    return note;
+}
+
+static int hold_line(DiffPrinter *p, IndexChange change, int dfd, const char *dir, const char *name,
+                     const struct stat *st, const char *const *fields, size_t nfields) {
+    if (p->dir && strcmp(p->dir, dir) != 0)
+        diff_printer_flush(p);
+    if (!p->dir && !(p->dir = strdup(dir)))
+        return -1;
+    if (p->count == p->cap) {
+        size_t cap = p->cap ? p->cap * 2 : 16;
+        ListLine *tmp = realloc(p->lines, cap * sizeof(ListLine));
+        if (!tmp)
+            return -1;
+        p->lines = tmp;
+        p->cap = cap;
+    }
+    ListLine *line = &p->lines[p->count];
+    memset(line, 0, sizeof(*line));
+    if (!(line->ent.name = join_path(dir, name)))
+        return -1;
+    line->ent.st = *st;
+    /* Removed entries are only known from the snapshot, if at all. */
+    line->dfd = dfd == -1 || dfd == LINK_GONE ? dfd : AT_FDCWD;
+    line->mark = change == INDEX_ADDED ? "+ " : change == INDEX_REMOVED ? "- " : "M ";
+    line->note = change_note(fields, nfields);
+    if (nfields && !line->note) {
+        free(line->ent.name);
+        return -1;
+    }
+    p->count++;
+    return 0;
+}
+
+void diff_printer_add(DiffPrinter *p, IndexChange change, int dfd, const char *dir, const char *name,
+                      const struct stat *old, const struct stat *cur) {
+    const char *fields[5];
+    size_t nfields = 0;
+    if (change == INDEX_MODIFIED) {
+        if (old->st_size != cur->st_size)
+            fields[nfields++] = "size";
+        if (old->ST_MTIM.tv_sec != cur->ST_MTIM.tv_sec || old->ST_MTIM.tv_nsec != cur->ST_MTIM.tv_nsec)
+            fields[nfields++] = "mtime";
+        if (old->st_mode != cur->st_mode)
+            fields[nfields++] = "mode";
+        if (old->st_uid != cur->st_uid)
+            fields[nfields++] = "owner";
+        if (old->st_gid != cur->st_gid)
+            fields[nfields++] = "group";
+    }
+
+    if (p->format != FORMAT_TEXT) {
+        const char *word = change == INDEX_ADDED ? "added" : change == INDEX_REMOVED ? "removed" : "modified";
+        json_change(p->format, dfd, dir, name, cur ? cur : old, p->args->numeric_ids, word, fields, nfields);
+        return;
+    }
+    if (hold_line(p, change, dfd, dir, name, cur ? cur : old, fields, nfields) == -1)
+        perror("malloc");
+}
+
+typedef struct {
+    const char *root;
+    DiffPrinter *printer;
+    char *dirbuf;
+    size_t dir_cap;
+} DiffOutput;
+
+static const char *display_dir(DiffOutput *out, const char *dir) {
+    if (!dir[0])
+        return out->root;
+    size_t rlen = strlen(out->root), dlen = strlen(dir);
+    size_t need = rlen + dlen + 2;
+    if (need > out->dir_cap) {
+        char *tmp = realloc(out->dirbuf, need);
+        if (!tmp)
+            return NULL;
+        out->dirbuf = tmp;
+        out->dir_cap = need;
+    }
+    memcpy(out->dirbuf, out->root, rlen);
+    size_t o = rlen;
+    if (o && out->dirbuf[o - 1] != '/')
+        out->dirbuf[o++] = '/';
+    memcpy(out->dirbuf + o, dir, dlen + 1);
+    return out->dirbuf;
+}
+
+static int skipped(const Args *a, const char *name) {
+    return skip_name(name, a->show_hidden, a->almost_all, a->ignore_backups, a->ignore_patterns,
+                     a->ignore_count, a->hide_patterns, a->hide_count);
+}
+
+/* Whether the name filters hide NAME, or one of the directories of DIR
+ * (relative to the root) above it, as a listing would. */
+static int hidden(const Args *a, const char *dir, const char *name) {
+    if (skipped(a, name))
+        return 1;
+    if (!dir[0])
+        return 0;
+    char *copy = strdup(dir);
+    if (!copy)
+        return 0;
+    int hide = 0;
+    for (char *part = copy, *slash; !hide && part; part = slash ? slash + 1 : NULL) {
+        if ((slash = strchr(part, '/')))
+            *slash = '\0';
+        hide = skipped(a, part);
+    }
+    free(copy);
+    return hide;
+}
+
+static void report(void *ctx, IndexChange change, int dfd, const char *dir, const char *name,
+                   const struct stat *old, const struct stat *cur) {
+    DiffOutput *out = ctx;
+    if (hidden(out->printer->args, dir, name))
+        return;
+    const char *shown = display_dir(out, dir);
+    if (!shown) {
+        perror("malloc");
+        return;
+    }
+    diff_printer_add(out->printer, change, dfd, shown, name, old, cur);
+}
+
+int diff_tree(const char *file, const char *root, const Args *args) {
+    DiffOutput out = {root, diff_printer_new(args, args->format), NULL, 0};
+    if (!out.printer)
+        return -1;
+    if (args->format != FORMAT_TEXT)
+        json_begin(args->format);
+    int rc = index_diff(file, root, report, &out);
+    diff_printer_free(out.printer);
+    if (args->format != FORMAT_TEXT)
+        json_end(args->format);
+    free(out.dirbuf);
+    return rc;
+}
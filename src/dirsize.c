@@ -0,0 +1,266 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "dirsize.h"
+#include "trace.h"
+
+#define DIRSIZE_MAX_THREADS 8
+
+typedef struct {
+    uint64_t bytes;    /* apparent size */
+    uint64_t blocks;   /* 512-byte blocks */
+} Total;
+
+typedef struct {
+    uint64_t dev;
+    uint64_t ino;
+    Total total;
+    int used;
+} Slot;
+
+/* Open-addressing (dev, ino) table; used both as the hard link set and as
+ * the per-directory memo. */
+typedef struct {
+    Slot *slots;
+    size_t cap, count;
+    pthread_mutex_t lock;
+} InodeTable;
+
+static DirSizeMode mode = DIRSIZE_NONE;
+static int one_fs = 0;
+static InodeTable links = {NULL, 0, 0, PTHREAD_MUTEX_INITIALIZER};
+static InodeTable memo = {NULL, 0, 0, PTHREAD_MUTEX_INITIALIZER};
+
+void dirsize_init(DirSizeMode m, int one_file_system) {
+    mode = m;
+    one_fs = one_file_system;
+}
+
+int dirsize_enabled(void) {
+    return mode != DIRSIZE_NONE;
+}
+
+static size_t slot_of(const InodeTable *t, uint64_t dev, uint64_t ino) {
+    uint64_t h = (ino ^ (dev << 32) ^ (dev >> 32)) * 0x9e3779b97f4a7c15ULL;
+    size_t i = (size_t)(h >> 17) & (t->cap - 1);
+    while (t->slots[i].used && (t->slots[i].dev != dev || t->slots[i].ino != ino))
+        i = (i + 1) & (t->cap - 1);
+    return i;
+}
+
+static int table_grow(InodeTable *t) {
+    size_t cap = t->cap ? t->cap * 2 : 1024;
+    Slot *old = t->slots;
+    size_t old_cap = t->cap;
+    t->slots = calloc(cap, sizeof(Slot));
+    if (!t->slots) {
+        t->slots = old;
+        return -1;
+    }
+    t->cap = cap;
+    for (size_t i = 0; i < old_cap; i++)
+        if (old[i].used)
+            t->slots[slot_of(t, old[i].dev, old[i].ino)] = old[i];
+    free(old);
+    return 0;
+}
+
+/* Insert (DEV, INO) with TOTAL.  Returns 1 when it was already present
+ * (and fills *FOUND if given), 0 when inserted, -1 on allocation failure.
+ * The caller holds the table's lock. */
+static int table_put(InodeTable *t, uint64_t dev, uint64_t ino, const Total *total, Total *found) {
+    if ((t->count + 1) * 2 > t->cap && table_grow(t) == -1)
+        return -1;
+    size_t i = slot_of(t, dev, ino);
+    if (t->slots[i].used) {
+        if (found)
+            *found = t->slots[i].total;
+        return 1;
+    }
+    t->slots[i].used = 1;
+    t->slots[i].dev = dev;
+    t->slots[i].ino = ino;
+    if (total)
+        t->slots[i].total = *total;
+    t->count++;
+    return 0;
+}
+
+static int memo_get(const struct stat *st, Total *out) {
+    int hit = 0;
+    pthread_mutex_lock(&memo.lock);
+    if (memo.cap) {
+        size_t i = slot_of(&memo, (uint64_t)st->st_dev, (uint64_t)st->st_ino);
+        if (memo.slots[i].used) {
+            *out = memo.slots[i].total;
+            hit = 1;
+        }
+    }
+    pthread_mutex_unlock(&memo.lock);
+    return hit;
+}
+
+static void memo_put(const struct stat *st, const Total *total) {
+    pthread_mutex_lock(&memo.lock);
+    table_put(&memo, (uint64_t)st->st_dev, (uint64_t)st->st_ino, total, NULL);
+    pthread_mutex_unlock(&memo.lock);
+}
+
+/* Nonzero when ST is a hard link whose inode was already counted. */
+static int seen_link(const struct stat *st) {
+    if (st->st_nlink < 2)
+        return 0;
+    pthread_mutex_lock(&links.lock);
+    int rc = table_put(&links, (uint64_t)st->st_dev, (uint64_t)st->st_ino, NULL, NULL);
+    pthread_mutex_unlock(&links.lock);
+    return rc == 1;
+}
+
+/* Sum the directory NAME (opened relative to PARENT, described by ST)
+ * bottom-up, memoizing the total of every directory visited. */
+static void subtree(int parent, const char *name, const struct stat *st, dev_t root_dev, Total *out) {
+    if (memo_get(st, out))
+        return;
+    Total sum = {(uint64_t)st->st_size, (uint64_t)st->st_blocks};
+    int fd = openat(parent, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+    DIR *dir = fd == -1 ? NULL : fdopendir(fd);
+    if (!dir) {
+        if (fd != -1)
+            close(fd);
+        *out = sum;
+        return;
+    }
+    struct dirent *de;
+    while ((de = readdir(dir)) != NULL) {
+        if (de->d_name[0] == '.' && (de->d_name[1] == '\0' || (de->d_name[1] == '.' && de->d_name[2] == '\0')))
+            continue;
+        struct stat cst;
+        if (fstatat(fd, de->d_name, &cst, AT_SYMLINK_NOFOLLOW) == -1)
+            continue;
+        if (S_ISDIR(cst.st_mode)) {
+            if (one_fs && cst.st_dev != root_dev)
+                continue;
+            Total child;
+            subtree(fd, de->d_name, &cst, root_dev, &child);
+            sum.bytes += child.bytes;
+            sum.blocks += child.blocks;
+        } else if (!seen_link(&cst)) {
+            sum.bytes += (uint64_t)cst.st_size;
+            sum.blocks += (uint64_t)cst.st_blocks;
+        }
+    }
+    closedir(dir);
+    memo_put(st, &sum);
+    *out = sum;
+}
+
+typedef struct {
+    const char *path;
+    Entry **todo;
+    size_t todo_count;
+    size_t next;
+    dev_t root_dev;
+    pthread_t owner;
+    pthread_mutex_t lock;
+} Job;
+
+static void store(struct stat *st, const Total *t) {
+    if (mode == DIRSIZE_APPARENT)
+        st->st_size = (off_t)t->bytes;
+    else
+        st->st_size = (off_t)(t->blocks * 512);
+    st->st_blocks = (blkcnt_t)t->blocks;
+}
+
+static void *worker(void *arg) {
+    Job *job = arg;
+    int dfd = open(job->path, O_RDONLY | O_DIRECTORY);
+    if (dfd == -1)
+        return NULL;
+    if (trace_on && !pthread_equal(pthread_self(), job->owner))
+        trace_thread_name("dirsize worker");
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        size_t k = job->next++;
+        pthread_mutex_unlock(&job->lock);
+        if (k >= job->todo_count)
+            break;
+        Entry *ent = job->todo[k];
+        Total t;
+        uint64_t start = 0;
+        TRACE_NOW(start);
+        subtree(dfd, ent->name, &ent->st, job->root_dev, &t);
+        TRACE_SPAN("dirsize", job->path, ent->name, start);
+        store(&ent->st, &t);
+    }
+    close(dfd);
+    return NULL;
+}
+
+static int cmp_name(const void *a, const void *b) {
+    return strcmp((*(Entry *const *)a)->name, (*(Entry *const *)b)->name);
+}
+
+void dirsize_apply(const char *path, Entry *entries, size_t count) {
+    struct stat root;
+    if (mode == DIRSIZE_NONE || stat(path, &root) == -1)
+        return;
+    Entry **todo = malloc((count ? count : 1) * sizeof(Entry *));
+    if (!todo) {
+        perror("malloc");
+        return;
+    }
+    size_t todo_count = 0;
+    ssize_t self = -1;
+    for (size_t i = 0; i < count; i++) {
+        if (!S_ISDIR(entries[i].st.st_mode) || strcmp(entries[i].name, "..") == 0)
+            continue;
+        if (strcmp(entries[i].name, ".") == 0)
+            self = (ssize_t)i;
+        else if (!one_fs || entries[i].st.st_dev == root.st_dev)
+            todo[todo_count++] = &entries[i];
+    }
+    /* Hand out work in name order so a single thread charges shared hard
+     * links the same way on every run. */
+    qsort(todo, todo_count, sizeof(Entry *), cmp_name);
+
+    Job job = {path, todo, todo_count, 0, root.st_dev, pthread_self(), PTHREAD_MUTEX_INITIALIZER};
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t threads = cpus > 1 ? (size_t)cpus : 1;
+    if (threads > DIRSIZE_MAX_THREADS)
+        threads = DIRSIZE_MAX_THREADS;
+    if (threads > todo_count)
+        threads = todo_count;
+    pthread_t tids[DIRSIZE_MAX_THREADS];
+    size_t started = 0;
+    for (size_t i = 1; i < threads; i++)
+        if (pthread_create(&tids[started], NULL, worker, &job) == 0)
+            started++;
+    worker(&job);
+    for (size_t i = 0; i < started; i++)
+        pthread_join(tids[i], NULL);
+
+    /* "." sums what the workers memoized. */
+    if (self >= 0)
+        dirsize_path(path, &entries[self].st);
+    free(todo);
+}
+
+void dirsize_path(const char *path, struct stat *st) {
+    if (mode == DIRSIZE_NONE || !S_ISDIR(st->st_mode))
+        return;
+    int dfd = open(path, O_RDONLY | O_DIRECTORY);
+    if (dfd == -1)
+        return;
+    Total t;
+    subtree(dfd, ".", st, st->st_dev, &t);
+    store(st, &t);
+    close(dfd);
+}
@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pwd.h>
+#include <grp.h>
+#include "idcache.h"
+#include "stats.h"
+
+typedef struct {
+    unsigned long id;
+    char *name;
+    int used;
+} IdSlot;
+
+typedef struct {
+    IdSlot *slots;
+    size_t mask;
+    size_t count;
+} IdTable;
+
+static IdTable users, groups;
+static char *nss_buf = NULL;
+static size_t nss_bufsz = 0;
+
+static int table_grow(IdTable *t) {
+    size_t size = t->slots ? (t->mask + 1) * 2 : 64;
+    IdSlot *slots = calloc(size, sizeof(IdSlot));
+    if (!slots)
+        return -1;
+    for (size_t i = 0; t->slots && i <= t->mask; i++) {
+        if (!t->slots[i].used)
+            continue;
+        size_t pos = (t->slots[i].id * 2654435761u) & (size - 1);
+        while (slots[pos].used)
+            pos = (pos + 1) & (size - 1);
+        slots[pos] = t->slots[i];
+    }
+    free(t->slots);
+    t->slots = slots;
+    t->mask = size - 1;
+    return 0;
+}
+
+static IdSlot *table_find(IdTable *t, unsigned long id, int *found) {
+    if ((!t->slots || (t->count + 1) * 2 > t->mask + 1) && table_grow(t) == -1)
+        return NULL;
+    size_t pos = (id * 2654435761u) & t->mask;
+    while (t->slots[pos].used) {
+        if (t->slots[pos].id == id) {
+            *found = 1;
+            return &t->slots[pos];
+        }
+        pos = (pos + 1) & t->mask;
+    }
+    *found = 0;
+    return &t->slots[pos];
+}
+
+static int grow_buf(void) {
+    size_t sz = nss_bufsz;
+    if (!sz) {
+        long pw = sysconf(_SC_GETPW_R_SIZE_MAX);
+        long gr = sysconf(_SC_GETGR_R_SIZE_MAX);
+        long max = pw > gr ? pw : gr;
+        sz = max > 0 ? (size_t)max : 16384;
+    } else {
+        sz *= 2;
+    }
+    char *tmp = realloc(nss_buf, sz);
+    if (!tmp) {
+        perror("realloc");
+        return -1;
+    }
+    nss_buf = tmp;
+    nss_bufsz = sz;
+    return 0;
+}
+
+const char *idcache_user(uid_t uid) {
+    int found;
+    IdSlot *slot = table_find(&users, (unsigned long)uid, &found);
+    if (!slot)
+        return NULL;
+    if (found)
+        return slot->name;
+    char *name = NULL;
+    for (;;) {
+        if (!nss_buf && grow_buf() == -1)
+            return NULL;
+        struct passwd pw;
+        struct passwd *res = NULL;
+        int rc = getpwuid_r(uid, &pw, nss_buf, nss_bufsz, &res);
+        STATS_CALL(STATS_GETPWUID, rc != 0);
+        if (rc == ERANGE && grow_buf() == 0)
+            continue;
+        if (rc == 0 && res)
+            name = strdup(res->pw_name);
+        break;
+    }
+    slot->id = (unsigned long)uid;
+    slot->name = name;
+    slot->used = 1;
+    users.count++;
+    return name;
+}
+
+const char *idcache_group(gid_t gid) {
+    int found;
+    IdSlot *slot = table_find(&groups, (unsigned long)gid, &found);
+    if (!slot)
+        return NULL;
+    if (found)
+        return slot->name;
+    char *name = NULL;
+    for (;;) {
+        if (!nss_buf && grow_buf() == -1)
+            return NULL;
+        struct group gr;
+        struct group *res = NULL;
+        int rc = getgrgid_r(gid, &gr, nss_buf, nss_bufsz, &res);
+        STATS_CALL(STATS_GETGRGID, rc != 0);
+        if (rc == ERANGE && grow_buf() == 0)
+            continue;
+        if (rc == 0 && res)
+            name = strdup(res->gr_name);
+        break;
+    }
+    slot->id = (unsigned long)gid;
+    slot->name = name;
+    slot->used = 1;
+    groups.count++;
+    return name;
+}
+
+static void preload(IdTable *t, unsigned long id, const char *name) {
+    int found;
+    IdSlot *slot = table_find(t, id, &found);
+    if (!slot || found)
+        return;
+    slot->id = id;
+    slot->name = strdup(name);
+    slot->used = 1;
+    t->count++;
+}
+
+void idcache_preload(size_t limit) {
+    struct passwd *pw;
+    size_t n = 0;
+    setpwent();
+    while (n++ < limit && (pw = getpwent()) != NULL)
+        preload(&users, (unsigned long)pw->pw_uid, pw->pw_name);
+    endpwent();
+    struct group *gr;
+    n = 0;
+    setgrent();
+    while (n++ < limit && (gr = getgrent()) != NULL)
+        preload(&groups, (unsigned long)gr->gr_gid, gr->gr_name);
+    endgrent();
+}
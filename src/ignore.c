@@ -0,0 +1,321 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <locale.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "ignore.h"
+#include "util.h"
+
+typedef struct {
+    const char *pattern;
+    unsigned negate : 1;
+    unsigned dir_only : 1;
+    unsigned anchored : 1;
+} Rule;
+
+/* The rules read in one directory, whose path is PATH_LEN bytes long. */
+typedef struct {
+    size_t path_len;
+    char *text;
+    Rule *rules;
+    size_t count;
+    int anchored;
+} Frame;
+
+static const char **file_names = NULL;
+static size_t file_count = 0;
+static Frame *frames = NULL;
+static size_t depth = 0, frame_cap = 0;
+/* Frames that hold rules; with none there is nothing to match. */
+static size_t active_frames = 0;
+
+/* Reusable "<dir>/<name>" buffer for anchored rules. */
+static char *pathbuf = NULL;
+static size_t path_cap = 0;
+
+void ignore_init(const char **names, size_t count) {
+    file_names = names;
+    file_count = count;
+}
+
+int ignore_active(void) {
+    return file_count > 0;
+}
+
+static int match_class(const char *name, size_t len, unsigned char c) {
+    static const struct { const char *name; int (*fn)(int); } classes[] = {
+        {"alnum", isalnum}, {"alpha", isalpha}, {"blank", isblank}, {"cntrl", iscntrl},
+        {"digit", isdigit}, {"graph", isgraph}, {"lower", islower}, {"print", isprint},
+        {"punct", ispunct}, {"space", isspace}, {"upper", isupper}, {"xdigit", isxdigit}
+    };
+    if (c >= 0x80)
+        locale_need(LC_CTYPE);
+    for (size_t i = 0; i < sizeof(classes) / sizeof(classes[0]); i++)
+        if (strlen(classes[i].name) == len && strncmp(classes[i].name, name, len) == 0)
+            return classes[i].fn(c) != 0;
+    return 0;
+}
+
+/* Match a bracket expression at P against C; returns the position after
+ * the closing ']' or NULL when C is not matched.  *UNCLOSED is set when
+ * there is no ']', in which case '[' stands for itself. */
+static const char *match_bracket(const char *p, unsigned char c, int *unclosed) {
+    const char *q = p + 1;
+    int negate = 0, hit = 0;
+    *unclosed = 0;
+    if (*q == '!' || *q == '^') {
+        negate = 1;
+        q++;
+    }
+    const char *first = q;
+    while (*q && (*q != ']' || q == first)) {
+        if (q[0] == '[' && q[1] == ':') {
+            const char *end = strstr(q + 2, ":]");
+            if (end) {
+                if (match_class(q + 2, (size_t)(end - q - 2), c))
+                    hit = 1;
+                q = end + 2;
+                continue;
+            }
+        }
+        unsigned char lo = (unsigned char)*q;
+        if (*q == '\\' && q[1])
+            lo = (unsigned char)*++q;
+        q++;
+        unsigned char hi = lo;
+        if (q[0] == '-' && q[1] && q[1] != ']') {
+            q++;
+            if (*q == '\\' && q[1])
+                q++;
+            hi = (unsigned char)*q++;
+        }
+        if (lo <= c && c <= hi)
+            hit = 1;
+    }
+    if (!*q) {
+        *unclosed = 1;
+        return NULL;
+    }
+    return hit != negate ? q + 1 : NULL;
+}
+
+/* gitignore globs: '*' and '?' stop at '/', "**" between slashes (or at
+ * either end) spans any number of directories. */
+static int wildmatch(const char *start, const char *p, const char *s) {
+    while (*p) {
+        switch (*p) {
+        case '\\':
+            if (!p[1] || *s != p[1])
+                return 0;
+            p += 2;
+            s++;
+            continue;
+        case '?':
+            if (!*s || *s == '/')
+                return 0;
+            p++;
+            s++;
+            continue;
+        case '[': {
+            int unclosed;
+            const char *next = (*s && *s != '/') ? match_bracket(p, (unsigned char)*s, &unclosed) : NULL;
+            if (!next) {
+                if (!*s || *s == '/')
+                    match_bracket(p, 0, &unclosed);
+                if (!unclosed || *s != '[')
+                    return 0;
+                next = p + 1;
+            }
+            p = next;
+            s++;
+            continue;
+        }
+        case '*':
+            if (p[1] == '*' && (p == start || p[-1] == '/') && (p[2] == '/' || !p[2])) {
+                if (!p[2])
+                    return 1;
+                for (const char *t = s;; t++) {
+                    if (wildmatch(start, p + 3, t))
+                        return 1;
+                    t = strchr(t, '/');
+                    if (!t)
+                        return 0;
+                }
+            }
+            while (*p == '*')
+                p++;
+            for (;; s++) {
+                if (wildmatch(start, p, s))
+                    return 1;
+                if (!*s || *s == '/')
+                    return 0;
+            }
+        default:
+            if (*s != *p)
+                return 0;
+            p++;
+            s++;
+        }
+    }
+    return *s == '\0';
+}
+
+/* Split TEXT into rules, editing it in place. */
+static int parse_rules(Frame *f, char *text) {
+    for (char *line = text; line && *line;) {
+        char *next = strchr(line, '\n');
+        if (next)
+            *next++ = '\0';
+        size_t len = strlen(line);
+        if (len && line[len - 1] == '\r')
+            line[--len] = '\0';
+        while (len && line[len - 1] == ' ' && !(len > 1 && line[len - 2] == '\\'))
+            line[--len] = '\0';
+        if (len == 0 || *line == '#') {
+            line = next;
+            continue;
+        }
+        Rule r = {line, 0, 0, 0};
+        if (*line == '!') {
+            r.negate = 1;
+            r.pattern = ++line;
+            len--;
+        }
+        if (len && line[len - 1] == '/') {
+            r.dir_only = 1;
+            line[--len] = '\0';
+        }
+        if (len == 0) {
+            line = next;
+            continue;
+        }
+        if (strchr(line, '/')) {
+            r.anchored = 1;
+            if (*line == '/')
+                r.pattern = line + 1;
+            f->anchored = 1;
+        }
+        Rule *tmp = realloc(f->rules, (f->count + 1) * sizeof(Rule));
+        if (!tmp) {
+            perror("realloc");
+            return -1;
+        }
+        f->rules = tmp;
+        f->rules[f->count++] = r;
+        line = next;
+    }
+    return 0;
+}
+
+/* Append the contents of NAME in the directory to *TEXT. */
+static int read_file(const char *path, int dfd, const char *name, char **text, size_t *len) {
+    int fd;
+    if (dfd >= 0) {
+        fd = openat(dfd, name, O_RDONLY);
+    } else {
+        char *full = join_path(path, name);
+        if (!full)
+            return -1;
+        fd = open(full, O_RDONLY);
+        free(full);
+    }
+    if (fd == -1)
+        return errno == ENOENT || errno == ENOTDIR ? 0 : -1;
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return 0;
+    }
+    char *buf = realloc(*text, *len + (size_t)st.st_size + 2);
+    if (!buf) {
+        close(fd);
+        return -1;
+    }
+    *text = buf;
+    size_t got = 0;
+    ssize_t n;
+    while (got < (size_t)st.st_size && (n = read(fd, buf + *len + got, (size_t)st.st_size - got)) > 0)
+        got += (size_t)n;
+    close(fd);
+    *len += got;
+    buf[(*len)++] = '\n';
+    buf[*len] = '\0';
+    return 0;
+}
+
+int ignore_push(const char *path, int dfd) {
+    if (depth == frame_cap) {
+        size_t cap = frame_cap ? frame_cap * 2 : 16;
+        Frame *tmp = realloc(frames, cap * sizeof(Frame));
+        if (!tmp) {
+            perror("realloc");
+            return -1;
+        }
+        frames = tmp;
+        frame_cap = cap;
+    }
+    Frame *f = &frames[depth++];
+    memset(f, 0, sizeof(*f));
+    f->path_len = strlen(path);
+
+    size_t len = 0;
+    for (size_t i = 0; i < file_count; i++)
+        if (read_file(path, dfd, file_names[i], &f->text, &len) == -1)
+            fprintf(stderr, "ignore: %s/%s: %s\n", path, file_names[i], strerror(errno));
+    if (f->text && parse_rules(f, f->text) == -1)
+        f->count = 0;
+    if (f->count)
+        active_frames++;
+    return 0;
+}
+
+void ignore_pop(void) {
+    if (depth == 0)
+        return;
+    Frame *f = &frames[--depth];
+    if (f->count)
+        active_frames--;
+    free(f->rules);
+    free(f->text);
+}
+
+int ignore_excluded(const char *path, const char *name, int is_dir) {
+    if (!active_frames)
+        return 0;
+    const char *full = NULL;
+    for (size_t d = depth; d-- > 0;) {
+        const Frame *f = &frames[d];
+        if (!f->count)
+            continue;
+        const char *rel = name;
+        if (f->anchored && !full) {
+            size_t plen = strlen(path), nlen = strlen(name);
+            if (plen + nlen + 2 > path_cap) {
+                char *tmp = realloc(pathbuf, plen + nlen + 2);
+                if (!tmp)
+                    return 0;
+                pathbuf = tmp;
+                path_cap = plen + nlen + 2;
+            }
+            memcpy(pathbuf, path, plen);
+            pathbuf[plen] = '/';
+            memcpy(pathbuf + plen + 1, name, nlen + 1);
+            full = pathbuf;
+        }
+        if (f->anchored)
+            rel = full + f->path_len + 1;
+        for (size_t i = f->count; i-- > 0;) {
+            const Rule *r = &f->rules[i];
+            if (r->dir_only && !is_dir)
+                continue;
+            const char *subject = r->anchored ? rel : name;
+            if (wildmatch(r->pattern, r->pattern, subject))
+                return !r->negate;
+        }
+    }
+    return 0;
+}
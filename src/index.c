@@ -0,0 +1,761 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include "index.h"
+#include "linkcache.h"
+#include "util.h"
+
+#define INDEX_MAGIC "VLSINDEX"
+#define INDEX_VERSION 2
+/* Records store key lengths in 16 bits. */
+#define KEY_MAX UINT16_MAX
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t root_len;
+    uint32_t real_len;
+    uint32_t reserved;
+    int64_t created;
+    uint64_t count;
+    uint64_t restarts_off;
+    uint64_t restart_count;
+} IndexHeader;
+
+typedef struct {
+    uint64_t ino;
+    uint64_t dev;
+    uint64_t rdev;
+    uint64_t nlink;
+    int64_t size;
+    int64_t blocks;
+    int64_t atime_s;
+    int64_t mtime_s;
+    int64_t ctime_s;
+    uint32_t atime_ns;
+    uint32_t mtime_ns;
+    uint32_t ctime_ns;
+    uint32_t mode;
+    uint32_t uid;
+    uint32_t gid;
+    uint32_t blksize;
+} IndexStat;
+
+static void pack_stat(IndexStat *r, const struct stat *st) {
+    memset(r, 0, sizeof(*r));
+    r->ino = (uint64_t)st->st_ino;
+    r->dev = (uint64_t)st->st_dev;
+    r->rdev = (uint64_t)st->st_rdev;
+    r->nlink = (uint64_t)st->st_nlink;
+    r->size = (int64_t)st->st_size;
+    r->blocks = (int64_t)st->st_blocks;
+    r->atime_s = (int64_t)st->ST_ATIM.tv_sec;
+    r->mtime_s = (int64_t)st->ST_MTIM.tv_sec;
+    r->ctime_s = (int64_t)st->ST_CTIM.tv_sec;
+    r->atime_ns = (uint32_t)st->ST_ATIM.tv_nsec;
+    r->mtime_ns = (uint32_t)st->ST_MTIM.tv_nsec;
+    r->ctime_ns = (uint32_t)st->ST_CTIM.tv_nsec;
+    r->mode = (uint32_t)st->st_mode;
+    r->uid = (uint32_t)st->st_uid;
+    r->gid = (uint32_t)st->st_gid;
+    r->blksize = (uint32_t)st->st_blksize;
+}
+
+static void unpack_stat(const IndexStat *r, struct stat *st) {
+    memset(st, 0, sizeof(*st));
+    st->st_ino = (ino_t)r->ino;
+    st->st_dev = (dev_t)r->dev;
+    st->st_rdev = (dev_t)r->rdev;
+    st->st_nlink = (nlink_t)r->nlink;
+    st->st_size = (off_t)r->size;
+    st->st_blocks = (blkcnt_t)r->blocks;
+    st->st_blksize = (blksize_t)r->blksize;
+    st->st_mode = (mode_t)r->mode;
+    st->st_uid = (uid_t)r->uid;
+    st->st_gid = (gid_t)r->gid;
+    st->ST_ATIM.tv_sec = (time_t)r->atime_s;
+    st->ST_ATIM.tv_nsec = (long)r->atime_ns;
+    st->ST_MTIM.tv_sec = (time_t)r->mtime_s;
+    st->ST_MTIM.tv_nsec = (long)r->mtime_ns;
+    st->ST_CTIM.tv_sec = (time_t)r->ctime_s;
+    st->ST_CTIM.tv_nsec = (long)r->ctime_ns;
+}
+
+/* Directory paths compare with '/' below every other byte. */
+static int dir_cmp(const char *a, size_t alen, const char *b, size_t blen) {
+    size_t n = alen < blen ? alen : blen;
+    for (size_t i = 0; i < n; i++) {
+        unsigned ca = a[i] == '/' ? 0 : (unsigned)(unsigned char)a[i] + 1;
+        unsigned cb = b[i] == '/' ? 0 : (unsigned)(unsigned char)b[i] + 1;
+        if (ca != cb)
+            return ca < cb ? -1 : 1;
+    }
+    return alen < blen ? -1 : alen > blen;
+}
+
+/* Keys are "dir\0name"; compare by directory first, then by name bytes. */
+static int key_cmp(const char *a, size_t alen, const char *b, size_t blen) {
+    size_t adir = strlen(a), bdir = strlen(b);
+    int c = dir_cmp(a, adir, b, bdir);
+    if (c)
+        return c;
+    const char *an = a + adir + 1, *bn = b + bdir + 1;
+    size_t anl = alen - adir - 1, bnl = blen - bdir - 1;
+    size_t n = anl < bnl ? anl : bnl;
+    c = memcmp(an, bn, n);
+    if (c)
+        return c < 0 ? -1 : 1;
+    return anl < bnl ? -1 : anl > bnl;
+}
+
+/* A key buffer that grows to fit. */
+typedef struct {
+    char *s;
+    size_t len, cap;
+} Key;
+
+/* Make room for LEN bytes and a NUL in K. */
+static int key_reserve(Key *k, size_t len) {
+    if (len < k->cap)
+        return 0;
+    size_t cap = k->cap ? k->cap : 256;
+    while (cap <= len)
+        cap *= 2;
+    char *tmp = realloc(k->s, cap);
+    if (!tmp)
+        return -1;
+    k->s = tmp;
+    k->cap = cap;
+    return 0;
+}
+
+/* Set K to the key "DIR\0NAME". */
+static int key_set(Key *k, const char *dir, const char *name) {
+    size_t dlen = strlen(dir), nlen = strlen(name);
+    if (key_reserve(k, dlen + 1 + nlen) == -1)
+        return -1;
+    memcpy(k->s, dir, dlen);
+    k->s[dlen] = '\0';
+    memcpy(k->s + dlen + 1, name, nlen);
+    k->len = dlen + 1 + nlen;
+    k->s[k->len] = '\0';
+    return 0;
+}
+
+/* An entry whose key the record format cannot hold. */
+static void report_long(const char *what, const char *root, const char *dir, const char *name) {
+    fprintf(stderr, "%s: %s/%s%s%s: path longer than %u bytes\n", what, root, dir, dir[0] ? "/" : "", name,
+            (unsigned)KEY_MAX);
+}
+
+/* ---- building ---- */
+
+typedef struct {
+    FILE *f;
+    uint64_t count;
+    uint64_t pos;
+    uint64_t *restarts;
+    size_t restart_count, restart_cap;
+    Key prev, key;
+    const char *root;
+    uint64_t skipped;
+    int err;
+} Builder;
+
+typedef struct {
+    char *name;
+    struct stat st;
+} BuildEntry;
+
+static void put(Builder *b, const void *p, size_t n) {
+    if (!b->err && fwrite(p, 1, n, b->f) != n)
+        b->err = 1;
+    b->pos += n;
+}
+
+static int add_record(void *ctx, int dfd, const char *dir, const char *name, const struct stat *st) {
+    Builder *b = ctx;
+    if (key_set(&b->key, dir, name) == -1) {
+        perror("malloc");
+        b->err = 1;
+        return -1;
+    }
+    if (b->key.len > KEY_MAX) {
+        report_long("build-index", b->root, dir, name);
+        b->skipped++;
+        return 0;
+    }
+    const char *key = b->key.s;
+    size_t klen = b->key.len;
+
+    size_t shared = 0;
+    if (b->count % INDEX_RESTART == 0) {
+        if (b->restart_count == b->restart_cap) {
+            size_t cap = b->restart_cap ? b->restart_cap * 2 : 256;
+            uint64_t *tmp = realloc(b->restarts, cap * sizeof(uint64_t));
+            if (!tmp) {
+                b->err = 1;
+                return -1;
+            }
+            b->restarts = tmp;
+            b->restart_cap = cap;
+        }
+        b->restarts[b->restart_count++] = b->pos;
+    } else {
+        while (shared < klen && shared < b->prev.len && key[shared] == b->prev.s[shared])
+            shared++;
+    }
+    uint16_t hdr[2] = {(uint16_t)shared, (uint16_t)(klen - shared)};
+    put(b, hdr, sizeof(hdr));
+    put(b, key + shared, klen - shared);
+    IndexStat rs;
+    pack_stat(&rs, st);
+    put(b, &rs, sizeof(rs));
+    if (S_ISLNK(st->st_mode)) {
+        /* The target with its NUL, or nothing when it cannot be read. */
+        const char *target = linkcache_target(dfd, dir, name);
+        size_t tlen = target ? strlen(target) + 1 : 0;
+        uint16_t tl = tlen <= UINT16_MAX ? (uint16_t)tlen : 0;
+        put(b, &tl, sizeof(tl));
+        put(b, target, tl);
+    }
+    Key last = b->prev;
+    b->prev = b->key;
+    b->key = last;
+    b->count++;
+    return 0;
+}
+
+static int cmp_build(const void *a, const void *b) {
+    return strcmp(((const BuildEntry *)a)->name, ((const BuildEntry *)b)->name);
+}
+
+/* Called for each entry of the live tree in index key order. */
+typedef int (*WalkVisit)(void *ctx, int dfd, const char *dir, const char *name, const struct stat *st);
+
+/* Depth-first walk visiting each directory's entries before its children,
+ * which yields exactly the index key order.  "." and ".." are visited
+ * like any other entry so -a listings match the live directory.  Only one
+ * directory's entries per level are held in memory. */
+static int walk_dir(int dfd, const char *rel, const char *shown, WalkVisit visit, void *ctx) {
+    DIR *dir = fdopendir(dfd);
+    if (!dir) {
+        fprintf(stderr, "opendir: %s: %s\n", shown, strerror(errno));
+        close(dfd);
+        return 0;
+    }
+    size_t count = 0, cap = 64;
+    BuildEntry *ents = malloc(cap * sizeof(BuildEntry));
+    struct dirent *de;
+    while (ents && (de = readdir(dir)) != NULL) {
+        if (count == cap) {
+            BuildEntry *tmp = realloc(ents, cap * 2 * sizeof(BuildEntry));
+            if (!tmp)
+                break;
+            ents = tmp;
+            cap *= 2;
+        }
+        if (fstatat(dfd, de->d_name, &ents[count].st, AT_SYMLINK_NOFOLLOW) == -1) {
+            fprintf(stderr, "stat: %s/%s: %s\n", shown, de->d_name, strerror(errno));
+            continue;
+        }
+        ents[count].name = strdup(de->d_name);
+        if (ents[count].name)
+            count++;
+    }
+    if (!ents) {
+        perror("malloc");
+        closedir(dir);
+        return -1;
+    }
+    qsort(ents, count, sizeof(BuildEntry), cmp_build);
+    int rc = 0;
+    for (size_t i = 0; i < count && rc == 0; i++)
+        rc = visit(ctx, dfd, rel, ents[i].name, &ents[i].st);
+    for (size_t i = 0; i < count; i++) {
+        if (rc == 0 && S_ISDIR(ents[i].st.st_mode) && strcmp(ents[i].name, ".") != 0 &&
+            strcmp(ents[i].name, "..") != 0) {
+            char *child_rel = NULL, *child_shown = join_path(shown, ents[i].name);
+            if (rel[0])
+                child_rel = join_path(rel, ents[i].name);
+            else
+                child_rel = strdup(ents[i].name);
+            int cfd = openat(dfd, ents[i].name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+            if (cfd == -1)
+                fprintf(stderr, "opendir: %s: %s\n", child_shown ? child_shown : ents[i].name, strerror(errno));
+            else if (child_rel && child_shown)
+                rc = walk_dir(cfd, child_rel, child_shown, visit, ctx);
+            else
+                close(cfd);
+            free(child_rel);
+            free(child_shown);
+        }
+        free(ents[i].name);
+    }
+    free(ents);
+    closedir(dir);
+    return rc;
+}
+
+static int open_root(const char *root, struct stat *rst, const char *what) {
+    if (stat(root, rst) == -1) {
+        fprintf(stderr, "%s: %s: %s\n", what, root, strerror(errno));
+        return -1;
+    }
+    if (!S_ISDIR(rst->st_mode)) {
+        fprintf(stderr, "%s: %s: Not a directory\n", what, root);
+        return -1;
+    }
+    int dfd = open(root, O_RDONLY | O_DIRECTORY);
+    if (dfd == -1)
+        fprintf(stderr, "opendir: %s: %s\n", root, strerror(errno));
+    return dfd;
+}
+
+int index_build(const char *file, const char *root) {
+    struct stat rst;
+    int dfd = open_root(root, &rst, "build-index");
+    if (dfd == -1)
+        return -1;
+    Builder b;
+    memset(&b, 0, sizeof(b));
+    b.root = root;
+    b.f = fopen(file, "wb");
+    if (!b.f) {
+        fprintf(stderr, "build-index: %s: %s\n", file, strerror(errno));
+        close(dfd);
+        return -1;
+    }
+    IndexHeader h;
+    memset(&h, 0, sizeof(h));
+    size_t root_len = strlen(root);
+    while (root_len > 1 && root[root_len - 1] == '/')
+        root_len--;
+    char *real = realpath(root, NULL);
+    size_t real_len = real ? strlen(real) : 0;
+    put(&b, &h, sizeof(h));
+    put(&b, root, root_len);
+    put(&b, real ? real : "", real_len);
+    free(real);
+    IndexStat rs;
+    pack_stat(&rs, &rst);
+    put(&b, &rs, sizeof(rs));
+
+    walk_dir(dfd, "", root, add_record, &b);
+
+    uint64_t pad = (8 - b.pos % 8) % 8;
+    put(&b, "\0\0\0\0\0\0\0", pad);
+    h.restarts_off = b.pos;
+    put(&b, b.restarts, b.restart_count * sizeof(uint64_t));
+    memcpy(h.magic, INDEX_MAGIC, 8);
+    h.version = INDEX_VERSION;
+    h.root_len = (uint32_t)root_len;
+    h.real_len = (uint32_t)real_len;
+    h.created = (int64_t)time(NULL);
+    h.count = b.count;
+    h.restart_count = b.restart_count;
+    if (!b.err && (fseek(b.f, 0, SEEK_SET) != 0 || fwrite(&h, sizeof(h), 1, b.f) != 1))
+        b.err = 1;
+    if (fclose(b.f) == EOF)
+        b.err = 1;
+    free(b.restarts);
+    free(b.prev.s);
+    free(b.key.s);
+    if (b.err) {
+        fprintf(stderr, "build-index: %s: write error\n", file);
+        return -1;
+    }
+    if (b.skipped) {
+        fprintf(stderr, "build-index: %s: %llu entries left out\n", file, (unsigned long long)b.skipped);
+        return -1;
+    }
+    return 0;
+}
+
+/* ---- querying ---- */
+
+static const char *map = NULL;
+static size_t map_len = 0;
+static const IndexHeader *hdr = NULL;
+static const char *root_path = NULL;
+static size_t root_path_len = 0;
+static const char *real_path = NULL;
+static size_t real_path_len = 0;
+static IndexStat root_stat;
+static const uint64_t *restarts = NULL;
+static uint64_t records_off = 0;
+
+int index_active(void) {
+    return hdr != NULL;
+}
+
+int index_open(const char *file, long max_age) {
+    int fd = open(file, O_RDONLY);
+    if (fd == -1) {
+        fprintf(stderr, "index: %s: %s\n", file, strerror(errno));
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(IndexHeader)) {
+        fprintf(stderr, "index: %s: not a vls index\n", file);
+        close(fd);
+        return -1;
+    }
+    size_t len = (size_t)st.st_size;
+    void *m = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED) {
+        fprintf(stderr, "index: %s: %s\n", file, strerror(errno));
+        return -1;
+    }
+    const IndexHeader *h = m;
+    if (memcmp(h->magic, INDEX_MAGIC, 8) != 0 || h->version != INDEX_VERSION ||
+        sizeof(IndexHeader) + (uint64_t)h->root_len + h->real_len + sizeof(IndexStat) > len ||
+        h->restarts_off > len || h->restart_count > (len - h->restarts_off) / sizeof(uint64_t)) {
+        fprintf(stderr, "index: %s: not a vls index\n", file);
+        munmap(m, len);
+        return -1;
+    }
+    map = m;
+    map_len = len;
+    hdr = h;
+    root_path = map + sizeof(IndexHeader);
+    root_path_len = h->root_len;
+    real_path = root_path + root_path_len;
+    real_path_len = h->real_len;
+    memcpy(&root_stat, real_path + real_path_len, sizeof(root_stat));
+    restarts = (const uint64_t *)(map + h->restarts_off);
+    records_off = sizeof(IndexHeader) + (uint64_t)h->root_len + h->real_len + sizeof(IndexStat);
+
+    long age = (long)(time(NULL) - h->created);
+    if (max_age >= 0 && age > max_age)
+        fprintf(stderr, "warning: index '%s' is %ld hours old\n", file, age / 3600);
+    return 0;
+}
+
+static const char *strip_prefix(const char *path, const char *prefix, size_t plen) {
+    if (plen == 0 || strncmp(path, prefix, plen) != 0)
+        return NULL;
+    if (path[plen] == '\0' || path[plen] == '/' || prefix[plen - 1] == '/')
+        return path + plen;
+    return NULL;
+}
+
+/* Map a path as given on the command line (or built by -R) to the
+ * index-relative path it names, in a string the caller frees.  Paths
+ * under the root as it was spelled at build time or under its canonical
+ * form are accepted, and other relative paths are taken to be relative to
+ * the root; absolute paths outside it fail with ENOENT.  No filesystem
+ * access is made. */
+static char *relative_path(const char *path) {
+    const char *rest = strip_prefix(path, root_path, root_path_len);
+    if (!rest)
+        rest = strip_prefix(path, real_path, real_path_len);
+    if (rest)
+        path = rest;
+    else if (path[0] == '/') {
+        errno = ENOENT;
+        return NULL;
+    }
+    /* Only ever shortened, so the path's own length is enough. */
+    char *out = malloc(strlen(path) + 1);
+    if (!out)
+        return NULL;
+    while (*path == '/')
+        path++;
+    size_t o = 0;
+    while (*path) {
+        while (path[0] == '.' && (path[1] == '/' || path[1] == '\0')) {
+            path += path[1] ? 2 : 1;
+            while (*path == '/')
+                path++;
+        }
+        if (!*path)
+            break;
+        if (o)
+            out[o++] = '/';
+        while (*path && *path != '/')
+            out[o++] = *path++;
+        while (*path == '/')
+            path++;
+    }
+    out[o] = '\0';
+    return out;
+}
+
+typedef struct {
+    uint64_t pos;
+    uint64_t rec;
+    Key key;
+    IndexStat st;
+    const char *target;
+} Cursor;
+
+static int cursor_next(Cursor *c) {
+    if (c->rec >= hdr->count || c->pos + 4 > hdr->restarts_off)
+        return 0;
+    uint16_t lens[2];
+    memcpy(lens, map + c->pos, sizeof(lens));
+    size_t shared = c->rec % INDEX_RESTART ? lens[0] : 0;
+    if (shared > c->key.len || c->pos + 4 + lens[1] + sizeof(IndexStat) > hdr->restarts_off ||
+        key_reserve(&c->key, shared + lens[1]) == -1)
+        return 0;
+    memcpy(c->key.s + shared, map + c->pos + 4, lens[1]);
+    c->key.len = shared + lens[1];
+    c->key.s[c->key.len] = '\0';
+    memcpy(&c->st, map + c->pos + 4 + lens[1], sizeof(IndexStat));
+    c->pos += 4 + lens[1] + sizeof(IndexStat);
+    c->target = NULL;
+    if (S_ISLNK(c->st.mode)) {
+        uint16_t tlen;
+        if (c->pos + sizeof(tlen) > hdr->restarts_off)
+            return 0;
+        memcpy(&tlen, map + c->pos, sizeof(tlen));
+        c->pos += sizeof(tlen);
+        if (c->pos + tlen > hdr->restarts_off || (tlen && map[c->pos + tlen - 1] != '\0'))
+            return 0;
+        if (tlen)
+            c->target = map + c->pos;
+        c->pos += tlen;
+    }
+    c->rec++;
+    return 1;
+}
+
+/* Position C on the first record whose key is not below TARGET. */
+static int cursor_seek(Cursor *c, const char *target, size_t tlen) {
+    size_t lo = 0, hi = hdr->restart_count;
+    Cursor probe = {0};
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        probe.pos = restarts[mid];
+        probe.rec = (uint64_t)mid * INDEX_RESTART;
+        probe.key.len = 0;
+        if (!cursor_next(&probe)) {
+            free(probe.key.s);
+            return 0;
+        }
+        if (key_cmp(probe.key.s, probe.key.len, target, tlen) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    free(probe.key.s);
+    size_t block = lo ? lo - 1 : 0;
+    if (hdr->restart_count == 0)
+        return 0;
+    c->pos = restarts[block];
+    c->rec = (uint64_t)block * INDEX_RESTART;
+    c->key.len = 0;
+    while (cursor_next(c))
+        if (key_cmp(c->key.s, c->key.len, target, tlen) >= 0)
+            return 1;
+    return 0;
+}
+
+/* A cursor on the record for PATH, which must not be the root; NULL with
+ * errno set when there is none.  The caller frees it with cursor_free. */
+static Cursor *cursor_find(const char *rel) {
+    Key key = {0};
+    char *dir = strdup(rel);
+    char *slash = dir ? strrchr(dir, '/') : NULL;
+    if (slash)
+        *slash = '\0';
+    int rc = dir ? key_set(&key, slash ? dir : "", slash ? slash + 1 : dir) : -1;
+    free(dir);
+    Cursor *c = calloc(1, sizeof(Cursor));
+    if (rc == -1 || !c) {
+        free(key.s);
+        free(c);
+        return NULL;
+    }
+    int found = cursor_seek(c, key.s, key.len) && key_cmp(c->key.s, c->key.len, key.s, key.len) == 0;
+    free(key.s);
+    if (!found) {
+        free(c->key.s);
+        free(c);
+        errno = ENOENT;
+        return NULL;
+    }
+    return c;
+}
+
+static void cursor_free(Cursor *c) {
+    free(c->key.s);
+    free(c);
+}
+
+int index_stat(const char *path, struct stat *st) {
+    char *rel = relative_path(path);
+    if (!rel)
+        return -1;
+    if (!rel[0]) {
+        free(rel);
+        unpack_stat(&root_stat, st);
+        return 0;
+    }
+    Cursor *c = cursor_find(rel);
+    free(rel);
+    if (!c)
+        return -1;
+    unpack_stat(&c->st, st);
+    cursor_free(c);
+    return 0;
+}
+
+const char *index_readlink(const char *path) {
+    char *rel = relative_path(path);
+    if (!rel)
+        return NULL;
+    Cursor *c = rel[0] ? cursor_find(rel) : NULL;
+    free(rel);
+    if (!c) {
+        errno = ENOENT;
+        return NULL;
+    }
+    const char *target = c->target;
+    cursor_free(c);
+    if (!target)
+        errno = EINVAL;
+    return target;
+}
+
+int index_list(const char *path, IndexVisit visit, void *ctx) {
+    struct stat dst;
+    if (index_stat(path, &dst) == -1)
+        return -1;
+    if (!S_ISDIR(dst.st_mode)) {
+        errno = ENOTDIR;
+        return -1;
+    }
+    char *rel = relative_path(path);
+    Cursor *c = calloc(1, sizeof(Cursor));
+    if (!rel || !c) {
+        free(rel);
+        free(c);
+        return -1;
+    }
+    size_t dlen = strlen(rel);
+    int rc = 0;
+    if (cursor_seek(c, rel, dlen + 1)) {
+        do {
+            if (strlen(c->key.s) != dlen || memcmp(c->key.s, rel, dlen) != 0)
+                break;
+            struct stat st;
+            unpack_stat(&c->st, &st);
+            if (visit(ctx, c->key.s + dlen + 1, &st) == -1) {
+                rc = -1;
+                break;
+            }
+        } while (cursor_next(c));
+    }
+    free(rel);
+    free(c->key.s);
+    free(c);
+    return rc;
+}
+
+/* ---- diffing ---- */
+
+typedef struct {
+    Cursor cur;
+    int more;
+    Key key;
+    const char *root;
+    uint64_t skipped;
+    IndexDiffVisit visit;
+    void *ctx;
+} Differ;
+
+static int dot_entry(const char *name) {
+    return name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+}
+
+/* Report the snapshot record under the cursor as removed and advance. */
+static void diff_removed(Differ *d) {
+    const char *dir = d->cur.key.s;
+    const char *name = dir + strlen(dir) + 1;
+    if (!dot_entry(name)) {
+        struct stat old;
+        unpack_stat(&d->cur.st, &old);
+        d->visit(d->ctx, INDEX_REMOVED, -1, dir, name, &old, NULL);
+    }
+    d->more = cursor_next(&d->cur);
+}
+
+static int diff_record(void *ctx, int dfd, const char *dir, const char *name, const struct stat *st) {
+    Differ *d = ctx;
+    if (dot_entry(name))
+        return 0;
+    if (key_set(&d->key, dir, name) == -1) {
+        perror("malloc");
+        return -1;
+    }
+    /* The snapshot cannot hold it, so it would always show as added. */
+    if (d->key.len > KEY_MAX) {
+        report_long("diff", d->root, dir, name);
+        d->skipped++;
+        return 0;
+    }
+    const char *key = d->key.s;
+    size_t klen = d->key.len;
+
+    while (d->more && key_cmp(d->cur.key.s, d->cur.key.len, key, klen) < 0)
+        diff_removed(d);
+    if (d->more && key_cmp(d->cur.key.s, d->cur.key.len, key, klen) == 0) {
+        struct stat old;
+        unpack_stat(&d->cur.st, &old);
+        if (old.st_ino != st->st_ino) {
+            /* Same name, different file: it was replaced. */
+            d->visit(d->ctx, INDEX_REMOVED, -1, dir, name, &old, NULL);
+            d->visit(d->ctx, INDEX_ADDED, dfd, dir, name, NULL, st);
+        } else if (old.st_size != st->st_size || old.st_mode != st->st_mode ||
+                   old.st_uid != st->st_uid || old.st_gid != st->st_gid ||
+                   old.ST_MTIM.tv_sec != st->ST_MTIM.tv_sec ||
+                   old.ST_MTIM.tv_nsec != st->ST_MTIM.tv_nsec) {
+            d->visit(d->ctx, INDEX_MODIFIED, dfd, dir, name, &old, st);
+        }
+        d->more = cursor_next(&d->cur);
+        return 0;
+    }
+    d->visit(d->ctx, INDEX_ADDED, dfd, dir, name, NULL, st);
+    return 0;
+}
+
+int index_diff(const char *file, const char *root, IndexDiffVisit visit, void *ctx) {
+    if (!index_active() && index_open(file, -1) == -1)
+        return -1;
+    struct stat rst;
+    int dfd = open_root(root, &rst, "diff");
+    if (dfd == -1)
+        return -1;
+    Differ *d = calloc(1, sizeof(Differ));
+    if (!d) {
+        perror("calloc");
+        close(dfd);
+        return -1;
+    }
+    d->visit = visit;
+    d->ctx = ctx;
+    d->root = root;
+    d->cur.pos = records_off;
+    d->more = cursor_next(&d->cur);
+    int rc = walk_dir(dfd, "", root, diff_record, d);
+    while (rc == 0 && d->more)
+        diff_removed(d);
+    if (rc == 0 && d->skipped) {
+        fprintf(stderr, "diff: %llu entries not compared\n", (unsigned long long)d->skipped);
+        rc = -1;
+    }
+    free(d->cur.key.s);
+    free(d->key.s);
+    free(d);
+    return rc;
+}
@@ -0,0 +1,333 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "json.h"
+#include "idcache.h"
+#include "linkcache.h"
+#include "util.h"
+
+#define OUT_CAP (1 << 16)
+
+static char outbuf[OUT_CAP];
+static size_t outlen = 0;
+static int first_record = 1;
+
+void json_flush(void) {
+    if (outlen) {
+        fwrite(outbuf, 1, outlen, stdout);
+        outlen = 0;
+    }
+    fflush(stdout);
+}
+
+static inline char *reserve(size_t n) {
+    if (outlen + n > OUT_CAP) {
+        fwrite(outbuf, 1, outlen, stdout);
+        outlen = 0;
+    }
+    return outbuf + outlen;
+}
+
+static void put_raw(const char *s, size_t len) {
+    while (len) {
+        size_t chunk = len < OUT_CAP / 2 ? len : OUT_CAP / 2;
+        memcpy(reserve(chunk), s, chunk);
+        outlen += chunk;
+        s += chunk;
+        len -= chunk;
+    }
+}
+
+#define PUT_LIT(s) put_raw((s), sizeof(s) - 1)
+
+static void put_u64(uint64_t v) {
+    char tmp[24];
+    char *p = tmp + sizeof(tmp);
+    do {
+        *--p = (char)('0' + v % 10);
+        v /= 10;
+    } while (v);
+    put_raw(p, (size_t)(tmp + sizeof(tmp) - p));
+}
+
+static void put_i64(int64_t v) {
+    if (v < 0) {
+        PUT_LIT("-");
+        put_u64((uint64_t)0 - (uint64_t)v);
+    } else {
+        put_u64((uint64_t)v);
+    }
+}
+
+/* Byte-parallel tests on a 64-bit word: any byte below 0x20, equal to
+ * '"' or '\\', or with the high bit set sends the word to the slow path. */
+#define ONES 0x0101010101010101ULL
+#define HIGHS 0x8080808080808080ULL
+
+static inline int word_needs_escape(uint64_t w) {
+    uint64_t ctrl = (w - ONES * 0x20) & ~w;
+    uint64_t q = w ^ (ONES * '"');
+    uint64_t bs = w ^ (ONES * '\\');
+    uint64_t quote = (q - ONES) & ~q;
+    uint64_t slash = (bs - ONES) & ~bs;
+    return ((ctrl | quote | slash) & HIGHS) != 0 || (w & HIGHS) != 0;
+}
+
+/* Length of the valid UTF-8 sequence at S, or 0 if it is malformed. */
+static size_t utf8_len(const unsigned char *s, size_t avail) {
+    unsigned char c = s[0];
+    size_t n;
+    unsigned char lo = 0x80, hi = 0xBF;
+    if (c >= 0xC2 && c <= 0xDF) {
+        n = 2;
+    } else if (c >= 0xE0 && c <= 0xEF) {
+        n = 3;
+        if (c == 0xE0)
+            lo = 0xA0;
+        else if (c == 0xED)
+            hi = 0x9F;
+    } else if (c >= 0xF0 && c <= 0xF4) {
+        n = 4;
+        if (c == 0xF0)
+            lo = 0x90;
+        else if (c == 0xF4)
+            hi = 0x8F;
+    } else {
+        return 0;
+    }
+    if (n > avail || s[1] < lo || s[1] > hi)
+        return 0;
+    for (size_t i = 2; i < n; i++)
+        if (s[i] < 0x80 || s[i] > 0xBF)
+            return 0;
+    return n;
+}
+
+/*
+ * Write S as a JSON string.  Clean 8-byte blocks are copied as a whole;
+ * bytes that are not valid UTF-8 are written as \udcXX (the surrogateescape
+ * convention), so arbitrary file names survive a round trip.
+ */
+static void put_string(const char *s, size_t len) {
+    static const char hex[] = "0123456789abcdef";
+    const unsigned char *p = (const unsigned char *)s;
+    size_t i = 0;
+    PUT_LIT("\"");
+    while (i < len) {
+        if (i + 8 <= len) {
+            uint64_t w;
+            memcpy(&w, p + i, 8);
+            if (!word_needs_escape(w)) {
+                memcpy(reserve(8), p + i, 8);
+                outlen += 8;
+                i += 8;
+                continue;
+            }
+        }
+        unsigned char c = p[i];
+        char *o = reserve(12);
+        if (c == '"' || c == '\\') {
+            o[0] = '\\';
+            o[1] = (char)c;
+            outlen += 2;
+            i++;
+        } else if (c < 0x20) {
+            size_t n = 2;
+            o[0] = '\\';
+            switch (c) {
+            case '\b': o[1] = 'b'; break;
+            case '\f': o[1] = 'f'; break;
+            case '\n': o[1] = 'n'; break;
+            case '\r': o[1] = 'r'; break;
+            case '\t': o[1] = 't'; break;
+            default:
+                memcpy(o + 1, "u00", 3);
+                o[4] = hex[c >> 4];
+                o[5] = hex[c & 15];
+                n = 6;
+                break;
+            }
+            outlen += n;
+            i++;
+        } else if (c < 0x80) {
+            o[0] = (char)c;
+            outlen++;
+            i++;
+        } else {
+            size_t n = utf8_len(p + i, len - i);
+            if (n) {
+                memcpy(o, p + i, n);
+                outlen += n;
+                i += n;
+            } else {
+                memcpy(o, "\\udc", 4);
+                o[4] = hex[c >> 4];
+                o[5] = hex[c & 15];
+                outlen += 6;
+                i++;
+            }
+        }
+    }
+    PUT_LIT("\"");
+}
+
+static void put_cstr_or_null(const char *s) {
+    if (s)
+        put_string(s, strlen(s));
+    else
+        PUT_LIT("null");
+}
+
+static int64_t ts_ns(const struct timespec *ts) {
+    return (int64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+static const char *type_name(mode_t mode) {
+    if (S_ISREG(mode)) return "file";
+    if (S_ISDIR(mode)) return "directory";
+    if (S_ISLNK(mode)) return "symlink";
+    if (S_ISFIFO(mode)) return "fifo";
+    if (S_ISSOCK(mode)) return "socket";
+    if (S_ISBLK(mode)) return "block";
+    if (S_ISCHR(mode)) return "char";
+    return "unknown";
+}
+
+void json_raw(const char *s) {
+    put_raw(s, strlen(s));
+}
+
+void json_string(const char *s) {
+    put_string(s, strlen(s));
+}
+
+void json_u64(uint64_t v) {
+    put_u64(v);
+}
+
+void json_fstring(FILE *out, const char *s) {
+    static const char hex[] = "0123456789abcdef";
+    const unsigned char *p = (const unsigned char *)s;
+    size_t len = strlen(s);
+    putc('"', out);
+    for (size_t i = 0; i < len;) {
+        unsigned char c = p[i];
+        if (c == '"' || c == '\\') {
+            putc('\\', out);
+            putc(c, out);
+            i++;
+        } else if (c < 0x20) {
+            fprintf(out, "\\u00%c%c", hex[c >> 4], hex[c & 15]);
+            i++;
+        } else if (c < 0x80) {
+            putc(c, out);
+            i++;
+        } else {
+            size_t n = utf8_len(p + i, len - i);
+            if (n) {
+                fwrite(p + i, 1, n, out);
+                i += n;
+            } else {
+                fprintf(out, "\\udc%c%c", hex[c >> 4], hex[c & 15]);
+                i++;
+            }
+        }
+    }
+    putc('"', out);
+}
+
+void json_begin(OutputFormat format) {
+    first_record = 1;
+    if (format == FORMAT_JSON)
+        PUT_LIT("[");
+}
+
+void json_end(OutputFormat format) {
+    if (format == FORMAT_JSON)
+        PUT_LIT("]\n");
+}
+
+static void json_record(OutputFormat format, int dfd, const char *dir, const char *name,
+                        const struct stat *st, int numeric_ids, const char *change,
+                        const char *const *fields, size_t nfields) {
+    if (format == FORMAT_JSON && !first_record)
+        PUT_LIT(",");
+    first_record = 0;
+    PUT_LIT("{\"dir\":");
+    put_cstr_or_null(dir);
+    PUT_LIT(",\"name\":");
+    put_string(name, strlen(name));
+    PUT_LIT(",\"type\":\"");
+    const char *type = type_name(st->st_mode);
+    put_raw(type, strlen(type));
+    PUT_LIT("\",\"dev\":");
+    put_u64((uint64_t)st->st_dev);
+    PUT_LIT(",\"ino\":");
+    put_u64((uint64_t)st->st_ino);
+    PUT_LIT(",\"mode\":");
+    put_u64((uint64_t)st->st_mode);
+    PUT_LIT(",\"nlink\":");
+    put_u64((uint64_t)st->st_nlink);
+    PUT_LIT(",\"uid\":");
+    put_u64((uint64_t)st->st_uid);
+    PUT_LIT(",\"gid\":");
+    put_u64((uint64_t)st->st_gid);
+    PUT_LIT(",\"owner\":");
+    put_cstr_or_null(numeric_ids ? NULL : idcache_user(st->st_uid));
+    PUT_LIT(",\"group\":");
+    put_cstr_or_null(numeric_ids ? NULL : idcache_group(st->st_gid));
+    PUT_LIT(",\"rdev\":");
+    put_u64((uint64_t)st->st_rdev);
+    PUT_LIT(",\"size\":");
+    put_i64((int64_t)st->st_size);
+    PUT_LIT(",\"blksize\":");
+    put_i64((int64_t)st->st_blksize);
+    PUT_LIT(",\"blocks\":");
+    put_i64((int64_t)st->st_blocks);
+    PUT_LIT(",\"atime_ns\":");
+    put_i64(ts_ns(&st->ST_ATIM));
+    PUT_LIT(",\"mtime_ns\":");
+    put_i64(ts_ns(&st->ST_MTIM));
+    PUT_LIT(",\"ctime_ns\":");
+    put_i64(ts_ns(&st->ST_CTIM));
+    if (S_ISLNK(st->st_mode)) {
+        /* Read in full however long; a fixed buffer would cut it short. */
+        const char *target = dfd == LINK_GONE ? NULL : linkcache_target(dfd, dir, name);
+        PUT_LIT(",\"target\":");
+        if (target)
+            put_string(target, strlen(target));
+        else
+            PUT_LIT("null");
+    }
+    if (change) {
+        PUT_LIT(",\"change\":\"");
+        put_raw(change, strlen(change));
+        PUT_LIT("\"");
+        if (nfields) {
+            PUT_LIT(",\"changed\":[");
+            for (size_t i = 0; i < nfields; i++) {
+                if (i)
+                    PUT_LIT(",");
+                put_string(fields[i], strlen(fields[i]));
+            }
+            PUT_LIT("]");
+        }
+    }
+    PUT_LIT("}");
+    if (format == FORMAT_NDJSON)
+        PUT_LIT("\n");
+}
+
+void json_entry(OutputFormat format, int dfd, const char *dir, const char *name,
+                const struct stat *st, int numeric_ids) {
+    json_record(format, dfd, dir, name, st, numeric_ids, NULL, NULL, 0);
+}
+
+void json_change(OutputFormat format, int dfd, const char *dir, const char *name,
+                 const struct stat *st, int numeric_ids, const char *change,
+                 const char *const *fields, size_t nfields) {
+    json_record(format, dfd, dir, name, st, numeric_ids, change, fields, nfields);
+}
@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "index.h"
+#include "linkcache.h"
+#include "stats.h"
+#include "util.h"
+
+typedef struct {
+    char *path;
+    uint64_t hash;
+    int dangling;
+    struct stat st;
+} LinkSlot;
+
+static LinkSlot *slots = NULL;
+static size_t mask = 0;
+static size_t used = 0;
+static char *buf = NULL;
+static size_t bufsz = 0;
+
+static const char *read_target(int dfd, const char *name) {
+    for (;;) {
+        if (!buf) {
+            bufsz = 256;
+            if (!(buf = malloc(bufsz)))
+                return NULL;
+        }
+        ssize_t n = readlinkat(dfd, name, buf, bufsz);
+        if (n < 0)
+            return NULL;
+        if ((size_t)n < bufsz) {
+            buf[n] = '\0';
+            return buf;
+        }
+        /* Possibly cut short: try again with twice the room. */
+        char *tmp = realloc(buf, bufsz * 2);
+        if (!tmp)
+            return NULL;
+        buf = tmp;
+        bufsz *= 2;
+    }
+}
+
+const char *linkcache_target(int dfd, const char *dir, const char *name) {
+    if (dfd == -1) {
+        if (!dir)
+            return index_readlink(name);
+        char *path = join_path(dir, name);
+        const char *target = path ? index_readlink(path) : NULL;
+        free(path);
+        return target;
+    }
+    char *path = NULL;
+    if (dfd == AT_FDCWD && dir) {
+        if (!(path = join_path(dir, name)))
+            return NULL;
+        name = path;
+    }
+    const char *target = read_target(dfd, name);
+    free(path);
+    return target;
+}
+
+void linkcache_clear(void) {
+    for (size_t i = 0; slots && i <= mask; i++)
+        free(slots[i].path);
+    free(slots);
+    slots = NULL;
+    mask = used = 0;
+}
+
+static uint64_t hash_path(const char *s) {
+    uint64_t h = 14695981039346656037ULL;
+    for (; *s; s++) {
+        h ^= (unsigned char)*s;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static int grow(void) {
+    size_t size = slots ? (mask + 1) * 2 : 64;
+    LinkSlot *fresh = calloc(size, sizeof(LinkSlot));
+    if (!fresh)
+        return -1;
+    for (size_t i = 0; slots && i <= mask; i++) {
+        if (!slots[i].path)
+            continue;
+        size_t pos = slots[i].hash & (size - 1);
+        while (fresh[pos].path)
+            pos = (pos + 1) & (size - 1);
+        fresh[pos] = slots[i];
+    }
+    free(slots);
+    slots = fresh;
+    mask = size - 1;
+    return 0;
+}
+
+/* TARGET as a path usable from the working directory: absolute targets
+ * as they are, relative ones joined to the link's directory. */
+static char *resolve(const char *dir, const char *name, const char *target) {
+    if (target[0] == '/')
+        return strdup(target);
+    if (dir)
+        return join_path(dir, target);
+    const char *slash = strrchr(name, '/');
+    if (!slash)
+        return strdup(target);
+    char *path = NULL;
+    if (asprintf(&path, "%.*s/%s", (int)(slash - name), name, target) < 0)
+        return NULL;
+    return path;
+}
+
+int linkcache_stat(const char *dir, const char *name, const char *target, struct stat *st) {
+    char *path = resolve(dir, name, target);
+    if (!path)
+        return -1;
+    if ((!slots || (used + 1) * 2 > mask + 1) && grow() == -1) {
+        int failed = stat(path, st) == -1;
+        free(path);
+        return failed ? -1 : 0;
+    }
+    uint64_t h = hash_path(path);
+    size_t pos = h & mask;
+    while (slots[pos].path) {
+        if (slots[pos].hash == h && strcmp(slots[pos].path, path) == 0) {
+            free(path);
+            *st = slots[pos].st;
+            return slots[pos].dangling ? -1 : 0;
+        }
+        pos = (pos + 1) & mask;
+    }
+    LinkSlot *slot = &slots[pos];
+    slot->dangling = stat(path, &slot->st) == -1;
+    STATS_CALL(STATS_STAT_CALL, slot->dangling);
+    slot->path = path;
+    slot->hash = h;
+    used++;
+    *st = slot->st;
+    return slot->dangling ? -1 : 0;
+}
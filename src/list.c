@@ -3,178 +3,48 @@
 #include <dirent.h>
 #include <sys/stat.h>
 #include <string.h>
-#include <strings.h>
 #include <unistd.h>
 #include <errno.h>
 #include <stdlib.h>
-#include <ctype.h>
 #include <wchar.h>
-#include <pwd.h>
-#include <grp.h>
 #include <time.h>
-#include <fnmatch.h>
-#include <stdbool.h>
-#ifndef HAVE_SELINUX
-# define HAVE_SELINUX 0
-#endif
-
-#if HAVE_SELINUX
-# ifdef __has_include
-#  if __has_include(<selinux/selinux.h>)
-#   include <selinux/selinux.h>
-#  else
-#   undef HAVE_SELINUX
-#   define HAVE_SELINUX 0
-#  endif
-# else
-#  include <selinux/selinux.h>
-# endif
-#endif
+#include <fcntl.h>
+#include <locale.h>
+#include <stdint.h>
 #include "list.h"
+#include "vlsdir.h"
 #include "color.h"
 #include "util.h"
 #include "quote.h"
+#include "context.h"
+#include "idcache.h"
+#include "json.h"
+#include "columnar.h"
+#include "index.h"
+#include "summary.h"
+#include "stats.h"
+#include "sort.h"
+#include "entry.h"
+#include "spill.h"
+#include "linkcache.h"
 
 static int hyperlink_enabled(HyperlinkMode mode) {
-    return mode == HYPERLINK_ALWAYS || (mode == HYPERLINK_AUTO && isatty(STDOUT_FILENO));
+    return mode == HYPERLINK_ALWAYS || (mode == HYPERLINK_AUTO && stdout_isatty());
 }
 
-static void hyperlink_start(const char *target, HyperlinkMode mode) {
+static void hyperlink_start(FILE *out, const char *target, HyperlinkMode mode) {
     if (hyperlink_enabled(mode))
-        printf("\033]8;;%s\033\\", target);
+        fprintf(out, "\033]8;;%s\033\\", target);
 }
 
-static void hyperlink_end(HyperlinkMode mode) {
+static void hyperlink_end(FILE *out, HyperlinkMode mode) {
     if (hyperlink_enabled(mode))
-        printf("\033]8;;\033\\");
+        fprintf(out, "\033]8;;\033\\");
 }
 
-typedef struct {
-    char *name;
-    struct stat st;
-} Entry;
-
-typedef struct Visited {
-    dev_t dev;
-    ino_t ino;
-    struct Visited *next;
-} Visited;
-
-static Visited *visited_head = NULL;
-static int recursion_depth = 0;
-
-static int visited_contains(dev_t dev, ino_t ino) {
-    for (Visited *v = visited_head; v; v = v->next)
-        if (v->dev == dev && v->ino == ino)
-            return 1;
-    return 0;
-}
-
-static int visited_add(dev_t dev, ino_t ino) {
-    Visited *v = malloc(sizeof(Visited));
-    if (!v)
-        return -1;
-    v->dev = dev;
-    v->ino = ino;
-    v->next = visited_head;
-    visited_head = v;
-    return 0;
-}
-
-static void visited_free_all(void) {
-    Visited *v = visited_head;
-    while (v) {
-        Visited *tmp = v->next;
-        free(v);
-        v = tmp;
-    }
-    visited_head = NULL;
-}
-
-#define FINALIZE() do {                         \
-    recursion_depth--;                           \
-    if (recursion_depth == 0)                    \
-        visited_free_all();                      \
-} while (0)
-
-static int cmp_names(const void *a, const void *b) {
-    const Entry *ea = a;
-    const Entry *eb = b;
-    return strcmp(ea->name, eb->name);
-}
-
-static int cmp_mtime(const void *a, const void *b) {
-    const Entry *ea = a;
-    const Entry *eb = b;
-    if (ea->st.st_mtime == eb->st.st_mtime)
-        return 0;
-    return (ea->st.st_mtime > eb->st.st_mtime) ? -1 : 1;
-}
-
-static int cmp_atime(const void *a, const void *b) {
-    const Entry *ea = a;
-    const Entry *eb = b;
-    if (ea->st.st_atime == eb->st.st_atime)
-        return 0;
-    return (ea->st.st_atime > eb->st.st_atime) ? -1 : 1;
-}
-
-static int cmp_ctime(const void *a, const void *b) {
-    const Entry *ea = a;
-    const Entry *eb = b;
-    if (ea->st.st_ctime == eb->st.st_ctime)
-        return 0;
-    return (ea->st.st_ctime > eb->st.st_ctime) ? -1 : 1;
-}
-
-static int cmp_size(const void *a, const void *b) {
-    const Entry *ea = a;
-    const Entry *eb = b;
-    if (ea->st.st_size == eb->st.st_size)
-        return 0;
-    return (ea->st.st_size > eb->st.st_size) ? -1 : 1;
-}
-
-static int cmp_extension(const void *a, const void *b) {
-    const Entry *ea = a;
-    const Entry *eb = b;
-    const char *ea_ext = strrchr(ea->name, '.');
-    const char *eb_ext = strrchr(eb->name, '.');
-    ea_ext = ea_ext ? ea_ext + 1 : ea->name;
-    eb_ext = eb_ext ? eb_ext + 1 : eb->name;
-    int cmp = strcasecmp(ea_ext, eb_ext);
-    if (cmp == 0)
-        return strcasecmp(ea->name, eb->name);
-    return cmp;
-}
-
-static int cmp_version(const void *a, const void *b) {
-    const Entry *ea = a;
-    const Entry *eb = b;
-#if defined(__GLIBC__) || defined(__GNU_LIBRARY__) || defined(__linux__)
-    return strverscmp(ea->name, eb->name);
-#else
-    const char *sa = ea->name;
-    const char *sb = eb->name;
-    while (*sa && *sb) {
-        if (isdigit((unsigned char)*sa) && isdigit((unsigned char)*sb)) {
-            char *ea_end; char *eb_end;
-            unsigned long na = strtoul(sa, &ea_end, 10);
-            unsigned long nb = strtoul(sb, &eb_end, 10);
-            if (na != nb)
-                return (na > nb) ? 1 : -1;
-            sa = ea_end;
-            sb = eb_end;
-        } else {
-            if (*sa != *sb)
-                return (unsigned char)*sa - (unsigned char)*sb;
-            sa++; sb++;
-        }
-    }
-    if (*sa) return 1;
-    if (*sb) return -1;
-    return 0;
-#endif
+/* The hyperlink target of NAME; operand entries are named by their path. */
+static char *entry_path(const char *dir, const char *name) {
+    return dir ? join_path(dir, name) : strdup(name);
 }
 
 static void human_size(off_t size, int si, char *buf, size_t bufsz) {
@@ -192,6 +62,82 @@ static void human_size(off_t size, int si, char *buf, size_t bufsz) {
         snprintf(buf, bufsz, "%.1f%c", s, suffixes[i]);
 }
 
+static const char *indicator_for(mode_t mode, IndicatorStyle style) {
+    switch (style) {
+    case INDICATOR_CLASSIFY:
+        if (S_ISDIR(mode))
+            return "/";
+        if (S_ISLNK(mode))
+            return "@";
+        if (mode & S_IXUSR)
+            return "*";
+        break;
+    case INDICATOR_FILE_TYPE:
+        if (S_ISDIR(mode))
+            return "/";
+        if (S_ISLNK(mode))
+            return "@";
+        break;
+    case INDICATOR_SLASH:
+        if (S_ISDIR(mode))
+            return "/";
+        break;
+    default:
+        break;
+    }
+    return "";
+}
+
+/* Color index for a freshly stat'ed entry in DIR; dangling links are
+ * only detected when LS_COLORS defines "or", since that costs reading the
+ * link.  Entries served from an index (DFD is -1) use the recorded target,
+ * which is looked up in the live filesystem like any other; LINK_GONE
+ * ones are not looked at. */
+static int entry_color(int dfd, const char *dir, const char *name, mode_t mode) {
+    int broken = 0;
+    if (S_ISLNK(mode) && color_has(COLOR_TYPE_ORPHAN) && dfd != LINK_GONE) {
+        struct stat tst;
+        const char *target = linkcache_target(dfd, dir, name);
+        broken = !target || linkcache_stat(dir, name, target, &tst) == -1;
+    }
+    return color_resolve(name, mode, broken);
+}
+
+/* " -> TARGET" after a symlink in a long listing, quoted like a name and
+ * colored and marked for what it points at. */
+static void print_target(FILE *out, const char *dir, const char *name, const char *target, int use_color,
+                         IndicatorStyle indicator_style, QuotingStyle quoting_style, int hide_control,
+                         int show_controls, int literal_names) {
+    struct stat tst;
+    int resolved = (use_color || indicator_style != INDICATOR_NONE) &&
+                   linkcache_stat(dir, name, target, &tst) == 0;
+    int color = COLOR_TYPE_NONE;
+    if (use_color)
+        color = resolved ? color_resolve(target, tst.st_mode, 0) : COLOR_TYPE_MISSING;
+    fprintf(out, " -> %s", use_color ? color_code(color) : "");
+    print_quoted(out, target, quoting_style, hide_control, show_controls, literal_names);
+    fprintf(out, "%s%s", use_color ? color_reset() : "", resolved ? indicator_for(tst.st_mode, indicator_style) : "");
+}
+
+/* Machine-readable output for one directory's entries. */
+static void emit_records(OutputFormat format, int dfd, const char *path, const Entry *entries,
+                         size_t count, int numeric_ids) {
+    if (format == FORMAT_COLUMNAR) {
+        uint32_t dir = path ? columnar_add_dir(path) : COLUMNAR_NO_DIR;
+        for (size_t i = 0; i < count; i++) {
+            const Entry *ent = &entries[i];
+            columnar_add_row(dir, ent->name, &ent->st);
+        }
+        return;
+    }
+    json_begin(format);
+    for (size_t i = 0; i < count; i++) {
+        const Entry *ent = &entries[i];
+        json_entry(format, dfd, path, ent->name, &ent->st, numeric_ids);
+    }
+    json_end(format);
+}
+
 static size_t num_digits(unsigned long long n) {
     size_t d = 1;
     while (n >= 10) {
@@ -208,6 +154,8 @@ static size_t quoted_len(const char *s, int escape_nonprint, int hide_control) {
     const char *p = s;
     while (*p) {
         wchar_t wc;
+        if ((unsigned char)*p >= 0x80)
+            locale_need(LC_CTYPE);
         size_t n = mbrtowc(&wc, p, MB_CUR_MAX, &st);
         if (n == (size_t)-1 || n == (size_t)-2) {
             wc = (unsigned char)*p;
@@ -239,6 +187,8 @@ static size_t escaped_len(const char *s, int hide_control) {
     const char *p = s;
     while (*p) {
         wchar_t wc;
+        if ((unsigned char)*p >= 0x80)
+            locale_need(LC_CTYPE);
         size_t n = mbrtowc(&wc, p, MB_CUR_MAX, &st);
         if (n == (size_t)-1 || n == (size_t)-2) {
             wc = (unsigned char)*p;
@@ -259,937 +209,762 @@ static size_t escaped_len(const char *s, int hide_control) {
     return len;
 }
 
-
-void list_directory(const char *path, ColorMode color_mode, HyperlinkMode hyperlink_mode, int show_hidden, int almost_all, int long_format, int show_inode, int sort_time, int sort_atime, int sort_ctime, int sort_size, int sort_extension, int sort_version, const char *sort_word, int unsorted, int reverse, int dirs_first, int recursive, IndicatorStyle indicator_style, int human_readable, int human_si, int numeric_ids, int hide_owner, int hide_group, int show_context, int follow_links, int list_dirs_only, int ignore_backups, const char **ignore_patterns, size_t ignore_count, const char **hide_patterns, size_t hide_count, int columns, int across_columns, int one_per_line, int comma_separated, int output_width, int tabsize, int show_blocks, QuotingStyle quoting_style, const char *time_word, const char *time_style, unsigned block_size, int hide_control, int show_controls, int literal_names) {
-    recursion_depth++;
-    if (follow_links) {
-        struct stat vst;
-        if (stat(path, &vst) == 0) {
-            if (visited_contains(vst.st_dev, vst.st_ino)) {
-                fprintf(stderr, "warning: skipping cyclic directory '%s'\n", path);
-                FINALIZE();
-                return;
-            }
-            if (visited_add(vst.st_dev, vst.st_ino) == -1) {
-                perror("malloc");
-                FINALIZE();
-                return;
-            }
-        }
-    }
-    int use_color = 0;
-    if (color_mode == COLOR_ALWAYS)
-        use_color = 1;
-    else if (color_mode == COLOR_AUTO)
-        use_color = isatty(STDOUT_FILENO);
-    if (literal_names) {
-        quoting_style = QUOTE_LITERAL;
-        hide_control = 0;
-        show_controls = 0;
-    }
-    int quote_names = (quoting_style == QUOTE_C);
-    int escape_nonprint = (quoting_style == QUOTE_C || quoting_style == QUOTE_ESCAPE);
-    if (show_controls) {
-        hide_control = 0;
-        escape_nonprint = 0;
+static void resolve_entries(int dfd, const char *dir, Entry *entries, size_t count, int use_color,
+                            int with_context) {
+    for (size_t i = 0; i < count; i++) {
+        entries[i].color = use_color ? entry_color(dfd, dir, entries[i].name, entries[i].st.st_mode)
+                                     : COLOR_TYPE_NONE;
+        entries[i].context = with_context ? context_lookup(entries[i].name) : 0;
     }
+}
 
-    long pw_bufsz_l = sysconf(_SC_GETPW_R_SIZE_MAX);
-    if (pw_bufsz_l < 0)
-        pw_bufsz_l = 16384;
-    size_t pw_bufsz = (size_t)pw_bufsz_l;
-    char *pwbuf = malloc(pw_bufsz);
-    if (!pwbuf) {
-        perror("malloc");
-        FINALIZE();
-        return;
-    }
-    long gr_bufsz_l = sysconf(_SC_GETGR_R_SIZE_MAX);
-    if (gr_bufsz_l < 0)
-        gr_bufsz_l = 16384;
-    size_t gr_bufsz = (size_t)gr_bufsz_l;
-    char *grbuf = malloc(gr_bufsz);
-    if (!grbuf) {
-        perror("malloc");
-        free(pwbuf);
-        FINALIZE();
-        return;
-    }
-    if (list_dirs_only) {
-        struct stat st;
-        int (*stat_fn)(const char *, struct stat *) = follow_links ? stat : lstat;
-        if (stat_fn(path, &st) == -1) {
-            fprintf(stderr, "stat: %s: %s\n", path, strerror(errno));
-            free(pwbuf);
-            free(grbuf);
-            FINALIZE();
-            return;
-        }
+/* ---- text rendering ---- */
 
-        const char *prefix = "";
-        const char *suffix = "";
-        const char *indicator = "";
-        if (use_color) {
-            if (S_ISDIR(st.st_mode))
-                prefix = color_dir();
-            else if (S_ISLNK(st.st_mode))
-                prefix = color_link();
-            else if (st.st_mode & S_IXUSR)
-                prefix = color_exec();
-            suffix = color_reset();
-        }
-        switch (indicator_style) {
-        case INDICATOR_CLASSIFY:
-            if (S_ISDIR(st.st_mode))
-                indicator = "/";
-            else if (S_ISLNK(st.st_mode))
-                indicator = "@";
-            else if (st.st_mode & S_IXUSR)
-                indicator = "*";
-            break;
-        case INDICATOR_FILE_TYPE:
-            if (S_ISDIR(st.st_mode))
-                indicator = "/";
-            else if (S_ISLNK(st.st_mode))
-                indicator = "@";
-            break;
-        case INDICATOR_SLASH:
-            if (S_ISDIR(st.st_mode))
-                indicator = "/";
-            break;
-        default:
-            break;
+/* What the text renderer needs besides the entries, with the column
+ * widths measured over them. */
+typedef struct {
+    FILE *out;
+    const char *path;
+    int dfd;
+    int use_color;
+    HyperlinkMode hyperlink_mode;
+    IndicatorStyle indicator_style;
+    QuotingStyle quoting_style;
+    int hide_control, show_controls, literal_names, quote_names, escape_nonprint;
+    int long_format, one_per_line, columns, across_columns, comma_separated;
+    int output_width, tabsize;
+    int show_inode, show_blocks;
+    unsigned block_size;
+    int human_readable, human_si, numeric_ids, hide_owner, hide_group, show_context;
+    const char *time_word, *time_style;
+    int sort_atime, sort_ctime;
+    ListWidths w;
+    /* list_lines: printed before and after the line being rendered. */
+    const char *mark, *note;
+} Layout;
+
+typedef enum { RENDER_COMMAS, RENDER_ACROSS, RENDER_DOWN, RENDER_LINES } RenderMode;
+
+/* Where a listing's output has got to, for the layouts that take their
+ * entries in display order. */
+typedef struct {
+    RenderMode mode;
+    size_t count, i;
+    size_t cols, rows, col_width;
+    size_t line_len;
+} Render;
+
+/* The block count and inode columns of the short formats, and the width
+ * of the whole cell. */
+typedef struct {
+    char block_buf[32];
+    char inode_buf[32];
+    size_t len;
+} Cell;
+
+static unsigned long entry_blocks(const Layout *lay, const Entry *ent) {
+    return (unsigned long)((ent->st.st_blocks * 512 + lay->block_size - 1) / lay->block_size);
+}
+
+static size_t name_width(const Layout *lay, const char *name) {
+    return lay->quote_names ? quoted_len(name, lay->escape_nonprint, lay->hide_control) :
+           (lay->escape_nonprint ? escaped_len(name, lay->hide_control) : strlen(name));
+}
+
+/* Widen LAY's columns to fit ENTRIES; a spilled listing is measured one
+ * run at a time. */
+static void layout_measure(Layout *lay, const Entry *entries, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        const Entry *ent = &entries[i];
+        unsigned long blk = entry_blocks(lay, ent);
+        if (lay->long_format || lay->show_blocks)
+            lay->w.total_blocks += blk;
+        if (lay->show_blocks) {
+            size_t d = num_digits(blk);
+            if (d > lay->w.block_w)
+                lay->w.block_w = d;
         }
 
-        unsigned long single_blocks = (unsigned long)((st.st_blocks * 512 + block_size - 1) / block_size);
-        size_t single_w = num_digits(single_blocks);
-        size_t link_w = num_digits(st.st_nlink);
+        if (lay->long_format) {
+            if (num_digits(ent->st.st_nlink) > lay->w.link_w)
+                lay->w.link_w = num_digits(ent->st.st_nlink);
 
-        if (long_format) {
-            char size_buf[16];
-            if (human_readable)
-                human_size(st.st_size, human_si, size_buf, sizeof(size_buf));
-            else
-                snprintf(size_buf, sizeof(size_buf), "%lld", (long long)st.st_size);
-
-            struct passwd pw;
-            struct passwd *pw_res = NULL;
-            const char *owner_buf = NULL;
-            char owner_num[32];
-            if (!numeric_ids && getpwuid_r(st.st_uid, &pw, pwbuf, pw_bufsz, &pw_res) == 0 && pw_res)
-                owner_buf = pw_res->pw_name;
-            else {
-                snprintf(owner_num, sizeof(owner_num), "%u", st.st_uid);
-                owner_buf = owner_num;
+            if (!lay->hide_owner) {
+                const char *name = lay->numeric_ids ? NULL : idcache_user(ent->st.st_uid);
+                size_t len;
+                if (name)
+                    len = strlen(name);
+                else
+                    len = num_digits(ent->st.st_uid);
+                if (len > lay->w.owner_w)
+                    lay->w.owner_w = len;
             }
 
-            struct group gr;
-            struct group *gr_res = NULL;
-            const char *group_buf = NULL;
-            char group_num[32];
-            if (!numeric_ids && getgrgid_r(st.st_gid, &gr, grbuf, gr_bufsz, &gr_res) == 0 && gr_res)
-                group_buf = gr_res->gr_name;
-            else {
-                snprintf(group_num, sizeof(group_num), "%u", st.st_gid);
-                group_buf = group_num;
+            if (!lay->hide_group) {
+                const char *name = lay->numeric_ids ? NULL : idcache_group(ent->st.st_gid);
+                size_t len;
+                if (name)
+                    len = strlen(name);
+                else
+                    len = num_digits(ent->st.st_gid);
+                if (len > lay->w.group_w)
+                    lay->w.group_w = len;
             }
 
+            if (lay->show_context && context_width(ent->context) > lay->w.context_w)
+                lay->w.context_w = context_width(ent->context);
 
-            char perms[11];
-            perms[0] = S_ISDIR(st.st_mode) ? 'd' :
-                       S_ISLNK(st.st_mode) ? 'l' :
-                       S_ISCHR(st.st_mode) ? 'c' :
-                       S_ISBLK(st.st_mode) ? 'b' :
-                       S_ISFIFO(st.st_mode) ? 'p' :
-                       S_ISSOCK(st.st_mode) ? 's' : '-';
-            perms[1] = (st.st_mode & S_IRUSR) ? 'r' : '-';
-            perms[2] = (st.st_mode & S_IWUSR) ? 'w' : '-';
-            perms[3] = (st.st_mode & S_IXUSR)
-                        ? ((st.st_mode & S_ISUID) ? 's' : 'x')
-                        : ((st.st_mode & S_ISUID) ? 'S' : '-');
-            perms[4] = (st.st_mode & S_IRGRP) ? 'r' : '-';
-            perms[5] = (st.st_mode & S_IWGRP) ? 'w' : '-';
-            perms[6] = (st.st_mode & S_IXGRP)
-                        ? ((st.st_mode & S_ISGID) ? 's' : 'x')
-                        : ((st.st_mode & S_ISGID) ? 'S' : '-');
-            perms[7] = (st.st_mode & S_IROTH) ? 'r' : '-';
-            perms[8] = (st.st_mode & S_IWOTH) ? 'w' : '-';
-            perms[9] = (st.st_mode & S_IXOTH)
-                        ? ((st.st_mode & S_ISVTX) ? 't' : 'x')
-                        : ((st.st_mode & S_ISVTX) ? 'T' : '-');
-            perms[10] = '\0';
-
-            size_t time_buf_sz = strlen(time_style) * 4 + 32;
-            char *time_buf = malloc(time_buf_sz);
-            if (!time_buf) {
-                perror("malloc");
-                goto cleanup;
-            }
-            const time_t *tptr = &st.st_mtime;
-            if (time_word) {
-                if (strcmp(time_word, "access") == 0 || strcmp(time_word, "use") == 0)
-                    tptr = &st.st_atime;
-                else if (strcmp(time_word, "status") == 0)
-                    tptr = &st.st_ctime;
-            } else {
-                if (sort_atime)
-                    tptr = &st.st_atime;
-                else if (sort_ctime)
-                    tptr = &st.st_ctime;
-            }
-            struct tm *tm = localtime(tptr);
-            strftime(time_buf, time_buf_sz, time_style, tm);
-
-            size_t owner_len = strlen(owner_buf);
-            size_t group_len = strlen(group_buf);
-
-            if (show_blocks)
-                printf("%*lu ", (int)single_w, single_blocks);
-            if (show_inode)
-                printf("%10llu ", (unsigned long long)st.st_ino);
-            printf("%s %*lu ", perms, (int)link_w, (unsigned long)st.st_nlink);
-            if (!hide_owner)
-                printf("%-*s ", (int)owner_len, owner_buf);
-            if (!hide_group)
-                printf("%-*s ", (int)group_len, group_buf);
-            printf("%*s %s", (int)strlen(size_buf), size_buf, time_buf);
-            free(time_buf);
-            if (show_context) {
-#if HAVE_SELINUX
-                char *ctx = NULL;
-                if (lgetfilecon(path, &ctx) >= 0) {
-                    printf(" %s", ctx);
-                    freecon(ctx);
-                } else {
-                    printf(" -");
-                }
-#else
-                printf(" -");
-#endif
-            }
-            printf(" %s", prefix);
-            hyperlink_start(path, hyperlink_mode);
-            print_quoted(path, quoting_style, hide_control, show_controls, literal_names);
-            hyperlink_end(hyperlink_mode);
-            printf("%s%s\n", suffix, indicator);
-        } else {
-            if (show_blocks)
-                printf("%*lu ", (int)single_w, single_blocks);
-            if (show_inode) {
-                printf("%10llu %s", (unsigned long long)st.st_ino, prefix);
-                hyperlink_start(path, hyperlink_mode);
-                print_quoted(path, quoting_style, hide_control, show_controls, literal_names);
-                hyperlink_end(hyperlink_mode);
-                printf("%s%s\n", suffix, indicator);
-            }
-            else {
-                fputs(prefix, stdout);
-                hyperlink_start(path, hyperlink_mode);
-                print_quoted(path, quoting_style, hide_control, show_controls, literal_names);
-                hyperlink_end(hyperlink_mode);
-                printf("%s%s\n", suffix, indicator);
-            }
+            char sz[16];
+            if (lay->human_readable)
+                human_size(ent->st.st_size, lay->human_si, sz, sizeof(sz));
+            else
+                snprintf(sz, sizeof(sz), "%lld", (long long)ent->st.st_size);
+            size_t len_sz = strlen(sz);
+            if (len_sz > lay->w.size_w)
+                lay->w.size_w = len_sz;
         }
-        FINALIZE();
-        return;
+
+        size_t name_len = name_width(lay, ent->name);
+        if (lay->show_inode)
+            name_len += num_digits(ent->st.st_ino) + 1;
+        name_len += strlen(indicator_for(ent->st.st_mode, lay->indicator_style));
+        if (lay->use_color)
+            name_len += color_code_len(ent->color) + color_reset_len();
+        if (name_len > lay->w.max_len)
+            lay->w.max_len = name_len;
     }
+}
 
-    DIR *dir = opendir(path);
-    if (!dir) {
-        fprintf(stderr, "opendir: %s: %s\n", path, strerror(errno));
-        free(pwbuf);
-        free(grbuf);
-        FINALIZE();
-        return;
+static void cell_measure(const Layout *lay, const Entry *ent, Cell *cell) {
+    cell->block_buf[0] = '\0';
+    if (lay->show_blocks)
+        snprintf(cell->block_buf, sizeof(cell->block_buf), "%*lu ", (int)lay->w.block_w, entry_blocks(lay, ent));
+    cell->inode_buf[0] = '\0';
+    if (lay->show_inode)
+        snprintf(cell->inode_buf, sizeof(cell->inode_buf), "%10llu ", (unsigned long long)ent->st.st_ino);
+    cell->len = name_width(lay, ent->name) + strlen(indicator_for(ent->st.st_mode, lay->indicator_style)) +
+                strlen(cell->inode_buf) + strlen(cell->block_buf);
+    if (lay->use_color)
+        cell->len += color_code_len(ent->color) + color_reset_len();
+}
+
+static int cell_print(const Layout *lay, const Entry *ent, const Cell *cell) {
+    char *fullpath = entry_path(lay->path, ent->name);
+    if (!fullpath) {
+        perror("malloc");
+        return -1;
     }
+    fprintf(lay->out, "%s%s%s", cell->block_buf, cell->inode_buf, lay->use_color ? color_code(ent->color) : "");
+    hyperlink_start(lay->out, fullpath, lay->hyperlink_mode);
+    print_quoted(lay->out, ent->name, lay->quoting_style, lay->hide_control, lay->show_controls, lay->literal_names);
+    hyperlink_end(lay->out, lay->hyperlink_mode);
+    fprintf(lay->out, "%s%s", lay->use_color ? color_reset() : "", indicator_for(ent->st.st_mode, lay->indicator_style));
+    free(fullpath);
+    return 0;
+}
 
-    if (recursive) {
-        hyperlink_start(path, hyperlink_mode);
-        print_quoted(path, quoting_style, hide_control, show_controls, literal_names);
-        hyperlink_end(hyperlink_mode);
-        printf(":\n");
+/* A grid cell, then padding to the next column or the end of the row. */
+static int cell_place(const Layout *lay, const Render *rd, const Entry *ent, int last) {
+    Cell cell;
+    cell_measure(lay, ent, &cell);
+    if (cell_print(lay, ent, &cell) == -1)
+        return -1;
+    if (last) {
+        fputc('\n', lay->out);
+    } else {
+        for (size_t sp = cell.len; sp < rd->col_width; sp++)
+            fputc(' ', lay->out);
     }
+    return 0;
+}
 
-    struct dirent *entry;
-    size_t count = 0, capacity = 32;
-    Entry *entries = malloc(capacity * sizeof(Entry));
-    if (!entries) {
+static int print_line(const Layout *lay, const Entry *ent) {
+    unsigned long blk = entry_blocks(lay, ent);
+    const char *prefix = lay->use_color ? color_code(ent->color) : "";
+    const char *suffix = lay->use_color ? color_reset() : "";
+    const char *indicator = indicator_for(ent->st.st_mode, lay->indicator_style);
+
+    if (lay->mark)
+        fputs(lay->mark, lay->out);
+    if (lay->long_format || lay->one_per_line || !lay->columns) {
+        char size_buf[16];
+        if (lay->human_readable)
+            human_size(ent->st.st_size, lay->human_si, size_buf, sizeof(size_buf));
+        else
+            snprintf(size_buf, sizeof(size_buf), "%lld", (long long)ent->st.st_size);
+
+        const char *owner_buf = lay->numeric_ids ? NULL : idcache_user(ent->st.st_uid);
+        char owner_num[32];
+        if (!owner_buf) {
+            snprintf(owner_num, sizeof(owner_num), "%u", ent->st.st_uid);
+            owner_buf = owner_num;
+        }
+
+        const char *group_buf = lay->numeric_ids ? NULL : idcache_group(ent->st.st_gid);
+        char group_num[32];
+        if (!group_buf) {
+            snprintf(group_num, sizeof(group_num), "%u", ent->st.st_gid);
+            group_buf = group_num;
+        }
+
+        char perms[11];
+        mode_string(ent->st.st_mode, perms);
+
+        size_t time_buf_sz = strlen(lay->time_style) * 4 + 32;
+        char *time_buf = malloc(time_buf_sz);
+        if (!time_buf) {
+            perror("malloc");
+            return -1;
+        }
+        const time_t *tptr = &ent->st.st_mtime;
+        if (lay->time_word) {
+            if (strcmp(lay->time_word, "access") == 0 || strcmp(lay->time_word, "use") == 0)
+                tptr = &ent->st.st_atime;
+            else if (strcmp(lay->time_word, "status") == 0)
+                tptr = &ent->st.st_ctime;
+        } else {
+            if (lay->sort_atime)
+                tptr = &ent->st.st_atime;
+            else if (lay->sort_ctime)
+                tptr = &ent->st.st_ctime;
+        }
+        struct tm tm;
+        localtime_r(tptr, &tm);
+        locale_need(LC_TIME);
+        strftime(time_buf, time_buf_sz, lay->time_style, &tm);
+
+        if (lay->show_blocks)
+            fprintf(lay->out, "%*lu ", (int)lay->w.block_w, blk);
+        if (lay->show_inode)
+            fprintf(lay->out, "%10llu ", (unsigned long long)ent->st.st_ino);
+        fprintf(lay->out, "%s %*lu ", perms, (int)lay->w.link_w, (unsigned long)ent->st.st_nlink);
+        if (!lay->hide_owner)
+            fprintf(lay->out, "%-*s ", (int)lay->w.owner_w, owner_buf);
+        if (!lay->hide_group)
+            fprintf(lay->out, "%-*s ", (int)lay->w.group_w, group_buf);
+        fprintf(lay->out, "%*s %s", (int)lay->w.size_w, size_buf, time_buf);
+        free(time_buf);
+        if (lay->show_context)
+            fprintf(lay->out, " %-*s", (int)lay->w.context_w, context_str(ent->context));
+        fprintf(lay->out, " %s", prefix);
+    } else {
+        if (lay->show_blocks)
+            fprintf(lay->out, "%*lu ", (int)lay->w.block_w, blk);
+        if (lay->show_inode)
+            fprintf(lay->out, "%10llu ", (unsigned long long)ent->st.st_ino);
+        fputs(prefix, lay->out);
+    }
+    char *fullpath = entry_path(lay->path, ent->name);
+    if (!fullpath) {
         perror("malloc");
-        closedir(dir);
-        free(pwbuf);
-        free(grbuf);
-        FINALIZE();
-        return;
+        return -1;
     }
+    hyperlink_start(lay->out, fullpath, lay->hyperlink_mode);
+    print_quoted(lay->out, ent->name, lay->quoting_style, lay->hide_control, lay->show_controls, lay->literal_names);
+    hyperlink_end(lay->out, lay->hyperlink_mode);
+    free(fullpath);
+    const char *target = lay->long_format && S_ISLNK(ent->st.st_mode) && lay->dfd != LINK_GONE
+                             ? linkcache_target(lay->dfd, lay->path, ent->name) : NULL;
+    fprintf(lay->out, "%s%s", suffix, target ? "" : indicator);
+    if (target)
+        print_target(lay->out, lay->path, ent->name, target, lay->use_color, lay->indicator_style,
+                     lay->quoting_style, lay->hide_control, lay->show_controls, lay->literal_names);
+    if (lay->note)
+        fputs(lay->note, lay->out);
+    fputc('\n', lay->out);
+    return 0;
+}
 
-    while ((entry = readdir(dir)) != NULL) {
-        if (!show_hidden && !almost_all && entry->d_name[0] == '.')
-            continue;
-        if (almost_all && (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0))
-            continue;
-        if (hide_patterns && !show_hidden && !almost_all) {
-            int hide = 0;
-            for (size_t i = 0; i < hide_count && !hide; i++)
-                if (fnmatch(hide_patterns[i], entry->d_name, 0) == 0)
-                    hide = 1;
-            if (hide)
-                continue;
-        }
-        if (ignore_backups) {
-            size_t len = strlen(entry->d_name);
-            if (len > 0 && entry->d_name[len - 1] == '~')
-                continue;
-        }
-        if (ignore_patterns) {
-            int matched = 0;
-            for (size_t i = 0; i < ignore_count && !matched; i++)
-                if (fnmatch(ignore_patterns[i], entry->d_name, 0) == 0)
-                    matched = 1;
-            if (matched)
-                continue;
-        }
-        if (count == capacity) {
-            capacity *= 2;
-            Entry *tmp = realloc(entries, capacity * sizeof(Entry));
-            if (!tmp) {
-                perror("realloc");
-                goto cleanup;
-            }
-            entries = tmp;
-        }
-        entries[count].name = strdup(entry->d_name);
-        if (!entries[count].name) {
-            perror("strdup");
-            goto cleanup;
-        }
-        char *fullpath = join_path(path, entries[count].name);
-        if (!fullpath) {
-            perror("malloc");
-            goto cleanup;
-        }
-        int (*stat_fn)(const char *, struct stat *) = follow_links ? stat : lstat;
-        if (stat_fn(fullpath, &entries[count].st) == -1) {
-            fprintf(stderr, "stat: %s: %s\n", fullpath, strerror(errno));
-            free(fullpath);
-            free(entries[count].name);
-            continue;
+/* Pick the layout for COUNT entries; an empty grid is a blank line. */
+static void render_begin(const Layout *lay, Render *rd, size_t count) {
+    memset(rd, 0, sizeof(*rd));
+    rd->count = count;
+    if (lay->comma_separated && !lay->long_format) {
+        rd->mode = RENDER_COMMAS;
+    } else if (!lay->long_format && lay->columns && !lay->one_per_line) {
+        rd->mode = lay->across_columns ? RENDER_ACROSS : RENDER_DOWN;
+        if (count == 0) {
+            fputc('\n', lay->out);
+            return;
         }
-        free(fullpath);
-        count++;
+        rd->col_width = ((lay->w.max_len + lay->tabsize - 1) / lay->tabsize) * lay->tabsize + 2;
+        rd->cols = lay->output_width / (int)rd->col_width;
+        if (rd->cols == 0)
+            rd->cols = 1;
+        if (rd->cols > count)
+            rd->cols = count;
+        rd->rows = (count + rd->cols - 1) / rd->cols;
+    } else {
+        rd->mode = RENDER_LINES;
     }
+}
 
-    if (!unsorted) {
-        int (*cmp)(const void *, const void *) = cmp_names;
-        if (sort_word) {
-            if (strcmp(sort_word, "size") == 0)
-                cmp = cmp_size;
-            else if (strcmp(sort_word, "time") == 0)
-                cmp = cmp_mtime;
-            else if (strcmp(sort_word, "atime") == 0)
-                cmp = cmp_atime;
-            else if (strcmp(sort_word, "ctime") == 0)
-                cmp = cmp_ctime;
-            else if (strcmp(sort_word, "extension") == 0)
-                cmp = cmp_extension;
-            else if (strcmp(sort_word, "version") == 0)
-                cmp = cmp_version;
+/* The next entry in display order, for every layout but RENDER_DOWN. */
+static int render_next(const Layout *lay, Render *rd, const Entry *ent) {
+    size_t i = rd->i++;
+    if (rd->mode == RENDER_ACROSS)
+        return cell_place(lay, rd, ent, i % rd->cols == rd->cols - 1 || i == rd->count - 1);
+    if (rd->mode != RENDER_COMMAS)
+        return print_line(lay, ent);
+
+    Cell cell;
+    cell_measure(lay, ent, &cell);
+    if (rd->line_len && rd->line_len + cell.len > (size_t)lay->output_width) {
+        fputc('\n', lay->out);
+        rd->line_len = 0;
+    }
+    if (cell_print(lay, ent, &cell) == -1)
+        return -1;
+    rd->line_len += cell.len;
+    if (i < rd->count - 1) {
+        if (rd->line_len + 2 > (size_t)lay->output_width) {
+            fputc('\n', lay->out);
+            rd->line_len = 0;
         } else {
-            if (sort_size)
-                cmp = cmp_size;
-            else if (sort_time)
-                cmp = cmp_mtime;
-            else if (sort_atime)
-                cmp = cmp_atime;
-            else if (sort_ctime)
-                cmp = cmp_ctime;
-            else if (sort_extension)
-                cmp = cmp_extension;
-            else if (sort_version)
-                cmp = cmp_version;
+            fprintf(lay->out, ", ");
+            rd->line_len += 2;
         }
-        qsort(entries, count, sizeof(Entry), cmp);
+    } else {
+        fputc('\n', lay->out);
     }
+    return 0;
+}
 
-    if (dirs_first && count > 1) {
-        Entry *tmp = malloc(count * sizeof(Entry));
-        if (!tmp) {
-            perror("malloc");
-            goto cleanup;
-        }
-        size_t di = 0;
-        size_t fi = 0;
-        for (size_t i = 0; i < count; i++)
-            if (S_ISDIR(entries[i].st.st_mode))
-                fi++;
-        di = 0;
-        size_t dir_total = fi;
-        fi = dir_total;
-        for (size_t i = 0; i < count; i++) {
-            if (S_ISDIR(entries[i].st.st_mode))
-                tmp[di++] = entries[i];
-            else
-                tmp[fi++] = entries[i];
-        }
-        memcpy(entries, tmp, count * sizeof(Entry));
-        free(tmp);
-    }
+/* Entry I of the RENDER_DOWN grid, in column C. */
+static int render_down(const Layout *lay, const Render *rd, const Entry *ent, size_t c, size_t i) {
+    return cell_place(lay, rd, ent, c == rd->cols - 1 || i + rd->rows >= rd->count);
+}
 
-    size_t link_w = 0, owner_w = 0, group_w = 0, size_w = 0, block_w = 0;
-    unsigned long total_blocks = 0;
-    size_t max_len = 0;
-    for (size_t i = 0; i < count; i++) {
-        const Entry *ent = &entries[i];
-        unsigned long blk = (unsigned long)((ent->st.st_blocks * 512 + block_size - 1) / block_size);
-        if (long_format || show_blocks)
-            total_blocks += blk;
-        if (show_blocks) {
-            size_t d = num_digits(blk);
-            if (d > block_w)
-                block_w = d;
-        }
+/* A directory's entries in display order: an array of them, or for the
+ * --watch screen an array of pointers into its own set. */
+typedef struct {
+    const Entry *array;
+    Entry *const *refs;
+} Shown;
 
-        if (long_format) {
-            if (num_digits(ent->st.st_nlink) > link_w)
-                link_w = num_digits(ent->st.st_nlink);
+static const Entry *shown_at(const Shown *shown, size_t i) {
+    return shown->refs ? shown->refs[i] : &shown->array[i];
+}
 
-            if (!hide_owner) {
-                struct passwd pw;
-                struct passwd *pw_res = NULL;
-                size_t len;
-                if (!numeric_ids && getpwuid_r(ent->st.st_uid, &pw, pwbuf, pw_bufsz, &pw_res) == 0 && pw_res)
-                    len = strlen(pw_res->pw_name);
-                else
-                    len = num_digits(ent->st.st_uid);
-                if (len > owner_w)
-                    owner_w = len;
+/* COUNT entries in display order, up to the first MAX_ROWS rows of the
+ * layout; comma-separated output has no rows to count and is printed
+ * whole. */
+static int render_entries(const Layout *lay, const Shown *shown, size_t count, size_t max_rows) {
+    Render rd;
+    render_begin(lay, &rd, count);
+    int rc = 0;
+    if (rd.mode == RENDER_DOWN) {
+        for (size_t r = 0; rc == 0 && r < rd.rows && r < max_rows; r++) {
+            for (size_t c = 0; rc == 0 && c < rd.cols; c++) {
+                size_t i = c * rd.rows + r;
+                if (i < count)
+                    rc = render_down(lay, &rd, shown_at(shown, i), c, i);
             }
+        }
+        return rc;
+    }
+    size_t n = count;
+    if (rd.mode == RENDER_LINES && max_rows < n)
+        n = max_rows;
+    else if (rd.mode == RENDER_ACROSS && max_rows < rd.rows)
+        n = max_rows * rd.cols;
+    for (size_t i = 0; rc == 0 && i < n; i++)
+        rc = render_next(lay, &rd, shown_at(shown, i));
+    return rc;
+}
 
-            if (!hide_group) {
-                struct group gr;
-                struct group *gr_res = NULL;
-                size_t len;
-                if (!numeric_ids && getgrgid_r(ent->st.st_gid, &gr, grbuf, gr_bufsz, &gr_res) == 0 && gr_res)
-                    len = strlen(gr_res->gr_name);
-                else
-                    len = num_digits(ent->st.st_gid);
-                if (len > group_w)
-                    group_w = len;
-            }
+/* "PATH:" above a directory's entries. */
+static void print_header(const Layout *lay, const char *path) {
+    hyperlink_start(lay->out, path, lay->hyperlink_mode);
+    print_quoted(lay->out, path, lay->quoting_style, lay->hide_control, lay->show_controls, lay->literal_names);
+    hyperlink_end(lay->out, lay->hyperlink_mode);
+    fprintf(lay->out, ":\n");
+}
 
-            char sz[16];
-            if (human_readable)
-                human_size(ent->st.st_size, human_si, sz, sizeof(sz));
+/* ---- spilled listings ---- */
+
+typedef struct {
+    const Layout *lay;
+    Render *rd;
+    /* RENDER_DOWN: the merged entries again, a run per column. */
+    SpillSet *grid;
+    size_t in_run;
+} SpillOut;
+
+static int spill_emit(SpillOut *out, const Entry *ent) {
+    if (!out->grid)
+        return render_next(out->lay, out->rd, ent);
+    if (spill_add(out->grid, ent) == -1)
+        return -1;
+    if (++out->in_run < out->rd->rows)
+        return 0;
+    out->in_run = 0;
+    return spill_end_run(out->grid);
+}
+
+/* Print the RENDER_DOWN grid row by row, reading each column's run. */
+static int render_grid(const Layout *lay, const Render *rd, SpillSet *grid) {
+    size_t used = spill_run_count(grid);
+    SpillReader **readers = calloc(used, sizeof(SpillReader *));
+    if (!readers) {
+        perror("calloc");
+        return -1;
+    }
+    int rc = 0;
+    for (size_t c = 0; rc == 0 && c < used; c++)
+        if (!(readers[c] = spill_reader(grid, c)))
+            rc = -1;
+    for (size_t r = 0; rc == 0 && r < rd->rows; r++) {
+        for (size_t c = 0; rc == 0 && c < used; c++) {
+            size_t i = c * rd->rows + r;
+            if (i >= rd->count)
+                continue;
+            Entry ent;
+            if (spill_read(readers[c], &ent) != 1)
+                rc = -1;
             else
-                snprintf(sz, sizeof(sz), "%lld", (long long)ent->st.st_size);
-            size_t len_sz = strlen(sz);
-            if (len_sz > size_w)
-                size_w = len_sz;
+                rc = render_down(lay, rd, &ent, c, i);
         }
+    }
+    for (size_t c = 0; c < used; c++)
+        spill_reader_close(readers[c]);
+    free(readers);
+    return rc;
+}
 
-        size_t name_len = quote_names ? quoted_len(ent->name, escape_nonprint, hide_control) :
-                            (escape_nonprint ? escaped_len(ent->name, hide_control) : strlen(ent->name));
-        if (show_inode)
-            name_len += num_digits(ent->st.st_ino) + 1;
-        switch (indicator_style) {
-        case INDICATOR_CLASSIFY:
-            if (S_ISDIR(ent->st.st_mode) || (ent->st.st_mode & S_IXUSR) || S_ISLNK(ent->st.st_mode))
-                name_len += 1;
-            break;
-        case INDICATOR_FILE_TYPE:
-            if (S_ISDIR(ent->st.st_mode) || S_ISLNK(ent->st.st_mode))
-                name_len += 1;
-            break;
-        case INDICATOR_SLASH:
-            if (S_ISDIR(ent->st.st_mode))
-                name_len += 1;
-            break;
-        default:
-            break;
-        }
-        if (use_color) {
-            const char *pfx = "";
-            if (S_ISDIR(ent->st.st_mode))
-                pfx = color_dir();
-            else if (S_ISLNK(ent->st.st_mode))
-                pfx = color_link();
-            else if (ent->st.st_mode & S_IXUSR)
-                pfx = color_exec();
-            name_len += strlen(pfx) + strlen(color_reset());
-        }
-        if (name_len > max_len)
-            max_len = name_len;
+/* Render the merged runs of the spilled directory the walk is on. */
+static int render_spilled(const Listing *ls, VlsWalk *walk, const Layout *lay, size_t count) {
+    Render rd;
+    render_begin(lay, &rd, count);
+    SpillOut out = {lay, &rd, NULL, 0};
+    if (rd.mode == RENDER_DOWN && count && !(out.grid = spill_open(ls->walk.memory_limit)))
+        return -1;
+    Entry ent;
+    int got, rc = 0;
+    while (rc == 0 && (got = vls_dir_read(walk, &ent)) == 1)
+        rc = spill_emit(&out, &ent);
+    if (rc == 0 && got == -1)
+        rc = -1;
+    if (rc == 0 && out.grid && (rc = spill_end_run(out.grid)) == 0)
+        rc = render_grid(lay, &rd, out.grid);
+    spill_close(out.grid);
+    return rc == 0 ? 0 : -1;
+}
+
+/* ---- listings ---- */
+
+void list_init(Listing *ls, const Args *args) {
+    /* Targets are stat'ed afresh for every listing. */
+    linkcache_clear();
+    memset(ls, 0, sizeof(*ls));
+    ls->args = args;
+    VlsOptions *o = &ls->walk;
+    vls_options_init(o);
+    o->show_hidden = args->show_hidden;
+    o->almost_all = args->almost_all;
+    o->ignore_backups = args->ignore_backups;
+    o->ignore_patterns = args->ignore_patterns;
+    o->ignore_count = args->ignore_count;
+    o->hide_patterns = args->hide_patterns;
+    o->hide_count = args->hide_count;
+    o->sort = args->unsorted ? VLS_SORT_NONE
+                             : sort_key(args->sort_word, args->sort_time, args->sort_atime, args->sort_ctime,
+                                        args->sort_size, args->sort_extension, args->sort_version);
+    o->reverse = args->reverse;
+    o->dirs_first = args->dirs_first;
+    o->follow_links = args->follow_links;
+    o->recursive = args->recursive;
+    o->max_depth = args->max_depth;
+    o->one_file_system = args->one_file_system;
+    o->max_entries = args->max_entries;
+    o->inode_order = args->inode_order;
+    /* A summary takes the entries as they come; only the text renderer
+     * reads a spilled directory's merged runs. */
+    if (args->summary) {
+        o->sort = VLS_SORT_NONE;
+        o->reverse = 0;
+        o->dirs_first = 0;
+    } else if (args->format == FORMAT_TEXT) {
+        o->memory_limit = args->memory_limit;
     }
+}
 
-    if (show_blocks)
-        max_len += block_w + 1;
+/* Set LAY up from the command line for the next directory. */
+static void layout_init(Layout *lay, const Args *a) {
+    memset(lay, 0, sizeof(*lay));
+    lay->out = stdout;
+    lay->dfd = -1;
+    lay->use_color = a->format == FORMAT_TEXT &&
+                     (a->color_mode == COLOR_ALWAYS || (a->color_mode == COLOR_AUTO && stdout_isatty()));
+    lay->hyperlink_mode = a->hyperlink_mode;
+    lay->indicator_style = a->indicator_style;
+    lay->quoting_style = a->quoting_style;
+    lay->hide_control = a->hide_control;
+    lay->show_controls = a->show_controls;
+    lay->literal_names = a->literal_names;
+    if (lay->literal_names) {
+        lay->quoting_style = QUOTE_LITERAL;
+        lay->hide_control = 0;
+        lay->show_controls = 0;
+    }
+    lay->quote_names = lay->quoting_style == QUOTE_C;
+    lay->escape_nonprint = lay->quoting_style == QUOTE_C || lay->quoting_style == QUOTE_ESCAPE;
+    if (lay->show_controls) {
+        lay->hide_control = 0;
+        lay->escape_nonprint = 0;
+    }
+    lay->long_format = a->long_format;
+    lay->one_per_line = a->one_per_line;
+    lay->columns = a->columns;
+    lay->across_columns = a->across_columns;
+    lay->comma_separated = a->comma_separated;
+    lay->output_width = a->output_width;
+    lay->tabsize = a->tabsize;
+    lay->show_inode = a->show_inode;
+    lay->show_blocks = a->show_blocks;
+    lay->block_size = a->block_size;
+    lay->human_readable = a->human_readable;
+    lay->human_si = a->human_si;
+    lay->numeric_ids = a->numeric_ids;
+    lay->hide_owner = a->hide_owner;
+    lay->hide_group = a->hide_group;
+    lay->show_context = a->show_context;
+    lay->time_word = a->time_word;
+    lay->time_style = a->time_style;
+    lay->sort_atime = a->sort_atime;
+    lay->sort_ctime = a->sort_ctime;
+}
 
-    if (long_format || show_blocks)
-        printf("total %lu\n", total_blocks);
+/* Outside a long listing, one bare name per line whatever the layout. */
+static void layout_names(Layout *lay) {
+    if (lay->long_format)
+        return;
+    lay->columns = 1;
+    lay->one_per_line = lay->across_columns = lay->comma_separated = 0;
+}
 
-    if (comma_separated && !long_format) {
-        int term_width = output_width;
-        size_t line_len = 0;
-        for (size_t i = 0; i < count; i++) {
-            size_t idx = reverse ? count - 1 - i : i;
-            const Entry *ent = &entries[idx];
-            unsigned long blk = (unsigned long)((ent->st.st_blocks * 512 + block_size - 1) / block_size);
-
-            const char *prefix = "";
-            const char *suffix = "";
-            const char *indicator = "";
-            if (use_color) {
-                if (S_ISDIR(ent->st.st_mode))
-                    prefix = color_dir();
-                else if (S_ISLNK(ent->st.st_mode))
-                    prefix = color_link();
-                else if (ent->st.st_mode & S_IXUSR)
-                    prefix = color_exec();
-                suffix = color_reset();
-            }
-            switch (indicator_style) {
-            case INDICATOR_CLASSIFY:
-                if (S_ISDIR(ent->st.st_mode))
-                    indicator = "/";
-                else if (S_ISLNK(ent->st.st_mode))
-                    indicator = "@";
-                else if (ent->st.st_mode & S_IXUSR)
-                    indicator = "*";
-                break;
-            case INDICATOR_FILE_TYPE:
-                if (S_ISDIR(ent->st.st_mode))
-                    indicator = "/";
-                else if (S_ISLNK(ent->st.st_mode))
-                    indicator = "@";
-                break;
-            case INDICATOR_SLASH:
-                if (S_ISDIR(ent->st.st_mode))
-                    indicator = "/";
-                break;
-            default:
-                break;
-            }
+typedef struct {
+    const Listing *ls;
+    Layout lay;
+    int text;
+} Pass;
+
+/* VlsPrepare: color the entries and widen the columns to fit them, while
+ * the directory is open; a spilled directory is measured a run at a time. */
+static void prepare_entries(void *arg, const VlsDir *dir, Entry *entries, size_t count) {
+    Pass *pass = arg;
+    Layout *lay = &pass->lay;
+    if (pass->ls->prepare)
+        pass->ls->prepare(pass->ls->prepare_arg, dir, entries, count);
+    if (!pass->text)
+        return;
+    lay->path = dir->path;
+    lay->dfd = dir->dfd;
+    int with_context = lay->show_context && lay->long_format;
+    if (with_context)
+        context_set_dir(dir->dfd, dir->path);
+    resolve_entries(dir->dfd, dir->path, entries, count, lay->use_color, with_context);
+    layout_measure(lay, entries, count);
+}
 
-            char block_buf[32] = "";
-            if (show_blocks)
-                snprintf(block_buf, sizeof(block_buf), "%*lu ", (int)block_w, blk);
-            char inode_buf[32] = "";
-            if (show_inode)
-                snprintf(inode_buf, sizeof(inode_buf), "%10llu ", (unsigned long long)ent->st.st_ino);
-
-            size_t len = strlen(block_buf) + strlen(inode_buf) +
-                         (quote_names ? quoted_len(ent->name, escape_nonprint, hide_control) :
-                          (escape_nonprint ? escaped_len(ent->name, hide_control) : strlen(ent->name))) +
-                         strlen(indicator) + strlen(prefix) + strlen(suffix);
-            if (line_len && line_len + len > (size_t)term_width) {
-                putchar('\n');
-                line_len = 0;
-            }
-            char *fullpath = join_path(path, ent->name);
-            if (!fullpath) {
-                perror("malloc");
-                goto cleanup;
-            }
-            printf("%s%s%s", block_buf, inode_buf, prefix);
-            hyperlink_start(fullpath, hyperlink_mode);
-            print_quoted(ent->name, quoting_style, hide_control, show_controls, literal_names);
-            hyperlink_end(hyperlink_mode);
-            printf("%s%s", suffix, indicator);
-            free(fullpath);
-            line_len += len;
-            if (i < count - 1) {
-                if (line_len + 2 > (size_t)term_width) {
-                    putchar('\n');
-                    line_len = 0;
-                } else {
-                    printf(", ");
-                    line_len += 2;
-                }
-            } else {
-                putchar('\n');
-            }
-        }
-    } else if (!long_format && columns && !one_per_line) {
-        if (count == 0) {
-            putchar('\n');
-        } else {
-            int term_width = output_width;
-            size_t col_width = ((max_len + tabsize - 1) / tabsize) * tabsize + 2;
-            size_t cols = term_width / (int)col_width;
-            if (cols == 0)
-                cols = 1;
-            if (cols > count)
-                cols = count;
-            size_t rows = (count + cols - 1) / cols;
-
-        if (across_columns) {
-            for (size_t i = 0; i < count; i++) {
-                size_t idx = reverse ? count - 1 - i : i;
-                const Entry *ent = &entries[idx];
-                unsigned long blk = (unsigned long)((ent->st.st_blocks * 512 + block_size - 1) / block_size);
-
-            const char *prefix = "";
-            const char *suffix = "";
-            const char *indicator = "";
-            if (use_color) {
-                if (S_ISDIR(ent->st.st_mode))
-                    prefix = color_dir();
-                else if (S_ISLNK(ent->st.st_mode))
-                    prefix = color_link();
-                else if (ent->st.st_mode & S_IXUSR)
-                    prefix = color_exec();
-                suffix = color_reset();
-            }
-            switch (indicator_style) {
-            case INDICATOR_CLASSIFY:
-                if (S_ISDIR(ent->st.st_mode))
-                    indicator = "/";
-                else if (S_ISLNK(ent->st.st_mode))
-                    indicator = "@";
-                else if (ent->st.st_mode & S_IXUSR)
-                    indicator = "*";
-                break;
-            case INDICATOR_FILE_TYPE:
-                if (S_ISDIR(ent->st.st_mode))
-                    indicator = "/";
-                else if (S_ISLNK(ent->st.st_mode))
-                    indicator = "@";
-                break;
-            case INDICATOR_SLASH:
-                if (S_ISDIR(ent->st.st_mode))
-                    indicator = "/";
-                break;
-            default:
-                break;
-            }
+static int render_dir(const Listing *ls, VlsWalk *walk, Pass *pass, const VlsDir *dir) {
+    const Args *a = ls->args;
+    Layout *lay = &pass->lay;
+    StatsMark mark = dir->mark;
+    int rc = 0;
+
+    if (dir->path && a->recursive && pass->text)
+        print_header(lay, dir->path);
+    for (size_t i = 0; i < dir->failed_count; i++)
+        fprintf(stderr, "stat: %s/%s: %s\n", dir->path, dir->failed[i].name, strerror(dir->failed[i].err));
+
+    if (summary_mode() != SUMMARY_NONE) {
+        Summary *acc = summary_run();
+        for (size_t i = 0; acc && i < dir->count; i++)
+            if (strcmp(dir->entries[i].name, ".") != 0 && strcmp(dir->entries[i].name, "..") != 0)
+                summary_add(acc, dir->entries[i].name, &dir->entries[i].st);
+    } else if (a->format != FORMAT_TEXT) {
+        emit_records(a->format, dir->dfd, dir->path, dir->entries, dir->count, a->numeric_ids);
+    } else {
+        if (lay->show_blocks)
+            lay->w.max_len += lay->w.block_w + 1;
+        STATS_LAP(STATS_MEASURE, mark);
 
-            char block_buf[32] = "";
-            if (show_blocks)
-                snprintf(block_buf, sizeof(block_buf), "%*lu ", (int)block_w, blk);
-            char inode_buf[32] = "";
-            if (show_inode)
-                snprintf(inode_buf, sizeof(inode_buf), "%10llu ", (unsigned long long)ent->st.st_ino);
-            char *fullpath = join_path(path, ent->name);
-            if (!fullpath) {
-                perror("malloc");
-                goto cleanup;
-            }
-            printf("%s%s%s", block_buf, inode_buf, prefix);
-            hyperlink_start(fullpath, hyperlink_mode);
-            print_quoted(ent->name, quoting_style, hide_control, show_controls, literal_names);
-            hyperlink_end(hyperlink_mode);
-            printf("%s%s", suffix, indicator);
-            free(fullpath);
-
-            size_t len = (quote_names ? quoted_len(ent->name, escape_nonprint, hide_control) :
-                           (escape_nonprint ? escaped_len(ent->name, hide_control) : strlen(ent->name))) +
-                         strlen(indicator) + strlen(inode_buf) + strlen(block_buf) +
-                         strlen(prefix) + strlen(suffix);
-            if ((i % cols == cols - 1) || i == count - 1) {
-                putchar('\n');
-            } else {
-                for (size_t sp = len; sp < col_width; sp++)
-                    putchar(' ');
-            }
-        }
+        if (dir->path && (lay->long_format || lay->show_blocks))
+            fprintf(lay->out, "total %lu\n", lay->w.total_blocks);
+
+        if (dir->spilled) {
+            rc = render_spilled(ls, walk, lay, dir->total);
         } else {
-            for (size_t r = 0; r < rows; r++) {
-                for (size_t c = 0; c < cols; c++) {
-                    size_t i = c * rows + r;
-                    if (i >= count)
-                        continue;
-                    size_t idx = reverse ? count - 1 - i : i;
-                    const Entry *ent = &entries[idx];
-                    unsigned long blk = (unsigned long)((ent->st.st_blocks * 512 + block_size - 1) / block_size);
-
-                    const char *prefix = "";
-                    const char *suffix = "";
-                    const char *indicator = "";
-                    if (use_color) {
-                        if (S_ISDIR(ent->st.st_mode))
-                            prefix = color_dir();
-                        else if (S_ISLNK(ent->st.st_mode))
-                            prefix = color_link();
-                        else if (ent->st.st_mode & S_IXUSR)
-                            prefix = color_exec();
-                        suffix = color_reset();
-                    }
-                    switch (indicator_style) {
-                    case INDICATOR_CLASSIFY:
-                        if (S_ISDIR(ent->st.st_mode))
-                            indicator = "/";
-                        else if (S_ISLNK(ent->st.st_mode))
-                            indicator = "@";
-                        else if (ent->st.st_mode & S_IXUSR)
-                            indicator = "*";
-                        break;
-                    case INDICATOR_FILE_TYPE:
-                        if (S_ISDIR(ent->st.st_mode))
-                            indicator = "/";
-                        else if (S_ISLNK(ent->st.st_mode))
-                            indicator = "@";
-                        break;
-                    case INDICATOR_SLASH:
-                        if (S_ISDIR(ent->st.st_mode))
-                            indicator = "/";
-                        break;
-                    default:
-                        break;
-                    }
-
-                    char block_buf[32] = "";
-                    if (show_blocks)
-                        snprintf(block_buf, sizeof(block_buf), "%*lu ", (int)block_w, blk);
-                    char inode_buf[32] = "";
-                    if (show_inode)
-                        snprintf(inode_buf, sizeof(inode_buf), "%10llu ", (unsigned long long)ent->st.st_ino);
-                    char *fullpath = join_path(path, ent->name);
-                    if (!fullpath) {
-                        perror("malloc");
-                        goto cleanup;
-                    }
-                    printf("%s%s%s", block_buf, inode_buf, prefix);
-                    hyperlink_start(fullpath, hyperlink_mode);
-                    print_quoted(ent->name, quoting_style, hide_control, show_controls, literal_names);
-                    hyperlink_end(hyperlink_mode);
-                    printf("%s%s", suffix, indicator);
-                    free(fullpath);
-
-                    size_t len = (quote_names ? quoted_len(ent->name, escape_nonprint, hide_control) :
-                                   (escape_nonprint ? escaped_len(ent->name, hide_control) : strlen(ent->name))) +
-                                 strlen(indicator) + strlen(inode_buf) + strlen(block_buf) +
-                                 strlen(prefix) + strlen(suffix);
-                    if (c == cols - 1 || i + rows >= count) {
-                        putchar('\n');
-                    } else {
-                        for (size_t sp = len; sp < col_width; sp++)
-                            putchar(' ');
-                    }
-                }
-            }
-        }
-        }
-    } else {
-    for (size_t i = 0; i < count; i++) {
-        size_t idx = reverse ? count - 1 - i : i;
-        const Entry *ent = &entries[idx];
-        unsigned long blk = (unsigned long)((ent->st.st_blocks * 512 + block_size - 1) / block_size);
-
-        const char *prefix = "";
-        const char *suffix = "";
-        const char *indicator = "";
-        if (use_color) {
-            if (S_ISDIR(ent->st.st_mode))
-                prefix = color_dir();
-            else if (S_ISLNK(ent->st.st_mode))
-                prefix = color_link();
-            else if (ent->st.st_mode & S_IXUSR)
-                prefix = color_exec();
-            suffix = color_reset();
+            Shown shown = {dir->entries, NULL};
+            rc = render_entries(lay, &shown, dir->count, SIZE_MAX);
         }
-        switch (indicator_style) {
-        case INDICATOR_CLASSIFY:
-            if (S_ISDIR(ent->st.st_mode))
-                indicator = "/";
-            else if (S_ISLNK(ent->st.st_mode))
-                indicator = "@";
-            else if (ent->st.st_mode & S_IXUSR)
-                indicator = "*";
-            break;
-        case INDICATOR_FILE_TYPE:
-            if (S_ISDIR(ent->st.st_mode))
-                indicator = "/";
-            else if (S_ISLNK(ent->st.st_mode))
-                indicator = "@";
-            break;
-        case INDICATOR_SLASH:
-            if (S_ISDIR(ent->st.st_mode))
-                indicator = "/";
-            break;
-        default:
+    }
+
+    STATS_LAP(STATS_RENDER, mark);
+    if (dir->path)
+        STATS_DIR(dir->path, dir->total, dir->start);
+    return rc;
+}
+
+/* Render every directory WALK yields, then close it.  A SINGLE operand
+ * outside a long listing is one name, whatever the layout. */
+static void list_walk(Listing *ls, VlsWalk *walk, int single) {
+    const Args *a = ls->args;
+    Pass pass;
+    int text = a->format == FORMAT_TEXT && summary_mode() == SUMMARY_NONE;
+    vls_walk_set_prepare(walk, prepare_entries, &pass);
+    for (int first = 1;; first = 0) {
+        /* Reset before the walk loads the directory into it. */
+        layout_init(&pass.lay, a);
+        if (single)
+            layout_names(&pass.lay);
+        pass.ls = ls;
+        pass.text = text;
+        const VlsDir *dir = vls_walk_next_dir(walk);
+        if (!dir)
             break;
+        if (dir->error == ELOOP) {
+            fprintf(stderr, "warning: skipping cyclic directory '%s'\n", dir->path);
+            continue;
         }
+        if (text && !first)
+            printf("\n");
+        if (dir->error == ENOTDIR && index_active())
+            fprintf(stderr, "index: %s: not a directory in the index\n", dir->path);
+        else if (dir->error)
+            fprintf(stderr, "opendir: %s: %s\n", dir->path, strerror(dir->error));
+        else if (render_dir(ls, walk, &pass, dir) == -1)
+            break;
+    }
+    ls->listed += vls_walk_listed(walk);
+    ls->truncated |= vls_walk_truncated(walk);
+    vls_walk_close(walk);
+}
 
-        if (long_format || one_per_line || !columns) {
-            char size_buf[16];
-            if (human_readable)
-                human_size(ent->st.st_size, human_si, size_buf, sizeof(size_buf));
-            else
-                snprintf(size_buf, sizeof(size_buf), "%lld", (long long)ent->st.st_size);
-
-            struct passwd pw;
-            struct passwd *pw_res = NULL;
-            const char *owner_buf = NULL;
-            char owner_num[32];
-            if (!numeric_ids && getpwuid_r(ent->st.st_uid, &pw, pwbuf, pw_bufsz, &pw_res) == 0 && pw_res)
-                owner_buf = pw_res->pw_name;
-            else {
-                snprintf(owner_num, sizeof(owner_num), "%u", ent->st.st_uid);
-                owner_buf = owner_num;
-            }
+/* The options for the next walk: what is left of --max-entries, or NULL
+ * when it is used up. */
+static const VlsOptions *walk_options(Listing *ls, VlsOptions *opts) {
+    *opts = ls->walk;
+    if (opts->max_entries) {
+        if (ls->listed >= opts->max_entries) {
+            ls->truncated = 1;
+            return NULL;
+        }
+        opts->max_entries -= ls->listed;
+    }
+    return opts;
+}
 
-            struct group gr;
-            struct group *gr_res = NULL;
-            const char *group_buf = NULL;
-            char group_num[32];
-            if (!numeric_ids && getgrgid_r(ent->st.st_gid, &gr, grbuf, gr_bufsz, &gr_res) == 0 && gr_res)
-                group_buf = gr_res->gr_name;
-            else {
-                snprintf(group_num, sizeof(group_num), "%u", ent->st.st_gid);
-                group_buf = group_num;
-            }
+void list_directory(Listing *ls, const char *path) {
+    VlsOptions opts;
+    if (!walk_options(ls, &opts))
+        return;
+    VlsWalk *walk = vls_walk_open(path, &opts);
+    if (!walk) {
+        perror("malloc");
+        return;
+    }
+    list_walk(ls, walk, 0);
+}
 
-            char perms[11];
-            perms[0] = S_ISDIR(ent->st.st_mode) ? 'd' :
-                       S_ISLNK(ent->st.st_mode) ? 'l' :
-                       S_ISCHR(ent->st.st_mode) ? 'c' :
-                       S_ISBLK(ent->st.st_mode) ? 'b' :
-                       S_ISFIFO(ent->st.st_mode) ? 'p' :
-                       S_ISSOCK(ent->st.st_mode) ? 's' : '-';
-            perms[1] = (ent->st.st_mode & S_IRUSR) ? 'r' : '-';
-            perms[2] = (ent->st.st_mode & S_IWUSR) ? 'w' : '-';
-            perms[3] = (ent->st.st_mode & S_IXUSR)
-                        ? ((ent->st.st_mode & S_ISUID) ? 's' : 'x')
-                        : ((ent->st.st_mode & S_ISUID) ? 'S' : '-');
-            perms[4] = (ent->st.st_mode & S_IRGRP) ? 'r' : '-';
-            perms[5] = (ent->st.st_mode & S_IWGRP) ? 'w' : '-';
-            perms[6] = (ent->st.st_mode & S_IXGRP)
-                        ? ((ent->st.st_mode & S_ISGID) ? 's' : 'x')
-                        : ((ent->st.st_mode & S_ISGID) ? 'S' : '-');
-            perms[7] = (ent->st.st_mode & S_IROTH) ? 'r' : '-';
-            perms[8] = (ent->st.st_mode & S_IWOTH) ? 'w' : '-';
-            perms[9] = (ent->st.st_mode & S_IXOTH)
-                        ? ((ent->st.st_mode & S_ISVTX) ? 't' : 'x')
-                        : ((ent->st.st_mode & S_ISVTX) ? 'T' : '-');
-            perms[10] = '\0';
-
-            size_t time_buf_sz = strlen(time_style) * 4 + 32;
-            char *time_buf = malloc(time_buf_sz);
-            if (!time_buf) {
-                perror("malloc");
-                goto cleanup;
-            }
-            const time_t *tptr = &ent->st.st_mtime;
-            if (time_word) {
-                if (strcmp(time_word, "access") == 0 || strcmp(time_word, "use") == 0)
-                    tptr = &ent->st.st_atime;
-                else if (strcmp(time_word, "status") == 0)
-                    tptr = &ent->st.st_ctime;
-            } else {
-                if (sort_atime)
-                    tptr = &ent->st.st_atime;
-                else if (sort_ctime)
-                    tptr = &ent->st.st_ctime;
-            }
-            struct tm *tm = localtime(tptr);
-            strftime(time_buf, time_buf_sz, time_style, tm);
-
-            if (show_blocks)
-                printf("%*lu ", (int)block_w, blk);
-            if (show_inode)
-                printf("%10llu ", (unsigned long long)ent->st.st_ino);
-            printf("%s %*lu ", perms, (int)link_w, (unsigned long)ent->st.st_nlink);
-            if (!hide_owner)
-                printf("%-*s ", (int)owner_w, owner_buf);
-            if (!hide_group)
-                printf("%-*s ", (int)group_w, group_buf);
-            printf("%*s %s", (int)size_w, size_buf, time_buf);
-            free(time_buf);
-            if (show_context) {
-#if HAVE_SELINUX
-                char *ctx = NULL;
-                char *fullpath = join_path(path, ent->name);
-                if (!fullpath) {
-                    perror("malloc");
-                    goto cleanup;
-                }
-                if (lgetfilecon(fullpath, &ctx) >= 0) {
-                    printf(" %s", ctx);
-                    freecon(ctx);
-                } else {
-                    printf(" -");
-                }
-                free(fullpath);
-#else
-                printf(" -");
-#endif
-            }
-            printf(" %s", prefix);
-            char *fullpath1 = join_path(path, ent->name);
-            if (!fullpath1) {
-                perror("malloc");
-                goto cleanup;
-            }
-            hyperlink_start(fullpath1, hyperlink_mode);
-            print_quoted(ent->name, quoting_style, hide_control, show_controls, literal_names);
-            hyperlink_end(hyperlink_mode);
-            printf("%s%s\n", suffix, indicator);
-            free(fullpath1);
-        } else {
-            if (show_blocks)
-                printf("%*lu ", (int)block_w, blk);
-            if (show_inode) {
-                printf("%10llu %s", (unsigned long long)ent->st.st_ino, prefix);
-                char *fullpath2 = join_path(path, ent->name);
-                if (!fullpath2) {
-                    perror("malloc");
-                    goto cleanup;
-                }
-                hyperlink_start(fullpath2, hyperlink_mode);
-                print_quoted(ent->name, quoting_style, hide_control, show_controls, literal_names);
-                hyperlink_end(hyperlink_mode);
-                printf("%s%s\n", suffix, indicator);
-                free(fullpath2);
-            } else {
-                fputs(prefix, stdout);
-                char *fullpath3 = join_path(path, ent->name);
-                if (!fullpath3) {
-                    perror("malloc");
-                    goto cleanup;
-                }
-                hyperlink_start(fullpath3, hyperlink_mode);
-                print_quoted(ent->name, quoting_style, hide_control, show_controls, literal_names);
-                hyperlink_end(hyperlink_mode);
-                printf("%s%s\n", suffix, indicator);
-                free(fullpath3);
-            }
-        }
+static void list_group(Listing *ls, Entry *entries, size_t count, int single) {
+    VlsOptions opts;
+    if (!walk_options(ls, &opts)) {
+        for (size_t i = 0; i < count; i++)
+            free(entries[i].name);
+        free(entries);
+        return;
+    }
+    VlsWalk *walk = vls_walk_open_group(entries, count, &opts);
+    if (!walk) {
+        perror("malloc");
+        return;
     }
+    list_walk(ls, walk, single);
+}
+
+void list_entries(Listing *ls, Entry *entries, size_t count) {
+    list_group(ls, entries, count, 0);
+}
 
+void list_single(Listing *ls, const char *path, const struct stat *st) {
+    Entry *ent = calloc(1, sizeof(Entry));
+    if (!ent || !(ent->name = strdup(path))) {
+        perror("malloc");
+        free(ent);
+        return;
     }
+    ent->st = *st;
+    list_group(ls, ent, 1, 1);
+}
 
-    if (recursive) {
-        for (size_t i = 0; i < count; i++) {
-            size_t idx = reverse ? count - 1 - i : i;
-            const Entry *ent = &entries[idx];
-            if (!S_ISDIR(ent->st.st_mode) || S_ISLNK(ent->st.st_mode))
-                continue;
-            if (strcmp(ent->name, ".") == 0 || strcmp(ent->name, "..") == 0)
-                continue;
-            char *fullpath = join_path(path, ent->name);
-            if (!fullpath) {
-                perror("malloc");
-                goto cleanup;
-            }
-            if (follow_links) {
-                struct stat vst;
-                if (stat(fullpath, &vst) == 0 && visited_contains(vst.st_dev, vst.st_ino)) {
-                    fprintf(stderr, "warning: skipping cyclic directory '%s'\n", fullpath);
-                    free(fullpath);
-                    continue;
-                }
-            }
-            printf("\n");
-            list_directory(fullpath, color_mode, hyperlink_mode, show_hidden, almost_all, long_format, show_inode, sort_time, sort_atime, sort_ctime, sort_size, sort_extension, sort_version, sort_word, unsorted, reverse, dirs_first, recursive, indicator_style, human_readable, human_si, numeric_ids, hide_owner, hide_group, show_context, follow_links, list_dirs_only, ignore_backups, ignore_patterns, ignore_count, hide_patterns, hide_count, columns, across_columns, one_per_line, comma_separated, output_width, tabsize, show_blocks, quoting_style, time_word, time_style, block_size, hide_control, show_controls, literal_names);
-            free(fullpath);
-        }
+void list_header(const Listing *ls, const char *path) {
+    Layout lay;
+    layout_init(&lay, ls->args);
+    print_header(&lay, path);
+}
+
+void list_lines(const Args *args, ListLine *lines, size_t count) {
+    Layout lay;
+    layout_init(&lay, args);
+    layout_names(&lay);
+    int with_context = lay.show_context && lay.long_format;
+    if (with_context)
+        context_set_dir(AT_FDCWD, NULL);
+    for (size_t i = 0; i < count; i++) {
+        Entry *ent = &lines[i].ent;
+        ent->color = lay.use_color ? entry_color(lines[i].dfd, NULL, ent->name, ent->st.st_mode) : COLOR_TYPE_NONE;
+        ent->context = with_context ? context_lookup(ent->name) : 0;
+        layout_measure(&lay, ent, 1);
     }
+    for (size_t i = 0; i < count; i++) {
+        lay.dfd = lines[i].dfd;
+        lay.mark = lines[i].mark;
+        lay.note = lines[i].note;
+        if (print_line(&lay, &lines[i].ent) == -1)
+            return;
+    }
+}
+
+void list_resolve(const Args *args, const char *path, Entry *entries, size_t count) {
+    Layout lay;
+    layout_init(&lay, args);
+    int with_context = lay.show_context && lay.long_format;
+    if (with_context)
+        context_set_dir(AT_FDCWD, path);
+    resolve_entries(AT_FDCWD, path, entries, count, lay.use_color, with_context);
+}
+
+void list_measure(const Args *args, ListWidths *w, const Entry *ent) {
+    Layout lay;
+    layout_init(&lay, args);
+    lay.w = *w;
+    layout_measure(&lay, ent, 1);
+    *w = lay.w;
+}
+
+void list_unmeasure(const Args *args, ListWidths *w, const Entry *ent) {
+    Layout lay;
+    layout_init(&lay, args);
+    if (lay.long_format || lay.show_blocks)
+        w->total_blocks -= entry_blocks(&lay, ent);
+}
 
-cleanup:
-    for (size_t i = 0; i < count; i++)
-        free(entries[i].name);
-    free(entries);
-    closedir(dir);
-    free(pwbuf);
-    free(grbuf);
-    FINALIZE();
+int list_render(FILE *out, const Args *args, const char *path, Entry *const *entries, size_t count,
+                const ListWidths *w, int header, size_t max_rows) {
+    Layout lay;
+    layout_init(&lay, args);
+    lay.out = out;
+    lay.path = path;
+    lay.dfd = AT_FDCWD;
+    lay.w = *w;
+    if (lay.show_blocks)
+        lay.w.max_len += lay.w.block_w + 1;
+    if (header)
+        print_header(&lay, path);
+    if (lay.long_format || lay.show_blocks)
+        fprintf(out, "total %lu\n", lay.w.total_blocks);
+    Shown shown = {NULL, entries};
+    return render_entries(&lay, &shown, count, max_rows);
 }
@@ -2,80 +2,374 @@
 #include "list.h"
 #include "args.h"
 #include "color.h"
-#include "quote.h"
+#include "json.h"
+#include "columnar.h"
+#include "cache.h"
+#include "index.h"
+#include "diff.h"
+#include "watch.h"
+#include "dirsize.h"
+#include "summary.h"
+#include "where.h"
+#include "ignore.h"
+#include "stats.h"
+#include "trace.h"
+#include "serve.h"
+#include "batch.h"
+#include "sort.h"
+#include "util.h"
 #include <sys/stat.h>
 #include <ctype.h>
-#include <locale.h>
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
+#include <stdlib.h>
 
-static int hyperlink_enabled(HyperlinkMode mode) {
-    return mode == HYPERLINK_ALWAYS || (mode == HYPERLINK_AUTO && isatty(STDOUT_FILENO));
-}
+#define OPERAND_BATCH 4096
 
-static void hyperlink_start(const char *target, HyperlinkMode mode) {
-    if (hyperlink_enabled(mode))
-        printf("\033]8;;%s\033\\", target);
-}
+/* Set once an operand has been listed: the next one is preceded by a blank
+ * line. */
+static int separate = 0;
+
+/* List one operand.  PRE, when not NULL, is its stat result from a batch
+ * (following links with -H or -L) and ERR the errno value if that failed. */
+static void list_operand(Listing *ls, const char *path, int multiple, const struct stat *pre, int err) {
+    const Args *args = ls->args;
+    int text = args->format == FORMAT_TEXT && !args->summary;
+    if (text && separate)
+        printf("\n");
+    separate = 0;
+    if (text && !args->recursive && multiple && !args->list_dirs_only)
+        list_header(ls, path);
+
+    if (args->deref_cmdline || args->list_dirs_only) {
+        struct stat st;
+        int follow = args->deref_cmdline || args->follow_links;
+        if (pre ? err != 0 : (index_active() ? index_stat(path, &st) : follow ? stat(path, &st) : lstat(path, &st)) == -1) {
+            fprintf(stderr, "stat: %s: %s\n", path, strerror(pre ? err : errno));
+            return;
+        }
+        if (pre)
+            st = *pre;
+        if (args->list_dirs_only || !S_ISDIR(st.st_mode)) {
+            list_single(ls, path, &st);
+            separate = text;
+            return;
+        }
+    }
 
-static void hyperlink_end(HyperlinkMode mode) {
-    if (hyperlink_enabled(mode))
-        printf("\033]8;;\033\\");
+    list_directory(ls, path);
+    separate = text;
 }
 
+/* Whether the operands are stat'ed in batches before they are listed. */
+static int batch_stats(const Args *args) {
+    return args->deref_cmdline || args->list_dirs_only || args->group_files;
+}
 
-int main(int argc, char *argv[]) {
-    setlocale(LC_ALL, "");
-    Args args;
-    parse_args(argc, argv, &args);
-    color_init();
-    for (size_t i = 0; i < args.path_count; i++) {
-        const char *path = args.paths[i];
-        if (!args.recursive && args.path_count > 1 && !args.list_dirs_only) {
-            hyperlink_start(path, args.hyperlink_mode);
-            print_quoted(path, args.quoting_style, args.hide_control, args.show_controls, args.literal_names);
-            hyperlink_end(args.hyperlink_mode);
-            printf(":\n");
+/* --group-files: non-directory operands (all of them with -d) are listed
+ * first as one group, sorted and aligned like a directory, then each
+ * directory in turn. */
+static int list_grouped(Listing *ls, BatchReader *reader) {
+    const Args *args = ls->args;
+    Entry *group = NULL;
+    size_t group_count = 0, group_cap = 0;
+    char **dirs = NULL;
+    size_t dir_count = 0, dir_cap = 0, total = 0;
+    int follow = args->deref_cmdline || args->follow_links;
+    struct stat *sts = malloc(OPERAND_BATCH * sizeof(struct stat));
+    int *errs = malloc(OPERAND_BATCH * sizeof(int));
+    int rc = sts && errs ? 0 : -1;
+    size_t done = 0;
+    while (rc == 0) {
+        char **paths = (char **)args->paths + done;
+        size_t n;
+        if (reader) {
+            n = batch_next(reader, &paths, OPERAND_BATCH);
+        } else {
+            n = args->path_count - done < OPERAND_BATCH ? args->path_count - done : OPERAND_BATCH;
+            done += n;
         }
-
-        if (args.deref_cmdline) {
-            struct stat st;
-            if (stat(path, &st) == -1) {
-                fprintf(stderr, "stat: %s: %s\n", path, strerror(errno));
+        if (n == 0)
+            break;
+        total += n;
+        batch_stat(paths, n, follow, sts, errs);
+        for (size_t i = 0; i < n && rc == 0; i++) {
+            if (errs[i]) {
+                fprintf(stderr, "stat: %s: %s\n", paths[i], strerror(errs[i]));
                 continue;
             }
-            if (args.list_dirs_only || !S_ISDIR(st.st_mode)) {
-                list_directory(path, args.color_mode, args.hyperlink_mode, args.show_hidden, args.almost_all,
-                              args.long_format, args.show_inode, args.sort_time,
-                              args.sort_atime, args.sort_ctime, args.sort_size, args.sort_extension,
-                              args.sort_version, args.sort_word, args.unsorted, args.reverse, args.dirs_first, args.recursive,
-                              args.indicator_style, args.human_readable,
-                              args.human_si, args.numeric_ids, args.hide_owner, args.hide_group,
-                              args.show_context, 1, 1, args.ignore_backups,
-                                args.ignore_patterns, args.ignore_count,
-                                args.hide_patterns, args.hide_count,
-                                args.columns, args.across_columns, args.one_per_line, args.comma_separated,
-                                args.output_width, args.tabsize, args.show_blocks, args.quoting_style, args.time_word, args.time_style, args.block_size, args.hide_control, args.show_controls, args.literal_names);
-                if (i < args.path_count - 1)
-                    printf("\n");
+            int is_dir = S_ISDIR(sts[i].st_mode);
+            struct stat target;
+            /* A link to a directory is opened like the directory. */
+            if (S_ISLNK(sts[i].st_mode) && !index_active() && stat(paths[i], &target) == 0)
+                is_dir = S_ISDIR(target.st_mode);
+            if (is_dir && !args->list_dirs_only) {
+                if (dir_count == dir_cap) {
+                    size_t cap = dir_cap ? dir_cap * 2 : 16;
+                    char **tmp = realloc(dirs, cap * sizeof(char *));
+                    if (!tmp) {
+                        rc = -1;
+                        break;
+                    }
+                    dirs = tmp;
+                    dir_cap = cap;
+                }
+                if (!(dirs[dir_count] = strdup(paths[i])))
+                    rc = -1;
+                else
+                    dir_count++;
                 continue;
             }
+            if (group_count == group_cap) {
+                size_t cap = group_cap ? group_cap * 2 : 64;
+                Entry *tmp = realloc(group, cap * sizeof(Entry));
+                if (!tmp) {
+                    rc = -1;
+                    break;
+                }
+                group = tmp;
+                group_cap = cap;
+            }
+            memset(&group[group_count], 0, sizeof(Entry));
+            group[group_count].st = sts[i];
+            if (!(group[group_count].name = strdup(paths[i])))
+                rc = -1;
+            else
+                group_count++;
         }
+    }
+    free(sts);
+    free(errs);
+    if (rc == -1) {
+        perror("malloc");
+        for (size_t i = 0; i < group_count; i++)
+            free(group[i].name);
+        free(group);
+    } else if (group_count) {
+        list_entries(ls, group, group_count);
+        separate = args->format == FORMAT_TEXT && !args->summary;
+    } else {
+        free(group);
+    }
+    for (size_t i = 0; i < dir_count; i++) {
+        if (rc == 0)
+            list_operand(ls, dirs[i], total > 1, NULL, 0);
+        free(dirs[i]);
+    }
+    free(dirs);
+    return rc;
+}
+
+/* List the command line operands, or with --files-from stream the paths
+ * read from the file through here in batches, keeping their order. */
+static int list_operands(Listing *ls) {
+    const Args *args = ls->args;
+    BatchReader *reader = NULL;
+    if (args->files_from && !(reader = batch_open(args->files_from, args->null_sep)))
+        return -1;
+    if (args->group_files) {
+        int rc = list_grouped(ls, reader);
+        return batch_close(reader) == -1 ? -1 : rc;
+    }
+    int stat_first = batch_stats(args);
+    struct stat *sts = stat_first ? malloc(OPERAND_BATCH * sizeof(struct stat)) : NULL;
+    int *errs = stat_first ? malloc(OPERAND_BATCH * sizeof(int)) : NULL;
+    if (stat_first && (!sts || !errs)) {
+        perror("malloc");
+        free(sts);
+        free(errs);
+        batch_close(reader);
+        return -1;
+    }
+    size_t done = 0;
+    int multiple = -1;
+    for (;;) {
+        char **paths = (char **)args->paths + done;
+        size_t n;
+        if (reader) {
+            n = batch_next(reader, &paths, OPERAND_BATCH);
+        } else {
+            n = args->path_count - done < OPERAND_BATCH ? args->path_count - done : OPERAND_BATCH;
+            done += n;
+        }
+        if (n == 0)
+            break;
+        /* A short first batch holds every operand there is. */
+        if (multiple == -1)
+            multiple = n > 1 || n == OPERAND_BATCH || (!reader && args->path_count > n);
+        if (stat_first)
+            batch_stat(paths, n, args->deref_cmdline || args->follow_links, sts, errs);
+        for (size_t i = 0; i < n; i++)
+            list_operand(ls, paths[i], multiple, stat_first ? &sts[i] : NULL, stat_first ? errs[i] : 0);
+    }
+    free(sts);
+    free(errs);
+    return batch_close(reader);
+}
 
-        list_directory(path, args.color_mode, args.hyperlink_mode, args.show_hidden, args.almost_all,
-                      args.long_format, args.show_inode, args.sort_time,
-                      args.sort_atime, args.sort_ctime, args.sort_size, args.sort_extension,
-                      args.sort_version, args.sort_word, args.unsorted, args.reverse, args.dirs_first, args.recursive,
-                      args.indicator_style, args.human_readable,
-                      args.human_si, args.numeric_ids, args.hide_owner, args.hide_group,
-                      args.show_context, args.follow_links, args.list_dirs_only, args.ignore_backups,
-                        args.ignore_patterns, args.ignore_count,
-                        args.hide_patterns, args.hide_count,
-                        args.columns, args.across_columns, args.one_per_line, args.comma_separated,
-                        args.output_width, args.tabsize, args.show_blocks, args.quoting_style, args.time_word, args.time_style, args.block_size, args.hide_control, args.show_controls, args.literal_names);
-        if (i < args.path_count - 1)
-            printf("\n");
+/* Modes that need every operand up front read --files-from completely. */
+static int read_operands(Args *args) {
+    BatchReader *reader = batch_open(args->files_from, args->null_sep);
+    if (!reader)
+        return -1;
+    const char **all = NULL;
+    size_t count = 0;
+    char **paths;
+    size_t n;
+    while ((n = batch_next(reader, &paths, OPERAND_BATCH)) > 0) {
+        const char **tmp = realloc(all, (count + n) * sizeof(char *));
+        if (!tmp) {
+            perror("realloc");
+            batch_close(reader);
+            return -1;
+        }
+        all = tmp;
+        for (size_t i = 0; i < n; i++)
+            if ((all[count] = strdup(paths[i])) != NULL)
+                count++;
+    }
+    if (batch_close(reader) == -1)
+        return -1;
+    if (count == 0) {
+        fprintf(stderr, "files-from: %s: no file names\n", args->files_from);
+        return -1;
     }
+    args->paths = all;
+    args->path_count = count;
+    args->files_from = NULL;
     return 0;
 }
+
+static int serve_request(int argc, char *argv[]);
+
+static int run(int argc, char *argv[], int in_worker) {
+    Args args;
+    parse_args(argc, argv, &args);
+    if (args.serve_socket || args.client_socket) {
+        if (in_worker) {
+            fprintf(stderr, "--serve and --client cannot be sent to a daemon\n");
+            return 1;
+        }
+        if (args.client_socket)
+            return serve_client(args.client_socket, argc, argv);
+        return serve_run(args.serve_socket, args.cache_dir, serve_request);
+    }
+    if (args.files_from && (args.build_index || args.save_snapshot || args.diff_file || args.watch ||
+                            args.summary == SUMMARY_TYPES) && read_operands(&args) == -1)
+        return 1;
+    /* An index or snapshot file describes one tree. */
+    if ((args.build_index || args.save_snapshot || args.diff_file) && args.path_count > 1) {
+        fprintf(stderr, "%s takes one directory, not %zu\n",
+                args.build_index ? "--build-index" : args.save_snapshot ? "--save-snapshot" : "--diff",
+                args.path_count);
+        return 1;
+    }
+    if (args.trace_file && trace_open(args.trace_file) == -1)
+        return 1;
+    if (args.stats || args.trace_file)
+        stats_init(args.stats);
+    /* The watch screen colors in auto mode whatever the output. */
+    if (args.color_mode == COLOR_ALWAYS ||
+        (args.color_mode == COLOR_AUTO && (args.watch || stdout_isatty())))
+        color_init(args.color_cache);
+    cache_init(args.cache_dir, args.cache_revalidate);
+    /* A summary counts what entries hold, not what lies below them. */
+    dirsize_init(args.summary ? DIRSIZE_NONE : (DirSizeMode)args.dir_size, args.one_file_system);
+    summary_init((SummaryMode)args.summary);
+    if (args.where && where_compile(args.where) == -1)
+        return 1;
+    ignore_init(args.ignore_files, args.ignore_file_count);
+    sort_set_threads(args.sort_threads);
+    if (args.summary) {
+        if (args.format == FORMAT_COLUMNAR) {
+            fprintf(stderr, "--summary cannot be combined with --format=columnar\n");
+            return 1;
+        }
+        if (args.summary == SUMMARY_TYPES && args.where) {
+            fprintf(stderr, "--where cannot be combined with --summary=types\n");
+            return 1;
+        }
+        if (args.summary == SUMMARY_TYPES && args.ignore_file_count) {
+            fprintf(stderr, "--ignore-file-name cannot be combined with --summary=types\n");
+            return 1;
+        }
+        if (args.summary == SUMMARY_TYPES &&
+            summary_walk(args.paths, args.path_count, args.recursive, args.show_hidden, args.almost_all,
+                         args.ignore_backups, args.ignore_patterns, args.ignore_count,
+                         args.hide_patterns, args.hide_count) == -1)
+            return 1;
+    }
+    if (args.build_index)
+        return index_build(args.build_index, args.paths[0]) == -1 ? 1 : 0;
+    if (args.save_snapshot)
+        return index_build(args.save_snapshot, args.paths[0]) == -1 ? 1 : 0;
+    if (args.diff_file) {
+        if (args.format == FORMAT_COLUMNAR) {
+            fprintf(stderr, "--diff cannot be combined with --format=columnar\n");
+            return 1;
+        }
+        int rc = diff_tree(args.diff_file, args.paths[0], &args);
+        json_flush();
+        return rc == -1 ? 1 : 0;
+    }
+    if (args.index_file && index_open(args.index_file, args.index_max_age) == -1)
+        return 1;
+    if (args.format == FORMAT_COLUMNAR && stdout_isatty()) {
+        fprintf(stderr, "refusing to write columnar output to a terminal\n");
+        return 1;
+    }
+    if (args.watch) {
+        if (args.format == FORMAT_COLUMNAR) {
+            fprintf(stderr, "--watch cannot be combined with --format=columnar\n");
+            return 1;
+        }
+        if (args.where) {
+            fprintf(stderr, "--watch cannot be combined with --where\n");
+            return 1;
+        }
+        if (args.ignore_file_count) {
+            fprintf(stderr, "--watch cannot be combined with --ignore-file-name\n");
+            return 1;
+        }
+        if (watch_init(&args) == -1)
+            return 1;
+        /* On a terminal the watch screen replaces the initial listing. */
+        if (watch_interactive())
+            return watch_run() == -1 ? 1 : 0;
+    }
+    int status = 0;
+    Listing ls;
+    list_init(&ls, &args);
+    /* The watch starts from what the listing read, unless the listing
+     * shows less than the live tree or other sizes. */
+    if (args.watch && !args.max_entries && !args.dir_size && (!args.cache_dir || args.cache_revalidate))
+        ls.prepare = watch_seed;
+    if (args.summary != SUMMARY_TYPES && list_operands(&ls) == -1)
+        status = 1;
+    if (ls.truncated) {
+        if (args.format == FORMAT_TEXT && !args.summary)
+            printf("\n[truncated after %lu entries]\n", args.max_entries);
+        else
+            fprintf(stderr, "vls: truncated after %lu entries\n", args.max_entries);
+    }
+    if (args.summary)
+        summary_print(args.format, args.numeric_ids);
+    json_flush();
+    if (args.watch)
+        return watch_run() == -1 ? 1 : 0;
+    if (args.format == FORMAT_COLUMNAR && columnar_finish(stdout) == -1)
+        return 1;
+    return status;
+}
+
+/* One --serve request, run in a worker with the client's descriptors,
+ * working directory and environment already in place. */
+static int serve_request(int argc, char *argv[]) {
+    return run(argc, argv, 1);
+}
+
+int main(int argc, char *argv[]) {
+    locale_init();
+    return run(argc, argv, 0);
+}
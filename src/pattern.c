@@ -0,0 +1,253 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fnmatch.h>
+#include <locale.h>
+#include "pattern.h"
+#include "util.h"
+
+typedef struct {
+    const char *s;
+    size_t len;
+} Key;
+
+/* Open-addressing set of byte strings plus the distinct lengths in it, so
+ * a name is probed once per length rather than once per pattern. */
+typedef struct {
+    Key *slots;
+    size_t cap, count;
+    size_t *lens;
+    size_t nlens;
+} StrSet;
+
+typedef struct {
+    const char **pats;
+    size_t count;
+} GlobList;
+
+struct PatternSet {
+    const char **all;
+    size_t count;
+    int match_all;
+    StrSet literals;
+    StrSet suffixes;
+    StrSet prefixes;
+    GlobList first[256];   /* globs starting with a literal byte */
+    GlobList last[256];    /* ... or else ending with one */
+    GlobList wild;         /* the rest */
+};
+
+typedef struct {
+    const char **patterns;
+    size_t count;
+    PatternSet *set;
+} Compiled;
+
+static Compiled *compiled = NULL;
+static size_t compiled_count = 0;
+
+static uint64_t hash_bytes(const char *s, size_t len) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++)
+        h = (h ^ (unsigned char)s[i]) * 0x100000001b3ULL;
+    return h;
+}
+
+static size_t slot_of(const StrSet *set, const char *s, size_t len) {
+    size_t i = (size_t)hash_bytes(s, len) & (set->cap - 1);
+    while (set->slots[i].s && (set->slots[i].len != len || memcmp(set->slots[i].s, s, len) != 0))
+        i = (i + 1) & (set->cap - 1);
+    return i;
+}
+
+static int strset_contains(const StrSet *set, const char *s, size_t len) {
+    return set->count && set->slots[slot_of(set, s, len)].s != NULL;
+}
+
+static int strset_add(StrSet *set, const char *s, size_t len) {
+    if ((set->count + 1) * 2 > set->cap) {
+        size_t cap = set->cap ? set->cap * 2 : 16;
+        Key *old = set->slots;
+        size_t old_cap = set->cap;
+        set->slots = calloc(cap, sizeof(Key));
+        if (!set->slots) {
+            perror("calloc");
+            set->slots = old;
+            return -1;
+        }
+        set->cap = cap;
+        for (size_t i = 0; i < old_cap; i++)
+            if (old[i].s)
+                set->slots[slot_of(set, old[i].s, old[i].len)] = old[i];
+        free(old);
+    }
+    size_t i = slot_of(set, s, len);
+    if (set->slots[i].s)
+        return 0;
+    set->slots[i] = (Key){s, len};
+    set->count++;
+
+    size_t at = 0;
+    while (at < set->nlens && set->lens[at] < len)
+        at++;
+    if (at < set->nlens && set->lens[at] == len)
+        return 0;
+    size_t *tmp = realloc(set->lens, (set->nlens + 1) * sizeof(size_t));
+    if (!tmp) {
+        perror("realloc");
+        return -1;
+    }
+    set->lens = tmp;
+    memmove(set->lens + at + 1, set->lens + at, (set->nlens - at) * sizeof(size_t));
+    set->lens[at] = len;
+    set->nlens++;
+    return 0;
+}
+
+static void strset_free(StrSet *set) {
+    free(set->slots);
+    free(set->lens);
+}
+
+static int glob_add(GlobList *list, const char *pat) {
+    const char **tmp = realloc(list->pats, (list->count + 1) * sizeof(char *));
+    if (!tmp) {
+        perror("realloc");
+        return -1;
+    }
+    list->pats = tmp;
+    list->pats[list->count++] = pat;
+    return 0;
+}
+
+static int special(char c) {
+    return c == '*' || c == '?' || c == '[' || c == '\\';
+}
+
+static int plain(const char *s, size_t len) {
+    for (size_t i = 0; i < len; i++)
+        if (special(s[i]))
+            return 0;
+    return 1;
+}
+
+static int classify(PatternSet *set, const char *p) {
+    size_t len = strlen(p);
+    if (len > 0 && strspn(p, "*") == len) {
+        set->match_all = 1;
+        return 0;
+    }
+    if (plain(p, len))
+        return strset_add(&set->literals, p, len);
+    if (p[0] == '*' && plain(p + 1, len - 1))
+        return strset_add(&set->suffixes, p + 1, len - 1);
+    if (p[len - 1] == '*' && plain(p, len - 1))
+        return strset_add(&set->prefixes, p, len - 1);
+
+    /* A leading literal (possibly escaped) must equal the name's first
+     * byte; a trailing one outside any bracket must equal its last. */
+    if (p[0] == '\\' && p[1])
+        return glob_add(&set->first[(unsigned char)p[1]], p);
+    if (!special(p[0]))
+        return glob_add(&set->first[(unsigned char)p[0]], p);
+    if (!special(p[len - 1]) && p[len - 1] != ']')
+        return glob_add(&set->last[(unsigned char)p[len - 1]], p);
+    return glob_add(&set->wild, p);
+}
+
+void pattern_set_free(PatternSet *set) {
+    if (!set)
+        return;
+    strset_free(&set->literals);
+    strset_free(&set->suffixes);
+    strset_free(&set->prefixes);
+    for (size_t i = 0; i < 256; i++) {
+        free(set->first[i].pats);
+        free(set->last[i].pats);
+    }
+    free(set->wild.pats);
+    free(set);
+}
+
+PatternSet *pattern_set_new(const char **patterns, size_t count) {
+    PatternSet *set = calloc(1, sizeof(PatternSet));
+    if (!set) {
+        perror("calloc");
+        return NULL;
+    }
+    set->all = patterns;
+    set->count = count;
+    for (size_t i = 0; i < count; i++)
+        if (classify(set, patterns[i]) == -1) {
+            pattern_set_free(set);
+            return NULL;
+        }
+    return set;
+}
+
+int pattern_compile(const char **patterns, size_t count) {
+    if (!patterns || pattern_lookup(patterns, count))
+        return 0;
+    /* Matching may run on walker threads, where the locale cannot be
+     * loaded on demand. */
+    locale_need(LC_CTYPE);
+    PatternSet *set = pattern_set_new(patterns, count);
+    if (!set)
+        return -1;
+    Compiled *tmp = realloc(compiled, (compiled_count + 1) * sizeof(Compiled));
+    if (!tmp) {
+        perror("realloc");
+        pattern_set_free(set);
+        return -1;
+    }
+    compiled = tmp;
+    compiled[compiled_count++] = (Compiled){patterns, count, set};
+    return 0;
+}
+
+const PatternSet *pattern_lookup(const char **patterns, size_t count) {
+    for (size_t i = 0; i < compiled_count; i++)
+        if (compiled[i].patterns == patterns && compiled[i].count == count)
+            return compiled[i].set;
+    return NULL;
+}
+
+static int any_glob(const GlobList *list, const char *name) {
+    for (size_t i = 0; i < list->count; i++)
+        if (fnmatch(list->pats[i], name, 0) == 0)
+            return 1;
+    return 0;
+}
+
+int pattern_match(const PatternSet *set, const char *name) {
+    size_t n = 0;
+    int ascii = 1;
+    for (; name[n]; n++)
+        if ((unsigned char)name[n] >= 0x80)
+            ascii = 0;
+    /* fnmatch compares characters, not bytes, in a multibyte locale and
+     * rejects invalid sequences; leave those names to it. */
+    if (!ascii && MB_CUR_MAX > 1) {
+        GlobList all = {set->all, set->count};
+        return any_glob(&all, name);
+    }
+    if (set->match_all)
+        return 1;
+    if (strset_contains(&set->literals, name, n))
+        return 1;
+    for (size_t i = 0; i < set->suffixes.nlens && set->suffixes.lens[i] <= n; i++) {
+        size_t len = set->suffixes.lens[i];
+        if (strset_contains(&set->suffixes, name + n - len, len))
+            return 1;
+    }
+    for (size_t i = 0; i < set->prefixes.nlens && set->prefixes.lens[i] <= n; i++) {
+        size_t len = set->prefixes.lens[i];
+        if (strset_contains(&set->prefixes, name, len))
+            return 1;
+    }
+    if (n == 0)
+        return any_glob(&set->wild, name);
+    return any_glob(&set->first[(unsigned char)name[0]], name) ||
+           any_glob(&set->last[(unsigned char)name[n - 1]], name) || any_glob(&set->wild, name);
+}
@@ -3,11 +3,13 @@
 #include <wchar.h>
 #include <stdlib.h>
 #include <string.h>
+#include <locale.h>
 #include "quote.h"
+#include "util.h"
 
-void print_quoted(const char *s, QuotingStyle style, int hide_control, int show_controls, int literal_names) {
+void print_quoted(FILE *out, const char *s, QuotingStyle style, int hide_control, int show_controls, int literal_names) {
     if (literal_names) {
-        fputs(s, stdout);
+        fputs(s, out);
         return;
     }
     int quote = (style == QUOTE_C);
@@ -17,16 +19,18 @@ void print_quoted(const char *s, QuotingStyle style, int hide_control, int show_
         escape_nonprint = 0;
     }
     if (!quote && !escape_nonprint && !hide_control) {
-        fputs(s, stdout);
+        fputs(s, out);
         return;
     }
     if (quote)
-        putchar('"');
+        fputc('"', out);
     mbstate_t st;
     memset(&st, 0, sizeof(st));
     const char *p = s;
     while (*p) {
         wchar_t wc;
+        if ((unsigned char)*p >= 0x80)
+            locale_need(LC_CTYPE);
         size_t n = mbrtowc(&wc, p, MB_CUR_MAX, &st);
         if (n == (size_t)-1 || n == (size_t)-2) {
             wc = (unsigned char)*p;
@@ -34,23 +38,23 @@ void print_quoted(const char *s, QuotingStyle style, int hide_control, int show_
             memset(&st, 0, sizeof(st));
         }
         if (quote && (wc == L'"' || wc == L'\\'))
-            putchar('\\');
+            fputc('\\', out);
         int w = wcwidth(wc);
         if (w < 0) {
             if (hide_control) {
-                putchar('?');
+                fputc('?', out);
             } else if (escape_nonprint) {
                 for (size_t i = 0; i < n; i++) {
-                    printf("\\%03o", (unsigned char)p[i]);
+                    fprintf(out, "\\%03o", (unsigned char)p[i]);
                 }
             } else {
-                fwrite(p, 1, n, stdout);
+                fwrite(p, 1, n, out);
             }
         } else {
-            fwrite(p, 1, n, stdout);
+            fwrite(p, 1, n, out);
         }
         p += n;
     }
     if (quote)
-        putchar('"');
+        fputc('"', out);
 }
@@ -0,0 +1,672 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <getopt.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "serve.h"
+#include "cache.h"
+#include "color.h"
+#include "idcache.h"
+#include "linkcache.h"
+#include "util.h"
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#define SERVE_MAGIC 0x564c5331u        /* "VLS1" */
+#define SERVE_MAX_REQUEST (16u << 20)
+#define SERVE_FDS 4                    /* stdin, stdout, stderr, working directory */
+#define SERVE_PRELOAD 65536            /* users and groups loaded at startup */
+
+extern char **environ;
+
+/* Sent with the descriptors, followed by LEN bytes of NUL-terminated
+ * strings: ARGC arguments, then ENVC environment entries.  The reply is
+ * the worker's wait status as an int32_t. */
+typedef struct {
+    uint32_t magic;
+    uint32_t argc;
+    uint32_t envc;
+    uint32_t len;
+} Request;
+
+typedef struct {
+    pid_t pid;
+    int conn;
+    int hung_up;
+} Worker;
+
+static volatile sig_atomic_t stopping = 0;
+static int wake[2] = {-1, -1};
+
+static int socket_addr(const char *path, struct sockaddr_un *addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        fprintf(stderr, "serve: %s: socket path too long\n", path);
+        return -1;
+    }
+    strcpy(addr->sun_path, path);
+    return 0;
+}
+
+static int send_all(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int recv_all(int fd, void *buf, size_t len) {
+    char *p = buf;
+    while (len) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/* ---- client ---- */
+
+/* ARGV[I] is the --client option itself, or (for "--client S") its value.
+ * Arguments after "--" are operands and always kept. */
+static int client_option(int argc, char *argv[], int i, int *skip) {
+    if (*skip) {
+        *skip = 0;
+        return 1;
+    }
+    if (strncmp(argv[i], "--client=", 9) == 0)
+        return 1;
+    if (strcmp(argv[i], "--client") == 0 && i + 1 < argc) {
+        *skip = 1;
+        return 1;
+    }
+    return 0;
+}
+
+static int client_fd(int fd) {
+    if (fcntl(fd, F_GETFD) != -1)
+        return fd;
+    return open("/dev/null", O_RDWR);
+}
+
+int serve_client(const char *socket_path, int argc, char *argv[]) {
+    struct sockaddr_un addr;
+    if (socket_addr(socket_path, &addr) == -1)
+        return 1;
+
+    size_t len = 0;
+    uint32_t nargs = 0, nenv = 0;
+    int skip = 0, operands = 0;
+    for (int i = 0; i < argc; i++) {
+        if (i > 0 && !operands && client_option(argc, argv, i, &skip))
+            continue;
+        if (strcmp(argv[i], "--") == 0)
+            operands = 1;
+        len += strlen(argv[i]) + 1;
+        nargs++;
+    }
+    for (char **e = environ; *e; e++) {
+        len += strlen(*e) + 1;
+        nenv++;
+    }
+    if (len > SERVE_MAX_REQUEST) {
+        fprintf(stderr, "serve: request too large\n");
+        return 1;
+    }
+    char *buf = malloc(len ? len : 1);
+    if (!buf) {
+        perror("malloc");
+        return 1;
+    }
+    char *p = buf;
+    skip = operands = 0;
+    for (int i = 0; i < argc; i++) {
+        if (i > 0 && !operands && client_option(argc, argv, i, &skip))
+            continue;
+        if (strcmp(argv[i], "--") == 0)
+            operands = 1;
+        size_t n = strlen(argv[i]) + 1;
+        memcpy(p, argv[i], n);
+        p += n;
+    }
+    for (char **e = environ; *e; e++) {
+        size_t n = strlen(*e) + 1;
+        memcpy(p, *e, n);
+        p += n;
+    }
+
+    int fds[SERVE_FDS];
+    for (int i = 0; i < 3; i++)
+        fds[i] = client_fd(i);
+#ifdef O_PATH
+    fds[3] = open(".", O_PATH | O_DIRECTORY);
+#else
+    fds[3] = open(".", O_RDONLY | O_DIRECTORY);
+#endif
+    if (fds[0] == -1 || fds[1] == -1 || fds[2] == -1 || fds[3] == -1) {
+        perror("open");
+        free(buf);
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        fprintf(stderr, "serve: %s: %s\n", socket_path, strerror(errno));
+        free(buf);
+        return 1;
+    }
+    Request req = {SERVE_MAGIC, nargs, nenv, (uint32_t)len};
+    struct iovec iov = {&req, sizeof(req)};
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(fds))];
+    } ctl;
+    memset(&ctl, 0, sizeof(ctl));
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctl.buf;
+    msg.msg_controllen = sizeof(ctl.buf);
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cm), fds, sizeof(fds));
+
+    ssize_t sent;
+    do
+        sent = sendmsg(fd, &msg, 0);
+    while (sent == -1 && errno == EINTR);
+    int32_t status;
+    if (sent != (ssize_t)sizeof(req) || send_all(fd, buf, len) == -1 ||
+        recv_all(fd, &status, sizeof(status)) == -1) {
+        fprintf(stderr, "serve: %s: request failed\n", socket_path);
+        free(buf);
+        close(fd);
+        return 1;
+    }
+    free(buf);
+    close(fd);
+    /* A worker killed by a signal (SIGPIPE under `| head`) takes the
+     * client down the same way. */
+    if (WIFSIGNALED(status)) {
+        signal(WTERMSIG(status), SIG_DFL);
+        raise(WTERMSIG(status));
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
+
+/* ---- worker ---- */
+
+static const char *const locale_vars[] = {
+    "LC_ALL", "LC_COLLATE", "LC_CTYPE", "LC_MESSAGES", "LC_MONETARY", "LC_NUMERIC", "LC_TIME", "LANG",
+};
+
+static const char *env_get(char **env, const char *name) {
+    size_t len = strlen(name);
+    for (; *env; env++)
+        if (strncmp(*env, name, len) == 0 && (*env)[len] == '=')
+            return *env + len + 1;
+    return NULL;
+}
+
+static int same_locale(char **a, char **b) {
+    for (size_t i = 0; i < sizeof(locale_vars) / sizeof(locale_vars[0]); i++) {
+        const char *x = env_get(a, locale_vars[i]), *y = env_get(b, locale_vars[i]);
+        if (x ? !y || strcmp(x, y) != 0 : y != NULL)
+            return 0;
+    }
+    return 1;
+}
+
+/* COUNT strings from *P on, advancing it; NULL when they overrun END. */
+static char **split(char **p, char *end, uint32_t count) {
+    char **v = calloc((size_t)count + 1, sizeof(char *));
+    if (!v)
+        return NULL;
+    for (uint32_t i = 0; i < count; i++) {
+        char *nul = *p < end ? memchr(*p, '\0', (size_t)(end - *p)) : NULL;
+        if (!nul) {
+            free(v);
+            return NULL;
+        }
+        v[i] = *p;
+        *p = nul + 1;
+    }
+    return v;
+}
+
+static int receive(int conn, Request *req, int fds[SERVE_FDS]) {
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int) * SERVE_FDS)];
+    } ctl;
+    struct iovec iov = {req, sizeof(*req)};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctl.buf;
+    msg.msg_controllen = sizeof(ctl.buf);
+    ssize_t n;
+    do
+        n = recvmsg(conn, &msg, 0);
+    while (n == -1 && errno == EINTR);
+    struct cmsghdr *cm = n > 0 ? CMSG_FIRSTHDR(&msg) : NULL;
+    if (!cm || (msg.msg_flags & MSG_CTRUNC) || cm->cmsg_level != SOL_SOCKET ||
+        cm->cmsg_type != SCM_RIGHTS || cm->cmsg_len != CMSG_LEN(sizeof(int) * SERVE_FDS))
+        return -1;
+    memcpy(fds, CMSG_DATA(cm), sizeof(int) * SERVE_FDS);
+    if ((size_t)n < sizeof(*req) && recv_all(conn, (char *)req + n, sizeof(*req) - (size_t)n) == -1)
+        return -1;
+    return req->magic == SERVE_MAGIC && req->len <= SERVE_MAX_REQUEST ? 0 : -1;
+}
+
+static void worker(int conn, ServeHandler handler) {
+    signal(SIGCHLD, SIG_DFL);
+    signal(SIGPIPE, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+
+    Request req;
+    int fds[SERVE_FDS];
+    if (receive(conn, &req, fds) == -1)
+        _exit(1);
+    char *buf = malloc(req.len ? req.len : 1);
+    if (!buf || recv_all(conn, buf, req.len) == -1)
+        _exit(1);
+    close(conn);
+    char *p = buf, *end = buf + req.len;
+    char **argv = split(&p, end, req.argc);
+    char **envp = argv ? split(&p, end, req.envc) : NULL;
+    if (!argv || !envp || req.argc == 0)
+        _exit(1);
+    for (int i = 0; i < 3; i++) {
+        if (dup2(fds[i], i) == -1)
+            _exit(1);
+    }
+    stdout_tty_reset();
+    /* What the daemon may have stat'ed is stale by now. */
+    linkcache_clear();
+    if (fchdir(fds[3]) == -1) {
+        perror("fchdir");
+        exit(1);
+    }
+    for (int i = 0; i < SERVE_FDS; i++)
+        if (fds[i] > 2)
+            close(fds[i]);
+
+    int relocale = !same_locale(environ, envp);
+    environ = envp;
+    if (relocale)
+        locale_init();
+    tzset();
+#if defined(__GLIBC__)
+    optind = 0;
+#else
+    optind = 1;
+    optreset = 1;
+#endif
+    exit(handler((int)req.argc, argv));
+}
+
+/* ---- daemon ---- */
+
+static void on_signal(int sig) {
+    int saved = errno;
+    if (sig != SIGCHLD)
+        stopping = 1;
+    ssize_t n = write(wake[1], "", 1);
+    (void)n;
+    errno = saved;
+}
+
+static int peer_allowed(int conn) {
+#if defined(SO_PEERCRED)
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    return getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 && cred.uid == geteuid();
+#else
+    uid_t uid;
+    gid_t gid;
+    return getpeereid(conn, &uid, &gid) == 0 && uid == geteuid();
+#endif
+}
+
+static void invalidate(dev_t dev, ino_t ino) {
+    struct stat st;
+    memset(&st, 0, sizeof(st));
+    st.st_dev = dev;
+    st.st_ino = ino;
+    cache_invalidate(&st, 0);
+    cache_invalidate(&st, 1);
+}
+
+#ifdef __linux__
+
+#define SERVE_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | IN_MODIFY | \
+                    IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+typedef struct {
+    int wd;
+    dev_t dev;
+    ino_t ino;
+} Watch;
+
+static Watch *watches = NULL;
+static size_t watch_count = 0, watch_cap = 0;
+
+static Watch *find_watch(int wd) {
+    for (size_t i = 0; i < watch_count; i++)
+        if (watches[i].wd == wd)
+            return &watches[i];
+    return NULL;
+}
+
+/* A snapshot that cannot be watched is dropped, so everything left in the
+ * cache is either watched or still checked by its directory's mtime. */
+static void watch_dir(int ifd, dev_t dev, ino_t ino, const char *path) {
+    struct stat st;
+    int wd = inotify_add_watch(ifd, path, SERVE_MASK);
+    if (wd == -1 || stat(path, &st) == -1 || st.st_dev != dev || st.st_ino != ino) {
+        invalidate(dev, ino);
+        return;
+    }
+    if (find_watch(wd))
+        return;
+    if (watch_count == watch_cap) {
+        size_t cap = watch_cap ? watch_cap * 2 : 64;
+        Watch *tmp = realloc(watches, cap * sizeof(Watch));
+        if (!tmp) {
+            inotify_rm_watch(ifd, wd);
+            invalidate(dev, ino);
+            return;
+        }
+        watches = tmp;
+        watch_cap = cap;
+    }
+    watches[watch_count++] = (Watch){wd, dev, ino};
+}
+
+static void read_events(int ifd) {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+    while ((len = read(ifd, buf, sizeof(buf))) > 0) {
+        for (char *p = buf; p < buf + len;) {
+            const struct inotify_event *ev = (const struct inotify_event *)p;
+            p += sizeof(*ev) + ev->len;
+            Watch *w = find_watch(ev->wd);
+            if (!w)
+                continue;
+            invalidate(w->dev, w->ino);
+            if (ev->mask & IN_IGNORED)
+                *w = watches[--watch_count];
+        }
+    }
+}
+
+#endif
+
+/* Snapshot announcements from the workers, one "dev ino path" per line. */
+static void read_notices(int fd, int ifd) {
+    static char pending[PIPE_BUF * 2];
+    static size_t used = 0;
+    ssize_t n;
+    while ((n = read(fd, pending + used, sizeof(pending) - used)) > 0) {
+        used += (size_t)n;
+        char *line = pending, *nl;
+        while ((nl = memchr(line, '\n', used - (size_t)(line - pending))) != NULL) {
+            *nl = '\0';
+#ifdef __linux__
+            unsigned long long dev, ino;
+            int off = 0;
+            if (ifd != -1 && sscanf(line, "%llx %llx %n", &dev, &ino, &off) == 2 && off > 0)
+                watch_dir(ifd, (dev_t)dev, (ino_t)ino, line + off);
+#else
+            (void)ifd;
+#endif
+            line = nl + 1;
+        }
+        used -= (size_t)(line - pending);
+        memmove(pending, line, used);
+        if (used == sizeof(pending))
+            used = 0;
+    }
+}
+
+static void finish(Worker *w, int status) {
+    int32_t s = (int32_t)status;
+    /* Fails only when the client has gone and nobody wants the status. */
+    send_all(w->conn, &s, sizeof(s));
+    close(w->conn);
+}
+
+static void reap(Worker *workers, size_t *active, int block) {
+    pid_t pid;
+    int status;
+    while (*active && (pid = waitpid(-1, &status, block ? 0 : WNOHANG)) != 0) {
+        if (pid == -1) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        for (size_t i = 0; i < *active; i++) {
+            if (workers[i].pid == pid) {
+                finish(&workers[i], status);
+                workers[i] = workers[--*active];
+                break;
+            }
+        }
+    }
+}
+
+static void remove_dir(const char *dir) {
+    DIR *d = opendir(dir);
+    if (d) {
+        struct dirent *e;
+        while ((e = readdir(d)) != NULL)
+            if (strcmp(e->d_name, ".") != 0 && strcmp(e->d_name, "..") != 0)
+                unlinkat(dirfd(d), e->d_name, 0);
+        closedir(d);
+    }
+    rmdir(dir);
+}
+
+static int listen_on(const char *socket_path) {
+    struct sockaddr_un addr;
+    if (socket_addr(socket_path, &addr) == -1)
+        return -1;
+    /* A socket nobody answers on is left over from an earlier daemon. */
+    struct stat st;
+    int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (probe != -1 && connect(probe, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+        fprintf(stderr, "serve: %s: already being served\n", socket_path);
+        close(probe);
+        return -1;
+    }
+    if (probe != -1)
+        close(probe);
+    if (lstat(socket_path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1) {
+        perror("socket");
+        return -1;
+    }
+    mode_t mask = umask(077);
+    int rc = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    umask(mask);
+    if (rc == -1 || listen(fd, 64) == -1) {
+        fprintf(stderr, "serve: %s: %s\n", socket_path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void nonblocking(int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+}
+
+int serve_run(const char *socket_path, const char *cache_dir, ServeHandler handler) {
+    char private_dir[PATH_MAX];
+    if (!cache_dir) {
+        const char *tmp = getenv("TMPDIR");
+        snprintf(private_dir, sizeof(private_dir), "%s/vls-serve.XXXXXX", tmp && *tmp ? tmp : "/tmp");
+        if (!mkdtemp(private_dir)) {
+            fprintf(stderr, "serve: %s: %s\n", private_dir, strerror(errno));
+            return 1;
+        }
+    }
+    int notify[2];
+    if (pipe(wake) == -1 || pipe(notify) == -1) {
+        perror("pipe");
+        return 1;
+    }
+    nonblocking(wake[0]);
+    nonblocking(wake[1]);
+    nonblocking(notify[0]);
+    int lfd = listen_on(socket_path);
+    if (lfd == -1) {
+        if (!cache_dir)
+            rmdir(private_dir);
+        return 1;
+    }
+    int ifd = -1;
+#ifdef __linux__
+    ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (ifd == -1)
+        perror("inotify_init1");
+#endif
+
+    const char *dir = cache_dir ? cache_dir : private_dir;
+    cache_init(dir, 0);
+    cache_attach(dir, notify[1]);
+    idcache_preload(SERVE_PRELOAD);
+    color_init(NULL);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGCHLD, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t max = cpus > 2 ? (size_t)cpus * 2 : 4;
+    Worker *workers = calloc(max, sizeof(Worker));
+    struct pollfd *pfds = calloc(max + 4, sizeof(struct pollfd));
+    if (!workers || !pfds) {
+        perror("calloc");
+        return 1;
+    }
+    size_t active = 0;
+
+    while (!stopping) {
+        pfds[0] = (struct pollfd){wake[0], POLLIN, 0};
+        pfds[1] = (struct pollfd){notify[0], POLLIN, 0};
+        pfds[2] = (struct pollfd){ifd, POLLIN, 0};
+        /* At capacity, new clients wait in the listen backlog. */
+        pfds[3] = (struct pollfd){active < max ? lfd : -1, POLLIN, 0};
+        for (size_t i = 0; i < active; i++) {
+#ifdef POLLRDHUP
+            pfds[4 + i] = (struct pollfd){workers[i].hung_up ? -1 : workers[i].conn, POLLRDHUP, 0};
+#else
+            pfds[4 + i] = (struct pollfd){-1, 0, 0};
+#endif
+        }
+        if (poll(pfds, 4 + active, -1) == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            break;
+        }
+        /* A client that disconnects (interrupted, say) takes its worker with it. */
+        for (size_t i = 0; i < active; i++) {
+            if (pfds[4 + i].revents) {
+                workers[i].hung_up = 1;
+                kill(workers[i].pid, SIGTERM);
+            }
+        }
+        if (pfds[0].revents & POLLIN) {
+            char drain[64];
+            while (read(wake[0], drain, sizeof(drain)) > 0)
+                ;
+            reap(workers, &active, 0);
+        }
+        if (pfds[1].revents & POLLIN)
+            read_notices(notify[0], ifd);
+#ifdef __linux__
+        if (ifd != -1 && (pfds[2].revents & POLLIN))
+            read_events(ifd);
+#endif
+        if (active < max && (pfds[3].revents & POLLIN)) {
+            int conn = accept(lfd, NULL, NULL);
+            if (conn == -1)
+                continue;
+            if (!peer_allowed(conn)) {
+                close(conn);
+                continue;
+            }
+            pid_t pid = fork();
+            if (pid == 0) {
+                close(lfd);
+                close(wake[0]);
+                close(wake[1]);
+                close(notify[0]);
+                if (ifd != -1)
+                    close(ifd);
+                for (size_t i = 0; i < active; i++)
+                    close(workers[i].conn);
+                worker(conn, handler);
+            }
+            if (pid == -1) {
+                perror("fork");
+                close(conn);
+                continue;
+            }
+            workers[active++] = (Worker){pid, conn, 0};
+        }
+    }
+
+    close(lfd);
+    unlink(socket_path);
+    reap(workers, &active, 1);
+    if (!cache_dir)
+        remove_dir(private_dir);
+    free(workers);
+    free(pfds);
+    return 0;
+}
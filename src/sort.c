@@ -0,0 +1,403 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "sort.h"
+#include "entry.h"
+#include "trace.h"
+
+/* Below SORT_PARALLEL_MIN entries qsort alone is faster than starting
+ * threads; each thread gets at least SORT_PER_THREAD entries. */
+#define SORT_PARALLEL_MIN 100000
+#define SORT_PER_THREAD 50000
+#define SORT_MAX_THREADS 64
+/* Runs sorted by insertion before merging starts. */
+#define SORT_RUN 16
+
+static int cmp_names(const void *a, const void *b) {
+    const Entry *ea = a;
+    const Entry *eb = b;
+    return strcmp(ea->name, eb->name);
+}
+
+static int cmp_mtime(const void *a, const void *b) {
+    const Entry *ea = a;
+    const Entry *eb = b;
+    if (ea->st.st_mtime == eb->st.st_mtime)
+        return strcmp(ea->name, eb->name);
+    return (ea->st.st_mtime > eb->st.st_mtime) ? -1 : 1;
+}
+
+static int cmp_atime(const void *a, const void *b) {
+    const Entry *ea = a;
+    const Entry *eb = b;
+    if (ea->st.st_atime == eb->st.st_atime)
+        return strcmp(ea->name, eb->name);
+    return (ea->st.st_atime > eb->st.st_atime) ? -1 : 1;
+}
+
+static int cmp_ctime(const void *a, const void *b) {
+    const Entry *ea = a;
+    const Entry *eb = b;
+    if (ea->st.st_ctime == eb->st.st_ctime)
+        return strcmp(ea->name, eb->name);
+    return (ea->st.st_ctime > eb->st.st_ctime) ? -1 : 1;
+}
+
+static int cmp_size(const void *a, const void *b) {
+    const Entry *ea = a;
+    const Entry *eb = b;
+    if (ea->st.st_size == eb->st.st_size)
+        return strcmp(ea->name, eb->name);
+    return (ea->st.st_size > eb->st.st_size) ? -1 : 1;
+}
+
+static int cmp_extension(const void *a, const void *b) {
+    const Entry *ea = a;
+    const Entry *eb = b;
+    const char *ea_ext = strrchr(ea->name, '.');
+    const char *eb_ext = strrchr(eb->name, '.');
+    ea_ext = ea_ext ? ea_ext + 1 : ea->name;
+    eb_ext = eb_ext ? eb_ext + 1 : eb->name;
+    int cmp = strcasecmp(ea_ext, eb_ext);
+    if (cmp == 0)
+        cmp = strcasecmp(ea->name, eb->name);
+    return cmp ? cmp : strcmp(ea->name, eb->name);
+}
+
+static int cmp_version(const void *a, const void *b) {
+    const Entry *ea = a;
+    const Entry *eb = b;
+#if defined(__GLIBC__) || defined(__GNU_LIBRARY__) || defined(__linux__)
+    int cmp = strverscmp(ea->name, eb->name);
+    return cmp ? cmp : strcmp(ea->name, eb->name);
+#else
+    const char *sa = ea->name;
+    const char *sb = eb->name;
+    while (*sa && *sb) {
+        if (isdigit((unsigned char)*sa) && isdigit((unsigned char)*sb)) {
+            char *ea_end; char *eb_end;
+            unsigned long na = strtoul(sa, &ea_end, 10);
+            unsigned long nb = strtoul(sb, &eb_end, 10);
+            if (na != nb)
+                return (na > nb) ? 1 : -1;
+            sa = ea_end;
+            sb = eb_end;
+        } else {
+            if (*sa != *sb)
+                return (unsigned char)*sa - (unsigned char)*sb;
+            sa++; sb++;
+        }
+    }
+    if (*sa) return 1;
+    if (*sb) return -1;
+    return strcmp(ea->name, eb->name);
+#endif
+}
+
+VlsSort sort_key(const char *sort_word, int sort_time, int sort_atime, int sort_ctime,
+                 int sort_size, int sort_extension, int sort_version) {
+    if (sort_word) {
+        if (strcmp(sort_word, "size") == 0)
+            return VLS_SORT_SIZE;
+        if (strcmp(sort_word, "time") == 0)
+            return VLS_SORT_TIME;
+        if (strcmp(sort_word, "atime") == 0)
+            return VLS_SORT_ATIME;
+        if (strcmp(sort_word, "ctime") == 0)
+            return VLS_SORT_CTIME;
+        if (strcmp(sort_word, "extension") == 0)
+            return VLS_SORT_EXTENSION;
+        if (strcmp(sort_word, "version") == 0)
+            return VLS_SORT_VERSION;
+        return VLS_SORT_NAME;
+    }
+    if (sort_size)
+        return VLS_SORT_SIZE;
+    if (sort_time)
+        return VLS_SORT_TIME;
+    if (sort_atime)
+        return VLS_SORT_ATIME;
+    if (sort_ctime)
+        return VLS_SORT_CTIME;
+    if (sort_extension)
+        return VLS_SORT_EXTENSION;
+    if (sort_version)
+        return VLS_SORT_VERSION;
+    return VLS_SORT_NAME;
+}
+
+EntryCmp sort_cmp(VlsSort key) {
+    switch (key) {
+    case VLS_SORT_SIZE:
+        return cmp_size;
+    case VLS_SORT_TIME:
+        return cmp_mtime;
+    case VLS_SORT_ATIME:
+        return cmp_atime;
+    case VLS_SORT_CTIME:
+        return cmp_ctime;
+    case VLS_SORT_EXTENSION:
+        return cmp_extension;
+    case VLS_SORT_VERSION:
+        return cmp_version;
+    default:
+        return cmp_names;
+    }
+}
+
+/* ---- display orders ---- */
+
+static int cmp_none(const void *a, const void *b) {
+    (void)a;
+    (void)b;
+    return 0;
+}
+
+static int cmp_dirs(const void *a, const void *b) {
+    int da = S_ISDIR(((const Entry *)a)->st.st_mode) != 0;
+    int db = S_ISDIR(((const Entry *)b)->st.st_mode) != 0;
+    return db - da;
+}
+
+/* Each ordering with directories first, reversed, and both. */
+#define DISPLAY_ORDERS(cmp)                                              \
+    static int cmp##_dirs(const void *a, const void *b) {                \
+        int c = cmp_dirs(a, b);                                          \
+        return c ? c : cmp(a, b);                                        \
+    }                                                                    \
+    static int cmp##_rev(const void *a, const void *b) {                 \
+        return cmp(b, a);                                                \
+    }                                                                    \
+    static int cmp##_dirs_rev(const void *a, const void *b) {            \
+        return cmp##_dirs(b, a);                                         \
+    }
+
+DISPLAY_ORDERS(cmp_names)
+DISPLAY_ORDERS(cmp_size)
+DISPLAY_ORDERS(cmp_mtime)
+DISPLAY_ORDERS(cmp_atime)
+DISPLAY_ORDERS(cmp_ctime)
+DISPLAY_ORDERS(cmp_extension)
+DISPLAY_ORDERS(cmp_version)
+DISPLAY_ORDERS(cmp_none)
+
+/* Indexed by VlsSort, then by dirs_first + 2 * reverse. */
+static const EntryCmp display_orders[][4] = {
+    {cmp_names, cmp_names_dirs, cmp_names_rev, cmp_names_dirs_rev},
+    {cmp_size, cmp_size_dirs, cmp_size_rev, cmp_size_dirs_rev},
+    {cmp_mtime, cmp_mtime_dirs, cmp_mtime_rev, cmp_mtime_dirs_rev},
+    {cmp_atime, cmp_atime_dirs, cmp_atime_rev, cmp_atime_dirs_rev},
+    {cmp_ctime, cmp_ctime_dirs, cmp_ctime_rev, cmp_ctime_dirs_rev},
+    {cmp_extension, cmp_extension_dirs, cmp_extension_rev, cmp_extension_dirs_rev},
+    {cmp_version, cmp_version_dirs, cmp_version_rev, cmp_version_dirs_rev},
+    {cmp_none, cmp_none_dirs, cmp_none_rev, cmp_none_dirs_rev},
+};
+
+EntryCmp sort_order(VlsSort key, int dirs_first, int reverse) {
+    if ((unsigned)key > VLS_SORT_NONE)
+        key = VLS_SORT_NAME;
+    return display_orders[key][(dirs_first != 0) + 2 * (reverse != 0)];
+}
+
+/* ---- parallel sort ---- */
+
+/*
+ * Above the threshold the entries are sorted through an array of pointers,
+ * so that merging moves eight bytes rather than a whole struct stat: each
+ * thread merge-sorts one slice, slices are merged pairwise in rounds with
+ * every merge split among the threads at balanced output positions, and
+ * the entries are permuted into place once at the end.  Every ordering
+ * ends in a comparison of names, so the result is the one qsort gives.
+ */
+
+static int sort_threads = 0;
+
+typedef struct {
+    Entry **src;
+    Entry **dst;
+    size_t count;
+    size_t run;         /* slice length, then length of the runs merged */
+    int merging;
+    size_t parts;       /* tasks per merge */
+    size_t tasks;
+    size_t next;
+    EntryCmp cmp;
+    pthread_t owner;
+    pthread_mutex_t lock;
+} SortJob;
+
+void sort_set_threads(int threads) {
+    sort_threads = threads;
+}
+
+static void merge(Entry **a, size_t na, Entry **b, size_t nb, Entry **out, EntryCmp cmp) {
+    size_t i = 0, j = 0;
+    while (i < na && j < nb)
+        *out++ = cmp(b[j], a[i]) < 0 ? b[j++] : a[i++];
+    memcpy(out, a + i, (na - i) * sizeof(Entry *));
+    memcpy(out + (na - i), b + j, (nb - j) * sizeof(Entry *));
+}
+
+/* Sort V[0..N) with TMP as scratch; the result is left in V. */
+static void merge_sort(Entry **v, Entry **tmp, size_t n, EntryCmp cmp) {
+    for (size_t lo = 0; lo < n; lo += SORT_RUN) {
+        size_t hi = lo + SORT_RUN < n ? lo + SORT_RUN : n;
+        for (size_t i = lo + 1; i < hi; i++) {
+            Entry *e = v[i];
+            size_t j = i;
+            while (j > lo && cmp(e, v[j - 1]) < 0) {
+                v[j] = v[j - 1];
+                j--;
+            }
+            v[j] = e;
+        }
+    }
+    Entry **src = v, **dst = tmp;
+    for (size_t run = SORT_RUN; run < n; run *= 2) {
+        for (size_t lo = 0; lo < n; lo += 2 * run) {
+            size_t mid = lo + run < n ? lo + run : n;
+            size_t hi = lo + 2 * run < n ? lo + 2 * run : n;
+            merge(src + lo, mid - lo, src + mid, hi - mid, dst + lo, cmp);
+        }
+        Entry **t = src;
+        src = dst;
+        dst = t;
+    }
+    if (src != v)
+        memcpy(v, src, n * sizeof(Entry *));
+}
+
+/* How many of the first K outputs of merging A and B come from A. */
+static size_t split(Entry **a, size_t na, Entry **b, size_t nb, size_t k, EntryCmp cmp) {
+    size_t lo = k > nb ? k - nb : 0, hi = k < na ? k : na;
+    while (lo < hi) {
+        size_t i = lo + (hi - lo) / 2;
+        /* Taking i + 1 from A is right while A[i] precedes B[k - i - 1]. */
+        if (cmp(b[k - i - 1], a[i]) < 0)
+            hi = i;
+        else
+            lo = i + 1;
+    }
+    return lo;
+}
+
+static void run_task(SortJob *job, size_t task) {
+    if (!job->merging) {
+        size_t lo = task * job->run;
+        size_t n = lo + job->run < job->count ? job->run : job->count - lo;
+        merge_sort(job->src + lo, job->dst + lo, n, job->cmp);
+        return;
+    }
+    size_t pair = task / job->parts, part = task % job->parts;
+    size_t lo = pair * 2 * job->run;
+    size_t mid = lo + job->run < job->count ? lo + job->run : job->count;
+    size_t hi = lo + 2 * job->run < job->count ? lo + 2 * job->run : job->count;
+    Entry **a = job->src + lo, **b = job->src + mid;
+    size_t na = mid - lo, nb = hi - mid, n = hi - lo;
+    size_t from = n * part / job->parts, to = n * (part + 1) / job->parts;
+    size_t ia = split(a, na, b, nb, from, job->cmp), ja = split(a, na, b, nb, to, job->cmp);
+    merge(a + ia, ja - ia, b + (from - ia), (to - ja) - (from - ia), job->dst + lo + from, job->cmp);
+}
+
+static void *sort_worker(void *arg) {
+    SortJob *job = arg;
+    if (trace_on && !pthread_equal(pthread_self(), job->owner))
+        trace_thread_name("sort worker");
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        size_t task = job->next++;
+        pthread_mutex_unlock(&job->lock);
+        if (task >= job->tasks)
+            break;
+        uint64_t start = 0;
+        TRACE_NOW(start);
+        run_task(job, task);
+        TRACE_SPAN(job->merging ? "sort merge" : "sort slice", NULL, NULL, start);
+    }
+    return NULL;
+}
+
+/* Run JOB's tasks on THREADS threads, this one included. */
+static void run_job(SortJob *job, size_t threads) {
+    pthread_t tids[SORT_MAX_THREADS];
+    size_t started = 0;
+    job->next = 0;
+    for (size_t i = 1; i < threads && i < job->tasks; i++)
+        if (pthread_create(&tids[started], NULL, sort_worker, job) == 0)
+            started++;
+    sort_worker(job);
+    for (size_t i = 0; i < started; i++)
+        pthread_join(tids[i], NULL);
+}
+
+static size_t thread_count(size_t count) {
+    size_t threads = (size_t)sort_threads;
+    if (sort_threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 1 ? (size_t)cpus : 1;
+    }
+    if (threads > SORT_MAX_THREADS)
+        threads = SORT_MAX_THREADS;
+    if (threads > count / SORT_PER_THREAD)
+        threads = count / SORT_PER_THREAD;
+    return threads;
+}
+
+static int parallel_sort(Entry *entries, size_t count, EntryCmp cmp, size_t threads) {
+    Entry **v = malloc(count * sizeof(Entry *));
+    Entry **tmp = malloc(count * sizeof(Entry *));
+    if (!v || !tmp) {
+        free(v);
+        free(tmp);
+        return -1;
+    }
+    for (size_t i = 0; i < count; i++)
+        v[i] = &entries[i];
+    size_t slice = (count + threads - 1) / threads;
+    SortJob job = {v, tmp, count, slice, 0, 1, (count + slice - 1) / slice, 0, cmp, pthread_self(),
+                   PTHREAD_MUTEX_INITIALIZER};
+    run_job(&job, threads);
+    job.merging = 1;
+    for (; job.run < count; job.run *= 2) {
+        size_t pairs = (count + 2 * job.run - 1) / (2 * job.run);
+        job.parts = threads / pairs ? threads / pairs : 1;
+        job.tasks = pairs * job.parts;
+        run_job(&job, threads);
+        Entry **t = job.src;
+        job.src = job.dst;
+        job.dst = t;
+    }
+    free(job.dst);
+
+    /* Slot I takes the entry SORTED[I] points at; each cycle of that
+     * permutation is followed once, marking slots done as they fill. */
+    Entry **sorted = job.src;
+    for (size_t i = 0; i < count; i++) {
+        if (sorted[i] == &entries[i])
+            continue;
+        Entry held = entries[i];
+        size_t j = i;
+        while (sorted[j] != &entries[i]) {
+            size_t k = (size_t)(sorted[j] - entries);
+            entries[j] = entries[k];
+            sorted[j] = &entries[j];
+            j = k;
+        }
+        entries[j] = held;
+        sorted[j] = &entries[j];
+    }
+    free(sorted);
+    return 0;
+}
+
+void sort_entries(Entry *entries, size_t count, EntryCmp cmp) {
+    size_t threads = count >= SORT_PARALLEL_MIN ? thread_count(count) : 1;
+    if (threads > 1 && parallel_sort(entries, count, cmp, threads) == 0)
+        return;
+    qsort(entries, count, sizeof(Entry), cmp);
+}
@@ -0,0 +1,393 @@
+#define _XOPEN_SOURCE 700
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include "spill.h"
+#include "trace.h"
+#include "util.h"
+
+/* Each run being merged reads through its own buffer of this size, so
+ * the memory a merge may use sets how many runs it takes at once. */
+#define SPILL_BUFFER (64 * 1024)
+#define SPILL_MAX_FANIN 1024
+
+/* The fixed part of a record; the name follows without its NUL. */
+typedef struct {
+    uint64_t ino, dev, nlink, size, blocks;
+    int64_t atime, mtime, ctime;
+    uint32_t atime_ns, mtime_ns, ctime_ns;
+    uint32_t mode, uid, gid;
+    int32_t color, context;
+    uint32_t name_len;
+} Record;
+
+struct SpillSet {
+    FILE *f;
+    int fd;
+    size_t memory;
+    size_t fanin;
+    off_t end;
+    /* Run i spans bounds[i] to bounds[i + 1]. */
+    off_t *bounds;
+    size_t runs, cap;
+};
+
+struct SpillReader {
+    int fd;
+    off_t pos, end;
+    char *buf;
+    size_t cap, at, len;
+    char *name;
+    size_t name_cap;
+};
+
+typedef struct {
+    SpillReader *r;
+    size_t run;
+    Entry ent;
+} Head;
+
+typedef struct {
+    EntryCmp cmp;
+    int later_first;
+} Order;
+
+static void report(const char *what) {
+    fprintf(stderr, "spill: %s: %s\n", what, strerror(errno));
+}
+
+SpillSet *spill_open(size_t memory) {
+    SpillSet *s = calloc(1, sizeof(SpillSet));
+    if (!s) {
+        perror("malloc");
+        return NULL;
+    }
+    s->fd = temp_file("vls-spill");
+    if (s->fd == -1) {
+        report("temporary file");
+        free(s);
+        return NULL;
+    }
+    s->f = fdopen(s->fd, "wb");
+    s->cap = 16;
+    s->bounds = malloc(s->cap * sizeof(off_t));
+    if (!s->f || !s->bounds) {
+        perror("malloc");
+        if (s->f)
+            fclose(s->f);
+        else
+            close(s->fd);
+        free(s->bounds);
+        free(s);
+        return NULL;
+    }
+    s->bounds[0] = 0;
+    s->memory = memory;
+    s->fanin = memory / SPILL_BUFFER;
+    if (s->fanin < 2)
+        s->fanin = 2;
+    if (s->fanin > SPILL_MAX_FANIN)
+        s->fanin = SPILL_MAX_FANIN;
+    return s;
+}
+
+int spill_add(SpillSet *s, const Entry *ent) {
+    const struct stat *st = &ent->st;
+    Record rec = {
+        (uint64_t)st->st_ino, (uint64_t)st->st_dev, (uint64_t)st->st_nlink,
+        (uint64_t)st->st_size, (uint64_t)st->st_blocks,
+        (int64_t)st->ST_ATIM.tv_sec, (int64_t)st->ST_MTIM.tv_sec, (int64_t)st->ST_CTIM.tv_sec,
+        (uint32_t)st->ST_ATIM.tv_nsec, (uint32_t)st->ST_MTIM.tv_nsec, (uint32_t)st->ST_CTIM.tv_nsec,
+        (uint32_t)st->st_mode, (uint32_t)st->st_uid, (uint32_t)st->st_gid,
+        ent->color, ent->context, (uint32_t)strlen(ent->name)
+    };
+    if (fwrite(&rec, sizeof(rec), 1, s->f) != 1 || fwrite(ent->name, 1, rec.name_len, s->f) != rec.name_len) {
+        report("write");
+        return -1;
+    }
+    s->end += (off_t)(sizeof(rec) + rec.name_len);
+    return 0;
+}
+
+int spill_end_run(SpillSet *s) {
+    if (s->end == s->bounds[s->runs])
+        return 0;
+    if (s->runs + 1 == s->cap) {
+        off_t *tmp = realloc(s->bounds, s->cap * 2 * sizeof(off_t));
+        if (!tmp) {
+            perror("realloc");
+            return -1;
+        }
+        s->bounds = tmp;
+        s->cap *= 2;
+    }
+    s->bounds[++s->runs] = s->end;
+    return 0;
+}
+
+size_t spill_run_count(const SpillSet *s) {
+    return s->runs;
+}
+
+void spill_close(SpillSet *s) {
+    if (!s)
+        return;
+    fclose(s->f);
+    free(s->bounds);
+    free(s);
+}
+
+/* ---- reading ---- */
+
+SpillReader *spill_reader(SpillSet *s, size_t run) {
+    if (fflush(s->f) == EOF) {
+        report("write");
+        return NULL;
+    }
+    SpillReader *r = calloc(1, sizeof(SpillReader));
+    if (r)
+        r->buf = malloc(SPILL_BUFFER);
+    if (!r || !r->buf) {
+        perror("malloc");
+        free(r);
+        return NULL;
+    }
+    r->fd = s->fd;
+    r->pos = s->bounds[run];
+    r->end = s->bounds[run + 1];
+    r->cap = SPILL_BUFFER;
+    return r;
+}
+
+/* Make NEED unread bytes available at buf + at: 1 when they are, 0 at
+ * the end of the run and -1 on an error or a cut-off record. */
+static int fill(SpillReader *r, size_t need) {
+    if (r->len - r->at >= need)
+        return 1;
+    memmove(r->buf, r->buf + r->at, r->len - r->at);
+    r->len -= r->at;
+    r->at = 0;
+    if (need > r->cap) {
+        char *tmp = realloc(r->buf, need);
+        if (!tmp) {
+            perror("realloc");
+            return -1;
+        }
+        r->buf = tmp;
+        r->cap = need;
+    }
+    while (r->len < need && r->pos < r->end) {
+        size_t want = r->cap - r->len;
+        if ((off_t)want > r->end - r->pos)
+            want = (size_t)(r->end - r->pos);
+        ssize_t n = pread(r->fd, r->buf + r->len, want, r->pos);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            if (n == 0)
+                errno = EIO;
+            report("read");
+            return -1;
+        }
+        r->len += (size_t)n;
+        r->pos += n;
+    }
+    if (r->len >= need)
+        return 1;
+    if (r->len == 0)
+        return 0;
+    errno = EIO;
+    report("read");
+    return -1;
+}
+
+int spill_read(SpillReader *r, Entry *ent) {
+    int rc = fill(r, sizeof(Record));
+    if (rc <= 0)
+        return rc;
+    Record rec;
+    memcpy(&rec, r->buf + r->at, sizeof(rec));
+    if (fill(r, sizeof(rec) + rec.name_len) != 1)
+        return -1;
+    if (rec.name_len + 1 > r->name_cap) {
+        char *tmp = realloc(r->name, rec.name_len + 1);
+        if (!tmp) {
+            perror("realloc");
+            return -1;
+        }
+        r->name = tmp;
+        r->name_cap = rec.name_len + 1;
+    }
+    memcpy(r->name, r->buf + r->at + sizeof(rec), rec.name_len);
+    r->name[rec.name_len] = '\0';
+    r->at += sizeof(rec) + rec.name_len;
+
+    memset(ent, 0, sizeof(*ent));
+    ent->name = r->name;
+    ent->st.st_ino = (ino_t)rec.ino;
+    ent->st.st_dev = (dev_t)rec.dev;
+    ent->st.st_nlink = (nlink_t)rec.nlink;
+    ent->st.st_size = (off_t)rec.size;
+    ent->st.st_blocks = (blkcnt_t)rec.blocks;
+    ent->st.ST_ATIM.tv_sec = (time_t)rec.atime;
+    ent->st.ST_MTIM.tv_sec = (time_t)rec.mtime;
+    ent->st.ST_CTIM.tv_sec = (time_t)rec.ctime;
+    ent->st.ST_ATIM.tv_nsec = rec.atime_ns;
+    ent->st.ST_MTIM.tv_nsec = rec.mtime_ns;
+    ent->st.ST_CTIM.tv_nsec = rec.ctime_ns;
+    ent->st.st_mode = (mode_t)rec.mode;
+    ent->st.st_uid = (uid_t)rec.uid;
+    ent->st.st_gid = (gid_t)rec.gid;
+    ent->color = rec.color;
+    ent->context = rec.context;
+    return 1;
+}
+
+void spill_reader_close(SpillReader *r) {
+    if (!r)
+        return;
+    free(r->buf);
+    free(r->name);
+    free(r);
+}
+
+/* ---- merging ---- */
+
+static int head_before(const Order *o, const Head *a, const Head *b) {
+    int c = o->cmp(&a->ent, &b->ent);
+    if (c)
+        return c < 0;
+    return o->later_first ? a->run > b->run : a->run < b->run;
+}
+
+static void sift_down(const Order *o, Head *heap, size_t n, size_t i) {
+    for (;;) {
+        size_t best = i, l = 2 * i + 1, r = l + 1;
+        if (l < n && head_before(o, &heap[l], &heap[best]))
+            best = l;
+        if (r < n && head_before(o, &heap[r], &heap[best]))
+            best = r;
+        if (best == i)
+            return;
+        Head tmp = heap[i];
+        heap[i] = heap[best];
+        heap[best] = tmp;
+        i = best;
+    }
+}
+
+struct SpillMerge {
+    Order o;
+    Head *heap;
+    size_t n;
+    /* The entry last handed out still sits at the top of the heap. */
+    int handed;
+    uint64_t start;
+};
+
+/* A merge of runs FROM to TO of S. */
+static SpillMerge *merge_start(SpillSet *s, size_t from, size_t to, const Order *o) {
+    SpillMerge *m = calloc(1, sizeof(SpillMerge));
+    if (m)
+        m->heap = calloc(to - from ? to - from : 1, sizeof(Head));
+    if (!m || !m->heap) {
+        perror("calloc");
+        free(m);
+        return NULL;
+    }
+    TRACE_NOW(m->start);
+    m->o = *o;
+    for (size_t run = from; run < to; run++) {
+        SpillReader *r = spill_reader(s, run);
+        if (!r) {
+            spill_merge_close(m);
+            return NULL;
+        }
+        Head *h = &m->heap[m->n];
+        h->r = r;
+        h->run = run;
+        int got = spill_read(r, &h->ent);
+        if (got == 1) {
+            m->n++;
+            continue;
+        }
+        spill_reader_close(r);
+        if (got == -1) {
+            spill_merge_close(m);
+            return NULL;
+        }
+    }
+    for (size_t i = m->n / 2; i-- > 0;)
+        sift_down(&m->o, m->heap, m->n, i);
+    return m;
+}
+
+int spill_merge_next(SpillMerge *m, Entry *ent) {
+    if (m->handed) {
+        m->handed = 0;
+        int got = spill_read(m->heap[0].r, &m->heap[0].ent);
+        if (got == -1)
+            return -1;
+        if (got == 0) {
+            spill_reader_close(m->heap[0].r);
+            m->heap[0] = m->heap[--m->n];
+        }
+        sift_down(&m->o, m->heap, m->n, 0);
+    }
+    if (m->n == 0)
+        return 0;
+    *ent = m->heap[0].ent;
+    m->handed = 1;
+    return 1;
+}
+
+void spill_merge_close(SpillMerge *m) {
+    if (!m)
+        return;
+    for (size_t i = 0; i < m->n; i++)
+        spill_reader_close(m->heap[i].r);
+    free(m->heap);
+    TRACE_SPAN("spill merge", NULL, NULL, m->start);
+    free(m);
+}
+
+/* Merge runs FROM to TO into one run of NEXT. */
+static int merge_into(SpillSet *s, size_t from, size_t to, const Order *o, SpillSet *next) {
+    SpillMerge *m = merge_start(s, from, to, o);
+    if (!m)
+        return -1;
+    Entry ent;
+    int got;
+    while ((got = spill_merge_next(m, &ent)) == 1)
+        if (spill_add(next, &ent) == -1) {
+            got = -1;
+            break;
+        }
+    spill_merge_close(m);
+    return got == 0 ? spill_end_run(next) : -1;
+}
+
+SpillMerge *spill_merge(SpillSet *s, EntryCmp cmp, int later_first) {
+    Order o = {cmp, later_first};
+    while (s->runs > s->fanin) {
+        SpillSet *next = spill_open(s->memory);
+        if (!next)
+            return NULL;
+        for (size_t from = 0; from < s->runs; from += s->fanin) {
+            size_t to = from + s->fanin < s->runs ? from + s->fanin : s->runs;
+            if (merge_into(s, from, to, &o, next) == -1) {
+                spill_close(next);
+                return NULL;
+            }
+        }
+        /* The longer runs replace the old ones in S. */
+        SpillSet old = *s;
+        *s = *next;
+        *next = old;
+        spill_close(next);
+    }
+    return merge_start(s, 0, s->runs, &o);
+}
@@ -0,0 +1,198 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "stats.h"
+#include "trace.h"
+#include "util.h"
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+#define SLOWEST 5
+
+typedef struct {
+    char *path;
+    size_t count;
+    double wall;
+} SlowDir;
+
+int stats_on = 0;
+
+static const char *phase_names[STATS_PHASES] = {"opendir", "scan", "stat", "sort", "measure", "render", "write"};
+static const char *call_names[STATS_CALLS] = {"opendir", "readdir", "stat", "getpwuid", "getgrgid", "lgetfilecon"};
+
+static double phase_wall[STATS_PHASES], phase_cpu[STATS_PHASES];
+static unsigned long long calls[STATS_CALLS], errors[STATS_CALLS];
+static unsigned long long out_bytes = 0, out_writes = 0;
+static unsigned long dirs_listed = 0;
+static SlowDir slowest[SLOWEST];
+static struct timespec start_wall;
+static int hooked = 0;
+static int reporting = 0;
+
+static uint64_t to_ns(const struct timespec *ts) {
+    return (uint64_t)ts->tv_sec * 1000000000u + (uint64_t)ts->tv_nsec;
+}
+
+static double elapsed_ms(const struct timespec *from, const struct timespec *to) {
+    return (double)(to->tv_sec - from->tv_sec) * 1e3 + (double)(to->tv_nsec - from->tv_nsec) / 1e6;
+}
+
+static void now(struct timespec *wall, struct timespec *cpu) {
+    clock_gettime(CLOCK_MONOTONIC, wall);
+    if (cpu)
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, cpu);
+}
+
+/* Standard output is replaced by a stream whose buffer drains through
+ * here, so every write(2) is counted and timed. */
+static ssize_t write_out(const char *buf, size_t len) {
+    struct timespec w0, c0, w1, c1;
+    now(&w0, &c0);
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = write(STDOUT_FILENO, buf + done, len - done);
+        out_writes++;
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        done += (size_t)n;
+    }
+    now(&w1, &c1);
+    out_bytes += done;
+    phase_wall[STATS_WRITE] += elapsed_ms(&w0, &w1);
+    phase_cpu[STATS_WRITE] += elapsed_ms(&c0, &c1);
+    return done == 0 && len ? -1 : (ssize_t)done;
+}
+
+#if defined(__GLIBC__)
+static ssize_t cookie_write(void *cookie, const char *buf, size_t len) {
+    (void)cookie;
+    return write_out(buf, len);
+}
+#elif defined(__APPLE__) || defined(__NetBSD__) || defined(__FreeBSD__) || defined(__OpenBSD__)
+static int cookie_write(void *cookie, const char *buf, int len) {
+    (void)cookie;
+    return (int)write_out(buf, (size_t)len);
+}
+#endif
+
+static void hook_stdout(void) {
+    FILE *f = NULL;
+#if defined(__GLIBC__)
+    cookie_io_functions_t io = {NULL, cookie_write, NULL, NULL};
+    f = fopencookie(NULL, "w", io);
+#elif defined(__APPLE__) || defined(__NetBSD__) || defined(__FreeBSD__) || defined(__OpenBSD__)
+    f = funopen(NULL, NULL, cookie_write, NULL, NULL);
+#endif
+    if (!f)
+        return;
+    /* Keep the buffering the real stream would have had. */
+    setvbuf(f, NULL, stdout_isatty() ? _IOLBF : _IOFBF, BUFSIZ);
+    fflush(stdout);
+    stdout = f;
+    hooked = 1;
+}
+
+static void report(void) {
+    struct timespec end_wall, end_cpu;
+    fflush(stdout);
+    now(&end_wall, &end_cpu);
+
+    fprintf(stderr, "\nvls: stats\n%-12s %12s %12s\n", "phase", "wall ms", "cpu ms");
+    for (int p = 0; p < STATS_PHASES; p++)
+        fprintf(stderr, "%-12s %12.3f %12.3f\n", phase_names[p], phase_wall[p], phase_cpu[p]);
+    struct timespec zero = {0, 0};
+    fprintf(stderr, "%-12s %12.3f %12.3f\n", "total", elapsed_ms(&start_wall, &end_wall),
+            elapsed_ms(&zero, &end_cpu));
+
+    fprintf(stderr, "\n%-12s %12s %12s\n", "call", "count", "errors");
+    for (int c = 0; c < STATS_CALLS; c++)
+        fprintf(stderr, "%-12s %12llu %12llu\n", call_names[c], calls[c], errors[c]);
+
+    fprintf(stderr, "\n");
+    if (hooked)
+        fprintf(stderr, "output       %llu bytes in %llu writes\n", out_bytes, out_writes);
+    else
+        fprintf(stderr, "output       not measured on this platform\n");
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) == 0) {
+#ifdef __APPLE__
+        long peak = (long)(ru.ru_maxrss / 1024);
+#else
+        long peak = (long)ru.ru_maxrss;
+#endif
+        fprintf(stderr, "peak rss     %ld KiB\n", peak);
+    }
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    struct mallinfo2 mi = mallinfo2();
+    fprintf(stderr, "heap         %zu KiB in use, %zu KiB mapped\n", (mi.uordblks + mi.hblkhd) / 1024,
+            (mi.arena + mi.hblkhd) / 1024);
+#endif
+
+    if (dirs_listed > 1 && slowest[0].path) {
+        fprintf(stderr, "\nslowest of %lu directories (excluding subdirectories)\n", dirs_listed);
+        for (int i = 0; i < SLOWEST && slowest[i].path; i++)
+            fprintf(stderr, "%12.3f ms %8zu entries  %s\n", slowest[i].wall, slowest[i].count, slowest[i].path);
+    }
+}
+
+void stats_init(int with_report) {
+    stats_on = 1;
+    if (!with_report)
+        return;
+    reporting = 1;
+    clock_gettime(CLOCK_MONOTONIC, &start_wall);
+    hook_stdout();
+    atexit(report);
+}
+
+/* Tracing alone needs no CPU times, which cost a system call each. */
+void stats_mark(StatsMark *mark) {
+    now(&mark->wall, reporting ? &mark->cpu : NULL);
+    mark->write_wall = phase_wall[STATS_WRITE];
+    mark->write_cpu = phase_cpu[STATS_WRITE];
+}
+
+void stats_lap(StatsPhase phase, StatsMark *mark) {
+    StatsMark cur;
+    stats_mark(&cur);
+    if (reporting) {
+        phase_wall[phase] += elapsed_ms(&mark->wall, &cur.wall) - (cur.write_wall - mark->write_wall);
+        phase_cpu[phase] += elapsed_ms(&mark->cpu, &cur.cpu) - (cur.write_cpu - mark->write_cpu);
+    }
+    TRACE_SPAN(phase_names[phase], NULL, NULL, to_ns(&mark->wall));
+    *mark = cur;
+}
+
+void stats_call(StatsCall call, int failed) {
+    calls[call]++;
+    if (failed)
+        errors[call]++;
+}
+
+void stats_dir(const char *path, size_t count, const StatsMark *mark) {
+    TRACE_SPAN(NULL, path, NULL, to_ns(&mark->wall));
+    if (!reporting)
+        return;
+    struct timespec wall;
+    clock_gettime(CLOCK_MONOTONIC, &wall);
+    double ms = elapsed_ms(&mark->wall, &wall);
+    dirs_listed++;
+    int at = SLOWEST;
+    while (at > 0 && (!slowest[at - 1].path || slowest[at - 1].wall < ms))
+        at--;
+    if (at == SLOWEST)
+        return;
+    char *copy = strdup(path);
+    if (!copy)
+        return;
+    free(slowest[SLOWEST - 1].path);
+    memmove(&slowest[at + 1], &slowest[at], (SLOWEST - 1 - (size_t)at) * sizeof(SlowDir));
+    slowest[at] = (SlowDir){copy, count, ms};
+}
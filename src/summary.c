@@ -0,0 +1,581 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <locale.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "summary.h"
+#include "idcache.h"
+#include "json.h"
+#include "vlsdir.h"
+#include "util.h"
+
+#define HIST_BUCKETS 65
+#define TOP_COUNT 10
+#define SUMMARY_MAX_THREADS 8
+
+enum {
+    T_FILE, T_DIR, T_LINK, T_FIFO, T_SOCK, T_BLK, T_CHR, T_OTHER, T_COUNT
+};
+
+static const char *const type_names[T_COUNT] = {
+    "file", "directory", "symlink", "fifo", "socket", "block", "char", "other"
+};
+
+enum {
+    AGE_FUTURE, AGE_HOUR, AGE_DAY, AGE_WEEK, AGE_MONTH, AGE_YEAR, AGE_OLDER, AGE_COUNT
+};
+
+static const char *const age_names[AGE_COUNT] = {
+    "future", "1h", "1d", "7d", "30d", "365d", "older"
+};
+
+static const int64_t age_limits[AGE_COUNT] = {
+    0, 3600, 86400, 7 * 86400, 30 * 86400, 365 * 86400, INT64_MAX
+};
+
+typedef struct {
+    char *key;         /* lowercased extension, "" for none */
+    uint64_t count;
+    uint64_t bytes;
+} ExtSlot;
+
+typedef struct {
+    uint32_t uid;
+    int used;
+    uint64_t count;
+    uint64_t bytes;
+} OwnerSlot;
+
+struct Summary {
+    uint64_t entries;
+    uint64_t types[T_COUNT];
+    uint64_t bytes;
+    uint64_t allocated;
+    uint64_t hist[HIST_BUCKETS];
+    uint64_t age[AGE_COUNT];
+    ExtSlot *exts;
+    size_t ext_cap, ext_count;
+    OwnerSlot *owners;
+    size_t owner_cap, owner_count;
+};
+
+static SummaryMode mode = SUMMARY_NONE;
+static time_t now;
+static Summary *run = NULL;
+
+void summary_init(SummaryMode m) {
+    mode = m;
+    now = time(NULL);
+    /* Extensions are case-folded, possibly on walker threads. */
+    if (mode)
+        locale_need(LC_CTYPE);
+}
+
+SummaryMode summary_mode(void) {
+    return mode;
+}
+
+Summary *summary_new(void) {
+    return calloc(1, sizeof(Summary));
+}
+
+void summary_free(Summary *s) {
+    if (!s)
+        return;
+    for (size_t i = 0; i < s->ext_cap; i++)
+        free(s->exts[i].key);
+    free(s->exts);
+    free(s->owners);
+    free(s);
+}
+
+Summary *summary_run(void) {
+    if (!run)
+        run = summary_new();
+    return run;
+}
+
+static int type_of(mode_t m) {
+    if (S_ISREG(m)) return T_FILE;
+    if (S_ISDIR(m)) return T_DIR;
+    if (S_ISLNK(m)) return T_LINK;
+    if (S_ISFIFO(m)) return T_FIFO;
+    if (S_ISSOCK(m)) return T_SOCK;
+    if (S_ISBLK(m)) return T_BLK;
+    if (S_ISCHR(m)) return T_CHR;
+    return T_OTHER;
+}
+
+static uint64_t hash_str(const char *s) {
+    uint64_t h = 1469598103934665603ULL;
+    for (; *s; s++)
+        h = (h ^ (unsigned char)*s) * 1099511628211ULL;
+    return h;
+}
+
+static ExtSlot *ext_slot(Summary *s, const char *key) {
+    if ((s->ext_count + 1) * 2 > s->ext_cap) {
+        size_t cap = s->ext_cap ? s->ext_cap * 2 : 64;
+        ExtSlot *slots = calloc(cap, sizeof(ExtSlot));
+        if (!slots)
+            return NULL;
+        for (size_t i = 0; i < s->ext_cap; i++) {
+            if (!s->exts[i].key)
+                continue;
+            size_t j = (size_t)hash_str(s->exts[i].key) & (cap - 1);
+            while (slots[j].key)
+                j = (j + 1) & (cap - 1);
+            slots[j] = s->exts[i];
+        }
+        free(s->exts);
+        s->exts = slots;
+        s->ext_cap = cap;
+    }
+    size_t i = (size_t)hash_str(key) & (s->ext_cap - 1);
+    while (s->exts[i].key && strcmp(s->exts[i].key, key) != 0)
+        i = (i + 1) & (s->ext_cap - 1);
+    if (!s->exts[i].key) {
+        s->exts[i].key = strdup(key);
+        if (!s->exts[i].key)
+            return NULL;
+        s->ext_count++;
+    }
+    return &s->exts[i];
+}
+
+static OwnerSlot *owner_slot(Summary *s, uint32_t uid) {
+    if ((s->owner_count + 1) * 2 > s->owner_cap) {
+        size_t cap = s->owner_cap ? s->owner_cap * 2 : 16;
+        OwnerSlot *slots = calloc(cap, sizeof(OwnerSlot));
+        if (!slots)
+            return NULL;
+        for (size_t i = 0; i < s->owner_cap; i++) {
+            if (!s->owners[i].used)
+                continue;
+            size_t j = (size_t)(s->owners[i].uid * 2654435761u) & (cap - 1);
+            while (slots[j].used)
+                j = (j + 1) & (cap - 1);
+            slots[j] = s->owners[i];
+        }
+        free(s->owners);
+        s->owners = slots;
+        s->owner_cap = cap;
+    }
+    size_t i = (size_t)(uid * 2654435761u) & (s->owner_cap - 1);
+    while (s->owners[i].used && s->owners[i].uid != uid)
+        i = (i + 1) & (s->owner_cap - 1);
+    if (!s->owners[i].used) {
+        s->owners[i].used = 1;
+        s->owners[i].uid = uid;
+        s->owner_count++;
+    }
+    return &s->owners[i];
+}
+
+static int size_bucket(uint64_t size) {
+    int b = 0;
+    while (size) {
+        size >>= 1;
+        b++;
+    }
+    return b;
+}
+
+void summary_add(Summary *s, const char *name, const struct stat *st) {
+    s->entries++;
+    s->types[type_of(st->st_mode)]++;
+    if (mode == SUMMARY_TYPES)
+        return;
+
+    uint64_t size = st->st_size > 0 ? (uint64_t)st->st_size : 0;
+    s->bytes += size;
+    s->allocated += (uint64_t)st->st_blocks * 512;
+    if (S_ISREG(st->st_mode)) {
+        s->hist[size_bucket(size)]++;
+
+        char ext[32] = "";
+        const char *dot = strrchr(name, '.');
+        if (dot && dot != name && strlen(dot) < sizeof(ext)) {
+            size_t i = 0;
+            for (; dot[i]; i++)
+                ext[i] = (char)tolower((unsigned char)dot[i]);
+            ext[i] = '\0';
+        }
+        ExtSlot *e = ext_slot(s, ext);
+        if (e) {
+            e->count++;
+            e->bytes += size;
+        }
+    }
+
+    int64_t age = (int64_t)now - (int64_t)st->st_mtime;
+    int a = 0;
+    while (a < AGE_OLDER && (a == AGE_FUTURE ? age >= 0 : age >= age_limits[a]))
+        a++;
+    s->age[a]++;
+
+    OwnerSlot *o = owner_slot(s, (uint32_t)st->st_uid);
+    if (o) {
+        o->count++;
+        o->bytes += size;
+    }
+}
+
+void summary_merge(Summary *dst, const Summary *src) {
+    dst->entries += src->entries;
+    for (int i = 0; i < T_COUNT; i++)
+        dst->types[i] += src->types[i];
+    dst->bytes += src->bytes;
+    dst->allocated += src->allocated;
+    for (int i = 0; i < HIST_BUCKETS; i++)
+        dst->hist[i] += src->hist[i];
+    for (int i = 0; i < AGE_COUNT; i++)
+        dst->age[i] += src->age[i];
+    for (size_t i = 0; i < src->ext_cap; i++) {
+        if (!src->exts[i].key)
+            continue;
+        ExtSlot *e = ext_slot(dst, src->exts[i].key);
+        if (e) {
+            e->count += src->exts[i].count;
+            e->bytes += src->exts[i].bytes;
+        }
+    }
+    for (size_t i = 0; i < src->owner_cap; i++) {
+        if (!src->owners[i].used)
+            continue;
+        OwnerSlot *o = owner_slot(dst, src->owners[i].uid);
+        if (o) {
+            o->count += src->owners[i].count;
+            o->bytes += src->owners[i].bytes;
+        }
+    }
+}
+
+/* ---- d_type walk ---- */
+
+typedef struct Work {
+    char *path;
+    struct Work *next;
+} Work;
+
+typedef struct {
+    Work *queue;
+    size_t active;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int recursive, show_hidden, almost_all, ignore_backups;
+    const char **ignore_patterns, **hide_patterns;
+    size_t ignore_count, hide_count;
+} Walk;
+
+static void push(Walk *w, char *path) {
+    Work *item = malloc(sizeof(Work));
+    if (!item) {
+        perror("malloc");
+        free(path);
+        return;
+    }
+    item->path = path;
+    pthread_mutex_lock(&w->lock);
+    item->next = w->queue;
+    w->queue = item;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+}
+
+static void scan(Walk *w, Summary *acc, const char *path) {
+    DIR *dir = opendir(path);
+    if (!dir) {
+        fprintf(stderr, "opendir: %s: %s\n", path, strerror(errno));
+        return;
+    }
+    struct dirent *de;
+    while ((de = readdir(dir)) != NULL) {
+        const char *name = de->d_name;
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+            continue;
+        if (skip_name(name, w->show_hidden, w->almost_all, w->ignore_backups, w->ignore_patterns,
+                      w->ignore_count, w->hide_patterns, w->hide_count))
+            continue;
+        struct stat st;
+        memset(&st, 0, sizeof(st));
+#ifdef DT_UNKNOWN
+        if (de->d_type != DT_UNKNOWN)
+            st.st_mode = DTTOIF(de->d_type);
+        else
+#endif
+        if (fstatat(dirfd(dir), name, &st, AT_SYMLINK_NOFOLLOW) == -1)
+            continue;
+        summary_add(acc, name, &st);
+        if (w->recursive && S_ISDIR(st.st_mode)) {
+            char *child = join_path(path, name);
+            if (child)
+                push(w, child);
+        }
+    }
+    closedir(dir);
+}
+
+static void *walker(void *arg) {
+    Walk *w = arg;
+    Summary *acc = summary_new();
+    if (!acc)
+        return NULL;
+    pthread_mutex_lock(&w->lock);
+    for (;;) {
+        while (!w->queue && w->active)
+            pthread_cond_wait(&w->cond, &w->lock);
+        if (!w->queue)
+            break;
+        Work *item = w->queue;
+        w->queue = item->next;
+        w->active++;
+        pthread_mutex_unlock(&w->lock);
+        scan(w, acc, item->path);
+        free(item->path);
+        free(item);
+        pthread_mutex_lock(&w->lock);
+        w->active--;
+        if (!w->queue && !w->active)
+            pthread_cond_broadcast(&w->cond);
+    }
+    pthread_mutex_unlock(&w->lock);
+    return acc;
+}
+
+int summary_walk(const char **paths, size_t path_count, int recursive, int show_hidden,
+                 int almost_all, int ignore_backups, const char **ignore_patterns,
+                 size_t ignore_count, const char **hide_patterns, size_t hide_count) {
+    Walk w = {NULL, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, recursive, show_hidden,
+              almost_all, ignore_backups, ignore_patterns, hide_patterns, ignore_count, hide_count};
+    for (size_t i = 0; i < path_count; i++) {
+        char *p = strdup(paths[i]);
+        if (p)
+            push(&w, p);
+    }
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t threads = cpus > 1 ? (size_t)cpus : 1;
+    if (threads > SUMMARY_MAX_THREADS)
+        threads = SUMMARY_MAX_THREADS;
+    pthread_t tids[SUMMARY_MAX_THREADS];
+    size_t started = 0;
+    for (size_t i = 1; i < threads; i++)
+        if (pthread_create(&tids[started], NULL, walker, &w) == 0)
+            started++;
+    /* Each thread fills its own accumulator; they are merged at the end. */
+    Summary *mine = walker(&w);
+    Summary *total = summary_run();
+    if (!total || !mine) {
+        perror("malloc");
+        return -1;
+    }
+    summary_merge(total, mine);
+    summary_free(mine);
+    for (size_t i = 0; i < started; i++) {
+        void *acc = NULL;
+        pthread_join(tids[i], &acc);
+        if (acc) {
+            summary_merge(total, acc);
+            summary_free(acc);
+        }
+    }
+    return 0;
+}
+
+/* ---- output ---- */
+
+static void human(uint64_t v, char *buf, size_t bufsz) {
+    const char units[] = "BKMGTPE";
+    double d = (double)v;
+    int u = 0;
+    while (d >= 1024 && u < 6) {
+        d /= 1024;
+        u++;
+    }
+    if (u == 0)
+        snprintf(buf, bufsz, "%lluB", (unsigned long long)v);
+    else
+        snprintf(buf, bufsz, "%.1f%c", d, units[u]);
+}
+
+static int cmp_ext(const void *a, const void *b) {
+    const ExtSlot *x = *(ExtSlot *const *)a, *y = *(ExtSlot *const *)b;
+    if (x->bytes != y->bytes)
+        return x->bytes > y->bytes ? -1 : 1;
+    return strcmp(x->key, y->key);
+}
+
+static int cmp_owner(const void *a, const void *b) {
+    const OwnerSlot *x = *(OwnerSlot *const *)a, *y = *(OwnerSlot *const *)b;
+    if (x->bytes != y->bytes)
+        return x->bytes > y->bytes ? -1 : 1;
+    return x->uid < y->uid ? -1 : x->uid > y->uid;
+}
+
+static const char *owner_name(uint32_t uid, int numeric_ids, char *buf, size_t bufsz) {
+    const char *name = numeric_ids ? NULL : idcache_user((uid_t)uid);
+    if (name)
+        return name;
+    snprintf(buf, bufsz, "%u", uid);
+    return buf;
+}
+
+/* Bucket B holds sizes in [2^(B-1), 2^B); bucket 0 holds empty files. */
+static uint64_t bucket_min(int b) {
+    return b == 0 ? 0 : (uint64_t)1 << (b - 1);
+}
+
+static void print_text(const Summary *s, ExtSlot **exts, OwnerSlot **owners, int numeric_ids) {
+    char h1[32], h2[32];
+    printf("entries: %llu\n", (unsigned long long)s->entries);
+    for (int i = 0; i < T_COUNT; i++)
+        if (s->types[i])
+            printf("  %-10s %llu\n", type_names[i], (unsigned long long)s->types[i]);
+    if (mode == SUMMARY_TYPES)
+        return;
+    human(s->bytes, h1, sizeof(h1));
+    human(s->allocated, h2, sizeof(h2));
+    printf("bytes: %llu (%s), allocated %llu (%s)\n", (unsigned long long)s->bytes, h1,
+           (unsigned long long)s->allocated, h2);
+
+    printf("sizes:\n");
+    for (int b = 0; b < HIST_BUCKETS; b++) {
+        if (!s->hist[b])
+            continue;
+        if (b == 0) {
+            printf("  %-17s %llu\n", "0", (unsigned long long)s->hist[b]);
+            continue;
+        }
+        char range[80];
+        human(bucket_min(b), h1, sizeof(h1));
+        if (b < 64)
+            human(bucket_min(b + 1), h2, sizeof(h2));
+        else
+            snprintf(h2, sizeof(h2), "-");
+        snprintf(range, sizeof(range), "[%s, %s)", h1, h2);
+        printf("  %-17s %llu\n", range, (unsigned long long)s->hist[b]);
+    }
+
+    printf("modified within:\n");
+    for (int a = 0; a < AGE_COUNT; a++)
+        if (s->age[a])
+            printf("  %-7s %llu\n", age_names[a], (unsigned long long)s->age[a]);
+
+    printf("extensions:\n");
+    for (size_t i = 0; i < s->ext_count && i < TOP_COUNT; i++) {
+        human(exts[i]->bytes, h1, sizeof(h1));
+        printf("  %-10s %8llu %8s\n", exts[i]->key[0] ? exts[i]->key : "(none)",
+               (unsigned long long)exts[i]->count, h1);
+    }
+
+    printf("owners:\n");
+    for (size_t i = 0; i < s->owner_count && i < TOP_COUNT; i++) {
+        char num[32];
+        human(owners[i]->bytes, h1, sizeof(h1));
+        printf("  %-10s %8llu %8s\n", owner_name(owners[i]->uid, numeric_ids, num, sizeof(num)),
+               (unsigned long long)owners[i]->count, h1);
+    }
+}
+
+static void print_json(const Summary *s, ExtSlot **exts, OwnerSlot **owners, int numeric_ids) {
+    json_raw("{\"entries\":");
+    json_u64(s->entries);
+    json_raw(",\"types\":{");
+    for (int i = 0; i < T_COUNT; i++) {
+        if (i)
+            json_raw(",");
+        json_string(type_names[i]);
+        json_raw(":");
+        json_u64(s->types[i]);
+    }
+    json_raw("}");
+    if (mode == SUMMARY_FULL) {
+        json_raw(",\"bytes\":");
+        json_u64(s->bytes);
+        json_raw(",\"allocated\":");
+        json_u64(s->allocated);
+        json_raw(",\"size_histogram\":[");
+        int first = 1;
+        for (int b = 0; b < HIST_BUCKETS; b++) {
+            if (!s->hist[b])
+                continue;
+            json_raw(first ? "{\"min\":" : ",{\"min\":");
+            first = 0;
+            json_u64(bucket_min(b));
+            json_raw(",\"count\":");
+            json_u64(s->hist[b]);
+            json_raw("}");
+        }
+        json_raw("],\"modified_within\":{");
+        for (int a = 0; a < AGE_COUNT; a++) {
+            if (a)
+                json_raw(",");
+            json_string(age_names[a]);
+            json_raw(":");
+            json_u64(s->age[a]);
+        }
+        json_raw("},\"extensions\":[");
+        for (size_t i = 0; i < s->ext_count; i++) {
+            json_raw(i ? ",{\"extension\":" : "{\"extension\":");
+            json_string(exts[i]->key);
+            json_raw(",\"count\":");
+            json_u64(exts[i]->count);
+            json_raw(",\"bytes\":");
+            json_u64(exts[i]->bytes);
+            json_raw("}");
+        }
+        json_raw("],\"owners\":[");
+        for (size_t i = 0; i < s->owner_count && i < TOP_COUNT; i++) {
+            char num[32];
+            json_raw(i ? ",{\"uid\":" : "{\"uid\":");
+            json_u64(owners[i]->uid);
+            json_raw(",\"owner\":");
+            json_string(owner_name(owners[i]->uid, numeric_ids, num, sizeof(num)));
+            json_raw(",\"count\":");
+            json_u64(owners[i]->count);
+            json_raw(",\"bytes\":");
+            json_u64(owners[i]->bytes);
+            json_raw("}");
+        }
+        json_raw("]");
+    }
+    json_raw("}\n");
+}
+
+void summary_print(OutputFormat format, int numeric_ids) {
+    Summary *s = summary_run();
+    if (!s)
+        return;
+    ExtSlot **exts = malloc((s->ext_count + 1) * sizeof(ExtSlot *));
+    OwnerSlot **owners = malloc((s->owner_count + 1) * sizeof(OwnerSlot *));
+    if (!exts || !owners) {
+        perror("malloc");
+        free(exts);
+        free(owners);
+        return;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < s->ext_cap; i++)
+        if (s->exts[i].key)
+            exts[n++] = &s->exts[i];
+    qsort(exts, n, sizeof(ExtSlot *), cmp_ext);
+    n = 0;
+    for (size_t i = 0; i < s->owner_cap; i++)
+        if (s->owners[i].used)
+            owners[n++] = &s->owners[i];
+    qsort(owners, n, sizeof(OwnerSlot *), cmp_owner);
+
+    if (format == FORMAT_TEXT)
+        print_text(s, exts, owners, numeric_ids);
+    else
+        print_json(s, exts, owners, numeric_ids);
+    free(exts);
+    free(owners);
+}
@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "trace.h"
+#include "json.h"
+#include "util.h"
+
+/* Events kept per thread; older ones are overwritten. */
+#define TRACE_RING (1u << 21)
+
+typedef struct {
+    const char *name;
+    char *path;
+    uint64_t ts, dur;
+    int err;
+    char ph;
+} Event;
+
+typedef struct Track {
+    Event *events;
+    size_t cap;
+    uint64_t written;
+    unsigned tid;
+    const char *label;
+    struct Track *next;
+} Track;
+
+int trace_on = 0;
+
+static FILE *trace_file = NULL;
+static const char *trace_name = NULL;
+static uint64_t origin = 0;
+static pthread_key_t track_key;
+/* Tracks are only linked in, once per thread, under this lock. */
+static pthread_mutex_t tracks_lock = PTHREAD_MUTEX_INITIALIZER;
+static Track *tracks = NULL;
+static unsigned next_tid = 1;
+
+uint64_t trace_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static Track *own_track(void) {
+    Track *t = pthread_getspecific(track_key);
+    if (t)
+        return t;
+    t = calloc(1, sizeof(Track));
+    if (!t)
+        return NULL;
+    pthread_mutex_lock(&tracks_lock);
+    t->tid = next_tid++;
+    t->next = tracks;
+    tracks = t;
+    pthread_mutex_unlock(&tracks_lock);
+    pthread_setspecific(track_key, t);
+    return t;
+}
+
+static Event *slot(void) {
+    Track *t = own_track();
+    if (!t)
+        return NULL;
+    if (t->written < TRACE_RING && t->written == t->cap) {
+        size_t cap = t->cap ? t->cap * 2 : 4096;
+        Event *tmp = realloc(t->events, cap * sizeof(Event));
+        if (!tmp)
+            return NULL;
+        t->events = tmp;
+        t->cap = cap;
+    }
+    Event *ev = &t->events[t->written++ % TRACE_RING];
+    if (t->written > TRACE_RING)
+        free(ev->path);
+    return ev;
+}
+
+static char *make_path(const char *dir, const char *entry) {
+    if (!dir)
+        return NULL;
+    return entry ? join_path(dir, entry) : strdup(dir);
+}
+
+void trace_thread_name(const char *name) {
+    Track *t = own_track();
+    if (t)
+        t->label = name;
+}
+
+void trace_span(const char *name, const char *dir, const char *entry, uint64_t start) {
+    uint64_t end = trace_now();
+    Event *ev = slot();
+    if (!ev)
+        return;
+    *ev = (Event){name, make_path(dir, entry), start, end - start, 0, 'X'};
+}
+
+void trace_instant(const char *name, const char *dir, const char *entry, int err) {
+    Event *ev = slot();
+    if (!ev)
+        return;
+    *ev = (Event){name, make_path(dir, entry), trace_now(), 0, err, 'i'};
+}
+
+static void write_event(FILE *out, int pid, unsigned tid, const Event *ev, int *first) {
+    fputs(*first ? "\n" : ",\n", out);
+    *first = 0;
+    fputs("{\"name\":", out);
+    json_fstring(out, ev->name ? ev->name : ev->path ? ev->path : "");
+    fprintf(out, ",\"ph\":\"%c\",\"pid\":%d,\"tid\":%u,\"ts\":%.3f", ev->ph, pid, tid,
+            (double)(ev->ts - origin) / 1e3);
+    if (ev->ph == 'X')
+        fprintf(out, ",\"dur\":%.3f", (double)ev->dur / 1e3);
+    else
+        fputs(",\"s\":\"t\"", out);
+    if (ev->path || ev->err) {
+        fputs(",\"args\":{", out);
+        if (ev->path) {
+            fputs("\"path\":", out);
+            json_fstring(out, ev->path);
+        }
+        if (ev->err) {
+            fputs(ev->path ? ",\"error\":" : "\"error\":", out);
+            json_fstring(out, strerror(ev->err));
+        }
+        fputc('}', out);
+    }
+    fputc('}', out);
+}
+
+static void trace_write(void) {
+    FILE *out = trace_file;
+    int pid = (int)getpid();
+    int first = 1;
+    uint64_t dropped = 0;
+    fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", out);
+    fputs("\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":", out);
+    fprintf(out, "%d,\"tid\":0,\"args\":{\"name\":\"vls\"}}", pid);
+    first = 0;
+    for (const Track *t = tracks; t; t = t->next) {
+        fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%u,\"args\":{\"name\":", pid,
+                t->tid);
+        json_fstring(out, t->label ? t->label : "thread");
+        fputs("}}", out);
+        /* Oldest first: a ring that wrapped starts just after its newest. */
+        uint64_t n = t->written < TRACE_RING ? t->written : TRACE_RING;
+        uint64_t begin = t->written - n;
+        for (uint64_t i = begin; i < t->written; i++)
+            write_event(out, pid, t->tid, &t->events[i % TRACE_RING], &first);
+        dropped += begin;
+    }
+    fputs("\n]}\n", out);
+    if (fclose(out) == EOF)
+        fprintf(stderr, "trace: %s: %s\n", trace_name, strerror(errno));
+    if (dropped)
+        fprintf(stderr, "trace: %llu oldest events were overwritten\n", (unsigned long long)dropped);
+}
+
+int trace_open(const char *file) {
+    trace_file = fopen(file, "w");
+    if (!trace_file) {
+        fprintf(stderr, "trace: %s: %s\n", file, strerror(errno));
+        return -1;
+    }
+    if (pthread_key_create(&track_key, NULL) != 0) {
+        fprintf(stderr, "trace: cannot create thread key\n");
+        fclose(trace_file);
+        return -1;
+    }
+    trace_name = file;
+    origin = trace_now();
+    trace_on = 1;
+    trace_thread_name("main");
+    atexit(trace_write);
+    return 0;
+}
@@ -1,6 +1,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <locale.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "util.h"
 
 char *join_path(const char *dir, const char *name) {
@@ -9,3 +12,100 @@ char *join_path(const char *dir, const char *name) {
         return NULL;
     return result;
 }
+
+int temp_file(const char *prefix) {
+    const char *dir = getenv("TMPDIR");
+    if (!dir || !*dir)
+        dir = "/tmp";
+    char *tmp = NULL;
+    if (asprintf(&tmp, "%s/%s-XXXXXX", dir, prefix) < 0)
+        return -1;
+    int fd = mkstemp(tmp);
+    if (fd != -1)
+        unlink(tmp);
+    free(tmp);
+    return fd;
+}
+
+void mode_string(mode_t mode, char perms[11]) {
+    perms[0] = S_ISDIR(mode) ? 'd' :
+               S_ISLNK(mode) ? 'l' :
+               S_ISCHR(mode) ? 'c' :
+               S_ISBLK(mode) ? 'b' :
+               S_ISFIFO(mode) ? 'p' :
+               S_ISSOCK(mode) ? 's' : '-';
+    perms[1] = (mode & S_IRUSR) ? 'r' : '-';
+    perms[2] = (mode & S_IWUSR) ? 'w' : '-';
+    perms[3] = (mode & S_IXUSR)
+                ? ((mode & S_ISUID) ? 's' : 'x')
+                : ((mode & S_ISUID) ? 'S' : '-');
+    perms[4] = (mode & S_IRGRP) ? 'r' : '-';
+    perms[5] = (mode & S_IWGRP) ? 'w' : '-';
+    perms[6] = (mode & S_IXGRP)
+                ? ((mode & S_ISGID) ? 's' : 'x')
+                : ((mode & S_ISGID) ? 'S' : '-');
+    perms[7] = (mode & S_IROTH) ? 'r' : '-';
+    perms[8] = (mode & S_IWOTH) ? 'w' : '-';
+    perms[9] = (mode & S_IXOTH)
+                ? ((mode & S_ISVTX) ? 't' : 'x')
+                : ((mode & S_ISVTX) ? 'T' : '-');
+    perms[10] = '\0';
+}
+
+static int out_tty = -1;
+
+int stdout_isatty(void) {
+    if (out_tty == -1)
+        out_tty = isatty(STDOUT_FILENO);
+    return out_tty;
+}
+
+void stdout_tty_reset(void) {
+    out_tty = -1;
+}
+
+/* Categories whose C.UTF-8 data is still plain C, as in glibc. */
+static int c_like(const char *v) {
+    return strcmp(v, "C") == 0 || strcmp(v, "POSIX") == 0 || strncmp(v, "C.", 2) == 0;
+}
+
+/* The value setlocale would pick for the category named by VAR. */
+static const char *locale_env(const char *var) {
+    const char *v = getenv("LC_ALL");
+    if (!v || !*v)
+        v = getenv(var);
+    if (!v || !*v)
+        v = getenv("LANG");
+    return v && *v ? v : "C";
+}
+
+static int ctype_pending = 0, time_pending = 0, loaded = 0;
+
+static void load(void) {
+    setlocale(LC_ALL, "");
+    loaded = 1;
+    ctype_pending = time_pending = 0;
+}
+
+void locale_init(void) {
+    static const char *const others[] = {"LC_COLLATE", "LC_MESSAGES", "LC_MONETARY", "LC_NUMERIC"};
+    for (size_t i = 0; i < sizeof(others) / sizeof(others[0]); i++) {
+        if (!c_like(locale_env(others[i]))) {
+            load();
+            return;
+        }
+    }
+    /* A --serve worker may start from the daemon's loaded locale. */
+    if (loaded) {
+        setlocale(LC_ALL, "C");
+        loaded = 0;
+    }
+    const char *ctype = locale_env("LC_CTYPE");
+    ctype_pending = strcmp(ctype, "C") != 0 && strcmp(ctype, "POSIX") != 0;
+    time_pending = !c_like(locale_env("LC_TIME"));
+}
+
+void locale_need(int category) {
+    if (category == LC_TIME ? time_pending : ctype_pending)
+        load();
+}
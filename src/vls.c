@@ -0,0 +1,1007 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#if defined(__linux__)
+#include <sys/vfs.h>
+#include <linux/magic.h>
+#endif
+#include "vls.h"
+#include "vlsdir.h"
+#include "sort.h"
+#include "pattern.h"
+#include "entry.h"
+#include "cache.h"
+#include "index.h"
+#include "dirsize.h"
+#include "where.h"
+#include "ignore.h"
+#include "spill.h"
+#include "stats.h"
+#include "trace.h"
+#include "util.h"
+
+typedef struct {
+    dev_t dev;
+    ino_t ino;
+} DirId;
+
+/* One directory of the walk.  Its entries are kept while it is the
+ * current directory; once the walk moves on only the subdirectories to
+ * enter remain, and the directory itself is closed. */
+typedef struct {
+    char *path;
+    DIR *dir;
+    VlsDir out;
+    Entry *entries;
+    size_t count;
+    VlsFailure *failed;
+    size_t failed_count;
+    /* Directories --where rejected that -R still enters. */
+    Entry *descend;
+    size_t descend_count;
+    /* Entry names point into the mapped snapshot and are not freed. */
+    CacheSnapshot snap;
+    int from_cache;
+    int ignoring;
+    SpillSet *spill;
+    SpillMerge *merge;
+    /* The subdirectories to enter, in display order. */
+    Entry *children;
+    size_t child_count, child_cap, next_child;
+    int descending;
+} Frame;
+
+struct VlsWalk {
+    const VlsOptions *opts;
+    const PatternSet *ignore, *hide;
+    PatternSet *own_ignore, *own_hide;
+    char *root;
+    Entry *group;
+    size_t group_count;
+    int started;
+    dev_t root_dev;
+    Frame *frames;
+    size_t depth, frame_cap;
+    /* Directories entered with -L, to break cycles. */
+    DirId *visited;
+    size_t visited_count, visited_cap;
+    unsigned long listed;
+    int truncated;
+    VlsPrepare prepare;
+    void *prepare_arg;
+    /* A directory that could not be listed, as last handed out. */
+    VlsDir failure;
+    char *failure_path;
+    /* vls_walk_next: the directory being returned and the place in it. */
+    const VlsDir *cur_dir;
+    size_t next, next_failed;
+    VlsEntry cur;
+    char *pathbuf;
+};
+
+void vls_options_init(VlsOptions *opts) {
+    memset(opts, 0, sizeof(*opts));
+    opts->sort = VLS_SORT_NAME;
+    opts->max_depth = -1;
+}
+
+/* ---- name filters ---- */
+
+static int any_fnmatch(const char **patterns, size_t count, const char *name) {
+    for (size_t i = 0; i < count; i++)
+        if (fnmatch(patterns[i], name, 0) == 0)
+            return 1;
+    return 0;
+}
+
+static int filtered(const char *name, int show_hidden, int almost_all, int ignore_backups,
+                    const PatternSet *ignore, const PatternSet *hide) {
+    if (!show_hidden && !almost_all && name[0] == '.')
+        return 1;
+    if (almost_all && (strcmp(name, ".") == 0 || strcmp(name, "..") == 0))
+        return 1;
+    if (hide && !show_hidden && !almost_all && pattern_match(hide, name))
+        return 1;
+    if (ignore_backups) {
+        size_t len = strlen(name);
+        if (len > 0 && name[len - 1] == '~')
+            return 1;
+    }
+    return ignore && pattern_match(ignore, name);
+}
+
+int skip_name(const char *name, int show_hidden, int almost_all, int ignore_backups,
+              const char **ignore_patterns, size_t ignore_count,
+              const char **hide_patterns, size_t hide_count) {
+    const PatternSet *ignore = ignore_count ? pattern_lookup(ignore_patterns, ignore_count) : NULL;
+    const PatternSet *hide = hide_count ? pattern_lookup(hide_patterns, hide_count) : NULL;
+    if (filtered(name, show_hidden, almost_all, ignore_backups, ignore, hide))
+        return 1;
+    /* Patterns parse_args did not compile are tried one by one. */
+    if (!ignore && any_fnmatch(ignore_patterns, ignore_count, name))
+        return 1;
+    return !hide && !show_hidden && !almost_all && any_fnmatch(hide_patterns, hide_count, name);
+}
+
+static int skipped(const VlsWalk *w, const char *name) {
+    const VlsOptions *o = w->opts;
+    return filtered(name, o->show_hidden, o->almost_all, o->ignore_backups, w->ignore, w->hide);
+}
+
+/* ---- opening and closing ---- */
+
+static VlsWalk *walk_new(const VlsOptions *opts) {
+    VlsWalk *w = calloc(1, sizeof(VlsWalk));
+    if (!w)
+        return NULL;
+    w->opts = opts;
+    /* Sets compiled by parse_args are shared; others are the walk's own. */
+    if (opts->ignore_count && !(w->ignore = pattern_lookup(opts->ignore_patterns, opts->ignore_count)) &&
+        !(w->ignore = w->own_ignore = pattern_set_new(opts->ignore_patterns, opts->ignore_count)))
+        goto fail;
+    if (opts->hide_count && !(w->hide = pattern_lookup(opts->hide_patterns, opts->hide_count)) &&
+        !(w->hide = w->own_hide = pattern_set_new(opts->hide_patterns, opts->hide_count)))
+        goto fail;
+    return w;
+fail:
+    vls_walk_close(w);
+    return NULL;
+}
+
+VlsWalk *vls_walk_open(const char *path, const VlsOptions *opts) {
+    VlsWalk *w = walk_new(opts);
+    if (w && !(w->root = strdup(path))) {
+        vls_walk_close(w);
+        w = NULL;
+    }
+    if (!w)
+        errno = ENOMEM;
+    return w;
+}
+
+VlsWalk *vls_walk_open_group(Entry *entries, size_t count, const VlsOptions *opts) {
+    VlsWalk *w = walk_new(opts);
+    if (!w) {
+        for (size_t i = 0; i < count; i++)
+            free(entries[i].name);
+        free(entries);
+        errno = ENOMEM;
+        return NULL;
+    }
+    w->group = entries;
+    w->group_count = count;
+    return w;
+}
+
+void vls_walk_set_prepare(VlsWalk *w, VlsPrepare prepare, void *arg) {
+    w->prepare = prepare;
+    w->prepare_arg = arg;
+}
+
+unsigned long vls_walk_listed(const VlsWalk *w) {
+    return w->listed;
+}
+
+int vls_walk_truncated(const VlsWalk *w) {
+    return w->truncated;
+}
+
+static void free_names(Entry *entries, size_t count) {
+    for (size_t i = 0; i < count; i++)
+        free(entries[i].name);
+}
+
+/* Let go of everything but the subdirectories still to enter. */
+static void leave_frame(Frame *f) {
+    spill_merge_close(f->merge);
+    f->merge = NULL;
+    spill_close(f->spill);
+    f->spill = NULL;
+    if (f->dir)
+        closedir(f->dir);
+    f->dir = NULL;
+    if (!f->from_cache) {
+        free_names(f->entries, f->count);
+        free_names(f->descend, f->descend_count);
+    }
+    free(f->entries);
+    free(f->descend);
+    f->entries = f->descend = NULL;
+    f->count = f->descend_count = 0;
+    for (size_t i = 0; i < f->failed_count; i++)
+        free(f->failed[i].name);
+    free(f->failed);
+    f->failed = NULL;
+    f->failed_count = 0;
+}
+
+static void pop_frame(VlsWalk *w) {
+    Frame *f = &w->frames[--w->depth];
+    leave_frame(f);
+    if (!f->from_cache)
+        free_names(f->children, f->child_count);
+    free(f->children);
+    cache_release(&f->snap);
+    if (f->ignoring)
+        ignore_pop();
+    free(f->path);
+}
+
+void vls_walk_close(VlsWalk *w) {
+    if (!w)
+        return;
+    while (w->depth)
+        pop_frame(w);
+    free(w->frames);
+    free(w->visited);
+    free(w->failure_path);
+    free(w->pathbuf);
+    free(w->root);
+    if (w->group) {
+        free_names(w->group, w->group_count);
+        free(w->group);
+    }
+    pattern_set_free(w->own_ignore);
+    pattern_set_free(w->own_hide);
+    free(w);
+}
+
+/* ---- limits ---- */
+
+static int budget_spent(VlsWalk *w) {
+    if (w->opts->max_entries && w->listed >= w->opts->max_entries) {
+        w->truncated = 1;
+        return 1;
+    }
+    return 0;
+}
+
+/* Charge COUNT entries in display order to max_entries, dropping those
+ * beyond it from the end. */
+static size_t budget_take(VlsWalk *w, Entry *entries, size_t count, int owned) {
+    unsigned long max = w->opts->max_entries;
+    if (!max)
+        return count;
+    size_t room = max - w->listed;
+    if (count <= room) {
+        w->listed += count;
+        return count;
+    }
+    w->truncated = 1;
+    w->listed = max;
+    if (owned)
+        free_names(entries + room, count - room);
+    return room;
+}
+
+/* 1 when ST's directory is new to the walk, 0 when it was entered before. */
+static int visit(VlsWalk *w, const struct stat *st) {
+    for (size_t i = 0; i < w->visited_count; i++)
+        if (w->visited[i].dev == st->st_dev && w->visited[i].ino == st->st_ino)
+            return 0;
+    if (w->visited_count == w->visited_cap) {
+        size_t cap = w->visited_cap ? w->visited_cap * 2 : 16;
+        DirId *tmp = realloc(w->visited, cap * sizeof(DirId));
+        if (!tmp)
+            return -1;
+        w->visited = tmp;
+        w->visited_cap = cap;
+    }
+    w->visited[w->visited_count++] = (DirId){st->st_dev, st->st_ino};
+    return 1;
+}
+
+/* ---- collecting entries ---- */
+
+static int grow_entries(Entry **entries, size_t *capacity) {
+    size_t cap = *capacity ? *capacity * 2 : 32;
+    Entry *tmp = realloc(*entries, cap * sizeof(Entry));
+    if (!tmp) {
+        perror("realloc");
+        return -1;
+    }
+    *entries = tmp;
+    *capacity = cap;
+    return 0;
+}
+
+static int add_failure(Frame *f, char *name, int err) {
+    VlsFailure *tmp = realloc(f->failed, (f->failed_count + 1) * sizeof(VlsFailure));
+    if (!tmp) {
+        free(name);
+        return -1;
+    }
+    f->failed = tmp;
+    f->failed[f->failed_count++] = (VlsFailure){name, err};
+    f->out.failed = f->failed;
+    f->out.failed_count = f->failed_count;
+    return 0;
+}
+
+/* Drop the entries skip_name would, freeing their names. */
+static size_t filter_entries(const VlsWalk *w, Entry *entries, size_t count) {
+    size_t kept = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (skipped(w, entries[i].name))
+            free(entries[i].name);
+        else
+            entries[kept++] = entries[i];
+    }
+    return kept;
+}
+
+/* Drop entries excluded by the ignore files that apply to PATH. */
+static size_t ignore_filter(const char *path, Entry *entries, size_t count, int owned) {
+    size_t kept = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (!ignore_excluded(path, entries[i].name, S_ISDIR(entries[i].st.st_mode)))
+            entries[kept++] = entries[i];
+        else if (owned)
+            free(entries[i].name);
+    }
+    return kept;
+}
+
+/* Drop entries that fail --where.  With -R the directories among them are
+ * moved to F's descend list instead, since the walk still has to enter
+ * them.  Operands are matched on their last component. */
+static size_t where_filter(const VlsWalk *w, Frame *f, Entry *entries, size_t count, int owned) {
+    size_t kept = 0;
+    for (size_t i = 0; i < count; i++) {
+        const char *name = entries[i].name;
+        if (!f->path) {
+            const char *base = strrchr(name, '/');
+            if (base && base[1])
+                name = base + 1;
+        }
+        if (where_match(name, &entries[i].st)) {
+            entries[kept++] = entries[i];
+            continue;
+        }
+        if (f->path && w->opts->recursive && S_ISDIR(entries[i].st.st_mode)) {
+            Entry *tmp = realloc(f->descend, (f->descend_count + 1) * sizeof(Entry));
+            if (tmp) {
+                f->descend = tmp;
+                f->descend[f->descend_count++] = entries[i];
+                continue;
+            }
+            perror("realloc");
+        }
+        if (owned)
+            free(entries[i].name);
+    }
+    return kept;
+}
+
+typedef struct {
+    Entry **entries;
+    size_t *count;
+    size_t *capacity;
+} IndexCollect;
+
+static int collect_index_entry(void *ctx, const char *name, const struct stat *st) {
+    IndexCollect *c = ctx;
+    if (*c->count == *c->capacity && grow_entries(c->entries, c->capacity) == -1)
+        return -1;
+    Entry *ent = &(*c->entries)[*c->count];
+    memset(ent, 0, sizeof(*ent));
+    ent->name = strdup(name);
+    if (!ent->name) {
+        perror("strdup");
+        return -1;
+    }
+    ent->st = *st;
+    (*c->count)++;
+    return 0;
+}
+
+typedef struct {
+    uint64_t ino;
+    size_t i;
+} InodeSlot;
+
+/* Sort SLOTS by inode a byte at a time, skipping the bytes all of them
+ * share; stable, so hard links keep their readdir order. */
+static int sort_by_inode(InodeSlot *slots, size_t count) {
+    InodeSlot *tmp = malloc(count * sizeof(InodeSlot));
+    if (!tmp)
+        return -1;
+    uint64_t any = 0, all = ~(uint64_t)0;
+    for (size_t i = 0; i < count; i++) {
+        any |= slots[i].ino;
+        all &= slots[i].ino;
+    }
+    InodeSlot *from = slots, *to = tmp;
+    for (unsigned shift = 0; shift < 64; shift += 8) {
+        if (!(((any ^ all) >> shift) & 0xff))
+            continue;
+        size_t start[257] = {0};
+        for (size_t i = 0; i < count; i++)
+            start[((from[i].ino >> shift) & 0xff) + 1]++;
+        for (int b = 0; b < 256; b++)
+            start[b + 1] += start[b];
+        for (size_t i = 0; i < count; i++)
+            to[start[(from[i].ino >> shift) & 0xff]++] = from[i];
+        InodeSlot *t = from;
+        from = to;
+        to = t;
+    }
+    if (from != slots)
+        memcpy(slots, from, count * sizeof(InodeSlot));
+    free(tmp);
+    return 0;
+}
+
+/* Memory-backed file systems have no seeks to save. */
+static int inode_order_useful(int dfd) {
+#if defined(__linux__)
+    struct statfs sfs;
+    if (fstatfs(dfd, &sfs) == 0 && (sfs.f_type == TMPFS_MAGIC || sfs.f_type == RAMFS_MAGIC))
+        return 0;
+#else
+    (void)dfd;
+#endif
+    return 1;
+}
+
+/* stat ENTRIES of F, moving those that fail to its failures.  From
+ * inode_order entries on, the calls go in ascending order of the d_ino
+ * values readdir left in st_ino: inode tables are then read front to back
+ * rather than in hash order, which saves seeks on rotational and some
+ * network file systems.  The entries keep their order either way. */
+static size_t stat_entries(const VlsWalk *w, Frame *f, Entry *entries, size_t count) {
+    const VlsOptions *o = w->opts;
+    int dfd = f->out.dfd;
+    InodeSlot *order = NULL;
+    if (o->inode_order && count >= o->inode_order && count > 1 && inode_order_useful(dfd) &&
+        (order = malloc(count * sizeof(InodeSlot)))) {
+        for (size_t i = 0; i < count; i++)
+            order[i] = (InodeSlot){(uint64_t)entries[i].st.st_ino, i};
+        if (sort_by_inode(order, count) == -1) {
+            free(order);
+            order = NULL;
+        }
+    }
+    for (size_t k = 0; k < count; k++) {
+        Entry *ent = &entries[order ? order[k].i : k];
+        int failed = fstatat(dfd, ent->name, &ent->st, o->follow_links ? 0 : AT_SYMLINK_NOFOLLOW) == -1;
+        STATS_CALL(STATS_STAT_CALL, failed);
+        if (failed) {
+            int err = errno;
+            TRACE_INSTANT("stat failed", f->path, ent->name, err);
+            if (add_failure(f, ent->name, err) == -1)
+                perror("realloc");
+            ent->name = NULL;
+        }
+    }
+    free(order);
+    size_t kept = 0;
+    for (size_t i = 0; i < count; i++)
+        if (entries[i].name)
+            entries[kept++] = entries[i];
+    return kept;
+}
+
+/* Put ENTRIES in display order. */
+static int order_entries(const VlsWalk *w, Entry *entries, size_t count) {
+    const VlsOptions *o = w->opts;
+    if (o->sort != VLS_SORT_NONE) {
+        sort_entries(entries, count, sort_order(o->sort, o->dirs_first, o->reverse));
+        return 0;
+    }
+    if (o->dirs_first && count > 1) {
+        /* A stable partition: qsort would not keep readdir order. */
+        Entry *tmp = malloc(count * sizeof(Entry));
+        if (!tmp) {
+            perror("malloc");
+            return -1;
+        }
+        size_t n = 0;
+        for (size_t i = 0; i < count; i++)
+            if (S_ISDIR(entries[i].st.st_mode))
+                tmp[n++] = entries[i];
+        for (size_t i = 0; i < count; i++)
+            if (!S_ISDIR(entries[i].st.st_mode))
+                tmp[n++] = entries[i];
+        memcpy(entries, tmp, count * sizeof(Entry));
+        free(tmp);
+    }
+    for (size_t i = 0; o->reverse && i < count / 2; i++) {
+        Entry tmp = entries[i];
+        entries[i] = entries[count - 1 - i];
+        entries[count - 1 - i] = tmp;
+    }
+    return 0;
+}
+
+static void prepare(VlsWalk *w, Frame *f, Entry *entries, size_t count) {
+    if (w->prepare)
+        w->prepare(w->prepare_arg, &f->out, entries, count);
+}
+
+/* ---- spilling ---- */
+
+/* Turn the COUNT entries read so far into a run: stat, filter, prepare
+ * and order them as an in-memory directory would be and write them out.
+ * Their names are freed either way. */
+static int spill_batch(VlsWalk *w, Frame *f, Entry *entries, size_t count) {
+    uint64_t start = 0;
+    TRACE_NOW(start);
+    count = stat_entries(w, f, entries, count);
+    if (f->ignoring)
+        count = ignore_filter(f->path, entries, count, 1);
+    if (dirsize_enabled())
+        dirsize_apply(f->path, entries, count);
+    prepare(w, f, entries, count);
+    int rc = order_entries(w, entries, count);
+    for (size_t i = 0; rc == 0 && i < count; i++)
+        rc = spill_add(f->spill, &entries[i]);
+    if (rc == 0)
+        rc = spill_end_run(f->spill);
+    f->out.total += count;
+    free_names(entries, count);
+    TRACE_SPAN("spill run", f->path, NULL, start);
+    return rc;
+}
+
+static int add_child(Frame *f, const Entry *ent) {
+    if (f->child_count == f->child_cap && grow_entries(&f->children, &f->child_cap) == -1)
+        return -1;
+    Entry *child = &f->children[f->child_count];
+    *child = *ent;
+    if (!(child->name = strdup(ent->name))) {
+        perror("strdup");
+        return -1;
+    }
+    f->child_count++;
+    return 0;
+}
+
+static int is_dot(const char *name) {
+    return name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+}
+
+int vls_dir_read(VlsWalk *w, Entry *ent) {
+    const VlsOptions *o = w->opts;
+    Frame *f = w->depth ? &w->frames[w->depth - 1] : NULL;
+    if (!f || !f->spill || f->descending)
+        return 0;
+    if (!f->merge &&
+        !(f->merge = spill_merge(f->spill, sort_order(o->sort, o->dirs_first, o->reverse),
+                                 o->sort == VLS_SORT_NONE && o->reverse)))
+        return -1;
+    int got = spill_merge_next(f->merge, ent);
+    /* The subdirectories to enter are picked up on the way. */
+    if (got == 1 && o->recursive && S_ISDIR(ent->st.st_mode) && !is_dot(ent->name) &&
+        add_child(f, ent) == -1)
+        return -1;
+    return got;
+}
+
+/* ---- loading a directory ---- */
+
+static int read_index(VlsWalk *w, Frame *f) {
+    size_t capacity = f->count;
+    IndexCollect collect = {&f->entries, &f->count, &capacity};
+    if (index_list(f->path, collect_index_entry, &collect) == -1)
+        return -1;
+    f->count = filter_entries(w, f->entries, f->count);
+    return 0;
+}
+
+static int read_cache(VlsWalk *w, Frame *f, const struct stat *dst) {
+    const VlsOptions *o = w->opts;
+    size_t capacity = 0;
+    int stale = 0;
+    for (size_t i = 0; i < f->snap.count; i++) {
+        const char *name = cache_name(&f->snap, i);
+        if (skipped(w, name))
+            continue;
+        if (f->count == capacity && grow_entries(&f->entries, &capacity) == -1)
+            return -1;
+        Entry *ent = &f->entries[f->count];
+        memset(ent, 0, sizeof(*ent));
+        ent->name = (char *)name;
+        cache_stat(&f->snap, i, &ent->st);
+        if (cache_revalidating()) {
+            struct stat cur;
+            int failed = fstatat(f->out.dfd, name, &cur, o->follow_links ? 0 : AT_SYMLINK_NOFOLLOW) == -1;
+            STATS_CALL(STATS_STAT_CALL, failed);
+            if (failed) {
+                stale = 1;
+                continue;
+            }
+            if (cur.st_ino != ent->st.st_ino || cur.st_size != ent->st.st_size ||
+                cur.ST_MTIM.tv_sec != ent->st.ST_MTIM.tv_sec || cur.ST_MTIM.tv_nsec != ent->st.ST_MTIM.tv_nsec ||
+                cur.ST_CTIM.tv_sec != ent->st.ST_CTIM.tv_sec || cur.ST_CTIM.tv_nsec != ent->st.ST_CTIM.tv_nsec)
+                stale = 1;
+            ent->st = cur;
+        }
+        f->count++;
+    }
+    if (stale)
+        cache_invalidate(dst, o->follow_links);
+    return 0;
+}
+
+/* readdir, then stat.  With a cache every entry is kept so the snapshot
+ * serves any combination of filters; the filters are applied afterwards.
+ * Past memory_limit the entries so far become a sorted run on disk and
+ * the table starts over. */
+static int read_live(VlsWalk *w, Frame *f, int caching, const struct stat *dst) {
+    const VlsOptions *o = w->opts;
+    int spilling = o->memory_limit && !caching && !where_active() && !o->max_entries;
+    size_t capacity = 0, name_bytes = 0;
+    for (;;) {
+        errno = 0;
+        struct dirent *de = readdir(f->dir);
+        STATS_CALL(STATS_READDIR, !de && errno);
+        if (!de) {
+            if (errno)
+                TRACE_INSTANT("readdir failed", f->path, NULL, errno);
+            break;
+        }
+        if (!caching && skipped(w, de->d_name))
+            continue;
+        /* Ignored subtrees are dropped here, so they are never opened. */
+        if (!caching && f->ignoring && de->d_type != DT_UNKNOWN &&
+            !(o->follow_links && de->d_type == DT_LNK) &&
+            ignore_excluded(f->path, de->d_name, de->d_type == DT_DIR))
+            continue;
+        /* Entries the expression rejects from the name and d_type alone
+         * are never stat'ed, unless -R may need to enter them. */
+        if (!caching && where_active()) {
+            unsigned char type = de->d_type;
+            if (o->follow_links && type == DT_LNK)
+                type = DT_UNKNOWN;
+            if (where_prestat(de->d_name, type) == WHERE_FALSE &&
+                (!o->recursive || (type != DT_DIR && type != DT_UNKNOWN)))
+                continue;
+        }
+        if (spilling && f->count &&
+            name_bytes + (f->count == capacity ? 2 * capacity : capacity) * sizeof(Entry) > o->memory_limit) {
+            if (!f->spill && !(f->spill = spill_open(o->memory_limit)))
+                return -1;
+            int rc = spill_batch(w, f, f->entries, f->count);
+            f->count = 0;
+            name_bytes = 0;
+            if (rc == -1)
+                return -1;
+        }
+        if (f->count == capacity && grow_entries(&f->entries, &capacity) == -1)
+            return -1;
+        Entry *ent = &f->entries[f->count];
+        memset(ent, 0, sizeof(*ent));
+        if (!(ent->name = strdup(de->d_name))) {
+            perror("strdup");
+            return -1;
+        }
+        /* Kept until the stat pass, which orders its calls by it. */
+        ent->st.st_ino = de->d_ino;
+        name_bytes += strlen(de->d_name) + 1;
+        f->count++;
+    }
+    STATS_LAP(STATS_SCAN, f->out.mark);
+
+    if (f->spill) {
+        int rc = f->count ? spill_batch(w, f, f->entries, f->count) : 0;
+        f->count = 0;
+        /* The table is not needed while the runs are merged. */
+        free(f->entries);
+        f->entries = NULL;
+        f->out.spilled = 1;
+        return rc;
+    }
+
+    f->count = stat_entries(w, f, f->entries, f->count);
+    STATS_LAP(STATS_STAT, f->out.mark);
+    if (caching) {
+        cache_store(dst, o->follow_links, f->path, f->entries, f->count);
+        f->count = filter_entries(w, f->entries, f->count);
+    }
+    return 0;
+}
+
+/* Filter, order and cut the entries of F, which have all been read. */
+static int finish_entries(VlsWalk *w, Frame *f) {
+    int owned = !f->from_cache;
+    if (f->ignoring)
+        f->count = ignore_filter(f->path, f->entries, f->count, owned);
+    STATS_LAP(STATS_SCAN, f->out.mark);
+
+    if (dirsize_enabled() && !index_active()) {
+        if (f->path)
+            dirsize_apply(f->path, f->entries, f->count);
+        else
+            for (size_t i = 0; i < f->count; i++)
+                dirsize_path(f->entries[i].name, &f->entries[i].st);
+    }
+    STATS_LAP(STATS_STAT, f->out.mark);
+
+    if (where_active())
+        f->count = where_filter(w, f, f->entries, f->count, owned);
+    STATS_LAP(STATS_SCAN, f->out.mark);
+
+    if (order_entries(w, f->entries, f->count) == -1)
+        return -1;
+    f->count = budget_take(w, f->entries, f->count, owned);
+    STATS_LAP(STATS_SORT, f->out.mark);
+    prepare(w, f, f->entries, f->count);
+    f->out.entries = f->entries;
+    f->out.count = f->out.total = f->count;
+    return 0;
+}
+
+/* Read the directory F->path; an errno value when it cannot be listed. */
+static int load_dir(VlsWalk *w, Frame *f) {
+    const VlsOptions *o = w->opts;
+    VlsDir *d = &f->out;
+    STATS_MARK(d->start);
+    d->mark = d->start;
+    d->path = f->path;
+    d->dfd = -1;
+
+    /* Listings served from an index never touch the directory itself. */
+    if (index_active()) {
+        struct stat ist;
+        if (index_stat(f->path, &ist) == -1 || !S_ISDIR(ist.st_mode))
+            return ENOTDIR;
+        if (d->depth == 1)
+            w->root_dev = ist.st_dev;
+    } else {
+        f->dir = opendir(f->path);
+        STATS_CALL(STATS_OPENDIR, !f->dir);
+        if (!f->dir) {
+            int err = errno;
+            TRACE_INSTANT("opendir failed", f->path, NULL, err);
+            return err;
+        }
+        d->dfd = dirfd(f->dir);
+        struct stat rst;
+        if (d->depth == 1 && o->one_file_system && fstat(d->dfd, &rst) == 0)
+            w->root_dev = rst.st_dev;
+    }
+    STATS_LAP(STATS_OPEN, d->mark);
+
+    f->ignoring = ignore_active() && ignore_push(f->path, d->dfd) == 0;
+    struct stat dst;
+    int caching = f->dir && cache_enabled() && fstat(d->dfd, &dst) == 0;
+    int rc;
+    if (!f->dir) {
+        rc = read_index(w, f);
+    } else if (caching && cache_load(&dst, o->follow_links, &f->snap)) {
+        f->from_cache = 1;
+        rc = read_cache(w, f, &dst);
+    } else {
+        rc = read_live(w, f, caching, &dst);
+    }
+    if (rc == 0 && !d->spilled)
+        rc = finish_entries(w, f);
+    else if (rc == 0)
+        STATS_LAP(STATS_SORT, d->mark);
+    return rc == -1 ? ENOMEM : 0;
+}
+
+static Frame *push_frame(VlsWalk *w, char *path, int depth) {
+    if (w->depth == w->frame_cap) {
+        size_t cap = w->frame_cap ? w->frame_cap * 2 : 8;
+        Frame *tmp = realloc(w->frames, cap * sizeof(Frame));
+        if (!tmp)
+            return NULL;
+        w->frames = tmp;
+        w->frame_cap = cap;
+    }
+    Frame *f = &w->frames[w->depth++];
+    memset(f, 0, sizeof(*f));
+    f->path = path;
+    f->out.depth = depth;
+    return f;
+}
+
+/* Hand out PATH, which takes over, as a directory that cannot be listed. */
+static const VlsDir *failure(VlsWalk *w, char *path, int depth, int err) {
+    free(w->failure_path);
+    w->failure_path = path;
+    memset(&w->failure, 0, sizeof(w->failure));
+    w->failure.path = path ? path : "";
+    w->failure.dfd = -1;
+    w->failure.depth = depth;
+    w->failure.error = err;
+    return &w->failure;
+}
+
+/* Load the directory PATH, which is taken over, at DEPTH.  ID is its
+ * status when the parent already has it, for -L cycle detection. */
+static const VlsDir *enter(VlsWalk *w, char *path, int depth, const struct stat *id) {
+    if (w->opts->follow_links && !index_active()) {
+        struct stat st;
+        if (!id && stat(path, &st) == 0)
+            id = &st;
+        int fresh = id ? visit(w, id) : 1;
+        if (fresh == 0) {
+            TRACE_INSTANT("cycle skipped", path, NULL, 0);
+            return failure(w, path, depth, ELOOP);
+        }
+        if (fresh == -1)
+            return failure(w, path, depth, ENOMEM);
+    }
+    Frame *f = push_frame(w, path, depth);
+    if (!f)
+        return failure(w, path, depth, ENOMEM);
+    int err = load_dir(w, f);
+    if (err) {
+        f->path = NULL;
+        pop_frame(w);
+        return failure(w, path, depth, err);
+    }
+    return &f->out;
+}
+
+static const VlsDir *enter_group(VlsWalk *w) {
+    Frame *f = push_frame(w, NULL, 1);
+    if (!f)
+        return failure(w, NULL, 1, ENOMEM);
+    STATS_MARK(f->out.start);
+    f->out.mark = f->out.start;
+    /* Operands are named by their paths, relative to the working directory. */
+    f->out.dfd = index_active() ? -1 : AT_FDCWD;
+    f->entries = w->group;
+    f->count = w->group_count;
+    w->group = NULL;
+    if (finish_entries(w, f) == -1) {
+        pop_frame(w);
+        return failure(w, NULL, 1, ENOMEM);
+    }
+    return &f->out;
+}
+
+/* The subdirectories of F to enter, in display order: those --where hid
+ * are merged back into their sorted place.  Everything else is let go. */
+static int start_descent(VlsWalk *w, Frame *f) {
+    const VlsOptions *o = w->opts;
+    f->descending = 1;
+    if (!o->recursive || !f->path || f->spill) {
+        leave_frame(f);
+        return 0;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < f->count; i++)
+        n += S_ISDIR(f->entries[i].st.st_mode) && !is_dot(f->entries[i].name);
+    n += f->descend_count;
+    f->children = malloc((n ? n : 1) * sizeof(Entry));
+    if (!f->children) {
+        perror("malloc");
+        leave_frame(f);
+        return -1;
+    }
+    /* The names move to the children.  Unsorted, the hidden directories
+     * follow the readdir order the others came in, so -r puts them first. */
+    int hidden_first = o->sort == VLS_SORT_NONE && o->reverse;
+    for (size_t i = f->descend_count; hidden_first && i-- > 0;) {
+        f->children[f->child_count++] = f->descend[i];
+        f->descend[i].name = NULL;
+    }
+    for (size_t i = 0; i < f->count; i++) {
+        Entry *ent = &f->entries[i];
+        if (S_ISDIR(ent->st.st_mode) && !is_dot(ent->name)) {
+            f->children[f->child_count++] = *ent;
+            ent->name = NULL;
+        }
+    }
+    for (size_t i = 0; !hidden_first && i < f->descend_count; i++) {
+        f->children[f->child_count++] = f->descend[i];
+        f->descend[i].name = NULL;
+    }
+    if (f->descend_count && o->sort != VLS_SORT_NONE)
+        sort_entries(f->children, f->child_count, sort_order(o->sort, o->dirs_first, o->reverse));
+    f->child_cap = n;
+    leave_frame(f);
+    return 0;
+}
+
+const VlsDir *vls_walk_next_dir(VlsWalk *w) {
+    const VlsOptions *o = w->opts;
+    free(w->failure_path);
+    w->failure_path = NULL;
+    if (!w->started) {
+        w->started = 1;
+        if (budget_spent(w))
+            return NULL;
+        if (!w->root)
+            return enter_group(w);
+        char *path = strdup(w->root);
+        return path ? enter(w, path, 1, NULL) : failure(w, NULL, 1, ENOMEM);
+    }
+    while (w->depth) {
+        Frame *f = &w->frames[w->depth - 1];
+        if (!f->descending && start_descent(w, f) == -1)
+            return failure(w, NULL, f->out.depth + 1, ENOMEM);
+        /* Limits are checked on the entry, before the child is opened. */
+        if (f->next_child < f->child_count && (o->max_depth >= 0 && f->out.depth > o->max_depth))
+            f->next_child = f->child_count;
+        if (f->next_child < f->child_count && budget_spent(w))
+            f->next_child = f->child_count;
+        if (f->next_child == f->child_count) {
+            pop_frame(w);
+            continue;
+        }
+        const Entry *child = &f->children[f->next_child++];
+        if (o->one_file_system && child->st.st_dev != w->root_dev)
+            continue;
+        char *path = join_path(f->path, child->name);
+        if (!path)
+            return failure(w, NULL, f->out.depth + 1, ENOMEM);
+        return enter(w, path, f->out.depth + 1, &child->st);
+    }
+    return NULL;
+}
+
+/* ---- one entry at a time ---- */
+
+static const VlsEntry *error_record(VlsWalk *w, const char *path, const char *dir, int depth, int err) {
+    memset(&w->cur, 0, sizeof(w->cur));
+    w->cur.path = path;
+    w->cur.dir = dir ? dir : path;
+    w->cur.name = path;
+    w->cur.depth = depth;
+    w->cur.error = err;
+    return &w->cur;
+}
+
+/* ENT of D as the current record; NULL when out of memory. */
+static const VlsEntry *entry_record(VlsWalk *w, const VlsDir *d, const char *name, const struct stat *st,
+                                    int err) {
+    char *path = d->path ? join_path(d->path, name) : strdup(name);
+    if (!path)
+        return NULL;
+    free(w->pathbuf);
+    w->pathbuf = path;
+    if (err)
+        return error_record(w, path, d->path, d->depth, err);
+    w->cur = (VlsEntry){path, d->path, name, *st, d->depth, 0};
+    return &w->cur;
+}
+
+const VlsEntry *vls_walk_next(VlsWalk *w) {
+    for (;;) {
+        const VlsDir *d = w->cur_dir;
+        const VlsEntry *rec = NULL;
+        if (d && w->next_failed < d->failed_count) {
+            const VlsFailure *bad = &d->failed[w->next_failed++];
+            struct stat none;
+            memset(&none, 0, sizeof(none));
+            rec = entry_record(w, d, bad->name, &none, bad->err);
+        } else if (d && d->spilled) {
+            Entry ent;
+            int got = vls_dir_read(w, &ent);
+            if (got == -1)
+                return error_record(w, d->path, NULL, d->depth - 1, EIO);
+            if (got == 1)
+                rec = entry_record(w, d, ent.name, &ent.st, 0);
+        } else if (d && w->next < d->count) {
+            const Entry *ent = &d->entries[w->next++];
+            rec = entry_record(w, d, ent->name, &ent->st, 0);
+        } else {
+            d = w->cur_dir = vls_walk_next_dir(w);
+            w->next = w->next_failed = 0;
+            if (!d)
+                return NULL;
+            if (d->error) {
+                w->cur_dir = NULL;
+                /* The directory itself sits one level above its entries. */
+                return error_record(w, d->path, NULL, d->depth - 1, d->error);
+            }
+            continue;
+        }
+        if (!rec)
+            return error_record(w, d->path ? d->path : "", NULL, d->depth, ENOMEM);
+        return rec;
+    }
+}
@@ -0,0 +1,47 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "vls.h"
+
+/* Print the entries of a libvls walk, one "depth<TAB>size<TAB>path" line
+ * each; a small client of the library API. */
+int main(int argc, char *argv[]) {
+    VlsOptions opts;
+    vls_options_init(&opts);
+    int opt;
+    while ((opt = getopt(argc, argv, "aARLrSUd:")) != -1) {
+        switch (opt) {
+        case 'a': opts.show_hidden = 1; break;
+        case 'A': opts.almost_all = 1; break;
+        case 'R': opts.recursive = 1; break;
+        case 'L': opts.follow_links = 1; break;
+        case 'r': opts.reverse = 1; break;
+        case 'S': opts.sort = VLS_SORT_SIZE; break;
+        case 'U': opts.sort = VLS_SORT_NONE; break;
+        case 'd': opts.max_depth = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-aARLrSU] [-d DEPTH] DIR...\n", argv[0]);
+            return 1;
+        }
+    }
+    int status = 0;
+    for (int i = optind; i < argc; i++) {
+        VlsWalk *walk = vls_walk_open(argv[i], &opts);
+        if (!walk) {
+            perror("vls_walk_open");
+            return 1;
+        }
+        const VlsEntry *e;
+        while ((e = vls_walk_next(walk)) != NULL) {
+            if (e->error) {
+                fprintf(stderr, "%s: %s\n", e->path, strerror(e->error));
+                status = 1;
+                continue;
+            }
+            printf("%d\t%lld\t%s\n", e->depth, (long long)e->st.st_size, e->path);
+        }
+        vls_walk_close(walk);
+    }
+    return status;
+}
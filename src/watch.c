@@ -0,0 +1,735 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "watch.h"
+
+#ifdef __linux__
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include "diff.h"
+#include "entry.h"
+#include "json.h"
+#include "linkcache.h"
+#include "list.h"
+#include "sort.h"
+#include "vlsdir.h"
+#include "util.h"
+
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | \
+                    IN_MODIFY | IN_CLOSE_WRITE | IN_ONLYDIR)
+
+typedef struct {
+    int wd;
+    char *path;
+    int listed;        /* entries read, by the listing or a scan */
+    int depth;         /* levels below the operand */
+    Entry **ents;      /* sorted by name */
+    Entry **order;     /* the same entries in display order */
+    size_t count, cap;
+    ListWidths widths; /* on the screen: grown as entries change */
+} WatchDir;
+
+static int ifd = -1;
+static WatchDir **dirs = NULL;     /* in display order */
+static size_t dir_count = 0, dir_cap = 0;
+static WatchDir **by_wd = NULL;    /* indexed by watch descriptor */
+static size_t wd_cap = 0;
+
+static const Args *w_args;
+static int w_interactive;
+/* The listing's order; under -U entries keep the order they came in. */
+static EntryCmp w_order;
+static int w_unsorted;
+/* The directory the listing is handing watch_seed, sorted once it is done. */
+static WatchDir *w_seeding;
+/* Change records when output is not a terminal. */
+static DiffPrinter *w_printer;
+
+static volatile sig_atomic_t resized = 0;
+
+static void on_winch(int sig) {
+    (void)sig;
+    resized = 1;
+}
+
+static int skipped(const char *name) {
+    const Args *a = w_args;
+    return skip_name(name, a->show_hidden, a->almost_all, a->ignore_backups, a->ignore_patterns,
+                     a->ignore_count, a->hide_patterns, a->hide_count);
+}
+
+static void report(IndexChange change, const WatchDir *d, const char *name,
+                   const struct stat *old, const struct stat *cur) {
+    if (w_interactive)
+        return;
+    /* Entries still there are looked up by path; removed ones are gone,
+     * with no index to ask about them. */
+    diff_printer_add(w_printer, change, change == INDEX_REMOVED ? LINK_GONE : AT_FDCWD, d->path, name, old, cur);
+}
+
+static int differs(const struct stat *a, const struct stat *b) {
+    return a->st_size != b->st_size || a->st_mode != b->st_mode || a->st_uid != b->st_uid ||
+           a->st_gid != b->st_gid || a->ST_MTIM.tv_sec != b->ST_MTIM.tv_sec ||
+           a->ST_MTIM.tv_nsec != b->ST_MTIM.tv_nsec;
+}
+
+/* Index of NAME in D, or of the slot it would be inserted at. */
+static size_t find(const WatchDir *d, const char *name, int *found) {
+    size_t lo = 0, hi = d->count;
+    *found = 0;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int c = strcmp(d->ents[mid]->name, name);
+        if (c == 0) {
+            *found = 1;
+            return mid;
+        }
+        if (c < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* Insert E into the first N entries of D's display order, after those it
+ * ties with. */
+static void show(WatchDir *d, size_t n, Entry *e) {
+    size_t lo = 0, hi = n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (w_order(e, d->order[mid]) < 0)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    memmove(d->order + lo + 1, d->order + lo, (n - lo) * sizeof(Entry *));
+    d->order[lo] = e;
+}
+
+/* Take E out of the first N entries of D's display order. */
+static void unshow(WatchDir *d, size_t n, const Entry *e) {
+    size_t lo = 0, hi = n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (w_order(d->order[mid], e) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    while (lo < n && d->order[lo] != e)
+        lo++;
+    if (lo < n)
+        memmove(d->order + lo, d->order + lo + 1, (n - lo - 1) * sizeof(Entry *));
+}
+
+static int cmp_entry(const void *a, const void *b) {
+    return strcmp((*(Entry *const *)a)->name, (*(Entry *const *)b)->name);
+}
+
+static int cmp_shown(const void *a, const void *b) {
+    return w_order(*(Entry *const *)a, *(Entry *const *)b);
+}
+
+/* Order D's entries, which are in the order they were read: by name, and
+ * for display.  Under -U a scan keeps directory order, with -r and
+ * --group-directories-first applied as a listing applies them; the
+ * listing's own entries come in display order already. */
+static void settle(WatchDir *d, int from_listing) {
+    size_t n = 0;
+    if (!d->count)
+        return;
+    if (w_unsorted && !from_listing) {
+        for (size_t i = 0; i < d->count; i++)
+            if (!w_args->dirs_first || S_ISDIR(d->ents[i]->st.st_mode))
+                d->order[n++] = d->ents[i];
+        for (size_t i = 0; w_args->dirs_first && i < d->count; i++)
+            if (!S_ISDIR(d->ents[i]->st.st_mode))
+                d->order[n++] = d->ents[i];
+        for (size_t i = 0; w_args->reverse && i < n / 2; i++) {
+            Entry *tmp = d->order[i];
+            d->order[i] = d->order[n - 1 - i];
+            d->order[n - 1 - i] = tmp;
+        }
+    } else {
+        memcpy(d->order, d->ents, d->count * sizeof(Entry *));
+        if (!w_unsorted)
+            qsort(d->order, d->count, sizeof(Entry *), cmp_shown);
+    }
+    qsort(d->ents, d->count, sizeof(Entry *), cmp_entry);
+}
+
+static void free_entry(Entry *e) {
+    free(e->name);
+    free(e);
+}
+
+static int stat_child(const WatchDir *d, const char *name, struct stat *st) {
+    char *path = join_path(d->path, name);
+    if (!path)
+        return -1;
+    int rc = fstatat(AT_FDCWD, path, st, w_args->follow_links ? 0 : AT_SYMLINK_NOFOLLOW);
+    free(path);
+    return rc;
+}
+
+static WatchDir *subscribe(const char *path, const WatchDir *parent, const Entry *e);
+static void rescan(WatchDir *d, int announce);
+static void drop_tree(const char *path);
+
+/* Whether the listing enters the subdirectory E of D. */
+static int descend(const WatchDir *d, const Entry *e) {
+    return w_args->recursive && (w_args->max_depth < 0 || d->depth < w_args->max_depth) &&
+           S_ISDIR(e->st.st_mode) && strcmp(e->name, ".") != 0 && strcmp(e->name, "..") != 0;
+}
+
+/* Watch the subdirectory E of D, and read it unless it already was. */
+static void add_subdir(const WatchDir *d, const Entry *e, int announce) {
+    char *path = join_path(d->path, e->name);
+    if (!path) {
+        perror("malloc");
+        return;
+    }
+    WatchDir *child = subscribe(path, d, e);
+    if (child && !child->listed)
+        rescan(child, announce);
+    free(path);
+}
+
+/* The screen shows entries colored as a listing colors them. */
+static void resolve(const WatchDir *d, Entry *e) {
+    e->color = 0;
+    e->context = 0;
+    if (w_interactive)
+        list_resolve(w_args, d->path, e, 1);
+}
+
+/* Count E in D's column widths, or with ADD clear take it out again.
+ * Widths only grow until a resize of the screen measures every entry. */
+static void measure(WatchDir *d, const Entry *e, int add) {
+    if (!w_interactive)
+        return;
+    if (add)
+        list_measure(w_args, &d->widths, e);
+    else
+        list_unmeasure(w_args, &d->widths, e);
+}
+
+static void remeasure(WatchDir *d) {
+    memset(&d->widths, 0, sizeof(d->widths));
+    for (size_t i = 0; i < d->count; i++)
+        measure(d, d->ents[i], 1);
+}
+
+static Entry *new_entry(const WatchDir *d, const char *name, const struct stat *st) {
+    Entry *e = malloc(sizeof(Entry));
+    if (!e || !(e->name = strdup(name))) {
+        free(e);
+        return NULL;
+    }
+    e->st = *st;
+    resolve(d, e);
+    return e;
+}
+
+static int reserve(WatchDir *d) {
+    if (d->count < d->cap)
+        return 0;
+    size_t cap = d->cap ? d->cap * 2 : 32;
+    Entry **tmp = realloc(d->ents, cap * sizeof(Entry *));
+    if (!tmp)
+        return -1;
+    d->ents = tmp;
+    if (!(tmp = realloc(d->order, cap * sizeof(Entry *))))
+        return -1;
+    d->order = tmp;
+    d->cap = cap;
+    return 0;
+}
+
+static int insert_entry(WatchDir *d, size_t at, const char *name, const struct stat *st) {
+    Entry *e;
+    if (reserve(d) == -1 || !(e = new_entry(d, name, st)))
+        return -1;
+    memmove(d->ents + at + 1, d->ents + at, (d->count - at) * sizeof(Entry *));
+    d->ents[at] = e;
+    show(d, d->count, e);
+    measure(d, e, 1);
+    d->count++;
+    return 0;
+}
+
+static void remove_entry(WatchDir *d, size_t at) {
+    Entry *e = d->ents[at];
+    report(INDEX_REMOVED, d, e->name, &e->st, NULL);
+    if (descend(d, e)) {
+        char *child = join_path(d->path, e->name);
+        if (child)
+            drop_tree(child);
+        free(child);
+    }
+    unshow(d, d->count, e);
+    measure(d, e, 0);
+    free_entry(e);
+    memmove(d->ents + at, d->ents + at + 1, (d->count - at - 1) * sizeof(Entry *));
+    d->count--;
+}
+
+/* Bring NAME in D up to date with the filesystem. */
+static void refresh(WatchDir *d, const char *name) {
+    int found;
+    size_t at = find(d, name, &found);
+    struct stat st;
+    if (stat_child(d, name, &st) == -1) {
+        if (found)
+            remove_entry(d, at);
+        return;
+    }
+    if (found) {
+        Entry *e = d->ents[at];
+        if (e->st.st_ino != st.st_ino) {
+            remove_entry(d, at);
+            refresh(d, name);
+            return;
+        }
+        if (differs(&e->st, &st))
+            report(INDEX_MODIFIED, d, name, &e->st, &st);
+        /* Any field may be the sort key: the entry moves to its new place. */
+        unshow(d, d->count, e);
+        measure(d, e, 0);
+        e->st = st;
+        resolve(d, e);
+        show(d, d->count - 1, e);
+        measure(d, e, 1);
+        return;
+    }
+    if (insert_entry(d, at, name, &st) == -1) {
+        perror("malloc");
+        return;
+    }
+    report(INDEX_ADDED, d, name, NULL, &st);
+    if (descend(d, d->ents[at]))
+        add_subdir(d, d->ents[at], 1);
+}
+
+/* Re-read D completely: for directories the listing did not read, new
+ * ones, and after the event queue overflowed. */
+static void rescan(WatchDir *d, int announce) {
+    DIR *dir = opendir(d->path);
+    if (!dir) {
+        fprintf(stderr, "opendir: %s: %s\n", d->path, strerror(errno));
+        return;
+    }
+    size_t old_count = d->count;
+    Entry **old = d->ents;
+    free(d->order);
+    d->ents = d->order = NULL;
+    d->count = d->cap = 0;
+    d->listed = 1;
+    struct dirent *de;
+    while ((de = readdir(dir)) != NULL) {
+        if (skipped(de->d_name))
+            continue;
+        struct stat st;
+        if (fstatat(dirfd(dir), de->d_name, &st, w_args->follow_links ? 0 : AT_SYMLINK_NOFOLLOW) == -1)
+            continue;
+        if (reserve(d) == -1 || !(d->ents[d->count] = new_entry(d, de->d_name, &st))) {
+            perror("malloc");
+            break;
+        }
+        d->count++;
+    }
+    closedir(dir);
+    settle(d, 0);
+    remeasure(d);
+
+    /* Merge the old and new sorted sets to report the differences. */
+    size_t i = 0, j = 0;
+    while (i < old_count || j < d->count) {
+        int c = i == old_count ? 1 : j == d->count ? -1 : strcmp(old[i]->name, d->ents[j]->name);
+        if (c < 0) {
+            report(INDEX_REMOVED, d, old[i]->name, &old[i]->st, NULL);
+            if (descend(d, old[i])) {
+                char *child = join_path(d->path, old[i]->name);
+                if (child)
+                    drop_tree(child);
+                free(child);
+            }
+            i++;
+        } else if (c > 0) {
+            if (announce)
+                report(INDEX_ADDED, d, d->ents[j]->name, NULL, &d->ents[j]->st);
+            j++;
+        } else {
+            if (differs(&old[i]->st, &d->ents[j]->st))
+                report(INDEX_MODIFIED, d, d->ents[j]->name, &old[i]->st, &d->ents[j]->st);
+            i++;
+            j++;
+        }
+    }
+    for (i = 0; i < old_count; i++)
+        free_entry(old[i]);
+    free(old);
+    /* In display order, so that they are placed as a listing shows them. */
+    for (i = 0; i < d->count; i++)
+        if (descend(d, d->order[i]))
+            add_subdir(d, d->order[i], announce);
+}
+
+/* What follows "DIR/" in PATH, or NULL when PATH is not below DIR. */
+static const char *below(const char *path, const char *dir) {
+    size_t len = strlen(dir);
+    return strncmp(path, dir, len) == 0 && path[len] == '/' ? path + len + 1 : NULL;
+}
+
+/* Where the subdirectory E of PARENT goes in the display order of
+ * directories: among PARENT's others as they are ordered there, each
+ * followed by the directories below it, as a recursive listing shows them.
+ * Past the end of PARENT's when its entries are still coming in. */
+static size_t place(const WatchDir *parent, const Entry *e) {
+    size_t i = 0;
+    while (i < dir_count && dirs[i] != parent)
+        i++;
+    if (i == dir_count)
+        return dir_count;
+    for (i++; i < dir_count; i++) {
+        const char *rest = below(dirs[i]->path, parent->path);
+        if (!rest)
+            break;
+        if (strchr(rest, '/'))
+            continue;   /* further down */
+        int found;
+        size_t at = find(parent, rest, &found);
+        if (found && w_order(e, parent->ents[at]) < 0)
+            break;
+    }
+    return i;
+}
+
+/* Watch PATH, without reading it: before it is read, so that nothing
+ * happening meanwhile is missed.  PARENT and E, when set, are the
+ * directory it was found in and its entry there. */
+static WatchDir *subscribe(const char *path, const WatchDir *parent, const Entry *e) {
+    int wd = inotify_add_watch(ifd, path, WATCH_MASK);
+    if (wd == -1) {
+        fprintf(stderr, "watch: %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    if ((size_t)wd < wd_cap && by_wd[wd])
+        return by_wd[wd];   /* the same directory reached twice */
+    if ((size_t)wd >= wd_cap) {
+        size_t cap = wd_cap ? wd_cap : 64;
+        while (cap <= (size_t)wd)
+            cap *= 2;
+        WatchDir **tmp = realloc(by_wd, cap * sizeof(WatchDir *));
+        if (!tmp)
+            goto oom;
+        memset(tmp + wd_cap, 0, (cap - wd_cap) * sizeof(WatchDir *));
+        by_wd = tmp;
+        wd_cap = cap;
+    }
+    if (dir_count == dir_cap) {
+        size_t cap = dir_cap ? dir_cap * 2 : 16;
+        WatchDir **tmp = realloc(dirs, cap * sizeof(WatchDir *));
+        if (!tmp)
+            goto oom;
+        dirs = tmp;
+        dir_cap = cap;
+    }
+    WatchDir *d = calloc(1, sizeof(WatchDir));
+    if (!d || !(d->path = strdup(path))) {
+        free(d);
+        goto oom;
+    }
+    d->wd = wd;
+    d->depth = parent ? parent->depth + 1 : 0;
+    by_wd[wd] = d;
+    size_t at = parent ? place(parent, e) : dir_count;
+    memmove(dirs + at + 1, dirs + at, (dir_count - at) * sizeof(WatchDir *));
+    dirs[at] = d;
+    dir_count++;
+    return d;
+oom:
+    perror("malloc");
+    inotify_rm_watch(ifd, wd);
+    return NULL;
+}
+
+static void release_dir(WatchDir *d) {
+    for (size_t i = 0; i < dir_count; i++) {
+        if (dirs[i] == d) {
+            memmove(dirs + i, dirs + i + 1, (dir_count - i - 1) * sizeof(WatchDir *));
+            dir_count--;
+            break;
+        }
+    }
+    if ((size_t)d->wd < wd_cap && by_wd[d->wd] == d)
+        by_wd[d->wd] = NULL;
+    for (size_t i = 0; i < d->count; i++)
+        free_entry(d->ents[i]);
+    free(d->ents);
+    free(d->order);
+    free(d->path);
+    free(d);
+}
+
+/* Stop watching PATH and everything below it. */
+static void drop_tree(const char *path) {
+    size_t len = strlen(path);
+    for (size_t i = 0; i < dir_count;) {
+        WatchDir *d = dirs[i];
+        if (strncmp(d->path, path, len) == 0 && (d->path[len] == '\0' || d->path[len] == '/')) {
+            inotify_rm_watch(ifd, d->wd);
+            release_dir(d);
+        } else {
+            i++;
+        }
+    }
+}
+
+int watch_init(const Args *args) {
+    w_args = args;
+    w_interactive = stdout_isatty();
+    w_unsorted = args->unsorted;
+    w_order = sort_order(args->unsorted ? VLS_SORT_NONE
+                                        : sort_key(args->sort_word, args->sort_time, args->sort_atime,
+                                                   args->sort_ctime, args->sort_size, args->sort_extension,
+                                                   args->sort_version),
+                         args->dirs_first, args->reverse);
+    ifd = inotify_init1(IN_CLOEXEC);
+    if (ifd == -1) {
+        perror("inotify_init1");
+        return -1;
+    }
+    for (size_t i = 0; i < args->path_count; i++)
+        subscribe(args->paths[i], NULL, NULL);
+    if (dir_count == 0)
+        return -1;
+    return 0;
+}
+
+int watch_interactive(void) {
+    return w_interactive;
+}
+
+void watch_seed(void *arg, const VlsDir *dir, Entry *entries, size_t count) {
+    (void)arg;
+    /* Operand groups are not directories; an index is not the live tree. */
+    if (!dir->path || dir->dfd == -1)
+        return;
+    WatchDir *d = subscribe(dir->path, NULL, NULL);
+    if (!d || (d->listed && d != w_seeding))
+        return;
+    if (d != w_seeding) {
+        if (w_seeding)
+            settle(w_seeding, 1);
+        w_seeding = d;
+        d->listed = 1;
+    }
+    for (size_t i = 0; i < count; i++) {
+        Entry *e;
+        if (reserve(d) == -1 || !(e = new_entry(d, entries[i].name, &entries[i].st))) {
+            perror("malloc");
+            return;
+        }
+        d->ents[d->count++] = e;
+        /* Subdirectories are watched before the walk reads them. */
+        char *child = descend(d, e) ? join_path(d->path, e->name) : NULL;
+        if (child)
+            subscribe(child, d, e);
+        free(child);
+    }
+}
+
+/* ---- terminal rendering ---- */
+
+static char **screen = NULL;   /* lines currently shown */
+static char *screen_text = NULL;
+static size_t screen_count = 0;
+
+/* Render the directories as a listing shows them, into as many lines as fit
+ * on the screen: only those rows are formatted.  Lines are NUL-terminated
+ * in place; *TEXT is the buffer holding them. */
+static size_t render_screen(char **text, char **lines, size_t rows) {
+    size_t size = 0, seen = 0, n = 0;
+    FILE *out = open_memstream(text, &size);
+    if (!out) {
+        perror("open_memstream");
+        return 0;
+    }
+    int headers = w_args->recursive || w_args->path_count > 1;
+    for (size_t i = 0; i < dir_count && n < rows; i++) {
+        const WatchDir *d = dirs[i];
+        if (i)
+            fputc('\n', out);
+        list_render(out, w_args, d->path, d->order, d->count, &d->widths, headers, rows - n);
+        fflush(out);
+        for (; seen < size; seen++)
+            if ((*text)[seen] == '\n')
+                n++;
+    }
+    fclose(out);
+    char *p = *text;
+    for (n = 0; n < rows && *p; n++) {
+        char *nl = strchr(p, '\n');
+        lines[n] = p;
+        if (!nl)
+            return n + 1;
+        *nl = '\0';
+        p = nl + 1;
+    }
+    return n;
+}
+
+/* Rewrite the rows whose text changed.  Only rows that fit on the screen
+ * are formatted, so the cost of a redraw is bounded by the terminal size. */
+static void redraw(int full) {
+    size_t rows = 24;
+    struct winsize ws;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_row > 1)
+        rows = ws.ws_row;
+    rows--;
+
+    char **lines = calloc(rows, sizeof(char *));
+    char *text = NULL;
+    if (!lines) {
+        perror("malloc");
+        return;
+    }
+    size_t n = render_screen(&text, lines, rows);
+
+    if (full)
+        fputs("\033[H\033[2J", stdout);
+    for (size_t i = 0; i < n; i++) {
+        if (full || i >= screen_count || !screen[i] || strcmp(screen[i], lines[i]) != 0)
+            printf("\033[%zu;1H%s\033[K", i + 1, lines[i]);
+    }
+    for (size_t i = n; i < screen_count; i++)
+        printf("\033[%zu;1H\033[K", i + 1);
+    printf("\033[%zu;1H", n + 1);
+    fflush(stdout);
+
+    free(screen);
+    free(screen_text);
+    screen = lines;
+    screen_text = text;
+    screen_count = n;
+}
+
+static int handle(const struct inotify_event *ev) {
+    if (ev->mask & IN_Q_OVERFLOW) {
+        for (size_t i = 0; i < dir_count; i++)
+            rescan(dirs[i], 1);
+        return 1;
+    }
+    if (ev->wd < 0 || (size_t)ev->wd >= wd_cap || !by_wd[ev->wd])
+        return 0;
+    WatchDir *d = by_wd[ev->wd];
+    if (ev->mask & IN_IGNORED) {
+        release_dir(d);
+        return 1;
+    }
+    if (!ev->len || skipped(ev->name))
+        return 0;
+    if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+        int found;
+        size_t at = find(d, ev->name, &found);
+        if (found)
+            remove_entry(d, at);
+        return found;
+    }
+    refresh(d, ev->name);
+    return 1;
+}
+
+int watch_run(void) {
+    /* Read what the listing did not hand over: everything on a terminal,
+     * where no listing precedes the screen. */
+    if (w_seeding)
+        settle(w_seeding, 1);
+    w_seeding = NULL;
+    for (size_t i = 0; i < dir_count; i++)
+        if (!dirs[i]->listed)
+            rescan(dirs[i], 0);
+
+    /* A JSON array could never be closed, so records are streamed. */
+    if (!w_interactive &&
+        !(w_printer = diff_printer_new(w_args, w_args->format == FORMAT_JSON ? FORMAT_NDJSON : w_args->format)))
+        return -1;
+    if (w_interactive) {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = on_winch;
+        sigaction(SIGWINCH, &sa, NULL);
+        redraw(1);
+    }
+    fflush(stdout);
+
+    /* Event records are variable length; the buffer holds many at once so
+     * bursts are applied together and drawn once. */
+    static char buf[64 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+    for (;;) {
+        ssize_t len = read(ifd, buf, sizeof(buf));
+        if (len == -1) {
+            if (errno == EINTR) {
+                if (resized) {
+                    resized = 0;
+                    /* Columns that outgrew the entries shrink back too. */
+                    for (size_t i = 0; i < dir_count; i++)
+                        remeasure(dirs[i]);
+                    redraw(1);
+                }
+                continue;
+            }
+            perror("read");
+            return -1;
+        }
+        /* Link targets may have come or gone since they were looked at. */
+        linkcache_clear();
+        int changed = 0;
+        for (char *p = buf; p < buf + len;) {
+            const struct inotify_event *ev = (const struct inotify_event *)p;
+            changed |= handle(ev);
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+        if (dir_count == 0)
+            return 0;
+        if (w_interactive) {
+            if (changed)
+                redraw(0);
+        } else {
+            diff_printer_flush(w_printer);
+            json_flush();
+            fflush(stdout);
+        }
+    }
+}
+
+#else
+
+int watch_init(const Args *args) {
+    (void)args;
+    fprintf(stderr, "--watch is only supported on Linux\n");
+    return -1;
+}
+
+int watch_interactive(void) {
+    return 0;
+}
+
+void watch_seed(void *arg, const VlsDir *dir, Entry *entries, size_t count) {
+    (void)arg; (void)dir; (void)entries; (void)count;
+}
+
+int watch_run(void) {
+    return -1;
+}
+
+#endif
@@ -0,0 +1,519 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <pwd.h>
+#include <grp.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include "where.h"
+
+#define WHERE_MAX_DEPTH 64
+
+typedef enum {
+    OP_TYPE,
+    OP_SIZE,
+    OP_MTIME,
+    OP_ATIME,
+    OP_CTIME,
+    OP_UID,
+    OP_GID,
+    OP_PERM,
+    OP_NAME,
+    OP_NOT,
+    OP_AND,
+    OP_OR,
+    OP_JF,      /* jump if the top of the stack is false */
+    OP_JT       /* jump if the top of the stack is true */
+} Op;
+
+typedef enum {
+    CMP_EQ,
+    CMP_NE,
+    CMP_LT,
+    CMP_LE,
+    CMP_GT,
+    CMP_GE,
+    CMP_ANY     /* perm & bits */
+} Cmp;
+
+typedef struct {
+    Op op;
+    Cmp cmp;
+    size_t jump;
+    long long value;
+    char *pattern;
+} Insn;
+
+typedef struct {
+    const char *p;
+    Insn *code;
+    size_t len, cap;
+    int depth, max_depth;
+    time_t now;
+} Parser;
+
+static Insn *program = NULL;
+static size_t program_len = 0;
+/* Whether any leaf can be decided without stat. */
+static int prestat_useful = 0;
+
+static int fail(const Parser *ps, const char *msg) {
+    if (*ps->p)
+        fprintf(stderr, "--where: %s at '%s'\n", msg, ps->p);
+    else
+        fprintf(stderr, "--where: %s at end of expression\n", msg);
+    return -1;
+}
+
+static int emit(Parser *ps, Op op, Cmp cmp, long long value, char *pattern) {
+    if (ps->len == ps->cap) {
+        size_t cap = ps->cap ? ps->cap * 2 : 16;
+        Insn *tmp = realloc(ps->code, cap * sizeof(Insn));
+        if (!tmp) {
+            perror("realloc");
+            free(pattern);
+            return -1;
+        }
+        ps->code = tmp;
+        ps->cap = cap;
+    }
+    ps->code[ps->len++] = (Insn){op, cmp, 0, value, pattern};
+    if (op <= OP_NAME && ++ps->depth > ps->max_depth)
+        ps->max_depth = ps->depth;
+    else if (op == OP_AND || op == OP_OR)
+        ps->depth--;
+    return 0;
+}
+
+static void skip_space(Parser *ps) {
+    while (isspace((unsigned char)*ps->p))
+        ps->p++;
+}
+
+static int accept(Parser *ps, const char *tok) {
+    skip_space(ps);
+    size_t n = strlen(tok);
+    if (strncmp(ps->p, tok, n) != 0)
+        return 0;
+    ps->p += n;
+    return 1;
+}
+
+/* A quoted string, or a bare word running to whitespace, ')' or && / ||. */
+static char *parse_value(Parser *ps) {
+    skip_space(ps);
+    const char *start = ps->p;
+    size_t n;
+    if (*ps->p == '"' || *ps->p == '\'') {
+        char quote = *ps->p++;
+        start = ps->p;
+        while (*ps->p && *ps->p != quote)
+            ps->p++;
+        if (!*ps->p) {
+            fail(ps, "unterminated string");
+            return NULL;
+        }
+        n = (size_t)(ps->p - start);
+        ps->p++;
+    } else {
+        while (*ps->p && !isspace((unsigned char)*ps->p) && *ps->p != ')' &&
+               strncmp(ps->p, "&&", 2) != 0 && strncmp(ps->p, "||", 2) != 0)
+            ps->p++;
+        n = (size_t)(ps->p - start);
+        if (n == 0) {
+            fail(ps, "expected a value");
+            return NULL;
+        }
+    }
+    char *v = strndup(start, n);
+    if (!v)
+        perror("strndup");
+    return v;
+}
+
+static int parse_cmp(Parser *ps, Cmp *cmp) {
+    static const struct { const char *tok; Cmp cmp; } ops[] = {
+        {"==", CMP_EQ}, {"!=", CMP_NE}, {"<=", CMP_LE}, {">=", CMP_GE},
+        {"<", CMP_LT}, {">", CMP_GT}, {"=", CMP_EQ}, {"&", CMP_ANY}
+    };
+    for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++)
+        if (accept(ps, ops[i].tok)) {
+            *cmp = ops[i].cmp;
+            return 0;
+        }
+    return fail(ps, "expected a comparison");
+}
+
+/* Sizes take the suffixes of --block-size: K, M, G, ... are powers of
+ * 1024, KB, MB, ... powers of 1000 and KiB, MiB, ... powers of 1024. */
+static int parse_size(const char *s, long long *out) {
+    char *end;
+    errno = 0;
+    unsigned long long v = strtoull(s, &end, 10);
+    if (errno || end == s || *s == '-')
+        return -1;
+    unsigned long long mult = 1;
+    if (*end) {
+        const char *units = "KMGTPE";
+        const char *u = strchr(units, toupper((unsigned char)*end));
+        if (strcmp(end, "c") == 0 || strcmp(end, "B") == 0)
+            end += 1;
+        else if (u && *end != '\0') {
+            unsigned long long base = 1024;
+            end++;
+            if (strcmp(end, "B") == 0) {
+                base = 1000;
+                end++;
+            } else if (strcmp(end, "iB") == 0) {
+                end += 2;
+            }
+            for (const char *x = units; x <= u; x++)
+                mult *= base;
+        }
+        if (*end)
+            return -1;
+    }
+    if (v > (unsigned long long)LLONG_MAX / mult)
+        return -1;
+    *out = (long long)(v * mult);
+    return 0;
+}
+
+/* Either an age such as 30d (s, m, h, d or w), which becomes the point in
+ * time that long ago, or a local date YYYY-MM-DD[THH:MM[:SS]]. */
+static int parse_time(const Parser *ps, const char *s, long long *out, int *is_age) {
+    char *end;
+    errno = 0;
+    long long n = strtoll(s, &end, 10);
+    if (!errno && end != s && n >= 0 && end[0] && !end[1] && strchr("smhdw", end[0])) {
+        static const long long unit[] = {1, 60, 3600, 86400, 604800};
+        long long u = unit[strchr("smhdw", end[0]) - "smhdw"];
+        if (n > LLONG_MAX / u)
+            return -1;
+        *out = (long long)ps->now - n * u;
+        *is_age = 1;
+        return 0;
+    }
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    int len = 0;
+    if (sscanf(s, "%4d-%2d-%2d%n", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &len) != 3)
+        return -1;
+    s += len;
+    if (*s == 'T' || *s == ' ') {
+        len = 0;
+        if (sscanf(s + 1, "%2d:%2d%n", &tm.tm_hour, &tm.tm_min, &len) != 2)
+            return -1;
+        s += 1 + len;
+        if (*s == ':') {
+            len = 0;
+            if (sscanf(s + 1, "%2d%n", &tm.tm_sec, &len) != 1)
+                return -1;
+            s += 1 + len;
+        }
+    }
+    if (*s)
+        return -1;
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    tm.tm_isdst = -1;
+    time_t t = mktime(&tm);
+    if (t == (time_t)-1)
+        return -1;
+    *out = (long long)t;
+    *is_age = 0;
+    return 0;
+}
+
+static int parse_type(const char *s, long long *out) {
+    static const struct { const char *a, *b; mode_t mode; } types[] = {
+        {"f", "file", S_IFREG}, {"d", "dir", S_IFDIR}, {"l", "link", S_IFLNK},
+        {"p", "fifo", S_IFIFO}, {"s", "socket", S_IFSOCK}, {"b", "block", S_IFBLK},
+        {"c", "char", S_IFCHR}
+    };
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++)
+        if (strcmp(s, types[i].a) == 0 || strcmp(s, types[i].b) == 0) {
+            *out = types[i].mode;
+            return 0;
+        }
+    return -1;
+}
+
+static int parse_id(const char *s, int group, long long *out) {
+    char *end;
+    errno = 0;
+    unsigned long v = strtoul(s, &end, 10);
+    if (!errno && end != s && !*end && *s != '-') {
+        *out = (long long)v;
+        return 0;
+    }
+    if (group) {
+        struct group *gr = getgrnam(s);
+        if (!gr)
+            return -1;
+        *out = gr->gr_gid;
+    } else {
+        struct passwd *pw = getpwnam(s);
+        if (!pw)
+            return -1;
+        *out = pw->pw_uid;
+    }
+    return 0;
+}
+
+static int parse_pred(Parser *ps) {
+    static const struct { const char *name; Op op; } fields[] = {
+        {"type", OP_TYPE}, {"size", OP_SIZE}, {"mtime", OP_MTIME}, {"atime", OP_ATIME},
+        {"ctime", OP_CTIME}, {"owner", OP_UID}, {"user", OP_UID}, {"uid", OP_UID},
+        {"group", OP_GID}, {"gid", OP_GID}, {"perm", OP_PERM}, {"name", OP_NAME}
+    };
+    skip_space(ps);
+    const char *start = ps->p;
+    while (isalpha((unsigned char)*ps->p))
+        ps->p++;
+    size_t n = (size_t)(ps->p - start);
+    Op op = OP_NOT;
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++)
+        if (strlen(fields[i].name) == n && strncmp(start, fields[i].name, n) == 0)
+            op = fields[i].op;
+    if (op == OP_NOT) {
+        ps->p = start;
+        return fail(ps, "expected type, size, mtime, atime, ctime, owner, group, perm or name");
+    }
+    Cmp cmp;
+    if (parse_cmp(ps, &cmp) == -1)
+        return -1;
+    skip_space(ps);
+    const char *vpos = ps->p;
+    char *v = parse_value(ps);
+    if (!v)
+        return -1;
+
+    long long value = 0;
+    int ok = 0, ordered = 0;
+    switch (op) {
+    case OP_TYPE:
+        ok = parse_type(v, &value) == 0;
+        break;
+    case OP_SIZE:
+        ok = parse_size(v, &value) == 0;
+        ordered = 1;
+        break;
+    case OP_MTIME:
+    case OP_ATIME:
+    case OP_CTIME: {
+        int is_age = 0;
+        ok = parse_time(ps, v, &value, &is_age) == 0;
+        ordered = 1;
+        if (ok && is_age) {
+            /* "older than" means "earlier than": flip the comparison. */
+            static const Cmp flip[] = {CMP_EQ, CMP_NE, CMP_GT, CMP_GE, CMP_LT, CMP_LE, CMP_ANY};
+            if (cmp == CMP_EQ || cmp == CMP_NE) {
+                free(v);
+                ps->p = vpos;
+                return fail(ps, "ages take <, <=, > or >=");
+            }
+            cmp = flip[cmp];
+        }
+        break;
+    }
+    case OP_UID:
+    case OP_GID:
+        ok = parse_id(v, op == OP_GID, &value) == 0;
+        break;
+    case OP_PERM: {
+        char *end;
+        errno = 0;
+        unsigned long bits = strtoul(v, &end, 8);
+        ok = !errno && end != v && !*end && bits <= 07777;
+        value = (long long)bits;
+        ordered = -1;
+        break;
+    }
+    default:
+        ok = 1;
+        break;
+    }
+    if (!ok) {
+        free(v);
+        ps->p = vpos;
+        return fail(ps, "invalid value");
+    }
+    if ((cmp == CMP_ANY && ordered != -1) || (cmp != CMP_ANY && cmp > CMP_NE && ordered != 1)) {
+        free(v);
+        ps->p = vpos;
+        return fail(ps, "comparison not supported for this field");
+    }
+    if (op != OP_NAME) {
+        free(v);
+        v = NULL;
+    }
+    return emit(ps, op, cmp, value, v);
+}
+
+static int parse_or(Parser *ps);
+
+static int parse_unary(Parser *ps) {
+    if (accept(ps, "!")) {
+        if (parse_unary(ps) == -1)
+            return -1;
+        return emit(ps, OP_NOT, CMP_EQ, 0, NULL);
+    }
+    if (accept(ps, "(")) {
+        if (parse_or(ps) == -1)
+            return -1;
+        if (!accept(ps, ")"))
+            return fail(ps, "expected ')'");
+        return 0;
+    }
+    return parse_pred(ps);
+}
+
+/* [left] JF/JT [right] AND/OR: the jump leaves the left result on the
+ * stack and skips the rest when it already decides the outcome. */
+static int parse_binary(Parser *ps, const char *tok, Op op, Op jump, int (*operand)(Parser *)) {
+    if (operand(ps) == -1)
+        return -1;
+    while (accept(ps, tok)) {
+        size_t at = ps->len;
+        if (emit(ps, jump, CMP_EQ, 0, NULL) == -1 || operand(ps) == -1 ||
+            emit(ps, op, CMP_EQ, 0, NULL) == -1)
+            return -1;
+        ps->code[at].jump = ps->len;
+    }
+    return 0;
+}
+
+static int parse_and(Parser *ps) {
+    return parse_binary(ps, "&&", OP_AND, OP_JF, parse_unary);
+}
+
+static int parse_or(Parser *ps) {
+    return parse_binary(ps, "||", OP_OR, OP_JT, parse_and);
+}
+
+int where_compile(const char *expr) {
+    Parser ps;
+    memset(&ps, 0, sizeof(ps));
+    ps.p = expr;
+    ps.now = time(NULL);
+    int rc = parse_or(&ps);
+    skip_space(&ps);
+    if (rc == 0 && *ps.p)
+        rc = fail(&ps, "unexpected text");
+    if (rc == 0 && ps.max_depth > WHERE_MAX_DEPTH) {
+        fprintf(stderr, "--where: expression nested too deeply\n");
+        rc = -1;
+    }
+    if (rc == -1) {
+        for (size_t i = 0; i < ps.len; i++)
+            free(ps.code[i].pattern);
+        free(ps.code);
+        return -1;
+    }
+    program = ps.code;
+    program_len = ps.len;
+    for (size_t i = 0; i < program_len; i++)
+        if (program[i].op == OP_NAME || program[i].op == OP_TYPE)
+            prestat_useful = 1;
+    return 0;
+}
+
+int where_active(void) {
+    return program != NULL;
+}
+
+static int compare(Cmp cmp, long long a, long long b) {
+    switch (cmp) {
+    case CMP_EQ: return a == b;
+    case CMP_NE: return a != b;
+    case CMP_LT: return a < b;
+    case CMP_LE: return a <= b;
+    case CMP_GT: return a > b;
+    case CMP_GE: return a >= b;
+    case CMP_ANY: return (a & b) != 0;
+    }
+    return 0;
+}
+
+/* Run the program.  ST may be NULL, in which case TYPE is the file type
+ * from d_type, or 0 when that is unknown too. */
+static WhereResult run(const char *name, mode_t type, const struct stat *st) {
+    unsigned char stack[WHERE_MAX_DEPTH];
+    int sp = 0;
+    for (size_t pc = 0; pc < program_len; pc++) {
+        const Insn *in = &program[pc];
+        long long v = 0;
+        switch (in->op) {
+        case OP_NOT:
+            if (stack[sp - 1] != WHERE_UNKNOWN)
+                stack[sp - 1] = stack[sp - 1] == WHERE_TRUE ? WHERE_FALSE : WHERE_TRUE;
+            continue;
+        case OP_AND:
+            sp--;
+            if (stack[sp - 1] == WHERE_FALSE || stack[sp] == WHERE_FALSE)
+                stack[sp - 1] = WHERE_FALSE;
+            else if (stack[sp - 1] != WHERE_TRUE || stack[sp] != WHERE_TRUE)
+                stack[sp - 1] = WHERE_UNKNOWN;
+            continue;
+        case OP_OR:
+            sp--;
+            if (stack[sp - 1] == WHERE_TRUE || stack[sp] == WHERE_TRUE)
+                stack[sp - 1] = WHERE_TRUE;
+            else if (stack[sp - 1] != WHERE_FALSE || stack[sp] != WHERE_FALSE)
+                stack[sp - 1] = WHERE_UNKNOWN;
+            continue;
+        case OP_JF:
+            if (stack[sp - 1] == WHERE_FALSE)
+                pc = in->jump - 1;
+            continue;
+        case OP_JT:
+            if (stack[sp - 1] == WHERE_TRUE)
+                pc = in->jump - 1;
+            continue;
+        case OP_NAME:
+            stack[sp++] = (fnmatch(in->pattern, name, 0) == 0) == (in->cmp == CMP_EQ) ? WHERE_TRUE
+                                                                                       : WHERE_FALSE;
+            continue;
+        case OP_TYPE:
+            if (!st && !type) {
+                stack[sp++] = WHERE_UNKNOWN;
+                continue;
+            }
+            v = st ? (long long)(st->st_mode & S_IFMT) : (long long)type;
+            break;
+        default:
+            if (!st) {
+                stack[sp++] = WHERE_UNKNOWN;
+                continue;
+            }
+            switch (in->op) {
+            case OP_SIZE: v = (long long)st->st_size; break;
+            case OP_MTIME: v = (long long)st->st_mtime; break;
+            case OP_ATIME: v = (long long)st->st_atime; break;
+            case OP_CTIME: v = (long long)st->st_ctime; break;
+            case OP_UID: v = (long long)st->st_uid; break;
+            case OP_GID: v = (long long)st->st_gid; break;
+            case OP_PERM: v = (long long)(st->st_mode & 07777); break;
+            default: break;
+            }
+            break;
+        }
+        stack[sp++] = compare(in->cmp, v, in->value) ? WHERE_TRUE : WHERE_FALSE;
+    }
+    return (WhereResult)stack[0];
+}
+
+WhereResult where_prestat(const char *name, unsigned char d_type) {
+    if (!prestat_useful)
+        return WHERE_UNKNOWN;
+    return run(name, d_type == DT_UNKNOWN ? 0 : DTTOIF(d_type), NULL);
+}
+
+int where_match(const char *name, const struct stat *st) {
+    return run(name, 0, st) == WHERE_TRUE;
+}